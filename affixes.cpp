@@ -3,6 +3,7 @@
 #include "strings.h"
 #include "powertag.h"
 #include "regexp.h"
+#include "gamebalance.h"
 #include <algorithm>
 
 int fixAttrId(int id, bool reverse) {
@@ -43,6 +44,11 @@ bool GameAffixes::isSecondary(uint32 attr) {
   return instance().affixData_.secondary.count(fixAttrId(attr)) != 0;
 }
 
+uint32 GameAffixes::itemTypeParent(uint32 id) {
+  uint32 parent = GameBalanceTables::typeParent(id);
+  return (parent == -1 ? 0 : parent);
+}
+
 AttributeSpecifier::AttributeSpecifier(GameBalance::Type::AttributeSpecifier const& attr, AttributeMap const& params)
   : type(attr.x00_Type)
   , param(attr.x04_Param)
@@ -56,7 +62,6 @@ AttributeSpecifier::AttributeSpecifier(GameBalance::Type::AttributeSpecifier con
 }
 
 struct GameAffixes::GameAffix {
-  std::set<uint32> itemTypes;
   AffixValue value;
 };
 
@@ -67,45 +72,19 @@ GameAffixes::GameAffixes() {
   defaultMap_.emplace("Effective_Level", 70.0);
   defaultMap_.emplace("iLevel", 72.0);
 
-  SnoFile<GameBalance> affixList("1xx_AffixList");
-  for (auto& fx : affixList->x078_AffixTable) {
-    uint32 id = HashNameLower(fx.x000_Text);
-    GameAffix& affix = affixes_[id];
-    for (auto id : fx.x178_GameBalanceIds) {
-      if (id != -1) affix.itemTypes.insert(id);
-    }
-    for (auto id : fx.x190_GameBalanceIds) {
-      if (id != -1) affix.itemTypes.insert(id);
-    }
-    for (auto id : fx.x1F0_GameBalanceIds) {
-      if (id != -1) affix.itemTypes.insert(id);
-    }
-    for (size_t i = 0; i < AffixValue::MaxAttributes; ++i) {
-      affix.value.attributes[i] = AttributeSpecifier(fx.x260_AttributeSpecifiers[i], defaultMap_);
-    }
-    std::sort(affix.value.attributes, affix.value.attributes + AffixValue::MaxAttributes, AttributeSpecifier::less);
-    if (fx.x168_AffixGroupGameBalanceId != -1) {
-      groups_[fx.x168_AffixGroupGameBalanceId].push_back(&affix);
-    }
-    if (fx.x16C_AffixGroupGameBalanceId != -1) {
-      groups_[fx.x16C_AffixGroupGameBalanceId].push_back(&affix);
-    }
-  }
-
-  SnoFile<GameBalance> affixListRecipes("AffixList");
-  for (auto& fx : affixListRecipes->x078_AffixTable) {
-    uint32 id = HashNameLower(fx.x000_Text);
-    GameAffix& affix = affixes_[id];
-    for (size_t i = 0; i < AffixValue::MaxAttributes; ++i) {
-      affix.value.attributes[i] = AttributeSpecifier(fx.x260_AttributeSpecifiers[i], defaultMap_);
-    }
-    std::sort(affix.value.attributes, affix.value.attributes + AffixValue::MaxAttributes, AttributeSpecifier::less);
-  }
-
-  SnoFile<GameBalance> itemTypes("ItemTypes");
-  for (auto& type : itemTypes->x018_ItemTypes) {
-    if (type.x108_ItemTypesGameBalanceId != -1) {
-      itemTypeParent_[HashNameLower(type.x000_Text)] = type.x108_ItemTypesGameBalanceId;
+  // group membership and item types are looked up in GameBalanceTables
+  auto& table = GameBalanceTables::affixes();
+  affixFile_ = GameBalanceTables::file("1xx_AffixList");
+  uint32 recipeFile = GameBalanceTables::file("AffixList");
+  for (uint32 file : {affixFile_, recipeFile}) {
+    for (uint32 row = 0; row < table.size(); ++row) {
+      if (table.file(row) != file) continue;
+      auto& fx = table[row];
+      GameAffix& affix = affixes_[table.id(row)];
+      for (size_t i = 0; i < AffixValue::MaxAttributes; ++i) {
+        affix.value.attributes[i] = AttributeSpecifier(fx.x260_AttributeSpecifiers[i], defaultMap_);
+      }
+      std::sort(affix.value.attributes, affix.value.attributes + AffixValue::MaxAttributes, AttributeSpecifier::less);
     }
   }
 
@@ -173,24 +152,19 @@ AffixValue const& GameAffixes::getAffix(uint32 id, bool recipe) {
   return instance().affixes_[id].value;
 }
 std::vector<AffixValue> GameAffixes::getGroup(uint32 id, uint32 itemType) {
-  auto& itemTypeParent = instance().itemTypeParent_;
-  std::vector<uint32> itemTypes;
-  while (itemType != -1) {
-    itemTypes.push_back(itemType);
-    auto it = itemTypeParent.find(itemType);
-    if (it == itemTypeParent.end()) break;
-    itemType = it->second;
-  }
+  auto& table = GameBalanceTables::affixes();
   std::map<std::pair<uint32, uint32>, AffixValue*> values;
-  for (GameAffix* affix : instance().groups_[id]) {
+  for (uint32 row : GameBalanceTables::affixGroup(id)) {
+    if (table.file(row) != instance().affixFile_) continue;
     bool hasType = false;
-    for (auto& type : itemTypes) {
-      if (affix->itemTypes.count(type)) {
+    for (uint32 type : GameBalanceTables::affixItemTypes(row)) {
+      if (GameBalanceTables::isType(itemType, type)) {
         hasType = true;
         break;
       }
     }
     if (hasType) {
+      GameAffix* affix = &instance().affixes_[table.id(row)];
       auto key = std::make_pair(affix->value.attributes[0].type, affix->value.attributes[0].param);
       auto it = values.find(key);
       if (it == values.end() || AffixValue::less(*it->second, affix->value)) {
@@ -295,10 +269,10 @@ std::vector<std::string> GameAffixes::format(std::vector<AttributeSpecifier> con
 
 std::string GameAffixes::getItemType(uint32 id) {
   auto& types = instance().itemTypes_;
-  auto& parent = instance().itemTypeParent_;
-  while (!types.count(id) && parent.count(id)) {
-    id = parent[id];
-  }
   auto it = types.find(id);
+  for (uint32 type : GameBalanceTables::typeAncestors(id)) {
+    if (it != types.end()) break;
+    it = types.find(type);
+  }
   return (it == types.end() ? "" : it->second);
 }
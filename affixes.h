@@ -25,7 +25,8 @@
 // std::vector<std::string> format(std::vector<AttributeSpecifier> const& attrs, bool html = false)
 //   same as above
 // uint32 itemTypeParent(uint32 id)
-//   returns parent of the item type (i.e. CrusaderShield -> Shield -> GenericOffHand -> Offhand)
+//   returns parent of the item type (i.e. CrusaderShield -> Shield -> GenericOffHand -> Offhand), or 0
+//   (GameBalanceTables has the full parent chain of every type)
 // bool isSecondary(uint32 attr)
 //   checks if an attribute type is secondary
 
@@ -50,9 +51,7 @@ public:
 
   static std::vector<std::string> format(AttributeSpecifier const* begin, AttributeSpecifier const* end, FormatFlags flags = FormatNone);
   static std::vector<std::string> format(std::vector<AttributeSpecifier> const& attrs, FormatFlags flags = FormatNone);
-  static uint32 itemTypeParent(uint32 id) {
-    return instance().itemTypeParent_[id];
-  }
+  static uint32 itemTypeParent(uint32 id);
   static bool isSecondary(uint32 attr);
 
   static std::string getItemType(uint32 id);
@@ -66,8 +65,7 @@ private:
   AttributeMap defaultMap_;
   std::map<uint32, GameAffix> affixes_;
   std::map<uint32, GameAffix> affixesRecipe_;
-  std::map<uint32, std::vector<GameAffix*>> groups_;
-  std::map<uint32, uint32> itemTypeParent_;
+  uint32 affixFile_;
   std::map<uint32, std::string> itemTypes_;
   struct AffixData {
     std::map<uint32, std::string> types;
@@ -0,0 +1,674 @@
+#include "benchmark.h"
+#include "parser.h"
+#include "snomap.h"
+#include "logger.h"
+#include "jsondiff.h"
+#include "dxt.h"
+#include "resample.h"
+#include "tests.h"
+#include "types/Scene.h"
+#include "types/Worlds.h"
+#include <algorithm>
+#include <memory>
+#include <random>
+#ifndef _WIN32
+#include <chrono>
+#endif
+
+namespace Benchmark {
+
+#ifdef _WIN32
+static sint64 frequency() {
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  return freq.QuadPart;
+}
+
+Timer::Timer() {
+  reset();
+}
+void Timer::reset() {
+  LARGE_INTEGER count;
+  QueryPerformanceCounter(&count);
+  start_ = count.QuadPart;
+}
+double Timer::elapsed() const {
+  LARGE_INTEGER count;
+  QueryPerformanceCounter(&count);
+  return double(count.QuadPart - start_) / double(frequency());
+}
+#else
+static sint64 now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Timer::Timer() {
+  reset();
+}
+void Timer::reset() {
+  start_ = now();
+}
+double Timer::elapsed() const {
+  return double(now() - start_) * 1e-9;
+}
+#endif
+
+void report(char const* name, double seconds, double amount, char const* unit) {
+  Logger::log("%-40s %10.3f ms  %12.1f %s/s", name, seconds * 1000.0, seconds > 0 ? amount / seconds : 0.0, unit);
+}
+
+// serialization of every file of a type: into a visitor that ignores everything (object walk and
+// name lookups only), and into a JSON writer
+template<class T>
+static void serialize() {
+  std::vector<std::unique_ptr<SnoFile<T>>> files;
+  for (auto& name : Logger::Loop(SnoLoader::List<T>(), fmtstring("Loading %s", T::type()).c_str())) {
+    std::unique_ptr<SnoFile<T>> file(new SnoFile<T>(name));
+    if (*file) files.push_back(std::move(file));
+  }
+  if (files.empty()) {
+    Logger::log("No %s files", T::type());
+    return;
+  }
+
+  // first pass builds the name maps
+  json::Visitor null;
+  for (auto& file : files) {
+    (*file)->serialize(&null);
+  }
+
+  Timer timer;
+  for (auto& file : files) {
+    (*file)->serialize(&null);
+  }
+  report(fmtstring("%s walk", T::type()).c_str(), timer.elapsed(), files.size(), "files");
+
+  MemoryFile out;
+  timer.reset();
+  for (auto& file : files) {
+    json::WriterVisitor writer(out);
+    writer.setIndent(2);
+    (*file)->serialize(&writer);
+    writer.onEnd();
+  }
+  double seconds = timer.elapsed();
+  report(fmtstring("%s json", T::type()).c_str(), seconds, files.size(), "files");
+  report(fmtstring("%s json", T::type()).c_str(), seconds, out.csize() / 1048576.0, "MB");
+}
+
+typedef std::map<uint32, std::map<uint32, std::string>> NameTree;
+
+template<class T>
+static void collect(std::vector<SNOName>& refs, NameTree& tree) {
+  uint32 const index = T::index;
+  auto& names = tree[index];
+  for (auto const& entry : SnoManager::get<T>()) {
+    SNOName ref = {T::index, entry.first};
+    refs.push_back(ref);
+    names[entry.first] = entry.second;
+  }
+}
+
+// id -> name lookups in random order, compared against the nested std::map the tables replaced
+static void lookup() {
+  std::vector<SNOName> refs;
+  NameTree tree;
+  collect<Actor>(refs, tree);
+  collect<Appearance>(refs, tree);
+  collect<LevelArea>(refs, tree);
+  collect<Power>(refs, tree);
+  collect<Scene>(refs, tree);
+  collect<Textures>(refs, tree);
+  collect<Worlds>(refs, tree);
+  if (refs.empty()) return;
+  std::shuffle(refs.begin(), refs.end(), std::mt19937(12345));
+  size_t count = std::max<size_t>(1, 4000000 / refs.size());
+
+  uint32 check = 0;
+  Timer timer;
+  for (size_t pass = 0; pass < count; ++pass) {
+    for (auto const& ref : refs) {
+      check += (uint8) *ref.c_name();
+    }
+  }
+  report("SnoMap lookup", timer.elapsed(), double(refs.size()) * count, "names");
+
+  uint32 checkTree = 0;
+  timer.reset();
+  for (size_t pass = 0; pass < count; ++pass) {
+    for (auto const& ref : refs) {
+      checkTree += (uint8) *tree[ref.group][ref.id].c_str();
+    }
+  }
+  report("std::map lookup", timer.elapsed(), double(refs.size()) * count, "names");
+  if (check != checkTree) {
+    Logger::log("Warning: lookup results differ");
+  }
+}
+
+// JSON output of parsed values in the three writer modes
+static void writer() {
+  json::Value values(json::Value::tArray);
+  for (auto const& value : SnoLoader::primary->json<Scene>()) {
+    values.append(value);
+  }
+  if (!values.length()) {
+    Logger::log("No Scene files");
+    return;
+  }
+  static char const* const modes[] = { "mJSON", "mJS", "mJSCall" };
+  for (int mode = json::mJSON; mode <= json::mJSCall; ++mode) {
+    MemoryFile out;
+    Timer timer;
+    json::WriterVisitor writer(out, mode, "load");
+    writer.setIndent(2);
+    values.walk(&writer);
+    writer.onEnd();
+    report(fmtstring("Write %s", modes[mode]).c_str(), timer.elapsed(), out.csize() / 1048576.0, "MB");
+  }
+}
+
+// a tree of every Scene file built from the serializer and destroyed again, as json::Value and as
+// an arena json::Document
+static void document() {
+  std::vector<std::unique_ptr<SnoFile<Scene>>> files;
+  for (auto& name : Logger::Loop(SnoLoader::List<Scene>(), "Loading Scene")) {
+    std::unique_ptr<SnoFile<Scene>> file(new SnoFile<Scene>(name));
+    if (*file) files.push_back(std::move(file));
+  }
+  if (files.empty()) {
+    Logger::log("No Scene files");
+    return;
+  }
+  json::Visitor null;
+  for (auto& file : files) {
+    (*file)->serialize(&null);
+  }
+
+  Timer timer;
+  {
+    json::Value value;
+    json::BuilderVisitor builder(value);
+    builder.onOpenArray();
+    for (auto& file : files) {
+      (*file)->serialize(&builder);
+    }
+    builder.onCloseArray();
+    report("Build json::Value", timer.elapsed(), files.size(), "files");
+    timer.reset();
+  }
+  report("Destroy json::Value", timer.elapsed(), files.size(), "files");
+
+  timer.reset();
+  {
+    json::Document document;
+    json::DocumentBuilder builder(document);
+    builder.onOpenArray();
+    for (auto& file : files) {
+      (*file)->serialize(&builder);
+    }
+    builder.onCloseArray();
+    report("Build json::Document", timer.elapsed(), files.size(), "files");
+    Logger::log("json::Document nodes: %.1f MB, %u strings", document.memory() / 1048576.0, (uint32) document.strings().size());
+    timer.reset();
+  }
+  report("Destroy json::Document", timer.elapsed(), files.size(), "files");
+}
+
+// Scene files dumped as JSON text and in the binary format, and loaded back from both
+static void binary() {
+  std::vector<std::unique_ptr<SnoFile<Scene>>> files;
+  for (auto& name : Logger::Loop(SnoLoader::List<Scene>(), "Loading Scene")) {
+    std::unique_ptr<SnoFile<Scene>> file(new SnoFile<Scene>(name));
+    if (*file) files.push_back(std::move(file));
+  }
+  if (files.empty()) {
+    Logger::log("No Scene files");
+    return;
+  }
+  json::Visitor null;
+  for (auto& file : files) {
+    (*file)->serialize(&null);
+  }
+
+  MemoryFile text, bin;
+  std::vector<uint64> textPos, binPos;
+  Timer timer;
+  for (auto& file : files) {
+    textPos.push_back(text.tell());
+    json::WriterVisitor writer(text);
+    writer.setIndent(2);
+    (*file)->serialize(&writer);
+    writer.onEnd();
+  }
+  report("Write text", timer.elapsed(), text.csize() / 1048576.0, "MB");
+  timer.reset();
+  for (auto& file : files) {
+    binPos.push_back(bin.tell());
+    json::BinaryWriter writer(bin);
+    (*file)->serialize(&writer);
+    writer.onEnd();
+  }
+  report("Write binary", timer.elapsed(), bin.csize() / 1048576.0, "MB");
+  Logger::log("Text %.2f MB, binary %.2f MB", text.csize() / 1048576.0, bin.csize() / 1048576.0);
+
+  timer.reset();
+  for (uint64 pos : textPos) {
+    text.seek(pos);
+    json::parse(text, &null);
+  }
+  report("Load text", timer.elapsed(), files.size(), "files");
+  timer.reset();
+  for (uint64 pos : binPos) {
+    bin.seek(pos);
+    json::parseBinary(bin, &null);
+  }
+  report("Load binary", timer.elapsed(), files.size(), "files");
+
+  // the binary stream played back into the writer must give the same text
+  MemoryFile replay;
+  for (uint64 pos : binPos) {
+    bin.seek(pos);
+    json::WriterVisitor writer(replay);
+    writer.setIndent(2);
+    json::parseBinary(bin, &writer);
+  }
+  if (replay.csize() != text.csize() || memcmp(replay.data(), text.data(), text.csize())) {
+    Logger::log("Warning: binary and text dumps differ");
+  }
+}
+
+// every Scene file compared with itself and with the next one: both trees built as documents and
+// compared, against the first one recorded and the second compared as it is serialized
+static void diff() {
+  std::vector<std::unique_ptr<SnoFile<Scene>>> files;
+  for (auto& name : Logger::Loop(SnoLoader::List<Scene>(), "Loading Scene")) {
+    std::unique_ptr<SnoFile<Scene>> file(new SnoFile<Scene>(name));
+    if (*file) files.push_back(std::move(file));
+  }
+  if (files.empty()) {
+    Logger::log("No Scene files");
+    return;
+  }
+  json::Visitor null;
+  for (auto& file : files) {
+    (*file)->serialize(&null);
+  }
+
+  size_t count = files.size() * 2;
+  std::vector<json::Value> results(count * 2);
+  Timer timer;
+  for (size_t i = 0; i < count; ++i) {
+    auto& lhs = files[i / 2];
+    auto& rhs = files[(i / 2 + i % 2) % files.size()];
+    json::StringTable strings;
+    json::Document ldoc(&strings), rdoc(&strings);
+    json::DocumentBuilder lbuilder(ldoc), rbuilder(rdoc);
+    (*lhs)->serialize(&lbuilder);
+    (*rhs)->serialize(&rbuilder);
+    json::compare(ldoc, rdoc, results[i * 2], results[i * 2 + 1]);
+  }
+  report("Diff documents", timer.elapsed(), count, "pairs");
+
+  std::vector<json::Value> streamed(count * 2);
+  timer.reset();
+  for (size_t i = 0; i < count; ++i) {
+    auto& lhs = files[i / 2];
+    auto& rhs = files[(i / 2 + i % 2) % files.size()];
+    json::EventStream stream;
+    (*lhs)->serialize(&stream);
+    json::DiffVisitor differ(stream, streamed[i * 2], streamed[i * 2 + 1]);
+    (*rhs)->serialize(&differ);
+    differ.onEnd();
+  }
+  report("Diff streams", timer.elapsed(), count, "pairs");
+
+  bool same = true;
+  for (size_t i = 0; i < results.size(); ++i) {
+    MemoryFile lhs, rhs;
+    json::write(lhs, results[i]);
+    json::write(rhs, streamed[i]);
+    if (lhs.csize() != rhs.csize() || memcmp(lhs.data(), rhs.data(), lhs.csize())) {
+      same = false;
+    }
+  }
+  if (!same) {
+    Logger::log("Warning: streamed and document diffs differ");
+  }
+}
+
+// each DXT format decoded from random blocks by the old decoder and by every kernel the CPU
+// supports; all kernels must match the old decoder bit for bit
+static void dxt() {
+  static char const* formats[] = {"DXT1", "DXT3", "DXT5"};
+  static char const* kernels[] = {"scalar", "SSE2", "AVX2"};
+  uint32 const width = 1024, height = 1024, count = 16;
+  std::mt19937 rng(1);
+  DXT::Kernel saved = DXT::kernel();
+  for (int format = DXT::DXT1; format <= DXT::DXT5; ++format) {
+    DXT::Format fmt = static_cast<DXT::Format>(format);
+    std::vector<uint8> data(DXT::size(fmt, width, height));
+    for (auto& byte : data) {
+      byte = static_cast<uint8>(rng());
+    }
+    DXT::Blocks blocks = DXT::planar(fmt, data.data(), width, height);
+    Image reference;
+    Timer timer;
+    for (uint32 i = 0; i < count; ++i) {
+      reference = Tests::oldDXT(fmt, width, height, data.data(), false);
+    }
+    report(fmtstring("%s old", formats[format]).c_str(), timer.elapsed(), double(width) * height * count / 1048576.0, "MP");
+    for (int kernel = DXT::Scalar; kernel < DXT::NumKernels; ++kernel) {
+      if (!DXT::supported(static_cast<DXT::Kernel>(kernel))) continue;
+      DXT::setKernel(static_cast<DXT::Kernel>(kernel));
+      Image image(width, height);
+      timer.reset();
+      for (uint32 i = 0; i < count; ++i) {
+        DXT::decode(fmt, blocks, image);
+      }
+      report(fmtstring("%s %s", formats[format], kernels[kernel]).c_str(), timer.elapsed(), double(width) * height * count / 1048576.0, "MP");
+      if (memcmp(image.bits(), reference.bits(), width * height * sizeof(Image::color_t))) {
+        Logger::log("Warning: %s %s output differs from the old decoder", formats[format], kernels[kernel]);
+      }
+    }
+  }
+  DXT::setKernel(saved);
+}
+
+// the resampler as it was before resample.cpp: double weights, straight alpha, columns walked
+// with a stride in the vertical pass
+template<typename PF>
+class Accum {
+public:
+  void add(typename PF::color_t value, double weight) {
+    r += weight * PF::red::from(value);
+    g += weight * PF::green::from(value);
+    b += weight * PF::blue::from(value);
+    a += weight * PF::alpha::from(value);
+    w += weight;
+  }
+  typename PF::color_t get() const {
+    if (w == 0) return 0;
+    return PF::color_clamp(
+      static_cast<int>(r / w + 0.5),
+      static_cast<int>(g / w + 0.5),
+      static_cast<int>(b / w + 0.5),
+      static_cast<int>(a / w + 0.5)
+      );
+  }
+private:
+  double r = 0, g = 0, b = 0, a = 0, w = 0;
+};
+
+template<class PF, class Filter>
+class LinScaler {
+public:
+  LinScaler(uint32 from, uint32 to) {
+    double scale = static_cast<double>(to) / from;
+    if (scale < 1) {
+      double radius = Filter::radius() / scale;
+      for (uint32 i = 0; i < to; ++i) {
+        double center = (i + 0.5) / scale;
+        int left = std::max(0, static_cast<int>(floor(center - radius)));
+        int right = std::min<int>(from, static_cast<int>(ceil(center + radius)) + 1);
+        pixels.emplace_back(left, right - left);
+        for (int j = left; j < right; ++j) {
+          factors.push_back(Filter::value(std::abs((center - j - 0.5) * scale)));
+        }
+      }
+    } else {
+      double radius = Filter::radius();
+      for (uint32 i = 0; i < to; ++i) {
+        double center = (i + 0.5) / scale;
+        int left = std::max(0, static_cast<int>(floor(center - radius)));
+        int right = std::min<int>(from, static_cast<int>(ceil(center + radius)) + 1);
+        pixels.emplace_back(left, right - left);
+        for (int j = left; j < right; ++j) {
+          factors.push_back(Filter::value(std::abs(center - j - 0.5)));
+        }
+      }
+    }
+  }
+  void scale(typename PF::color_t const* src, uint32 src_pitch,
+    typename PF::color_t* dst, uint32 dst_pitch)
+  {
+    double const* factor = &factors[0];
+    for (auto& p : pixels) {
+      typename PF::color_t const* from = src + p.first * src_pitch;
+      Accum<PF> accum;
+      for (uint32 i = p.second; i--;) {
+        accum.add(*from, *factor++);
+        from += src_pitch;
+      }
+      *dst = accum.get();
+      dst += dst_pitch;
+    }
+  }
+private:
+  std::vector<double> factors;
+  std::vector<std::pair<uint32, uint32>> pixels;
+};
+
+template<class Filter>
+static Image oldResize(Image const& image, uint32 width, uint32 height) {
+  Image cur(image);
+  if (cur.width() != width) {
+    LinScaler<DefaultFormat, Filter> scaler(cur.width(), width);
+    Image next(width, cur.height());
+    for (uint32 y = 0; y < cur.height(); ++y) {
+      scaler.scale(cur.bits() + y * cur.width(), 1, next.mutable_bits() + y * next.width(), 1);
+    }
+    cur = next;
+  }
+  if (cur.height() != height) {
+    LinScaler<DefaultFormat, Filter> scaler(cur.height(), height);
+    Image next(cur.width(), height);
+    for (uint32 x = 0; x < cur.width(); ++x) {
+      scaler.scale(cur.bits() + x, cur.width(), next.mutable_bits() + x, next.width());
+    }
+    cur = next;
+  }
+  return cur;
+}
+
+// one large image scaled down and a batch of item icons made into thumbnails, with the old
+// resampler and with every resample kernel the CPU supports; the kernels must match the plain C++
+// one bit for bit, and on opaque images the new results stay within rounding of the old ones
+template<class Filter>
+static void resizeFilter(char const* name, Image const& large, std::vector<Image> const& icons) {
+  static char const* kernels[] = {"scalar", "SSE2", "AVX2"};
+  uint32 const largeWidth = 300, largeHeight = 200, iconSize = 42;
+  double pixels = double(large.width()) * large.height();
+  for (auto const& icon : icons) {
+    pixels += double(icon.width()) * icon.height();
+  }
+
+  Timer timer;
+  Image oldLarge = oldResize<Filter>(large, largeWidth, largeHeight);
+  std::vector<Image> oldIcons;
+  for (auto const& icon : icons) {
+    oldIcons.push_back(oldResize<Filter>(icon, iconSize, iconSize));
+  }
+  report(fmtstring("%s old", name).c_str(), timer.elapsed(), pixels / 1048576.0, "MP");
+
+  Resample::Kernel saved = Resample::kernel();
+  Image refLarge;
+  std::vector<Image> refIcons;
+  for (int kernel = Resample::Scalar; kernel < Resample::NumKernels; ++kernel) {
+    if (!Resample::supported(static_cast<Resample::Kernel>(kernel))) continue;
+    Resample::setKernel(static_cast<Resample::Kernel>(kernel));
+    timer.reset();
+    Image newLarge = large.resize(largeWidth, largeHeight, Filter());
+    std::vector<Image> newIcons;
+    for (auto const& icon : icons) {
+      newIcons.push_back(icon.resize(iconSize, iconSize, Filter()));
+    }
+    report(fmtstring("%s %s", name, kernels[kernel]).c_str(), timer.elapsed(), pixels / 1048576.0, "MP");
+
+    if (kernel == Resample::Scalar) {
+      int diff = 0;
+      for (size_t i = 0; i < largeWidth * largeHeight; ++i) {
+        for (int shift = 0; shift < 32; shift += 8) {
+          diff = std::max(diff, std::abs(int((newLarge.bits()[i] >> shift) & 0xFF) - int((oldLarge.bits()[i] >> shift) & 0xFF)));
+        }
+      }
+      if (diff > 2) {
+        Logger::log("Warning: %s differs from the old resampler by up to %d", name, diff);
+      }
+      refLarge = newLarge;
+      refIcons = newIcons;
+      continue;
+    }
+    bool same = !memcmp(newLarge.bits(), refLarge.bits(), newLarge.size());
+    for (size_t i = 0; i < icons.size(); ++i) {
+      same = same && !memcmp(newIcons[i].bits(), refIcons[i].bits(), newIcons[i].size());
+    }
+    if (!same) {
+      Logger::log("Warning: %s %s output differs from the scalar kernel", name, kernels[kernel]);
+    }
+  }
+  Resample::setKernel(saved);
+}
+
+// smooth opaque gradients with noise, and icons with a transparent border
+static void testImages(Image& large, std::vector<Image>& icons) {
+  std::mt19937 rng(1);
+  large = Image(1024, 1024);
+  uint32* bits = large.mutable_bits();
+  for (uint32 y = 0; y < large.height(); ++y) {
+    for (uint32 x = 0; x < large.width(); ++x) {
+      int noise = static_cast<int>(rng() % 32);
+      bits[y * large.width() + x] = DefaultFormat::color_clamp(x / 4 + noise, y / 4 + noise, (x + y) / 8 + noise);
+    }
+  }
+  icons.clear();
+  for (uint32 i = 0; i < 256; ++i) {
+    Image icon(64, 64, 0u);
+    uint32* pixels = icon.mutable_bits();
+    for (uint32 y = 4; y < 60; ++y) {
+      for (uint32 x = 4; x < 60; ++x) {
+        uint32 value = rng();
+        pixels[y * 64 + x] = DefaultFormat::color(value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, 128 + (value >> 25));
+      }
+    }
+    icons.push_back(icon);
+  }
+}
+
+static void resize() {
+  Image large;
+  std::vector<Image> icons;
+  testImages(large, icons);
+
+#define FILTER(F) resizeFilter<decltype(ImageFilter::F)>(#F, large, icons)
+  FILTER(Box);
+  FILTER(Triangle);
+  FILTER(Hermite);
+  FILTER(Bell);
+  FILTER(CubicBSpline);
+  FILTER(Lanczos3);
+  FILTER(Mitchell);
+  FILTER(Cosine);
+  FILTER(CatmullRom);
+  FILTER(Quadratic);
+  FILTER(QuadraticBSpline);
+  FILTER(CubicConvolution);
+  FILTER(Lanczos8);
+#undef FILTER
+}
+
+// the same images written as PNG at several levels; every file must read back to the same pixels
+static void png() {
+  Image large;
+  std::vector<Image> icons;
+  testImages(large, icons);
+  std::vector<Image> images(1, large);
+  double pixels = double(large.width()) * large.height();
+  for (auto const& icon : icons) {
+    images.push_back(icon);
+    pixels += double(icon.width()) * icon.height();
+  }
+
+  static int const levels[] = {0, 1, 3, 6, 9};
+  int saved = ImageFormat::pngLevel();
+  for (int level : levels) {
+    ImageFormat::setPNGLevel(level);
+    std::vector<File> files;
+    uint64 bytes = 0;
+    Timer timer;
+    for (Image& image : images) {
+      MemoryFile file;
+      image.write(file, ImageFormat::PNG);
+      bytes += file.size();
+      files.push_back(file);
+    }
+    report(fmtstring("PNG level %d, %u KB", level, static_cast<uint32>(bytes / 1024)).c_str(), timer.elapsed(), pixels / 1048576.0, "MP");
+    for (size_t i = 0; i < images.size(); ++i) {
+      Image decoded(files[i], ImageFormat::PNG);
+      if (!decoded || decoded.width() != images[i].width() || decoded.height() != images[i].height() ||
+          memcmp(decoded.bits(), images[i].bits(), decoded.size())) {
+        Logger::log("Warning: PNG level %d does not read back", level);
+        break;
+      }
+    }
+  }
+  ImageFormat::setPNGLevel(saved);
+}
+
+// the JSON dump of one type, through the loader as SnoLoader::Dump does it
+template<class T>
+static size_t dumptype() {
+  size_t count = SnoLoader::List<T>().size();
+  if (!count) return 0;
+  Timer timer;
+  SnoLoader::Dump<T>();
+  report(fmtstring("Dump %s", T::type()).c_str(), timer.elapsed(), count, "files");
+  return count;
+}
+
+void dumpall() {
+  size_t total = 0;
+  Timer timer;
+#define SNOTYPE(T)  total += dumptype<T>();
+#include "allsno.h"
+#undef SNOTYPE
+  report("Dump all", timer.elapsed(), total, "files");
+}
+
+static struct {
+  char const* name;
+  void(*func)();
+} benchmarks[] = {
+  { "Serialize Scene", serialize<Scene> },
+  { "Serialize Worlds", serialize<Worlds> },
+  { "Name lookup", lookup },
+  { "JSON writer", writer },
+  { "JSON document", document },
+  { "Binary dump", binary },
+  { "JSON diff", diff },
+  { "DXT decode", dxt },
+  { "Image resize", resize },
+  { "PNG encode", png },
+  { "Dump all types", dumpall },
+};
+
+void menu() {
+  std::vector<std::string> options;
+  for (auto const& bench : benchmarks) {
+    options.push_back(bench.name);
+  }
+  options.push_back("Run all");
+  options.push_back("Back");
+  size_t choice = Logger::menu("Choose benchmark", options);
+  size_t count = sizeof benchmarks / sizeof benchmarks[0];
+  if (choice < count) {
+    benchmarks[choice].func();
+  } else if (choice == count) {
+    for (auto const& bench : benchmarks) {
+      bench.func();
+    }
+  }
+}
+
+}
@@ -0,0 +1,30 @@
+// benchmark.h
+//
+// throughput measurements for the parsing and output paths
+//
+// void Benchmark::menu() - choose and run benchmarks (main menu entry)
+// void Benchmark::dumpall() - dump every SNO type as JSON and report files/second
+// void Benchmark::report(char const* name, double seconds, double amount, char const* unit)
+//   log a measurement as amount/second, e.g. report("Scene", 1.2, 5400, "files")
+//
+// Benchmark::Timer - high resolution wall clock
+//   double elapsed() - seconds since construction or the last reset()
+
+#pragma once
+
+#include "common.h"
+
+namespace Benchmark {
+  class Timer {
+  public:
+    Timer();
+    void reset();
+    double elapsed() const;
+  private:
+    sint64 start_;
+  };
+
+  void report(char const* name, double seconds, double amount, char const* unit);
+  void menu();
+  void dumpall();
+}
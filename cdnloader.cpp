@@ -43,8 +43,9 @@ struct SnoCdnLoader::CdnImpl {
   std::string version;
 
   std::map<istring, NGDP::Hash_container> fileIndex[TocHeader::MAX_ASSETS];
+  NGDP::DecodedCache cache;
 
-  File load(const NGDP::Hash hash);
+  File load(const NGDP::Hash hash, bool stream = false);
 
   CdnImpl(std::string const& build, std::string lang);
 };
@@ -190,14 +191,22 @@ SnoCdnLoader::CdnImpl::CdnImpl(std::string const& build, std::string lang) {
   if (!version.empty()) version.push_back('.');
   version.append(fmtstring("%d", this->build));
 
-  SnoManager::loadTOC(toc.data());
+  SnoManager::loadTOC(std::move(toc));
 }
 
-File SnoCdnLoader::CdnImpl::load(const NGDP::Hash hash) {
+File SnoCdnLoader::CdnImpl::load(const NGDP::Hash hash, bool stream) {
+  File cached = cache.get(hash);
+  if (cached) return cached;
   auto* entry = encoding->getEncoding(hash);
+  if (!entry) return File();
   File raw = get_archives().load(entry->keys[0]);
   if (!raw) return raw;
-  return NGDP::DecodeBLTE(raw, entry->usize);
+  if (stream) {
+    return NGDP::StreamBLTE(raw, entry->usize);
+  }
+  File result = NGDP::DecodeBLTE(raw, entry->usize);
+  if (result) cache.put(hash, result);
+  return result;
 }
 
 SnoCdnLoader::SnoCdnLoader(std::string const& build, std::string lang)
@@ -232,6 +241,28 @@ File SnoCdnLoader::loadfile(SnoInfo const& type, char const* name) {
   }
 }
 
+// the file index is only written by the constructor, so this needs no locking
+bool SnoCdnLoader::filekey(SnoInfo const& type, char const* name, uint8* key) {
+  auto it = handle_->fileIndex[type.index].find(name);
+  if (it == handle_->fileIndex[type.index].end()) return false;
+  memcpy(key, it->second._, sizeof(NGDP::Hash));
+  return true;
+}
+
+void SnoCdnLoader::prefetchdir(SnoInfo const& type) {
+  std::vector<NGDP::Hash_container> hashes;
+  for (auto const& kv : handle_->fileIndex[type.index]) {
+    if (!handle_->cache.contains(kv.second._)) hashes.push_back(kv.second);
+  }
+  std::vector<NGDP::Encoding::EncodingEntry const*> entries(hashes.size());
+  handle_->encoding->getEncodings(hashes.data(), hashes.size(), entries.data());
+  std::vector<NGDP::Hash_container> keys;
+  for (auto const* entry : entries) {
+    if (entry) keys.push_back(NGDP::Hash_container::from(entry->keys[0]));
+  }
+  CdnImpl::get_archives().prefetch(keys);
+}
+
 std::vector<std::string> SnoCdnLoader::listdir(SnoInfo const& type) {
   std::vector<std::string> keys;
   for (auto const& kv : handle_->fileIndex[type.index]) {
@@ -249,9 +280,9 @@ File SnoCdnLoader::load(std::string const& hash) {
   if (it == handle_->namedFiles.end()) {
     NGDP::Hash bhash;
     NGDP::from_string(bhash, hash);
-    return handle_->load(bhash);
+    return handle_->load(bhash, true);
   } else {
-    return handle_->load(it->second._);
+    return handle_->load(it->second._, true);
   }
 }
 
@@ -1,10 +1,11 @@
 #include "checksum.h"
+#include <string.h>
 
-uint32 update_crc(uint32 crc, void const* vbuf, uint32 length) {
-  static uint32 crc_table[256];
-  static bool table_computed = false;
-  uint8 const* buf = (uint8*)vbuf;
-  if (!table_computed) {
+// slice-by-8: table[k][i] is the CRC of byte i followed by k zero bytes, so eight bytes are
+// folded in with eight lookups that do not depend on each other
+static struct CrcTable {
+  uint32 table[8][256];
+  CrcTable() {
     for (uint32 i = 0; i < 256; i++) {
       uint32 c = i;
       for (int k = 0; k < 8; k++) {
@@ -14,12 +15,29 @@ uint32 update_crc(uint32 crc, void const* vbuf, uint32 length) {
           c = c >> 1;
         }
       }
-      crc_table[i] = c;
+      table[0][i] = c;
+    }
+    for (uint32 i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++) {
+        table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+      }
     }
-    table_computed = true;
   }
-  for (uint32 i = 0; i < length; i++) {
-    crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+} const crcTable;
+
+uint32 update_crc(uint32 crc, void const* vbuf, uint32 length) {
+  uint32 const (*table)[256] = crcTable.table;
+  uint8 const* buf = (uint8 const*)vbuf;
+  for (; length >= 8; buf += 8, length -= 8) {
+    uint32 lo, hi;
+    memcpy(&lo, buf, 4);
+    memcpy(&hi, buf + 4, 4);
+    lo ^= crc;
+    crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+          table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+  }
+  while (length--) {
+    crc = table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
   }
   return crc;
 }
@@ -0,0 +1,72 @@
+// headless entry point for the portable build: reads extracted SNO files from a directory
+// (one subdirectory per type, as written by the extractor) and dumps them as JSON into the Work
+// directory next to the executable
+//
+// snocli <dir> list           - number of files of every type
+// snocli <dir> dump <type>    - dump all files of a type, or of every type with "all"
+// snocli <dir> dumpbin <type> - same in the binary format (json::BinaryWriter, .bin files)
+// snocli <dir> bench          - dump every type and report files/second
+// snocli test <name|all>      - run a self check that needs no game data (see tests.h)
+#include "parser.h"
+#include "snotypes.h"
+#include "benchmark.h"
+#include "tests.h"
+#include "logger.h"
+#include "path.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace path {
+  std::vector<std::string> roots;
+  std::vector<std::string> cascs;
+}
+
+static int usage() {
+  fprintf(stderr, "Usage: snocli <dir> list\n");
+  fprintf(stderr, "       snocli <dir> dump <type|all>\n");
+  fprintf(stderr, "       snocli <dir> dumpbin <type|all>\n");
+  fprintf(stderr, "       snocli <dir> bench\n");
+  fprintf(stderr, "       snocli test <name|all>\n");
+  return 1;
+}
+
+static void list() {
+#define SNOTYPE(T)  { size_t count = SnoLoader::List<T>().size(); if (count) printf("%-16s %u\n", T::type(), (uint32) count); }
+#include "allsno.h"
+#undef SNOTYPE
+}
+
+static bool dump(char const* type, bool binary) {
+  bool all = !_stricmp(type, "all");
+  bool found = false;
+#define SNOTYPE(T)  if (all || !_stricmp(type, T::type())) { if (binary) SnoLoader::DumpBinary<T>(); else SnoLoader::Dump<T>(); found = true; }
+#include "allsno.h"
+#undef SNOTYPE
+  return found;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) return usage();
+  try {
+    if (!strcmp(argv[1], "test")) {
+      return Tests::run(argv[2]) ? 0 : 1;
+    }
+    SnoLoader::primary = new SnoSysLoader(argv[1]);
+    if (!strcmp(argv[2], "list")) {
+      list();
+    } else if ((!strcmp(argv[2], "dump") || !strcmp(argv[2], "dumpbin")) && argc > 3) {
+      if (!dump(argv[3], !strcmp(argv[2], "dumpbin"))) {
+        fprintf(stderr, "Unknown type: %s\n", argv[3]);
+        return 1;
+      }
+    } else if (!strcmp(argv[2], "bench")) {
+      Benchmark::dumpall();
+    } else {
+      return usage();
+    }
+  } catch (Exception& ex) {
+    fprintf(stderr, "Exception: %s\n", ex.what());
+    return 1;
+  }
+  return 0;
+}
@@ -52,6 +52,9 @@ void _qmemset(uint32* mem, uint32 fill, uint32 count) {
   }
 }
 
+#ifndef _WIN32
+#include <zlib.h>
+#else
 #include "zlib/zlib.h"
 #ifdef _WIN64
   #ifdef _DEBUG
@@ -66,6 +69,7 @@ void _qmemset(uint32* mem, uint32 fill, uint32 count) {
     #pragma comment(lib, "zlib/zlib32r.lib")
   #endif
 #endif
+#endif
 
 uint32 gzdeflate(uint8 const* in, uint32 in_size, uint8* out, uint32* out_size) {
   z_stream z;
@@ -146,7 +150,7 @@ uint32 gzdecode(uint8 const* in, uint32 in_size, uint8* out, uint32* out_size) {
 
 std::string strlower(std::string const& str) {
   std::string dest(str.size(), ' ');
-  std::transform(str.begin(), str.end(), dest.begin(), std::tolower);
+  std::transform(str.begin(), str.end(), dest.begin(), ::tolower);
   return dest;
 }
 
@@ -1,14 +1,12 @@
 #pragma once
 
 #include "types.h"
-#include <intrin.h>
+#include "platform.h"
 #include <string>
 #include <sstream>
 #include <cctype>
 #include <vector>
 #include <map>
-#define NOMINMAX
-#include <windows.h>
 
 class Exception {
 public:
@@ -234,17 +232,17 @@ template<> struct FlipTraits<2> {
 };
 
 template<> struct FlipTraits<4> {
-  typedef unsigned long T;
+  typedef uint32 T;
   static T flip(T x) { return _byteswap_ulong(x); }
 };
 
 template<> struct FlipTraits<8> {
-  typedef unsigned long long T;
+  typedef uint64 T;
   static T flip(T x) { return _byteswap_uint64(x); }
 };
 
 template<typename T>
 void flip(T& x) {
   typedef FlipTraits<sizeof(T)> Flip;
-  x = static_cast<T>(Flip::flip(static_cast<Flip::T>(x)));
+  x = static_cast<T>(Flip::flip(static_cast<typename Flip::T>(x)));
 }
@@ -0,0 +1,33 @@
+#include "cpu.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace CPU {
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+bool hasAVX2() {
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  // OSXSAVE and AVX, and the OS saves the YMM registers
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+  if ((_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+}
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+bool hasAVX2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}
+#else
+bool hasAVX2() {
+  return false;
+}
+#endif
+
+}
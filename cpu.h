@@ -0,0 +1,12 @@
+// cpu.h
+//
+// CPU feature checks for the modules that pick SIMD kernels at run time
+//
+// bool CPU::hasAVX2()
+//   the CPU has AVX2 and the OS saves the YMM registers; always false off x86
+
+#pragma once
+
+namespace CPU {
+  bool hasAVX2();
+}
@@ -84,8 +84,9 @@ void FormulaParser::addcolor(char const* color, char const* val) {
 FormulaParser::FormulaParser(std::string const& descr, FormatFlags flags, AttributeMap const& values, PowerTag* context)
   : descr(descr)
   , flags(flags)
-  , values(values)
   , pos(0)
+  , values(values)
+  , inputs(values)
   , context(context)
 {
   if (!preloaded) {
@@ -294,9 +295,9 @@ FormulaParser::Value FormulaParser::eval() {
         //static re::Prog lookup(R"(table.(\w+).(\w+))", -1, re::Prog::CaseInsensitive);
         std::vector<std::string> match;
         if (context && sfid.match(result, &match)) {
-          stack.vals.emplace(context->get(atoi(match[1].c_str()), values));
+          stack.vals.emplace(context->get(atoi(match[1].c_str()), inputs));
         } else if (sftag.match(result, &match)) {
-          stack.vals.emplace(PowerTags::get(match[1], match[2], values));
+          stack.vals.emplace(PowerTags::get(match[1], match[2], inputs));
         } else {
           auto it = values.find(result);
           stack.vals.push(it == values.end() ? 0.0 : it->second);
@@ -308,7 +309,7 @@ FormulaParser::Value FormulaParser::eval() {
       if (it != values.end()) {
         prevtag = it->second;
       } else if (context) {
-        prevtag = context->get(tag, values);
+        prevtag = context->get(tag, inputs);
       } else {
         prevtag = 0.0;
       }
@@ -448,7 +449,7 @@ std::string FormulaParser::parse() {
         if (it != values.end()) {
           prevtag = it->second;
         } else if (context) {
-          prevtag = context->get(tag, values);
+          prevtag = context->get(tag, inputs);
         } else {
           prevtag = 0.0;
         }
@@ -477,189 +478,614 @@ std::string FormatDescription(std::string const& descr, FormatFlags flags, Attri
   return result;
 }
 
-static inline AttributeValue getval(AttributeMap const& values, istring const& name) {
-  auto it = values.find(name);
-  return (it == values.end() ? 0 : it->second);
-}
 static char const* elemNames[] = {
   "Physical", "Fire", "Lightning", "Cold", "Poison", "Arcane", "Holy"
 };
+static char const* slotNames[] = {
+  "Defense", "Strength", "Level", "Skill_Total", "Casting_Speed_Total", "Attacks_Per_Second_Total",
+  "Damage_Delta#Physical", "Damage_Delta#Fire", "Damage_Delta#Lightning", "Damage_Delta#Cold",
+  "Damage_Delta#Poison", "Damage_Delta#Arcane", "Damage_Delta#Holy",
+  "Damage_Min#Physical", "Damage_Min#Fire", "Damage_Min#Lightning", "Damage_Min#Cold",
+  "Damage_Min#Poison", "Damage_Min#Arcane", "Damage_Min#Holy",
+  "Rune_A", "Rune_B", "Rune_C", "Rune_D", "Rune_E",
+  "Buff_Icon_Count0", "Buff_Icon_Count1", "Buff_Icon_Count2", "Buff_Icon_Count3",
+  "Resource_Gain_Bonus_Percent", "Effective_Level",
+  "sLevel", "iLevel", "mLevel",
+  "mDamageMin#Physical", "mDamageDelta#Physical", "mDamageMin#Fire", "mDamageDelta#Fire",
+  "mDamageMin#Lightning", "mDamageDelta#Lightning", "mDamageMin#Cold", "mDamageDelta#Cold",
+  "mDamageMin#Poison", "mDamageDelta#Poison", "mDamageMin#Arcane", "mDamageDelta#Arcane",
+  "mDamageMin#Holy", "mDamageDelta#Holy",
+  "mHealthMin", "mAreaDamageMin", "mAreaDamageMax", "bTraitActive",
+};
+static const uint32 slotCount = sizeof slotNames / sizeof slotNames[0];
 
-AttributeValue ExecFormula(uint32 const* begin, uint32 const* end, AttributeMap const& values, PowerTag* context) {
-  std::stack<AttributeValue> stack;
-  AttributeValue a, b, c;
-  while (begin < end) {
+// built during static initialization, before any evaluation threads exist
+static Map<uint32> makeSlots() {
+  Map<uint32> slots;
+  for (uint32 i = 0; i < slotCount; ++i) {
+    slots.emplace(slotNames[i], i);
+  }
+  return slots;
+}
+static Map<uint32> const slotIndex = makeSlots();
+
+uint32 AttributeVector::slot(istring const& name) {
+  auto it = slotIndex.find(name);
+  if (it == slotIndex.end()) return NoSlot;
+  return it->second;
+}
+
+static void hashBytes(uint64& hash, void const* ptr, size_t size) {
+  uint8 const* bytes = static_cast<uint8 const*>(ptr);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  }
+}
+
+uint32 AttributeVector::slots() {
+  return slotCount;
+}
+
+AttributeVector::AttributeVector(AttributeMap const& values) {
+  std::vector<AttributeValue>* vec = new std::vector<AttributeValue>(slotCount);
+  // look up whichever side is smaller
+  if (values.size() < slotCount) {
+    for (auto& kv : values) {
+      uint32 index = slot(kv.first);
+      if (index != NoSlot) (*vec)[index] = kv.second;
+    }
+  } else {
+    for (uint32 i = 0; i < slotCount; ++i) {
+      auto it = values.find(slotNames[i]);
+      if (it != values.end()) (*vec)[i] = it->second;
+    }
+  }
+  *this = AttributeVector(vec);
+}
+
+AttributeVector::AttributeVector(std::vector<AttributeValue>* values)
+  : values_(values)
+  , hash_(0xCBF29CE484222325ULL)
+{
+  for (auto& val : *values) {
+    hashBytes(hash_, &val.min, sizeof val.min);
+    hashBytes(hash_, &val.max, sizeof val.max);
+    hashBytes(hash_, &val.table, sizeof val.table);
+    hashBytes(hash_, val.text.data(), val.text.size());
+  }
+}
+
+bool AttributeVector::operator==(AttributeVector const& rhs) const {
+  if (values_ == rhs.values_) return true;
+  if (hash_ != rhs.hash_) return false;
+  for (uint32 i = 0; i < slotCount; ++i) {
+    AttributeValue const& lv = (*values_)[i];
+    AttributeValue const& rv = (*rhs.values_)[i];
+    if (lv.min != rv.min || lv.max != rv.max || lv.table != rv.table || lv.text != rv.text) {
+      return false;
+    }
+  }
+  return true;
+}
+
+AttributeColumns::AttributeColumns(size_t rows, AttributeMap const& base)
+  : rows_(rows)
+  , columns_(slotCount)
+{
+  AttributeVector values(base);
+  for (uint32 i = 0; i < slotCount; ++i) {
+    columns_[i].min = values[i].min;
+    columns_[i].max = values[i].max;
+  }
+}
+
+void AttributeColumns::set(istring const& name, size_t row, AttributeValue const& value) {
+  uint32 index = AttributeVector::slot(name);
+  if (index == AttributeVector::NoSlot) return;
+  Column& column = columns_[index];
+  if (column.mins.empty()) {
+    column.mins.assign(rows_, column.min);
+    column.maxs.assign(rows_, column.max);
+  }
+  column.mins[row] = value.min;
+  column.maxs[row] = value.max;
+}
+
+AttributeVector AttributeColumns::row(size_t row) const {
+  std::vector<AttributeValue>* vec = new std::vector<AttributeValue>(slotCount);
+  for (uint32 i = 0; i < slotCount; ++i) {
+    Column const& column = columns_[i];
+    if (column.mins.empty()) {
+      (*vec)[i] = AttributeValue(column.min, column.max);
+    } else {
+      (*vec)[i] = AttributeValue(column.mins[row], column.maxs[row]);
+    }
+  }
+  return AttributeVector(vec);
+}
+
+enum FormulaOp {
+  opConst,      // constants_[arg]
+  opAttr,       // attribute slot arg
+  opScript,     // SF_arg of the context power
+  opPower,      // formula powers_[arg] of another power
+  opMin,
+  opMax,
+  opClamp,
+  opRange,
+  opTable,
+  opLess,
+  opGreater,
+  opAdd,
+  opSub,
+  opMul,
+  opDiv,
+  opNeg,
+  opTernary,
+};
+static const uint32 opArgs[] = {0, 0, 0, 0, 2, 2, 3, 2, 2, 2, 2, 2, 2, 2, 2, 1, 3};
+
+// replaces the operands at args with the result
+static inline void applyOp(uint8 op, AttributeValue* args) {
+  AttributeValue& a = args[0];
+  AttributeValue const& b = args[1];
+  AttributeValue const& c = args[2];
+  switch (op) {
+  case opMin: a = AttributeValue(std::min(a.min, b.min), std::min(a.max, b.max)); break;
+  case opMax: a = AttributeValue(std::max(a.min, b.min), std::max(a.max, b.max)); break;
+  case opClamp: a = AttributeValue(std::min(std::max(a.min, b.min), b.min), std::min(std::max(a.max, b.max), c.max)); break;
+  case opRange: a = AttributeValue(std::min(a.min, b.min), std::max(a.max, b.max)); break;
+  case opTable: a = binop(a, b, funcTable); break;
+  case opLess: a = AttributeValue(a.max < b.max ? 1 : 0); break;
+  case opGreater: a = AttributeValue(a.max > b.max ? 1 : 0); break;
+  case opAdd: a = a + b; break;
+  case opSub: a = a - b; break;
+  case opMul: a = a * b; break;
+  case opDiv: a = a / b; break;
+  case opNeg: a = AttributeValue(-a.max, -a.min); break;
+  case opTernary: a = (a.max ? b : c); break;
+  }
+}
+
+// folded[i] is true if stack entry i is a constant, in which case it was pushed by an opConst
+// that is still among the last instructions
+void Formula::push(uint8 op, uint32 arg, std::vector<bool>& folded) {
+  Instr instr = {op, arg};
+  code_.push_back(instr);
+  folded.push_back(op == opConst);
+  depth_ = std::max<uint32>(depth_, folded.size());
+}
+void Formula::apply(uint8 op, std::vector<bool>& folded) {
+  uint32 count = opArgs[op];
+  if (folded.size() < count) throw Exception("invalid formula");
+  if (std::find(folded.end() - count, folded.end(), false) == folded.end()) {
+    AttributeValue args[3];
+    for (uint32 i = 0; i < count; ++i) {
+      args[i] = constants_[code_[code_.size() - count + i].arg];
+    }
+    applyOp(op, args);
+    code_.resize(code_.size() - count);
+    folded.resize(folded.size() - count);
+    constants_.push_back(args[0]);
+    push(opConst, constants_.size() - 1, folded);
+  } else {
+    Instr instr = {op, 0};
+    code_.push_back(instr);
+    folded.resize(folded.size() - count);
+    folded.push_back(false);
+  }
+}
+
+Formula::Formula(uint32 const* begin, uint32 const* end)
+  : depth_(0)
+{
+  std::vector<bool> folded;
+  auto constant = [&](AttributeValue const& value) {
+    constants_.push_back(value);
+    push(opConst, constants_.size() - 1, folded);
+  };
+  auto attr = [&](istring const& name) {
+    uint32 slot = AttributeVector::slot(name);
+    if (slot == AttributeVector::NoSlot) {
+      constant(AttributeValue());
+    } else {
+      push(opAttr, slot, folded);
+    }
+  };
+  // the result is the top of the stack at the first return, or 0 if there is none
+  bool done = false;
+  while (begin < end && !done) {
     switch (*begin++) {
     case 0: // return
-      return (stack.empty() ? 0 : stack.top());
+      if (folded.empty()) constant(0.0);
+      done = true;
+      break;
     case 1: // function
       switch (*begin++) {
-      case 0: // min
-        b = stack.top(); stack.pop();
-        a = stack.top(); stack.pop();
-        stack.emplace(std::min(a.min, b.min), std::min(a.max, b.max));
-        break;
-      case 1: // max
-        b = stack.top(); stack.pop();
-        a = stack.top(); stack.pop();
-        stack.emplace(std::max(a.min, b.min), std::max(a.max, b.max));
-        break;
-      case 2: // clamp
-        c = stack.top(); stack.pop();
-        b = stack.top(); stack.pop();
-        a = stack.top(); stack.pop();
-        stack.emplace(std::min(std::max(a.min, b.min), b.min), std::min(std::max(a.max, b.max), c.max));
-        break;
+      case 0: apply(opMin, folded); break;
+      case 1: apply(opMax, folded); break;
+      case 2: apply(opClamp, folded); break;
       case 3: // random (int/float/range, can't remember which is which)
       case 4:
       case 10:
-        b = stack.top(); stack.pop();
-        a = stack.top(); stack.pop();
-        stack.emplace(std::min(a.min, b.min), std::max(a.max, b.max));
-        break;
-      case 11: // table lookup
-        b = stack.top(); stack.pop();
-        a = stack.top(); stack.pop();
-        stack.push(binop(a, b, funcTable));
+        apply(opRange, folded);
         break;
+      case 11: apply(opTable, folded); break;
       default:
-        return 0;
+        constant(0.0);
+        done = true;
       }
       break;
     case 5: { // push value
       uint32 x = *begin++;
       uint32 y = *begin++;
       uint32 z = *begin++;
-      uint32 w = *begin++;
+      begin++;
       switch (x) {
       case 0: // character stats
         switch (fixAttrId(y)) {
-        case 0: stack.push(getval(values, "Defense")); break;
-        case 10: stack.push(getval(values, "Strength")); break;
-        case 57: stack.push(getval(values, "Level")); break;
-        case 102: stack.push(getval(values, "Skill_Total")); break;
-        case 187: stack.push(getval(values, "Casting_Speed_Total")); break;
-        case 198: stack.push(getval(values, "Attacks_Per_Second_Total")); break;
-        case 209: stack.push(getval(values, fmtstring("Damage_Delta#%s", elemNames[z]))); break;
-        case 211: stack.push(getval(values, fmtstring("Damage_Min#%s", elemNames[z]))); break;
-        case 677: stack.push(getval(values, "Rune_A")); break;
-        case 678: stack.push(getval(values, "Rune_B")); break;
-        case 679: stack.push(getval(values, "Rune_C")); break;
-        case 680: stack.push(getval(values, "Rune_D")); break;
-        case 681: stack.push(getval(values, "Rune_E")); break;
-        case 745: stack.push(getval(values, "Buff_Icon_Count0")); break;
-        case 746: stack.push(getval(values, "Buff_Icon_Count1")); break;
-        case 747: stack.push(getval(values, "Buff_Icon_Count2")); break;
-        case 748: stack.push(getval(values, "Buff_Icon_Count3")); break;
-        case 1056: stack.push(getval(values, "Resource_Gain_Bonus_Percent")); break;
-        case 1377: stack.push(getval(values, "Effective_Level")); break;
-        //default: stack.push(0);
+        case 0: attr("Defense"); break;
+        case 10: attr("Strength"); break;
+        case 57: attr("Level"); break;
+        case 102: attr("Skill_Total"); break;
+        case 187: attr("Casting_Speed_Total"); break;
+        case 198: attr("Attacks_Per_Second_Total"); break;
+        case 209:
+          if (z >= 7) throw Exception("invalid damage type %u", z);
+          attr(fmtstring("Damage_Delta#%s", elemNames[z]));
+          break;
+        case 211:
+          if (z >= 7) throw Exception("invalid damage type %u", z);
+          attr(fmtstring("Damage_Min#%s", elemNames[z]));
+          break;
+        case 677: attr("Rune_A"); break;
+        case 678: attr("Rune_B"); break;
+        case 679: attr("Rune_C"); break;
+        case 680: attr("Rune_D"); break;
+        case 681: attr("Rune_E"); break;
+        case 745: attr("Buff_Icon_Count0"); break;
+        case 746: attr("Buff_Icon_Count1"); break;
+        case 747: attr("Buff_Icon_Count2"); break;
+        case 748: attr("Buff_Icon_Count3"); break;
+        case 1056: attr("Resource_Gain_Bonus_Percent"); break;
+        case 1377: attr("Effective_Level"); break;
         default: throw Exception("unknown attribute id %u", fixAttrId(y));
         }
         break;
-      case 1: stack.push(getval(values, "sLevel")); break;
-      case 2: stack.push(getval(values, "iLevel")); break;
-      case 3: stack.push(getval(values, "mLevel")); break;
-      case 6: stack.push(getval(values, "mDamageMin#Physical")); break;
-      case 7: stack.push(getval(values, "mDamageDelta#Physical")); break;
-      case 8: stack.push(getval(values, "mDamageMin#Fire")); break;
-      case 9: stack.push(getval(values, "mDamageDelta#Fire")); break;
-      case 10: stack.push(getval(values, "mDamageMin#Lightning")); break;
-      case 11: stack.push(getval(values, "mDamageDelta#Lightning")); break;
-      case 12: stack.push(getval(values, "mDamageMin#Cold")); break;
-      case 13: stack.push(getval(values, "mDamageDelta#Cold")); break;
-      case 14: stack.push(getval(values, "mDamageMin#Poison")); break;
-      case 15: stack.push(getval(values, "mDamageDelta#Poison")); break;
-      case 16: stack.push(getval(values, "mDamageMin#Arcane")); break;
-      case 17: stack.push(getval(values, "mDamageDelta#Arcane")); break;
-      case 18: stack.push(getval(values, "mDamageMin#Holy")); break;
-      case 19: stack.push(getval(values, "mDamageDelta#Holy")); break;
-      case 22: stack.push(PowerTags::getraw(y, z, values)); break;
+      case 1: attr("sLevel"); break;
+      case 2: attr("iLevel"); break;
+      case 3: attr("mLevel"); break;
+      case 6: attr("mDamageMin#Physical"); break;
+      case 7: attr("mDamageDelta#Physical"); break;
+      case 8: attr("mDamageMin#Fire"); break;
+      case 9: attr("mDamageDelta#Fire"); break;
+      case 10: attr("mDamageMin#Lightning"); break;
+      case 11: attr("mDamageDelta#Lightning"); break;
+      case 12: attr("mDamageMin#Cold"); break;
+      case 13: attr("mDamageDelta#Cold"); break;
+      case 14: attr("mDamageMin#Poison"); break;
+      case 15: attr("mDamageDelta#Poison"); break;
+      case 16: attr("mDamageMin#Arcane"); break;
+      case 17: attr("mDamageDelta#Arcane"); break;
+      case 18: attr("mDamageMin#Holy"); break;
+      case 19: attr("mDamageDelta#Holy"); break;
+      case 22:
+        powers_.emplace_back(y, z);
+        push(opPower, powers_.size() - 1, folded);
+        break;
         // 23...86 = SF_0...SF_63
-      case 87: stack.emplace(PowerTags::table("DmgTier1")); break;
-      case 88: stack.emplace(PowerTags::table("DmgTier2")); break;
-      case 89: stack.emplace(PowerTags::table("DmgTier3")); break;
-      case 90: stack.emplace(PowerTags::table("DmgTier4")); break;
-      case 91: stack.emplace(PowerTags::table("DmgTier5")); break;
-      case 92: stack.emplace(PowerTags::table("DmgTier6")); break;
-      case 93: stack.emplace(PowerTags::table("DmgTier7")); break;
-      case 94: stack.emplace(PowerTags::table("Healing")); break;
-      case 95: stack.emplace(PowerTags::table("WDCost")); break;
-      case 96: stack.emplace(PowerTags::table("RuneDamageBonus")); break;
-      case 97: stack.emplace(PowerTags::table("PvPAvgPrimaryStat")); break;
-      case 98: stack.emplace(PowerTags::table("PvPAvgVitality")); break;
-      case 99: stack.emplace(PowerTags::table("PvPAvgArmor")); break;
-      case 100: stack.emplace(PowerTags::table("PvPAvgWeaponDPS")); break;
-      case 101: stack.push(getval(values, "mHealthMin")); break;
-      case 102: stack.emplace(PowerTags::table("LegendaryProcDmg")); break;
-      case 103: stack.emplace(PowerTags::table("OffhandDmgMinMin")); break;
-      case 104: stack.emplace(PowerTags::table("OffhandDmgMinMax")); break;
-      case 105: stack.emplace(PowerTags::table("OffhandDmgDeltaMin")); break;
-      case 106: stack.emplace(PowerTags::table("OffhandDmgDeltaMax")); break;
-      case 107: stack.emplace(PowerTags::table("ShieldBlockMinMin")); break;
-      case 108: stack.emplace(PowerTags::table("ShieldBlockMinMax")); break;
-      case 109: stack.emplace(PowerTags::table("ShieldBlockDeltaMin")); break;
-      case 110: stack.emplace(PowerTags::table("ShieldBlockDeltaMax")); break;
-      case 111: stack.push(getval(values, "mAreaDamageMin")); break;
-      case 112: stack.push(getval(values, "mAreaDamageMax")); break;
-      case 113: stack.push(getval(values, "bTraitActive")); break;
+      case 87: constant(AttributeValue(PowerTags::table("DmgTier1"))); break;
+      case 88: constant(AttributeValue(PowerTags::table("DmgTier2"))); break;
+      case 89: constant(AttributeValue(PowerTags::table("DmgTier3"))); break;
+      case 90: constant(AttributeValue(PowerTags::table("DmgTier4"))); break;
+      case 91: constant(AttributeValue(PowerTags::table("DmgTier5"))); break;
+      case 92: constant(AttributeValue(PowerTags::table("DmgTier6"))); break;
+      case 93: constant(AttributeValue(PowerTags::table("DmgTier7"))); break;
+      case 94: constant(AttributeValue(PowerTags::table("Healing"))); break;
+      case 95: constant(AttributeValue(PowerTags::table("WDCost"))); break;
+      case 96: constant(AttributeValue(PowerTags::table("RuneDamageBonus"))); break;
+      case 97: constant(AttributeValue(PowerTags::table("PvPAvgPrimaryStat"))); break;
+      case 98: constant(AttributeValue(PowerTags::table("PvPAvgVitality"))); break;
+      case 99: constant(AttributeValue(PowerTags::table("PvPAvgArmor"))); break;
+      case 100: constant(AttributeValue(PowerTags::table("PvPAvgWeaponDPS"))); break;
+      case 101: attr("mHealthMin"); break;
+      case 102: constant(AttributeValue(PowerTags::table("LegendaryProcDmg"))); break;
+      case 103: constant(AttributeValue(PowerTags::table("OffhandDmgMinMin"))); break;
+      case 104: constant(AttributeValue(PowerTags::table("OffhandDmgMinMax"))); break;
+      case 105: constant(AttributeValue(PowerTags::table("OffhandDmgDeltaMin"))); break;
+      case 106: constant(AttributeValue(PowerTags::table("OffhandDmgDeltaMax"))); break;
+      case 107: constant(AttributeValue(PowerTags::table("ShieldBlockMinMin"))); break;
+      case 108: constant(AttributeValue(PowerTags::table("ShieldBlockMinMax"))); break;
+      case 109: constant(AttributeValue(PowerTags::table("ShieldBlockDeltaMin"))); break;
+      case 110: constant(AttributeValue(PowerTags::table("ShieldBlockDeltaMax"))); break;
+      case 111: attr("mAreaDamageMin"); break;
+      case 112: attr("mAreaDamageMax"); break;
+      case 113: attr("bTraitActive"); break;
       default:
         if (x >= 23 && x <= 86) {
-          stack.push(context ? context->get(x - 23, values) : 0); break;
+          push(opScript, x - 23, folded);
         } else {
           throw Exception("unknown value id %u", x);
-          stack.push(0);
         }
       }
       break;
     }
     case 6: // float constant
-      stack.push(*(float*)begin++);
+      constant(*(float*)begin++);
       break;
-    case 7: // <
-      b = stack.top(); stack.pop();
-      a = stack.top(); stack.pop();
-      stack.push(a.max < b.max ? 1 : 0);
+    case 7: apply(opLess, folded); break;
+    case 8: apply(opGreater, folded); break;
+    case 11: apply(opAdd, folded); break;
+    case 12: apply(opSub, folded); break;
+    case 13: apply(opMul, folded); break;
+    case 14: apply(opDiv, folded); break;
+    case 16: apply(opNeg, folded); break;
+    case 17: apply(opTernary, folded); break;
+    default:
+      throw Exception("unknown opcode %u", begin[-1]);
+    }
+  }
+  if (!done) {
+    // running off the end returns 0
+    constant(0.0);
+  }
+}
+
+AttributeValue Formula::eval(AttributeVector const& values, PowerTag* context) const {
+  AttributeValue local[16];
+  std::vector<AttributeValue> heap;
+  AttributeValue* stack = local;
+  if (depth_ > 16) {
+    heap.resize(depth_);
+    stack = heap.data();
+  }
+  AttributeValue* top = stack;
+  for (Instr const& instr : code_) {
+    switch (instr.op) {
+    case opConst:
+      *top++ = constants_[instr.arg];
       break;
-    case 8: // >
-      b = stack.top(); stack.pop();
-      a = stack.top(); stack.pop();
-      stack.push(a.max > b.max ? 1 : 0);
+    case opAttr:
+      *top++ = values[instr.arg];
       break;
-    case 11: // +
-      b = stack.top(); stack.pop();
-      a = stack.top(); stack.pop();
-      stack.push(a + b);
+    case opScript:
+      *top++ = (context ? context->get(static_cast<int>(instr.arg), values) : AttributeValue());
       break;
-    case 12: // -
-      b = stack.top(); stack.pop();
-      a = stack.top(); stack.pop();
-      stack.push(a - b);
+    case opPower:
+      *top++ = PowerTags::getraw(powers_[instr.arg].first, powers_[instr.arg].second, values);
       break;
-    case 13: // *
-      b = stack.top(); stack.pop();
-      a = stack.top(); stack.pop();
-      stack.push(a * b);
+    default:
+      top -= opArgs[instr.op];
+      applyOp(instr.op, top);
+      ++top;
+    }
+  }
+  return (top == stack ? AttributeValue() : top[-1]);
+}
+
+// the same operations on rows of ranges; these follow the AttributeValue operators exactly,
+// including the order of comparisons (which matters for NaN)
+static inline void includeLane(double& min, double& max, double x) {
+  if (x < min) min = x;
+  if (x > max) max = x;
+}
+static inline void mulLane(double& amin, double& amax, double bmin, double bmax) {
+  if (amin > 0 && bmin > 0) {
+    amin *= bmin;
+    amax *= bmax;
+    return;
+  }
+  double min = amin * bmin, max = min;
+  includeLane(min, max, amin * bmax);
+  includeLane(min, max, amax * bmin);
+  includeLane(min, max, amax * bmax);
+  if (amin <= 0 && amax >= 0) includeLane(min, max, 0);
+  if (bmin <= 0 && bmax >= 0) includeLane(min, max, 0);
+  amin = min;
+  amax = max;
+}
+static inline void divLane(double& amin, double& amax, double bmin, double bmax) {
+  if (amin > 0 && bmin > 0) {
+    double min = amin / bmax;
+    amax /= bmin;
+    amin = min;
+    return;
+  }
+  double min = amin / bmin, max = min;
+  includeLane(min, max, amin / bmax);
+  includeLane(min, max, amax / bmin);
+  includeLane(min, max, amax / bmax);
+  if (amin <= 0 && amax >= 0) includeLane(min, max, 0);
+  amin = min;
+  amax = max;
+}
+
+struct LaneEntry {
+  double* min;
+  double* max;
+  double const* table;
+};
+
+// replaces the operands at args with the result; returns false if the result would need a
+// different table in some rows
+static bool applyLanes(uint8 op, LaneEntry* args, size_t rows) {
+  double* amin = args[0].min;
+  double* amax = args[0].max;
+  double const* bmin = args[1].min;
+  double const* bmax = args[1].max;
+  double const* cmin = args[2].min;
+  double const* cmax = args[2].max;
+  double const* table = args[0].table;
+  args[0].table = nullptr;
+  switch (op) {
+  case opMin:
+    for (size_t i = 0; i < rows; ++i) {
+      amin[i] = std::min(amin[i], bmin[i]);
+      amax[i] = std::min(amax[i], bmax[i]);
+    }
+    break;
+  case opMax:
+    for (size_t i = 0; i < rows; ++i) {
+      amin[i] = std::max(amin[i], bmin[i]);
+      amax[i] = std::max(amax[i], bmax[i]);
+    }
+    break;
+  case opClamp:
+    for (size_t i = 0; i < rows; ++i) {
+      amin[i] = std::min(std::max(amin[i], bmin[i]), bmin[i]);
+      amax[i] = std::min(std::max(amax[i], bmax[i]), cmax[i]);
+    }
+    break;
+  case opRange:
+    for (size_t i = 0; i < rows; ++i) {
+      amin[i] = std::min(amin[i], bmin[i]);
+      amax[i] = std::max(amax[i], bmax[i]);
+    }
+    break;
+  case opTable:
+    for (size_t i = 0; i < rows; ++i) {
+      int imin = static_cast<int>(bmin[i]);
+      int imax = static_cast<int>(bmax[i]);
+      if (table == nullptr || imin < 0 || imax > 75) {
+        amin[i] = amax[i] = 0;
+      } else {
+        amin[i] = std::min(table[imin], table[imax]);
+        amax[i] = std::max(table[imin], table[imax]);
+      }
+    }
+    break;
+  case opLess:
+    for (size_t i = 0; i < rows; ++i) {
+      amin[i] = amax[i] = (amax[i] < bmax[i] ? 1 : 0);
+    }
+    break;
+  case opGreater:
+    for (size_t i = 0; i < rows; ++i) {
+      amin[i] = amax[i] = (amax[i] > bmax[i] ? 1 : 0);
+    }
+    break;
+  case opAdd:
+    for (size_t i = 0; i < rows; ++i) {
+      amin[i] += bmin[i];
+      amax[i] += bmax[i];
+    }
+    break;
+  case opSub:
+    for (size_t i = 0; i < rows; ++i) {
+      double min = amin[i] - bmax[i];
+      amax[i] -= bmin[i];
+      amin[i] = min;
+    }
+    break;
+  case opMul:
+    for (size_t i = 0; i < rows; ++i) {
+      mulLane(amin[i], amax[i], bmin[i], bmax[i]);
+    }
+    break;
+  case opDiv:
+    for (size_t i = 0; i < rows; ++i) {
+      divLane(amin[i], amax[i], bmin[i], bmax[i]);
+    }
+    break;
+  case opNeg:
+    for (size_t i = 0; i < rows; ++i) {
+      double min = -amax[i];
+      amax[i] = -amin[i];
+      amin[i] = min;
+    }
+    break;
+  case opTernary: {
+    bool left = false, right = false;
+    for (size_t i = 0; i < rows; ++i) {
+      if (amax[i]) {
+        left = true;
+        amin[i] = bmin[i];
+        amax[i] = bmax[i];
+      } else {
+        right = true;
+        amin[i] = cmin[i];
+        amax[i] = cmax[i];
+      }
+    }
+    if (left && right && args[1].table != args[2].table) return false;
+    args[0].table = (left ? args[1].table : args[2].table);
+    break;
+  }
+  }
+  return true;
+}
+
+static void fillLanes(LaneEntry& entry, AttributeColumn const& column) {
+  std::copy(column.min.begin(), column.min.end(), entry.min);
+  std::copy(column.max.begin(), column.max.end(), entry.max);
+  entry.table = column.table;
+}
+
+AttributeColumn Formula::eval(AttributeColumns const& values, PowerTag* context) const {
+  size_t rows = values.size();
+  std::vector<double> lanes(depth_ * rows * 2);
+  std::vector<LaneEntry> stack(depth_);
+  for (uint32 i = 0; i < depth_; ++i) {
+    stack[i].min = lanes.data() + i * rows * 2;
+    stack[i].max = stack[i].min + rows;
+    stack[i].table = nullptr;
+  }
+  LaneEntry* top = stack.data();
+  for (Instr const& instr : code_) {
+    switch (instr.op) {
+    case opConst: {
+      AttributeValue const& value = constants_[instr.arg];
+      std::fill(top->min, top->min + rows, value.min);
+      std::fill(top->max, top->max + rows, value.max);
+      top->table = value.table;
+      ++top;
       break;
-    case 14: // /
-      b = stack.top(); stack.pop();
-      a = stack.top(); stack.pop();
-      stack.push(a / b);
+    }
+    case opAttr: {
+      AttributeColumns::Column const& column = values.columns_[instr.arg];
+      if (column.mins.empty()) {
+        std::fill(top->min, top->min + rows, column.min);
+        std::fill(top->max, top->max + rows, column.max);
+      } else {
+        std::copy(column.mins.begin(), column.mins.end(), top->min);
+        std::copy(column.maxs.begin(), column.maxs.end(), top->max);
+      }
+      top->table = nullptr;
+      ++top;
       break;
-    case 16: // unary -
-      a = stack.top(); stack.pop();
-      stack.emplace(-a.max, -a.min);
+    }
+    case opScript:
+      if (context) {
+        fillLanes(*top, context->getBatch(static_cast<int>(instr.arg), values));
+      } else {
+        fillLanes(*top, AttributeColumn(rows));
+      }
+      ++top;
       break;
-    case 17: // ternary
-      c = stack.top(); stack.pop();
-      b = stack.top(); stack.pop();
-      a = stack.top(); stack.pop();
-      stack.push(a.max ? b : c);
+    case opPower:
+      fillLanes(*top, PowerTags::getrawBatch(powers_[instr.arg].first, powers_[instr.arg].second, values));
+      ++top;
       break;
     default:
-      throw Exception("unknown opcode %u", begin[-1]);
-      return 0;
+      top -= opArgs[instr.op];
+      if (!applyLanes(instr.op, top, rows)) {
+        // tables that differ between rows cannot be kept in one column; this does not happen
+        // with the formulas in the game data, where tables are only passed to table()
+        throw Exception("formula selects different tables for different attributes");
+      }
+      ++top;
     }
   }
-  return 0;
+  AttributeColumn res(rows);
+  if (top != stack.data()) {
+    --top;
+    std::copy(top->min, top->min + rows, res.min.begin());
+    std::copy(top->max, top->max + rows, res.max.begin());
+    res.table = top->table;
+  }
+  return res;
+}
+
+AttributeValue ExecFormula(uint32 const* begin, uint32 const* end, AttributeMap const& values, PowerTag* context) {
+  return Formula(begin, end).eval(AttributeVector(values), context);
 }
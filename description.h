@@ -10,6 +10,12 @@
 // AttributeValue ExecFormula(uint32 const* begin, uint32 const* end, AttributeMap const& values = {}, PowerTag* context = nullptr)
 //   execute a 'binary' formula
 //
+// class AttributeVector - the attributes formulas can read, looked up in an AttributeMap once
+// class AttributeColumns - the same for many rows of numeric values, stored by attribute
+// class Formula - a 'binary' formula compiled for repeated evaluation: attribute references are
+//   resolved to AttributeVector slots, tables to pointers, and constant subexpressions are folded;
+//   evaluating it over AttributeColumns runs each operation over all rows (AttributeColumn)
+//
 // std::string FormatDescription(std::string const& descr, bool html, AttributeMap const& values = {}, PowerTag* context = nullptr)
 //   format a description from StringLists
 
@@ -17,6 +23,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <memory>
 #include "common.h"
 
 enum FormatFlags {
@@ -96,6 +103,99 @@ struct AttributeValue {
 typedef Map<AttributeValue> AttributeMap;
 class PowerTag;
 
+class AttributeVector {
+public:
+  explicit AttributeVector(AttributeMap const& values);
+
+  AttributeValue const& operator[](uint32 slot) const {
+    return (*values_)[slot];
+  }
+  uint64 hash() const {
+    return hash_;
+  }
+  bool operator==(AttributeVector const& rhs) const;
+
+  // slot of an attribute name, or NoSlot if formulas never read it
+  static const uint32 NoSlot = uint32(-1);
+  static uint32 slot(istring const& name);
+  static uint32 slots();
+
+private:
+  friend class AttributeColumns;
+  explicit AttributeVector(std::vector<AttributeValue>* values);
+  std::shared_ptr<std::vector<AttributeValue> const> values_;
+  uint64 hash_;
+};
+
+// rows start out as copies of base (text and table references are not kept); attributes that are
+// never set hold one value for all rows
+class AttributeColumns {
+public:
+  AttributeColumns(size_t rows, AttributeMap const& base = {});
+
+  size_t size() const {
+    return rows_;
+  }
+  void set(istring const& name, size_t row, AttributeValue const& value);
+  AttributeVector row(size_t row) const;
+
+private:
+  friend class Formula;
+  struct Column {
+    double min, max;
+    std::vector<double> mins, maxs;
+  };
+  size_t rows_;
+  std::vector<Column> columns_;
+};
+
+struct AttributeColumn {
+  std::vector<double> min, max;
+  double const* table;
+  AttributeColumn(size_t rows = 0)
+    : min(rows)
+    , max(rows)
+    , table(nullptr)
+  {}
+  size_t size() const {
+    return min.size();
+  }
+  AttributeValue operator[](size_t row) const {
+    AttributeValue res(min[row], max[row]);
+    res.table = table;
+    return res;
+  }
+};
+
+class Formula {
+public:
+  Formula()
+    : depth_(0)
+  {}
+  // throws Exception on opcodes or value ids that ExecFormula does not know
+  Formula(uint32 const* begin, uint32 const* end);
+
+  AttributeValue eval(AttributeVector const& values, PowerTag* context = nullptr) const;
+  AttributeColumn eval(AttributeColumns const& values, PowerTag* context = nullptr) const;
+
+  bool empty() const {
+    return code_.empty();
+  }
+
+private:
+  struct Instr {
+    uint8 op;
+    uint32 arg;
+  };
+  std::vector<Instr> code_;
+  std::vector<AttributeValue> constants_;
+  std::vector<std::pair<uint32, uint32>> powers_;
+  uint32 depth_;
+
+  void push(uint8 op, uint32 arg, std::vector<bool>& folded);
+  void apply(uint8 op, std::vector<bool>& folded);
+};
+
 AttributeValue ExecFormula(uint32 const* begin, uint32 const* end, AttributeMap const& values = {}, PowerTag* context = nullptr);
 inline AttributeValue ExecFormula(std::vector<uint32> const& formula, AttributeMap const& values = {}, PowerTag* context = nullptr) {
   return ExecFormula(formula.data(), formula.data() + formula.size(), values, context);
@@ -107,6 +207,7 @@ struct FormulaParser {
   FormatFlags flags;
   size_t pos;
   AttributeMap values;
+  AttributeVector inputs;
   PowerTag* context;
   AttributeValue prevtag;
   static Dictionary pretags;
@@ -0,0 +1,391 @@
+#include "dxt.h"
+#include "cpu.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DXT_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is used without compiling the whole file for it, so the kernel is marked for the compiler
+// and only picked when the CPU reports support
+#if defined(DXT_SSE2) && defined(_MSC_VER) && _MSC_VER >= 1800
+#define DXT_AVX2
+#define DXT_TARGET_AVX2
+#include <immintrin.h>
+#elif defined(DXT_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DXT_AVX2
+#define DXT_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace DXT {
+
+typedef void(*RowFunc)(Blocks const& blocks, uint32 first, uint32 count, uint32* dst, uint32 stride);
+
+static inline uint16 load16(uint8 const* ptr) {
+  uint16 val;
+  memcpy(&val, ptr, sizeof val);
+  return val;
+}
+static inline uint32 load32(uint8 const* ptr) {
+  uint32 val;
+  memcpy(&val, ptr, sizeof val);
+  return val;
+}
+static inline uint64 load64(uint8 const* ptr) {
+  uint64 val;
+  memcpy(&val, ptr, sizeof val);
+  return val;
+}
+
+// the same arithmetic as Image::Format::from<FormatXRGB<0, 5, 6, 5>> and Image::Format::mix
+static inline uint32 expand(uint32 c) {
+  uint32 r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  return 0xFF000000 | ((r * 255 / 31) << 16) | ((g * 255 / 63) << 8) | (b * 255 / 31);
+}
+static inline uint32 mix(uint32 a, uint32 ka, uint32 b, uint32 kb) {
+  uint32 res = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    res |= (((a >> shift) & 0xFF) * ka + ((b >> shift) & 0xFF) * kb) / (ka + kb) << shift;
+  }
+  return res;
+}
+
+template<int F>
+static inline void palette(Blocks const& blocks, uint32 block, uint32* c) {
+  uint8 const* color = blocks.color + size_t(block) * blocks.colorStride;
+  uint32 p = load16(color), q = load16(color + 2);
+  c[0] = expand(p);
+  c[1] = expand(q);
+  if (F != DXT1 || p > q) {
+    c[2] = mix(c[0], 2, c[1], 1);
+    c[3] = mix(c[0], 1, c[1], 2);
+  } else {
+    c[2] = mix(c[0], 1, c[1], 1);
+    c[3] = 0;
+  }
+}
+static inline uint32 lookup(Blocks const& blocks, uint32 block) {
+  return load32(blocks.index + size_t(block) * blocks.indexStride);
+}
+static inline uint64 alpha4(Blocks const& blocks, uint32 block) {
+  return load64(blocks.alpha + size_t(block) * blocks.alphaStride);
+}
+// DXT5 alpha values, already shifted into place, and the 3-bit indices
+static inline uint64 alpha8(Blocks const& blocks, uint32 block, uint32* a) {
+  uint8 const* ends = blocks.alpha + size_t(block) * blocks.alphaStride;
+  uint32 a0 = ends[0], a1 = ends[1];
+  a[0] = a0;
+  a[1] = a1;
+  if (a0 > a1) {
+    a[2] = (a0 * 6 + a1 * 1) / 7;
+    a[3] = (a0 * 5 + a1 * 2) / 7;
+    a[4] = (a0 * 4 + a1 * 3) / 7;
+    a[5] = (a0 * 3 + a1 * 4) / 7;
+    a[6] = (a0 * 2 + a1 * 5) / 7;
+    a[7] = (a0 * 1 + a1 * 6) / 7;
+  } else {
+    a[2] = (a0 * 4 + a1 * 1) / 5;
+    a[3] = (a0 * 3 + a1 * 2) / 5;
+    a[4] = (a0 * 2 + a1 * 3) / 5;
+    a[5] = (a0 * 1 + a1 * 4) / 5;
+    a[6] = 0;
+    a[7] = 255;
+  }
+  for (int i = 0; i < 8; ++i) {
+    a[i] <<= 24;
+  }
+  uint8 const* map = blocks.alphaIndex + size_t(block) * blocks.alphaIndexStride;
+  uint64 amap = 0;
+  for (int i = 0; i < 6; ++i) {
+    amap |= static_cast<uint64>(map[i]) << (i * 8);
+  }
+  return amap;
+}
+
+template<int F>
+static void rowsScalar(Blocks const& blocks, uint32 first, uint32 count, uint32* dst, uint32 stride) {
+  for (uint32 block = first; block < first + count; ++block, dst += 4) {
+    uint32 c[4];
+    palette<F>(blocks, block, c);
+    uint32 index = lookup(blocks, block);
+    uint64 alpha = (F == DXT3 ? alpha4(blocks, block) : 0);
+    uint32 a[8];
+    if (F == DXT5) alpha = alpha8(blocks, block, a);
+    for (uint32 y = 0; y < 4; ++y) {
+      uint32* out = dst + size_t(y) * stride;
+      for (uint32 x = 0; x < 4; ++x) {
+        if (F == DXT1) {
+          out[x] = c[index & 3];
+        } else if (F == DXT3) {
+          out[x] = (c[index & 3] & 0x00FFFFFF) | (static_cast<uint32>(alpha & 15) * 17 << 24);
+          alpha >>= 4;
+        } else {
+          out[x] = (c[index & 3] & 0x00FFFFFF) | a[alpha & 7];
+          alpha >>= 3;
+        }
+        index >>= 2;
+      }
+    }
+  }
+}
+
+#ifdef DXT_SSE2
+// the four colors of a block in one register: the mixed colors are computed on 16-bit channels of
+// both endpoints at once, x / 3 is (x * 21846) >> 16 for every x up to 3 * 255
+template<int F>
+static inline __m128i paletteSSE2(Blocks const& blocks, uint32 block) {
+  uint8 const* color = blocks.color + size_t(block) * blocks.colorStride;
+  uint32 p = load16(color), q = load16(color + 2);
+  __m128i ends = _mm_unpacklo_epi8(_mm_cvtsi32_si128(expand(p)), _mm_setzero_si128());
+  ends = _mm_unpacklo_epi64(ends, _mm_unpacklo_epi8(_mm_cvtsi32_si128(expand(q)), _mm_setzero_si128()));
+  __m128i swapped = _mm_shuffle_epi32(ends, _MM_SHUFFLE(1, 0, 3, 2));
+  __m128i mixed;
+  if (F != DXT1 || p > q) {
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(ends, ends), swapped);
+    mixed = _mm_mulhi_epu16(sum, _mm_set1_epi16(21846));
+  } else {
+    mixed = _mm_srli_epi16(_mm_add_epi16(ends, swapped), 1);
+    mixed = _mm_unpacklo_epi64(mixed, _mm_setzero_si128());
+  }
+  return _mm_packus_epi16(ends, mixed);
+}
+
+// two index bits per pixel are tested with masks and used to select between the four colors
+template<int F>
+static void rowsSSE2(Blocks const& blocks, uint32 first, uint32 count, uint32* dst, uint32 stride) {
+  __m128i const bit0 = _mm_setr_epi32(1 << 0, 1 << 2, 1 << 4, 1 << 6);
+  __m128i const bit1 = _mm_setr_epi32(1 << 1, 1 << 3, 1 << 5, 1 << 7);
+  __m128i const rgb = _mm_set1_epi32(0x00FFFFFF);
+  __m128i const nibble = _mm_set1_epi8(0x0F);
+  __m128i const zero = _mm_setzero_si128();
+  for (uint32 block = first; block < first + count; ++block, dst += 4) {
+    __m128i colors = paletteSSE2<F>(blocks, block);
+    __m128i c0 = _mm_shuffle_epi32(colors, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128i c1 = _mm_shuffle_epi32(colors, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128i c2 = _mm_shuffle_epi32(colors, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128i c3 = _mm_shuffle_epi32(colors, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i index = _mm_set1_epi32(lookup(blocks, block));
+
+    __m128i alpha[4];
+    if (F == DXT3) {
+      // nibbles to bytes (n * 17), then to the top byte of each pixel
+      __m128i packed = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(blocks.alpha + size_t(block) * blocks.alphaStride));
+      __m128i lo = _mm_and_si128(packed, nibble);
+      __m128i hi = _mm_and_si128(_mm_srli_epi16(packed, 4), nibble);
+      __m128i values = _mm_unpacklo_epi8(lo, hi);
+      values = _mm_or_si128(values, _mm_slli_epi16(values, 4));
+      __m128i words0 = _mm_unpacklo_epi8(zero, values);
+      __m128i words1 = _mm_unpackhi_epi8(zero, values);
+      alpha[0] = _mm_unpacklo_epi16(zero, words0);
+      alpha[1] = _mm_unpackhi_epi16(zero, words0);
+      alpha[2] = _mm_unpacklo_epi16(zero, words1);
+      alpha[3] = _mm_unpackhi_epi16(zero, words1);
+    } else if (F == DXT5) {
+      uint32 a[8];
+      uint64 amap = alpha8(blocks, block, a);
+      for (int y = 0; y < 4; ++y, amap >>= 12) {
+        alpha[y] = _mm_setr_epi32(a[amap & 7], a[(amap >> 3) & 7], a[(amap >> 6) & 7], a[(amap >> 9) & 7]);
+      }
+    }
+
+    for (uint32 y = 0; y < 4; ++y, index = _mm_srli_epi32(index, 8)) {
+      __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(index, bit0), bit0);
+      __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(index, bit1), bit1);
+      __m128i lo = _mm_or_si128(_mm_and_si128(m0, c1), _mm_andnot_si128(m0, c0));
+      __m128i hi = _mm_or_si128(_mm_and_si128(m0, c3), _mm_andnot_si128(m0, c2));
+      __m128i pixels = _mm_or_si128(_mm_and_si128(m1, hi), _mm_andnot_si128(m1, lo));
+      if (F != DXT1) {
+        pixels = _mm_or_si128(_mm_and_si128(pixels, rgb), alpha[y]);
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + size_t(y) * stride), pixels);
+    }
+  }
+}
+#endif
+
+#ifdef DXT_AVX2
+// two rows at a time: indices are shifted per lane and looked up with a cross-lane permute
+template<int F>
+DXT_TARGET_AVX2 static void rowsAVX2(Blocks const& blocks, uint32 first, uint32 count, uint32* dst, uint32 stride) {
+  __m256i const shift2 = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+  __m256i const shift3 = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  __m256i const shift4 = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  __m256i const rgb = _mm256_set1_epi32(0x00FFFFFF);
+  for (uint32 block = first; block < first + count; ++block, dst += 4) {
+    __m256i colors = _mm256_castsi128_si256(paletteSSE2<F>(blocks, block));
+    uint32 index = lookup(blocks, block);
+
+    __m256i alpha[2];
+    if (F == DXT3) {
+      uint64 values = alpha4(blocks, block);
+      for (int half = 0; half < 2; ++half) {
+        __m256i nibbles = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(static_cast<uint32>(values >> (half * 32))), shift4), _mm256_set1_epi32(15));
+        alpha[half] = _mm256_slli_epi32(_mm256_or_si256(nibbles, _mm256_slli_epi32(nibbles, 4)), 24);
+      }
+    } else if (F == DXT5) {
+      uint32 a[8];
+      uint64 amap = alpha8(blocks, block, a);
+      __m256i values = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a));
+      for (int half = 0; half < 2; ++half) {
+        __m256i indices = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(static_cast<uint32>(amap >> (half * 24))), shift3), _mm256_set1_epi32(7));
+        alpha[half] = _mm256_permutevar8x32_epi32(values, indices);
+      }
+    }
+
+    for (int half = 0; half < 2; ++half) {
+      __m256i indices = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32(index >> (half * 16)), shift2), _mm256_set1_epi32(3));
+      __m256i pixels = _mm256_permutevar8x32_epi32(colors, indices);
+      if (F != DXT1) {
+        pixels = _mm256_or_si256(_mm256_and_si256(pixels, rgb), alpha[half]);
+      }
+      uint32* out = dst + size_t(half * 2) * stride;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(pixels));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + stride), _mm256_extracti128_si256(pixels, 1));
+    }
+  }
+}
+
+#endif
+
+static RowFunc const kernels[NumKernels][3] = {
+  {rowsScalar<DXT1>, rowsScalar<DXT3>, rowsScalar<DXT5>},
+#ifdef DXT_SSE2
+  {rowsSSE2<DXT1>, rowsSSE2<DXT3>, rowsSSE2<DXT5>},
+#else
+  {nullptr, nullptr, nullptr},
+#endif
+#ifdef DXT_AVX2
+  {rowsAVX2<DXT1>, rowsAVX2<DXT3>, rowsAVX2<DXT5>},
+#else
+  {nullptr, nullptr, nullptr},
+#endif
+};
+
+bool supported(Kernel kernel) {
+  switch (kernel) {
+  case Scalar:
+    return true;
+#ifdef DXT_SSE2
+  case SSE2:
+    return true;
+#endif
+#ifdef DXT_AVX2
+  case AVX2:
+    return CPU::hasAVX2();
+#endif
+  default:
+    return false;
+  }
+}
+
+static Kernel best() {
+  for (int kernel = NumKernels - 1; kernel > Scalar; --kernel) {
+    if (supported(static_cast<Kernel>(kernel))) return static_cast<Kernel>(kernel);
+  }
+  return Scalar;
+}
+// detected once at startup; setKernel() overrides it for benchmarks and tests, and may be called
+// while other threads decode
+static Kernel const detected = best();
+static std::atomic<int> selected(-1);
+
+Kernel kernel() {
+  int kernel = selected.load(std::memory_order_relaxed);
+  return (kernel < 0 ? detected : static_cast<Kernel>(kernel));
+}
+void setKernel(Kernel kernel) {
+  if (supported(kernel)) selected.store(kernel, std::memory_order_relaxed);
+}
+
+size_t size(Format format, uint32 width, uint32 height) {
+  size_t count = size_t((width + 3) / 4) * ((height + 3) / 4);
+  return count * (format == DXT1 ? 8 : 16);
+}
+
+Blocks planar(Format format, uint8 const* data, uint32 width, uint32 height) {
+  uint32 count = ((width + 3) / 4) * ((height + 3) / 4);
+  Blocks blocks;
+  memset(&blocks, 0, sizeof blocks);
+  switch (format) {
+  case DXT1:
+    blocks.color = data;
+    blocks.index = data + count * 4;
+    break;
+  case DXT3:
+    blocks.alpha = data;
+    blocks.alphaStride = 8;
+    blocks.color = data + count * 8;
+    blocks.index = data + count * 12;
+    break;
+  case DXT5:
+    blocks.alpha = data;
+    blocks.alphaStride = 2;
+    blocks.alphaIndex = data + count * 2;
+    blocks.alphaIndexStride = 6;
+    blocks.color = data + count * 8;
+    blocks.index = data + count * 12;
+    break;
+  }
+  blocks.colorStride = 4;
+  blocks.indexStride = 4;
+  return blocks;
+}
+
+Blocks interleaved(Format format, uint8 const* data) {
+  Blocks blocks;
+  memset(&blocks, 0, sizeof blocks);
+  uint32 stride = (format == DXT1 ? 8 : 16);
+  uint32 offset = (format == DXT1 ? 0 : 8);
+  blocks.color = data + offset;
+  blocks.colorStride = stride;
+  blocks.index = data + offset + 4;
+  blocks.indexStride = stride;
+  if (format != DXT1) {
+    blocks.alpha = data;
+    blocks.alphaStride = stride;
+  }
+  if (format == DXT5) {
+    blocks.alphaIndex = data + 2;
+    blocks.alphaIndexStride = stride;
+  }
+  return blocks;
+}
+
+void decode(Format format, Blocks const& blocks, uint32 width, uint32 height,
+    uint32 left, uint32 top, uint32 right, uint32 bottom, Image::color_t* bits, uint32 stride) {
+  if (right > width) right = width;
+  if (bottom > height) bottom = height;
+  if (left >= right || top >= bottom) return;
+  RowFunc func = kernels[kernel()][format];
+  uint32 across = (width + 3) / 4;
+  // blocks that lie inside the rectangle are decoded in place, the rest go through a buffer
+  uint32 fullFirst = (left + 3) / 4;
+  uint32 fullLast = right / 4;
+  uint32 temp[16];
+  for (uint32 by = top / 4; by * 4 < bottom; ++by) {
+    uint32 y0 = std::max(by * 4, top);
+    uint32 y1 = std::min(by * 4 + 4, bottom);
+    uint32* row = bits + size_t(y0 - top) * stride;
+    bool fullRows = (y1 - y0 == 4);
+    for (uint32 bx = left / 4; bx * 4 < right;) {
+      if (fullRows && bx >= fullFirst && bx < fullLast) {
+        func(blocks, by * across + bx, fullLast - bx, row + (bx * 4 - left), stride);
+        bx = fullLast;
+        continue;
+      }
+      func(blocks, by * across + bx, 1, temp, 4);
+      uint32 x0 = std::max(bx * 4, left);
+      uint32 x1 = std::min(bx * 4 + 4, right);
+      for (uint32 y = y0; y < y1; ++y) {
+        memcpy(row + size_t(y - y0) * stride + (x0 - left), temp + (y - by * 4) * 4 + (x0 - bx * 4), (x1 - x0) * sizeof(uint32));
+      }
+      ++bx;
+    }
+  }
+}
+
+}
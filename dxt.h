@@ -0,0 +1,73 @@
+// dxt.h
+//
+// DXT1/DXT3/DXT5 block decoding, shared by Textures and BLP2 images
+//
+// A block covers 4x4 pixels and has up to four parts: two 565 endpoint colors, 32 bits of 2-bit
+// color indices, and either 64 bits of 4-bit alpha (DXT3) or two alpha endpoints followed by 48
+// bits of 3-bit alpha indices (DXT5). BLP2 stores whole blocks one after another, D3 textures
+// store each part in its own plane. DXT::Blocks describes either layout with a pointer and a
+// stride per part.
+//
+// Blocks are decoded straight into rows of Image::color_t. The decoder (kernel) is picked on
+// first use: AVX2 if the CPU has it, then SSE2, then plain C++; all of them produce the same
+// pixels. Partial blocks at the right and bottom edges are clipped.
+//
+// size_t DXT::size(Format format, uint32 width, uint32 height)
+//   size of the compressed data in bytes
+// Blocks DXT::planar(Format format, uint8 const* data, uint32 width, uint32 height)
+// Blocks DXT::interleaved(Format format, uint8 const* data)
+//   block layouts of Textures and BLP2 data
+// void DXT::decode(Format format, Blocks const& blocks, uint32 width, uint32 height, Image::color_t* bits, uint32 stride)
+//   decode an image, stride is in pixels
+// void DXT::decode(Format format, Blocks const& blocks, uint32 width, uint32 height,
+//     uint32 left, uint32 top, uint32 right, uint32 bottom, Image::color_t* bits, uint32 stride)
+//   decode the pixels in [left, right) x [top, bottom) only, touching just the blocks that cover
+//   them; bits points to the pixel at (left, top)
+// bool DXT::supported(Kernel kernel), Kernel DXT::kernel(), void DXT::setKernel(Kernel kernel)
+//   kernel selection, for comparing them in benchmarks
+
+#pragma once
+#include "image.h"
+
+namespace DXT {
+  enum Format {
+    DXT1,
+    DXT3,
+    DXT5,
+  };
+  enum Kernel {
+    Scalar,
+    SSE2,
+    AVX2,
+
+    NumKernels
+  };
+
+  struct Blocks {
+    uint8 const* color;       // two uint16 endpoints
+    uint32 colorStride;
+    uint8 const* index;       // uint32 color indices
+    uint32 indexStride;
+    uint8 const* alpha;       // DXT3: uint64 alpha values, DXT5: two alpha endpoints
+    uint32 alphaStride;
+    uint8 const* alphaIndex;  // DXT5: 6 bytes of alpha indices
+    uint32 alphaIndexStride;
+  };
+
+  size_t size(Format format, uint32 width, uint32 height);
+  Blocks planar(Format format, uint8 const* data, uint32 width, uint32 height);
+  Blocks interleaved(Format format, uint8 const* data);
+
+  void decode(Format format, Blocks const& blocks, uint32 width, uint32 height,
+    uint32 left, uint32 top, uint32 right, uint32 bottom, Image::color_t* bits, uint32 stride);
+  inline void decode(Format format, Blocks const& blocks, uint32 width, uint32 height, Image::color_t* bits, uint32 stride) {
+    decode(format, blocks, width, height, 0, 0, width, height, bits, stride);
+  }
+  inline void decode(Format format, Blocks const& blocks, Image& image) {
+    decode(format, blocks, image.width(), image.height(), image.mutable_bits(), image.width());
+  }
+
+  bool supported(Kernel kernel);
+  Kernel kernel();
+  void setKernel(Kernel kernel);
+}
@@ -1,7 +1,15 @@
 #include "file.h"
-#include <windows.h>
+#include "path.h"
 #include <set>
 #include <algorithm>
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 class StdFileBuffer : public FileBuffer {
   FILE* file_;
@@ -42,10 +50,14 @@ File::File(char const* name, char const* mode)
   if (!file && (mode[0] == 'w' || mode[0] == 'a')) {
     std::string buf;
     for (int i = 0; name[i]; ++i) {
-      char chr = (name[i] == '/' ? '\\' : name[i]);
+      char chr = (name[i] == '\\' || name[i] == '/' ? path::sep : name[i]);
       buf += chr;
-      if (chr == '\\') {
+      if (chr == path::sep) {
+#ifdef _WIN32
         CreateDirectory(buf.c_str(), NULL);
+#else
+        ::mkdir(buf.c_str(), 0755);
+#endif
       }
     }
     file = fopen(name, mode);
@@ -56,7 +68,7 @@ File::File(char const* name, char const* mode)
 }
 
 void File::printf(char const* fmt, ...) {
-  static char buf[1024];
+  char buf[1024];
 
   va_list ap;
   va_start(ap, fmt);
@@ -213,12 +225,72 @@ public:
   size_t write(void const* ptr, size_t size) {
     return 0;
   }
+
+  uint8* buffer() {
+    return clone_;
+  }
 };
 
 File File::memfile(void const* ptr, size_t size, bool clone) {
   return File(new MemFileBuffer((uint8*)ptr, size, clone));
 }
 
+class MappedFileBuffer : public MemFileBuffer {
+  uint8* view_;
+public:
+  MappedFileBuffer(uint8* view, size_t size)
+    : MemFileBuffer(view, size, false)
+    , view_(view)
+  {}
+  ~MappedFileBuffer() {
+#ifdef _WIN32
+    UnmapViewOfFile(view_);
+#else
+    munmap(view_, size());
+#endif
+  }
+
+  uint8* buffer() {
+    return view_;
+  }
+};
+
+#ifdef _WIN32
+File File::mapfile(char const* name) {
+  HANDLE file = CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return File();
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+    // empty files cannot be mapped
+    CloseHandle(file);
+    return File(name, "rb");
+  }
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping) return File();
+  void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!view) return File();
+  return File(new MappedFileBuffer((uint8*) view, size.QuadPart));
+}
+#else
+File File::mapfile(char const* name) {
+  int file = open(name, O_RDONLY);
+  if (file < 0) return File();
+  struct stat info;
+  if (fstat(file, &info) || !info.st_size) {
+    // empty files cannot be mapped
+    close(file);
+    return File(name, "rb");
+  }
+  // MAP_PRIVATE gives the same copy-on-write view as FILE_MAP_COPY
+  void* view = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+  close(file);
+  if (view == MAP_FAILED) return File();
+  return File(new MappedFileBuffer((uint8*) view, info.st_size));
+}
+#endif
+
 class SubFileBuffer : public FileBuffer {
   File file_;
   uint64 start_;
@@ -278,6 +350,11 @@ public:
   size_t write(void const* ptr, size_t size) {
     return 0;
   }
+
+  uint8* buffer() {
+    uint8* base = file_.borrow();
+    return (base ? base + start_ : nullptr);
+  }
 };
 
 File File::subfile(uint64 offset, uint64 size) {
@@ -347,6 +424,9 @@ public:
   uint8 const* data() const {
     return data_;
   }
+  uint8* buffer() {
+    return data_;
+  }
   uint8* reserve(uint32 size) {
     if (pos_ + size > alloc_) {
       while (alloc_ < pos_ + size) {
@@ -518,6 +598,62 @@ void File::md5(void* digest) {
   }
 }
 
+#ifdef _WIN32
 bool File::exists(char const* path) {
   return GetFileAttributes(path) != INVALID_FILE_ATTRIBUTES;
 }
+bool File::remove(char const* path) {
+  return DeleteFile(path) != FALSE;
+}
+bool File::mkdir(std::string const& path) {
+  return CreateDirectory(path.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+bool File::rename(std::string const& from, std::string const& to) {
+  return MoveFileEx(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+}
+
+std::vector<std::string> File::listdir(std::string const& dir, char const* ext) {
+  std::vector<std::string> list;
+  WIN32_FIND_DATA data;
+  HANDLE hFind = FindFirstFile((dir / "*" + (ext ? ext : "")).c_str(), &data);
+  if (hFind == INVALID_HANDLE_VALUE) return list;
+  do {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+    list.push_back(data.cFileName);
+  } while (FindNextFile(hFind, &data));
+  FindClose(hFind);
+  return list;
+}
+#else
+bool File::exists(char const* path) {
+  return access(path, F_OK) == 0;
+}
+bool File::remove(char const* path) {
+  return unlink(path) == 0;
+}
+bool File::mkdir(std::string const& path) {
+  return ::mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+bool File::rename(std::string const& from, std::string const& to) {
+  return ::rename(from.c_str(), to.c_str()) == 0;
+}
+
+std::vector<std::string> File::listdir(std::string const& dir, char const* ext) {
+  std::vector<std::string> list;
+  DIR* handle = opendir(dir.c_str());
+  if (!handle) return list;
+  size_t extlen = (ext ? strlen(ext) : 0);
+  while (dirent* entry = readdir(handle)) {
+    size_t length = strlen(entry->d_name);
+    if (length < extlen || _stricmp(entry->d_name + length - extlen, ext ? ext : "")) continue;
+    if (entry->d_type == DT_DIR) continue;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat info;
+      if (stat((dir / entry->d_name).c_str(), &info) || S_ISDIR(info.st_mode)) continue;
+    }
+    list.push_back(entry->d_name);
+  }
+  closedir(handle);
+  return list;
+}
+#endif
@@ -3,7 +3,7 @@
 #include <stdio.h>
 #include "common.h"
 #include <string>
-#include <intrin.h>
+#include <vector>
 
 class FileBuffer : public RefCounted {
 public:
@@ -32,6 +32,11 @@ public:
 
   virtual size_t read(void* ptr, size_t size) = 0;
   virtual size_t write(void const* ptr, size_t size) = 0;
+
+  // contents of the whole file, if they are held in memory that the owner may modify
+  virtual uint8* buffer() {
+    return nullptr;
+  }
 };
 
 class File {
@@ -183,10 +188,31 @@ public:
   void copy(File& src, uint64 size = max_uint64);
   void md5(void* digest);
 
+  // pointer to the file contents if they can be used (and modified) in place without copying,
+  // i.e. the data is in private memory and no other File references the buffer
+  uint8* borrow() {
+    return (file_ && file_->unique() ? file_->buffer() : nullptr);
+  }
+  // read-only files are mapped copy-on-write, so borrow() works for them as well
+  static File mapfile(char const* name);
+  static File mapfile(std::string const& name) {
+    return mapfile(name.c_str());
+  }
+
   static bool exists(char const* path);
   static bool exists(std::string const& path) {
     return exists(path.c_str());
   }
+  static bool remove(char const* path);
+  static bool remove(std::string const& path) {
+    return remove(path.c_str());
+  }
+  // creates a single directory level; true if it exists afterwards
+  static bool mkdir(std::string const& path);
+  // moves a file, replacing the destination if it exists
+  static bool rename(std::string const& from, std::string const& to);
+  // names of the regular files in a directory, optionally only those ending with ext
+  static std::vector<std::string> listdir(std::string const& dir, char const* ext = nullptr);
 };
 
 class MemoryFile : public File {
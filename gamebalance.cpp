@@ -0,0 +1,173 @@
+#include "gamebalance.h"
+#include <algorithm>
+
+void BalanceIndex::build(std::vector<std::pair<uint32, uint32>>& pairs) {
+  pairs.erase(std::remove_if(pairs.begin(), pairs.end(), [](std::pair<uint32, uint32> const& p) {
+    return p.first == -1;
+  }), pairs.end());
+  std::stable_sort(pairs.begin(), pairs.end(), [](std::pair<uint32, uint32> const& lhs, std::pair<uint32, uint32> const& rhs) {
+    return lhs.first < rhs.first;
+  });
+  keys_.clear();
+  offsets_.clear();
+  values_.clear();
+  values_.reserve(pairs.size());
+  for (auto& p : pairs) {
+    if (keys_.empty() || keys_.back() != p.first) {
+      keys_.push_back(p.first);
+      offsets_.push_back(static_cast<uint32>(values_.size()));
+    }
+    values_.push_back(p.second);
+  }
+  offsets_.push_back(static_cast<uint32>(values_.size()));
+}
+
+BalanceIndex::Range BalanceIndex::operator[](uint32 key) const {
+  auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+  if (it == keys_.end() || *it != key) return Range();
+  size_t index = it - keys_.begin();
+  return Range(values_.data() + offsets_[index], values_.data() + offsets_[index + 1]);
+}
+
+uint32 BalanceTableBase::find(uint32 id) const {
+  if (buckets_.empty()) return -1;
+  uint32 mask = static_cast<uint32>(buckets_.size()) - 1;
+  for (uint32 pos = id & mask; buckets_[pos]; pos = (pos + 1) & mask) {
+    if (ids_[buckets_[pos] - 1] == id) return buckets_[pos] - 1;
+  }
+  return -1;
+}
+
+void BalanceTableBase::build() {
+  uint32 count = size();
+  uint32 hashSize = 16;
+  while (hashSize < count * 2) {
+    hashSize *= 2;
+  }
+  buckets_.assign(hashSize, 0);
+  uint32 mask = hashSize - 1;
+  for (uint32 row = 0; row < count; ++row) {
+    uint32 pos = ids_[row] & mask;
+    while (buckets_[pos] && ids_[buckets_[pos] - 1] != ids_[row]) {
+      pos = (pos + 1) & mask;
+    }
+    // later files override earlier ones
+    buckets_[pos] = row + 1;
+  }
+}
+
+GameBalanceTables::GameBalanceTables() {
+  for (auto& name : Logger::Loop(SnoLoader::List<GameBalance>(), "Loading game balance")) {
+    files_.emplace_back(name);
+    auto& file = files_.back();
+    if (!file || (!file->x018_ItemTypes.size() && !file->x028_Items.size() &&
+        !file->x078_AffixTable.size() && !file->x168_SetItemBonusTable.size())) {
+      files_.pop_back();
+      continue;
+    }
+    uint32 index = static_cast<uint32>(names_.size());
+    names_.push_back(name);
+    itemTypes_.add(file->x018_ItemTypes, index);
+    items_.add(file->x028_Items, index);
+    affixes_.add(file->x078_AffixTable, index);
+    setBonuses_.add(file->x168_SetItemBonusTable, index);
+  }
+  itemTypes_.build();
+  items_.build();
+  affixes_.build();
+  setBonuses_.build();
+
+  std::vector<std::pair<uint32, uint32>> pairs;
+
+  // parent closure, nearest first; the walk is bounded in case the data has a cycle
+  for (uint32 row = 0; row < itemTypes_.size(); ++row) {
+    uint32 id = itemTypes_.id(row);
+    if (itemTypes_.find(id) != row) continue;
+    pairs.emplace_back(id, id);
+    uint32 parent = itemTypes_[row].x108_ItemTypesGameBalanceId;
+    for (uint32 depth = 0; parent != -1 && parent != id && depth < itemTypes_.size(); ++depth) {
+      pairs.emplace_back(id, parent);
+      uint32 next = itemTypes_.find(parent);
+      if (next == -1) break;
+      parent = itemTypes_[next].x108_ItemTypesGameBalanceId;
+    }
+  }
+  typeAncestors_.build(pairs);
+
+  pairs.clear();
+  for (uint32 row = 0; row < items_.size(); ++row) {
+    pairs.emplace_back(items_[row].x10C_ItemTypesGameBalanceId, row);
+  }
+  itemsByType_.build(pairs);
+
+  pairs.clear();
+  for (uint32 row = 0; row < items_.size(); ++row) {
+    uint32 type = items_[row].x10C_ItemTypesGameBalanceId;
+    Range ancestors = typeAncestors_[type];
+    if (ancestors.empty()) {
+      pairs.emplace_back(type, row);
+    }
+    for (uint32 base : ancestors) {
+      pairs.emplace_back(base, row);
+    }
+  }
+  itemsByBase_.build(pairs);
+
+  pairs.clear();
+  for (uint32 row = 0; row < items_.size(); ++row) {
+    pairs.emplace_back(items_[row].x170_SetItemBonusesGameBalanceId, row);
+  }
+  itemsBySet_.build(pairs);
+
+  pairs.clear();
+  for (uint32 row = 0; row < affixes_.size(); ++row) {
+    auto& affix = affixes_[row];
+    pairs.emplace_back(affix.x168_AffixGroupGameBalanceId, row);
+    if (affix.x16C_AffixGroupGameBalanceId != affix.x168_AffixGroupGameBalanceId) {
+      pairs.emplace_back(affix.x16C_AffixGroupGameBalanceId, row);
+    }
+  }
+  affixesByGroup_.build(pairs);
+
+  pairs.clear();
+  for (uint32 row = 0; row < affixes_.size(); ++row) {
+    auto& affix = affixes_[row];
+    for (auto id : affix.x178_GameBalanceIds) {
+      if (id != -1) pairs.emplace_back(row, id);
+    }
+    for (auto id : affix.x190_GameBalanceIds) {
+      if (id != -1) pairs.emplace_back(row, id);
+    }
+    for (auto id : affix.x1F0_GameBalanceIds) {
+      if (id != -1) pairs.emplace_back(row, id);
+    }
+  }
+  affixTypes_.build(pairs);
+
+  pairs.clear();
+  for (uint32 row = 0; row < setBonuses_.size(); ++row) {
+    pairs.emplace_back(setBonuses_[row].x108_SetItemBonusesGameBalanceId, row);
+  }
+  setBonusesBySet_.build(pairs);
+}
+
+uint32 GameBalanceTables::file(char const* name) {
+  auto& names = instance().names_;
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (istring(names[i]) == name) return static_cast<uint32>(i);
+  }
+  return -1;
+}
+
+bool GameBalanceTables::isType(uint32 type, uint32 base) {
+  if (type == base) return true;
+  for (uint32 id : typeAncestors(type)) {
+    if (id == base) return true;
+  }
+  return false;
+}
+
+GameBalanceTables& GameBalanceTables::instance() {
+  static GameBalanceTables inst;
+  return inst;
+}
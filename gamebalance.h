@@ -0,0 +1,202 @@
+// gamebalance.h
+//
+// columnar GameBalance tables (singleton, all methods are static)
+//
+// The main tables of every GameBalance file are collected once, in file order. A table keeps its
+// rows as parallel arrays (row pointer, GameBalanceId, source file) with an open-addressing hash
+// on the id, which is the hash of the lowercase name, so lookups by id or name take one probe
+// sequence. Foreign keys are indexed as a sorted key array with offsets into a value list, and
+// "all rows with key K" is a binary search followed by a contiguous range. When an id appears in
+// more than one file, the row from the last file is the one found by id.
+//
+// BalanceTable<T>
+//   uint32 size(), T& operator[](uint32 row), uint32 id(row), uint32 file(row)
+//   uint32 find(uint32 id), uint32 find(char const* name) - row index or -1
+//   T* get(uint32 id), T* get(char const* name) - row or nullptr
+//
+// GameBalanceTables::itemTypes(), items(), affixes(), setBonuses()
+//   the tables
+// uint32 file(char const* name)
+//   index of a GameBalance file (for BalanceTable::file), or -1
+// Range itemsOfType(uint32 type, bool subtypes = true)
+//   rows in items() with the given item type, or with any type derived from it
+// Range itemsInSet(uint32 set)
+//   rows in items() that belong to the set (Item::x170_SetItemBonusesGameBalanceId)
+// Range affixGroup(uint32 group)
+//   rows in affixes() that are in the affix group (either of the two group columns)
+// Range affixItemTypes(uint32 row)
+//   item types an affix row can roll on (the three GameBalanceIds lists)
+// Range setBonuses(uint32 set)
+//   rows in setBonuses() that belong to the set (x108_SetItemBonusesGameBalanceId)
+// Range typeAncestors(uint32 type)
+//   the item type followed by all its parents up to the root; empty for unknown types
+// uint32 typeParent(uint32 type), uint32 typeRoot(uint32 type)
+//   direct parent (-1 if none), topmost parent (the type itself if it has none)
+// bool isType(uint32 type, uint32 base)
+//   checks if base is type or one of its parents
+
+#pragma once
+#include "types/GameBalance.h"
+#include <list>
+
+class BalanceIndex {
+public:
+  class Range {
+  public:
+    Range(uint32 const* begin = nullptr, uint32 const* end = nullptr)
+      : begin_(begin)
+      , end_(end)
+    {}
+    uint32 const* begin() const {
+      return begin_;
+    }
+    uint32 const* end() const {
+      return end_;
+    }
+    size_t size() const {
+      return end_ - begin_;
+    }
+    bool empty() const {
+      return begin_ == end_;
+    }
+    uint32 operator[](size_t i) const {
+      return begin_[i];
+    }
+  private:
+    uint32 const* begin_;
+    uint32 const* end_;
+  };
+
+  // (key, value) pairs; values with the same key keep their order, pairs with key -1 are skipped
+  void build(std::vector<std::pair<uint32, uint32>>& pairs);
+  Range operator[](uint32 key) const;
+
+private:
+  std::vector<uint32> keys_;
+  std::vector<uint32> offsets_;
+  std::vector<uint32> values_;
+};
+
+class BalanceTableBase {
+public:
+  uint32 size() const {
+    return static_cast<uint32>(ids_.size());
+  }
+  uint32 id(uint32 row) const {
+    return ids_[row];
+  }
+  uint32 file(uint32 row) const {
+    return files_[row];
+  }
+  uint32 find(uint32 id) const;
+
+protected:
+  std::vector<uint32> ids_;
+  std::vector<uint32> files_;
+  std::vector<uint32> buckets_; // row + 1, or 0 for empty slots
+
+  void build();
+};
+
+template<class T>
+class BalanceTable : public BalanceTableBase {
+public:
+  T& operator[](uint32 row) const {
+    return *rows_[row];
+  }
+  using BalanceTableBase::find;
+  uint32 find(char const* name) const {
+    uint32 row = find(HashNameLower(name));
+    return (row != -1 && istring(rows_[row]->x000_Text) == name ? row : -1);
+  }
+  T* get(uint32 id) const {
+    uint32 row = find(id);
+    return (row == -1 ? nullptr : rows_[row]);
+  }
+  T* get(char const* name) const {
+    uint32 row = find(name);
+    return (row == -1 ? nullptr : rows_[row]);
+  }
+
+private:
+  friend class GameBalanceTables;
+  std::vector<T*> rows_;
+
+  template<class Table>
+  void add(Table& table, uint32 file) {
+    for (auto& row : table) {
+      rows_.push_back(&row);
+      ids_.push_back(HashNameLower(row.x000_Text));
+      files_.push_back(file);
+    }
+  }
+};
+
+class GameBalanceTables {
+public:
+  typedef BalanceIndex::Range Range;
+  typedef GameBalance::Type Type;
+
+  static BalanceTable<Type::ItemType> const& itemTypes() {
+    return instance().itemTypes_;
+  }
+  static BalanceTable<Type::Item> const& items() {
+    return instance().items_;
+  }
+  static BalanceTable<Type::AffixTableEntry> const& affixes() {
+    return instance().affixes_;
+  }
+  static BalanceTable<Type::SetItemBonusTableEntry> const& setBonuses() {
+    return instance().setBonuses_;
+  }
+  static uint32 file(char const* name);
+
+  static Range itemsOfType(uint32 type, bool subtypes = true) {
+    return (subtypes ? instance().itemsByBase_ : instance().itemsByType_)[type];
+  }
+  static Range itemsInSet(uint32 set) {
+    return instance().itemsBySet_[set];
+  }
+  static Range affixGroup(uint32 group) {
+    return instance().affixesByGroup_[group];
+  }
+  static Range affixItemTypes(uint32 row) {
+    return instance().affixTypes_[row];
+  }
+  static Range setBonuses(uint32 set) {
+    return instance().setBonusesBySet_[set];
+  }
+
+  static Range typeAncestors(uint32 type) {
+    return instance().typeAncestors_[type];
+  }
+  static uint32 typeParent(uint32 type) {
+    Range range = typeAncestors(type);
+    return (range.size() > 1 ? range[1] : -1);
+  }
+  static uint32 typeRoot(uint32 type) {
+    Range range = typeAncestors(type);
+    return (range.empty() ? type : range[range.size() - 1]);
+  }
+  static bool isType(uint32 type, uint32 base);
+
+private:
+  std::list<SnoFile<GameBalance>> files_;
+  std::vector<std::string> names_;
+
+  BalanceTable<Type::ItemType> itemTypes_;
+  BalanceTable<Type::Item> items_;
+  BalanceTable<Type::AffixTableEntry> affixes_;
+  BalanceTable<Type::SetItemBonusTableEntry> setBonuses_;
+
+  BalanceIndex typeAncestors_;
+  BalanceIndex itemsByType_;
+  BalanceIndex itemsByBase_;
+  BalanceIndex itemsBySet_;
+  BalanceIndex affixesByGroup_;
+  BalanceIndex affixTypes_;
+  BalanceIndex setBonusesBySet_;
+
+  GameBalanceTables();
+  static GameBalanceTables& instance();
+};
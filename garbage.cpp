@@ -965,7 +965,7 @@ void make_menu() {
 }
 
 std::string get_version() {
-  if (SnoCdnLoader* cdn = dynamic_cast<SnoCdnLoader*>(SnoLoader::default)) {
+  if (SnoCdnLoader* cdn = dynamic_cast<SnoCdnLoader*>(SnoLoader::primary)) {
     auto config = cdn->buildinfo();
     std::vector<std::string> version;
     std::string build_id;
@@ -1133,7 +1133,7 @@ struct IconItemType {
     return result.resize(final_size, final_size * icons.size());
   }
 };
-void item_flavor(SnoLoader* loader = SnoLoader::default) {
+void item_flavor(SnoLoader* loader = SnoLoader::primary) {
   json::Value src, dst, iconsrc, icondst, extra, dyes;
   json::parse(File("itemtypes.js"), src, json::mJS);
   json::parse(File("webgl_items.js"), extra, json::mJS);
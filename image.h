@@ -3,6 +3,7 @@
 #include "common.h"
 #include "file.h"
 #include <algorithm>
+#include <cmath>
 
 template<
   typename p_type,
@@ -113,6 +114,11 @@ namespace ImageFormat {
 
     NumFormats
   };
+
+  // PNG writer level, the zlib level (0-9, 6 by default); 0 stores unfiltered rows, otherwise
+  // rows are either left unfiltered or filtered per row, whichever compresses a sample better
+  void setPNGLevel(int level);
+  int pngLevel();
 }
 
 struct ImageFilter {
@@ -252,9 +258,9 @@ public:
   ImageBase(ImageBase<PF> const& image)
     : data_(create(image.width(), image.height()))
   {
-    ImageBase<PF>::color_t const* src = image.bits();
+    typename ImageBase<PF>::color_t const* src = image.bits();
     for (uint32 i = 0; i < data_->width_ * data_->height_; ++i) {
-      data_->bits_[i] = Format::from<PF>(src[i]);
+      data_->bits_[i] = Format::template from<PF>(src[i]);
     }
   }
   ImageBase(ImageBase<Format> const& image)
@@ -300,9 +306,9 @@ public:
     }
     data_->width_ = image.width();
     data_->height_ = image.height();
-    ImageBase<PF>::color_t const* src = image.bits();
+    typename ImageBase<PF>::color_t const* src = image.bits();
     for (uint32 i = 0; i < data_->width_ * data_->height_; ++i) {
-      data_->bits_[i] = Format::from<PF>(src[i]);
+      data_->bits_[i] = Format::template from<PF>(src[i]);
     }
     return *this;
   }
@@ -460,80 +466,15 @@ namespace ImagePrivate {
   ImageFormat::Type getFormat(std::string const& name);
   bool imWrite(Image const& image, File& file, ImageFormat::Type format);
   Image imRead(File& file, ImageFormat::Type format);
+  inline bool imWrite(Image const& image, File&& file, ImageFormat::Type format) {
+    return imWrite(image, file, format);
+  }
+  inline Image imRead(File&& file, ImageFormat::Type format) {
+    return imRead(file, format);
+  }
+  // defined in resample.cpp
   Image imResize(Image const& image, uint32 width, uint32 height, double radius, ImageFilter::Function filter);
   void imBlit(Image& dst, Image const& src, int x, int y, int sx, int sy, uint32 sw, uint32 sh);
-
-  template<typename PF>
-  class Accum {
-  public:
-    void add(typename PF::color_t value, double weight) {
-      r += weight * PF::red::from(value);
-      g += weight * PF::green::from(value);
-      b += weight * PF::blue::from(value);
-      a += weight * PF::alpha::from(value);
-      w += weight;
-    }
-    typename PF::color_t get() const {
-      if (w == 0) return 0;
-      return PF::color_clamp(
-        static_cast<int>(r / w + 0.5),
-        static_cast<int>(g / w + 0.5),
-        static_cast<int>(b / w + 0.5),
-        static_cast<int>(a / w + 0.5)
-        );
-    }
-  private:
-    double r = 0, g = 0, b = 0, a = 0, w = 0;
-  };
-
-  template<class PF, class Filter>
-  class LinScaler {
-  public:
-    LinScaler(uint32 from, uint32 to) {
-      double scale = static_cast<double>(to) / from;
-      if (scale < 1) {
-        double radius = Filter::radius() / scale;
-        for (uint32 i = 0; i < to; ++i) {
-          double center = (i + 0.5) / scale;
-          int left = std::max(0, static_cast<int>(floor(center - radius)));
-          int right = std::min<int>(from, static_cast<int>(ceil(center + radius)) + 1);
-          pixels.emplace_back(left, right - left);
-          for (int j = left; j < right; ++j) {
-            factors.push_back(Filter::value(std::abs((center - j - 0.5) * scale)));
-          }
-        }
-      } else {
-        double radius = Filter::radius();
-        for (uint32 i = 0; i < to; ++i) {
-          double center = (i + 0.5) / scale;
-          int left = std::max(0, static_cast<int>(floor(center - radius)));
-          int right = std::min<int>(from, static_cast<int>(ceil(center + radius)) + 1);
-          pixels.emplace_back(left, right - left);
-          for (int j = left; j < right; ++j) {
-            factors.push_back(Filter::value(std::abs(center - j - 0.5)));
-          }
-        }
-      }
-    }
-    void scale(typename PF::color_t const* src, uint32 src_pitch,
-      typename PF::color_t* dst, uint32 dst_pitch)
-    {
-      double const* factor = &factors[0];
-      for (auto& p : pixels) {
-        typename PF::color_t const* from = src + p.first * src_pitch;
-        Accum<PF> accum;
-        for (uint32 i = p.second; i--;) {
-          accum.add(*from, *factor++);
-          from += src_pitch;
-        }
-        *dst = accum.get();
-        dst += dst_pitch;
-      }
-    }
-  private:
-    std::vector<double> factors;
-    std::vector<std::pair<uint32, uint32>> pixels;
-  };
 }
 
 template<class PF>
@@ -568,22 +509,5 @@ bool ImageBase<PF>::read(std::string const& path, ImageFormat::Type format) {
 template<class PF>
 template<typename Filter>
 ImageBase<PF> ImageBase<PF>::resize(uint32 width, uint32 height, Filter filter) const {
-  ImageBase<PF> cur(*this);
-  if (cur.width() != width) {
-    ImagePrivate::LinScaler<Format, Filter> scaler(cur.width(), width);
-    ImageBase<PF> next(width, cur.height());
-    for (uint32 y = 0; y < cur.height(); ++y) {
-      scaler.scale(cur.bits() + y * cur.width(), 1, next.mutable_bits() + y * next.width(), 1);
-    }
-    cur = next;
-  }
-  if (cur.height() != height) {
-    ImagePrivate::LinScaler<Format, Filter> scaler(cur.height(), height);
-    ImageBase<PF> next(cur.width(), height);
-    for (uint32 x = 0; x < cur.width(); ++x) {
-      scaler.scale(cur.bits() + x, cur.width(), next.mutable_bits() + x, next.width());
-    }
-    cur = next;
-  }
-  return cur;
+  return ImagePrivate::imResize(*this, width, height, Filter::radius(), Filter::value);
 }
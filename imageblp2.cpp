@@ -1,7 +1,6 @@
 #include <stdlib.h>
 #include "image.h"
-#include <windows.h>
-#include <intrin.h>
+#include "dxt.h"
 #include <vector>
 
 namespace _blp2 {
@@ -59,110 +58,12 @@ namespace _blp2 {
     return true;
   }
 
-  typedef FormatXRGB<0, 5, 6, 5> FormatDXT;
-
-  bool load_dxt1(uint8* src, uint32 length, Image::color_t* bits, BLP2Header const& hdr) {
-    if (hdr.width < 4 || hdr.height < 4) return false;
-    if (length != hdr.width * hdr.height / 2) return false;
-    for (uint32 y = 0; y < hdr.height; y += 4) {
-      for (uint32 x = 0; x < hdr.width; x += 4) {
-        uint16 p = *(uint16*)src;
-        uint16 q = *(uint16*)(src + 2);
-        uint32 lookup = *(uint32*)(src + 4);
-        src += 8;
-        Image::color_t c[4] = { Image::Format::from<FormatDXT>(p),
-          Image::Format::from<FormatDXT>(q) };
-        if (p > q) {
-          c[2] = Image::Format::mix(c[0], 2, c[1], 1);
-          c[3] = Image::Format::mix(c[0], 1, c[1], 2);
-        } else {
-          c[2] = Image::Format::mix(c[0], 1, c[1], 1);
-          c[3] = 0;
-        }
-        for (uint32 cy = y; cy < y + 4; ++cy) {
-          Image::color_t* dst = bits + cy * hdr.width + x;
-          for (uint32 cx = x; cx < x + 4; ++cx) {
-            *dst++ = c[lookup & 3];
-            lookup >>= 2;
-          }
-        }
-      }
-    }
-    return true;
-  }
-
-  bool load_dxt3(uint8* src, uint32 length, Image::color_t* bits, BLP2Header const& hdr) {
-    if (hdr.width < 4 || hdr.height < 4) return false;
-    if (length != hdr.width * hdr.height) return false;
-    for (uint32 y = 0; y < hdr.height; y += 4) {
-      for (uint32 x = 0; x < hdr.width; x += 4) {
-        uint64 alpha = *(uint64*)src;
-        uint16 p = *(uint16*)(src + 8);
-        uint16 q = *(uint16*)(src + 10);
-        uint32 lookup = *(uint32*)(src + 12);
-        Image::color_t c[4] = { Image::Format::from<FormatDXT>(p),
-          Image::Format::from<FormatDXT>(q) };
-        c[2] = Image::Format::mix(c[0], 2, c[1], 1);
-        c[3] = Image::Format::mix(c[0], 1, c[1], 2);
-        for (uint32 cy = y; cy < y + 4; ++cy) {
-          Image::color_t* dst = bits + cy * hdr.width + x;
-          for (uint32 cx = x; cx < x + 4; ++cx) {
-            int a = (alpha & 15) * 255 / 15;
-            *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a);
-            lookup >>= 2;
-            alpha >>= 4;
-          }
-        }
-      }
-    }
-    return true;
-  }
-
-  bool load_dxt5(uint8* src, uint32 length, Image::color_t* bits, BLP2Header const& hdr) {
+  bool load_dxt(DXT::Format format, uint8* src, uint32 length, Image::color_t* bits, BLP2Header const& hdr) {
     if (hdr.width < 4 || hdr.height < 4) return false;
-    if (length != hdr.width * hdr.height) return false;
-    for (uint32 y = 0; y < hdr.height; y += 4) {
-      for (uint32 x = 0; x < hdr.width; x += 4) {
-        uint32 a0 = *src++;
-        uint32 a1 = *src++;
-        uint64 amap = 0;
-        for (int i = 0; i < 48; i += 8) {
-          amap |= (static_cast<uint64>(*src++) << i);
-        }
-        uint16 p = *(uint16*)src;
-        uint16 q = *(uint16*)(src + 2);
-        uint32 lookup = *(uint32*)(src + 4);
-        src += 8;
-        Image::color_t c[4] = { Image::Format::from<FormatDXT>(p),
-          Image::Format::from<FormatDXT>(q) };
-        c[2] = Image::Format::mix(c[0], 2, c[1], 1);
-        c[3] = Image::Format::mix(c[0], 1, c[1], 2);
-        uint32 a[8] = { a0, a1 };
-        if (a0 > a1) {
-          a[2] = (a0 * 6 + a1 * 1) / 7;
-          a[3] = (a0 * 5 + a1 * 2) / 7;
-          a[4] = (a0 * 4 + a1 * 3) / 7;
-          a[5] = (a0 * 3 + a1 * 4) / 7;
-          a[6] = (a0 * 2 + a1 * 5) / 7;
-          a[7] = (a0 * 1 + a1 * 6) / 7;
-        } else {
-          a[2] = (a0 * 4 + a1 * 1) / 5;
-          a[3] = (a0 * 3 + a1 * 2) / 5;
-          a[4] = (a0 * 2 + a1 * 3) / 5;
-          a[5] = (a0 * 1 + a1 * 4) / 5;
-          a[6] = 0;
-          a[7] = 255;
-        }
-        for (uint32 cy = y; cy < y + 4; ++cy) {
-          Image::color_t* dst = bits + cy * hdr.width + x;
-          for (uint32 cx = x; cx < x + 4; ++cx) {
-            *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a[amap & 7]);
-            lookup >>= 2;
-            amap >>= 3;
-          }
-        }
-      }
-    }
+    // DXT::size counts partial blocks at the edges, so sides that are not a multiple of 4 load;
+    // the old per-format loaders expected exactly width * height / 2 (or width * height) bytes
+    if (length != DXT::size(format, hdr.width, hdr.height)) return false;
+    DXT::decode(format, DXT::interleaved(format, src), hdr.width, hdr.height, bits, hdr.width);
     return true;
   }
 
@@ -202,11 +103,11 @@ namespace ImagePrivate {
     if (hdr.encoding == 1) {
       result = load_raw(&src[0], hdr.lengths[0], bits, hdr);
     } else if (hdr.alphaDepth <= 1) {
-      result = load_dxt1(&src[0], hdr.lengths[0], bits, hdr);
+      result = load_dxt(DXT::DXT1, &src[0], hdr.lengths[0], bits, hdr);
     } else if (hdr.alphaEncoding != 7) {
-      result = load_dxt3(&src[0], hdr.lengths[0], bits, hdr);
+      result = load_dxt(DXT::DXT3, &src[0], hdr.lengths[0], bits, hdr);
     } else {
-      result = load_dxt5(&src[0], hdr.lengths[0], bits, hdr);
+      result = load_dxt(DXT::DXT5, &src[0], hdr.lengths[0], bits, hdr);
     }
 
     return result;
@@ -1,7 +1,13 @@
 #include "image.h"
-#include <windows.h>
-#include <intrin.h>
+#include "checksum.h"
+#include "threadpool.h"
 #include <vector>
+#include <atomic>
+#ifndef _WIN32
+#include <zlib.h>
+#else
+#include "zlib/zlib.h"
+#endif
 
 namespace ImagePrivate {
 
@@ -31,26 +37,6 @@ namespace ImagePrivate {
     };
 #pragma	pack(pop)
 
-    uint32 update_crc(uint32 crc, void const* vbuf, uint32 length) {
-      static uint32 crc_table[256];
-      static bool table_computed = false;
-      uint8 const* buf = (uint8*)vbuf;
-      if (!table_computed) {
-        for (uint32 i = 0; i < 256; i++) {
-          uint32 c = i;
-          for (int k = 0; k < 8; k++) {
-            if (c & 1) c = 0xEDB88320L ^ (c >> 1);
-            else c = c >> 1;
-          }
-          crc_table[i] = c;
-        }
-        table_computed = true;
-      }
-      for (uint32 i = 0; i < length; i++) {
-        crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
-      }
-      return crc;
-    }
     bool read_chunk(PNGChunk& ch, File& f) {
       delete[] ch.data;
       ch.data = NULL;
@@ -272,16 +258,132 @@ namespace ImagePrivate {
       }
     }
 
+    // image rows converted to PNG samples (RGBA or gray), one row at a time
+    void get_row(Image::color_t const* bits, uint32 width, bool gray, uint8* dst) {
+      if (gray) {
+        for (uint32 x = 0; x < width; x++) {
+          Image::Format::color_t color = bits[x];
+          int sum = Image::Format::red::from(color) +
+                    Image::Format::green::from(color) +
+                    Image::Format::blue::from(color);
+          dst[x] = sum / 3;
+        }
+      } else {
+        for (uint32 x = 0; x < width; x++) {
+          Image::Format::color_t color = bits[x];
+          dst[x * 4 + 0] = Image::Format::red::from(color);
+          dst[x * 4 + 1] = Image::Format::green::from(color);
+          dst[x * 4 + 2] = Image::Format::blue::from(color);
+          dst[x * 4 + 3] = Image::Format::alpha::from(color);
+        }
+      }
+    }
+
+    // filtered row into dst (without the filter byte); returns the sum of the filtered bytes as
+    // signed values, the usual estimate of how well a row compresses
+    uint32 filter_row(uint8 filter, uint8 const* cur, uint8 const* prev, uint32 bpl, uint32 bpp, uint8* dst) {
+      uint32 i;
+      switch (filter) {
+      case 1:
+        for (i = 0; i < bpp; i++) dst[i] = cur[i];
+        for (; i < bpl; i++) dst[i] = cur[i] - cur[i - bpp];
+        break;
+      case 2:
+        for (i = 0; i < bpl; i++) dst[i] = cur[i] - prev[i];
+        break;
+      case 3:
+        for (i = 0; i < bpp; i++) dst[i] = cur[i] - prev[i] / 2;
+        for (; i < bpl; i++) dst[i] = cur[i] - (cur[i - bpp] + prev[i]) / 2;
+        break;
+      case 4:
+        for (i = 0; i < bpp; i++) dst[i] = cur[i] - prev[i];
+        for (; i < bpl; i++) dst[i] = cur[i] - paethPredictor(cur[i - bpp], prev[i], prev[i - bpp]);
+        break;
+      default:
+        memcpy(dst, cur, bpl);
+        break;
+      }
+      uint32 sum = 0;
+      for (i = 0; i < bpl; i++) {
+        sum += (dst[i] < 128 ? dst[i] : 256 - dst[i]);
+      }
+      return sum;
+    }
+
+    // filter rows [first, last) of the image into dst, each row prefixed with its filter type;
+    // either all rows are left unfiltered, or each row gets the filter with the smallest sum
+    void filter_rows(Image const& image, bool gray, bool adaptive, uint32 first, uint32 last, uint8* dst) {
+      uint32 width = image.width();
+      uint32 bpp = (gray ? 1 : 4);
+      uint32 bpl = width * bpp;
+      // the row above the first one is all zeros
+      std::vector<uint8> rows(bpl * 4);
+      uint8* prev = rows.data();
+      uint8* cur = prev + bpl;
+      uint8* best = cur + bpl;
+      uint8* trial = best + bpl;
+      if (first) get_row(image.bits() + (first - 1) * width, width, gray, prev);
+      for (uint32 y = first; y < last; y++) {
+        get_row(image.bits() + y * width, width, gray, cur);
+        if (!adaptive) {
+          *dst++ = 0;
+          memcpy(dst, cur, bpl);
+        } else {
+          uint8 bestFilter = 0;
+          uint32 bestSum = filter_row(0, cur, prev, bpl, bpp, best);
+          for (uint8 filter = 1; filter <= 4; filter++) {
+            uint32 sum = filter_row(filter, cur, prev, bpl, bpp, trial);
+            if (sum < bestSum) {
+              bestSum = sum;
+              bestFilter = filter;
+              std::swap(best, trial);
+            }
+          }
+          *dst++ = bestFilter;
+          memcpy(dst, best, bpl);
+        }
+        dst += bpl;
+        std::swap(prev, cur);
+      }
+    }
+
+    // compressed size of a buffer with the fastest zlib level
+    uLong test_size(uint8 const* data, uint32 size) {
+      uLongf csize = compressBound(size);
+      std::vector<uint8> cdata(csize);
+      if (compress2(&cdata[0], &csize, data, size, 1) != Z_OK) return size;
+      return csize;
+    }
+
+    // the minimum sum heuristic helps with photographic images but not with flat artwork, where
+    // unfiltered rows repeat exactly and compress better; about 16K of rows from the middle of
+    // the image are compressed both ways to decide (bpl includes the filter byte)
+    bool use_filters(Image const& image, bool gray, uint32 bpl) {
+      uint32 height = image.height();
+      uint32 rows = std::min(height, std::max<uint32>(1, (16 * 1024) / bpl));
+      uint32 first = (height - rows) / 2;
+      std::vector<uint8> plain(size_t(rows) * bpl), filtered(size_t(rows) * bpl);
+      filter_rows(image, gray, false, first, first + rows, plain.data());
+      filter_rows(image, gray, true, first, first + rows, filtered.data());
+      return test_size(filtered.data(), filtered.size()) < test_size(plain.data(), plain.size());
+    }
+
   }
 
   using namespace _png;
 
+  // rows are filtered and compressed in ranges of about this many bytes on the thread pool; every
+  // range after the first starts with the last 32K of the one before as its dictionary, and all
+  // but the last end with a sync flush, so together they form one zlib stream
+  enum { ChunkSize = 256 * 1024, WindowSize = 32 * 1024 };
+  static std::atomic<int> writeLevel(6);
+
   bool imWritePNG(Image const& image, File& file, bool gray) {
     file.write(pngSignature, 8);
 
     uint32 width = image.width();
     uint32 height = image.height();
-    Image::Format::color_t const* bits = image.bits();
+    int level = writeLevel;
 
     PNGHeader hdr;
     hdr.width = _byteswap_ulong(width);
@@ -293,33 +395,69 @@ namespace ImagePrivate {
     hdr.interlaceMethod = 0;
     write_chunk('IHDR', sizeof hdr, &hdr, file);
 
-    uint32 usize = (width * (gray ? 1 : 4) + 1) * height;
-    std::vector<uint8> udata(usize);
-    uint8* dst = &udata[0];
-    for (int y = 0; y < height; y++) {
-      *dst++ = 0;
-      for (int x = 0; x < width; x++) {
-        Image::Format::color_t color = *bits++;
-        if (gray) {
-          int sum = Image::Format::red::from(color) +
-                    Image::Format::green::from(color) +
-                    Image::Format::blue::from(color);
-          *dst++ = sum / 3;
-        } else {
-          *dst++ = Image::Format::red::from(color);
-          *dst++ = Image::Format::green::from(color);
-          *dst++ = Image::Format::blue::from(color);
-          *dst++ = Image::Format::alpha::from(color);
-        }
+    uint32 bpl = width * (gray ? 1 : 4) + 1;
+    std::vector<uint8> udata(size_t(bpl) * height);
+    uint32 rows = std::max<uint32>(1, ChunkSize / bpl);
+    uint32 count = std::max<uint32>(1, (height + rows - 1) / rows);
+    // filters are not tried on empty images, the filter prologues assume at least one pixel
+    bool adaptive = (level && width && height && use_filters(image, gray, bpl));
+    std::vector<std::vector<uint8>> cdata(count);
+    std::vector<uLong> adler(count);
+    std::vector<uint8> failed(count, 0);
+
+    ThreadPool::instance().parallel_for(count, [&](size_t i) {
+      uint32 first = i * rows, last = std::min(height, first + rows);
+      filter_rows(image, gray, adaptive, first, last, udata.data() + size_t(first) * bpl);
+    });
+    ThreadPool::instance().parallel_for(count, [&](size_t i) {
+      uint32 first = i * rows, last = std::min(height, first + rows);
+      uint8* src = udata.data() + size_t(first) * bpl;
+      uint32 size = (last - first) * bpl;
+      adler[i] = adler32(adler32(0, nullptr, 0), src, size);
+
+      z_stream z;
+      memset(&z, 0, sizeof z);
+      if (deflateInit2(&z, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        failed[i] = 1;
+        return;
       }
+      if (first) {
+        uint32 window = std::min<uint32>(WindowSize, first * bpl);
+        deflateSetDictionary(&z, src - window, window);
+      }
+      std::vector<uint8>& dst = cdata[i];
+      dst.resize(deflateBound(&z, size) + 16);
+      z.next_in = src;
+      z.avail_in = size;
+      z.next_out = &dst[0];
+      z.avail_out = dst.size();
+      bool last_chunk = (i + 1 == count);
+      int result = deflate(&z, last_chunk ? Z_FINISH : Z_SYNC_FLUSH);
+      if (result != (last_chunk ? Z_STREAM_END : Z_OK) || z.avail_in) {
+        failed[i] = 1;
+      }
+      dst.resize(z.total_out);
+      deflateEnd(&z);
+    });
+
+    // zlib header with the level hint, then the deflate data and the adler32 of everything
+    std::vector<uint8> idat;
+    uint8 flevel = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3);
+    uint8 flg = flevel << 6;
+    flg += (31 - (0x7800 + flg) % 31) % 31;
+    idat.push_back(0x78);
+    idat.push_back(flg);
+    uLong checksum = adler32(0, nullptr, 0);
+    for (uint32 i = 0; i < count; i++) {
+      if (failed[i]) return false;
+      uint32 first = i * rows, last = std::min(height, first + rows);
+      checksum = adler32_combine(checksum, adler[i], (last - first) * bpl);
+      idat.insert(idat.end(), cdata[i].begin(), cdata[i].end());
     }
-    uint32 csize = (usize * 11) / 10 + 32;
-    std::vector<uint8> cdata(csize);
-    if (gzdeflate(&udata[0], usize, &cdata[0], &csize)) {
-      return false;
-    }
+    uint32 trailer = _byteswap_ulong(static_cast<uint32>(checksum));
+    idat.insert(idat.end(), reinterpret_cast<uint8*>(&trailer), reinterpret_cast<uint8*>(&trailer) + 4);
 
-    write_chunk('IDAT', csize, &cdata[0], file);
+    write_chunk('IDAT', idat.size(), &idat[0], file);
     write_chunk('IEND', 0, NULL, file);
 
     return true;
@@ -502,3 +640,12 @@ namespace ImagePrivate {
   }
 
 }
+
+namespace ImageFormat {
+  void setPNGLevel(int level) {
+    ImagePrivate::writeLevel = std::max(0, std::min(level, 9));
+  }
+  int pngLevel() {
+    return ImagePrivate::writeLevel;
+  }
+}
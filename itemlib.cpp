@@ -5,15 +5,8 @@ ItemLibrary& ItemLibrary::instance() {
   return inst;
 }
 ItemLibrary::ItemLibrary() {
-  for (auto& name : Logger::Loop(SnoLoader::List<GameBalance>(), "Parsing items")) {
-    files_.emplace_back(name);
-    auto& file = files_.back();
-    if (!file->x028_Items.size()) {
-      files_.pop_back();
-      continue;
-    }
-    for (auto& item : file->x028_Items) {
-      items_[item.x000_Text] = &item;
-    }
+  auto& items = GameBalanceTables::items();
+  for (uint32 row = 0; row < items.size(); ++row) {
+    items_[items[row].x000_Text] = &items[row];
   }
 }
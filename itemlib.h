@@ -4,17 +4,19 @@
 //
 // GameBalance::Type::Item* ItemLibrary::get(istring const& id)
 //   get item data
+// Map<GameBalance::Type::Item*> const& ItemLibrary::all()
+//   all items, sorted by text ID
+//
+// items are taken from GameBalanceTables, see gamebalance.h for queries by type or set
 
 #pragma once
 #include "types/GameBalance.h"
-#include <list>
+#include "gamebalance.h"
 
 class ItemLibrary {
 public:
   static GameBalance::Type::Item* get(istring const& id) {
-    auto& dir = instance().items_;
-    auto it = dir.find(id);
-    return (it == dir.end() ? nullptr : it->second);
+    return GameBalanceTables::items().get(id.c_str());
   }
   static Map<GameBalance::Type::Item*> const& all() {
     return instance().items_;
@@ -22,6 +24,5 @@ public:
 private:
   static ItemLibrary& instance();
   ItemLibrary();
-  std::list<SnoFile<GameBalance>> files_;
   Map<GameBalance::Type::Item*> items_;
 };
@@ -1,5 +1,11 @@
 #include "json.h"
 #include <algorithm>
+#include <cmath>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JSON_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace json {
 
@@ -38,23 +44,12 @@ Value::Value(unsigned int val)
     int_ = static_cast<int>(val);
   }
 }
-Value::Value(sint32 val)
-  : type_(tUndefined)
-{
-  setType(tInteger);
-  int_ = static_cast<int>(val);
-}
-Value::Value(uint32 val)
-  : type_(tUndefined)
-{
-  if (val > 0x7FFFFFFF) {
-    setType(tNumber);
-    number_ = static_cast<double>(val);
-  } else {
-    setType(tInteger);
-    int_ = static_cast<int>(val);
-  }
-}
+Value::Value(long val)
+  : Value(static_cast<sint64>(val))
+{}
+Value::Value(unsigned long val)
+  : Value(static_cast<uint64>(val))
+{}
 Value::Value(sint64 val)
   : type_(tUndefined)
 {
@@ -381,19 +376,18 @@ Value::ConstIterator Value::end() const {
   }
 }
 
+// the tokenizer works on the whole input in memory; whitespace and string contents are skipped
+// in blocks, and the line and column are only worked out when an error is reported
 class Tokenizer {
-  File* file;
+  uint8 const* data;
+  size_t size;
   bool strict;
 public:
-  uint32 line;
-  uint32 col;
+  size_t pos;
   int chr;
   int move() {
     int old = chr;
-    chr = file->getc();
-    if (chr == '\n') ++line;
-    if (chr == '\r' || chr == '\n') col = 0;
-    else ++col;
+    chr = (++pos < size ? data[pos] : EOF);
     return old;
   }
 
@@ -404,21 +398,87 @@ public:
   double valNumber;
   std::string value;
 
-  Tokenizer(File* file, bool strict)
-    : file(file)
-    , chr(file->getc())
+  Tokenizer(uint8 const* data, size_t size, bool strict)
+    : data(data)
+    , size(size)
     , strict(strict)
-    , line(0)
-    , col(0)
+    , pos(0)
+    , chr(size ? data[0] : EOF)
   {}
 
+  // position of the current character; lines are counted at '\n', and columns restart after
+  // '\r' or '\n' (the first character of the input does not count as a line break)
+  uint32 line() const {
+    size_t end = std::min(pos + 1, size);
+    return (end > 1 ? static_cast<uint32>(std::count(data + 1, data + end, '\n')) : 0);
+  }
+  uint32 col() const {
+    if (!size) return 0;
+    size_t last = std::min(pos, size - 1);
+    while (last > 0 && data[last] != '\r' && data[last] != '\n') {
+      --last;
+    }
+    return static_cast<uint32>(pos - last);
+  }
+
   State next();
+private:
+  void skipSpace();
+  size_t stringRun(char quote) const;
 };
 
-Tokenizer::State Tokenizer::next() {
+void Tokenizer::skipSpace() {
+#ifdef JSON_SSE2
+  __m128i const space = _mm_set1_epi8(' ');
+  __m128i const tab = _mm_set1_epi8('\t');
+  __m128i const range = _mm_set1_epi8('\r' - '\t');
+  while (pos + 16 <= size) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + pos));
+    __m128i control = _mm_sub_epi8(chunk, tab);
+    __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+      _mm_cmpeq_epi8(_mm_min_epu8(control, range), control));
+    uint32 mask = ~_mm_movemask_epi8(blank) & 0xFFFF;
+    if (mask) {
+      unsigned long index;
+      _BitScanForward(&index, mask);
+      pos += index;
+      chr = data[pos];
+      return;
+    }
+    pos += 16;
+  }
+  chr = (pos < size ? data[pos] : EOF);
+#endif
   while (chr != EOF && isspace(chr)) {
     move();
   }
+}
+
+// number of characters from the current one that are copied into a string as they are
+size_t Tokenizer::stringRun(char quote) const {
+  size_t end = pos;
+#ifdef JSON_SSE2
+  __m128i const close = _mm_set1_epi8(quote);
+  __m128i const slash = _mm_set1_epi8('\\');
+  while (end + 16 <= size) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + end));
+    uint32 mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, close), _mm_cmpeq_epi8(chunk, slash)));
+    if (mask) {
+      unsigned long index;
+      _BitScanForward(&index, mask);
+      return end + index - pos;
+    }
+    end += 16;
+  }
+#endif
+  while (end < size && data[end] != quote && data[end] != '\\') {
+    ++end;
+  }
+  return end - pos;
+}
+
+Tokenizer::State Tokenizer::next() {
+  skipSpace();
   if (chr == EOF) {
     return state = tEnd;
   }
@@ -428,126 +488,145 @@ Tokenizer::State Tokenizer::next() {
     state = tString;
     move();
     while (chr != init && chr != EOF) {
-      if (chr == '\\') {
+      if (size_t run = stringRun(init)) {
+        value.append(reinterpret_cast<char const*>(data + pos), run);
+        pos += run - 1;
         move();
-        switch (chr) {
-        case '\'':
-        case '"':
-        case '\\':
-        case '/':
-          value.push_back(move());
-          break;
-        case 'b':
-          value.push_back('\b');
-          move();
-          break;
-        case 'f':
-          value.push_back('\f');
-          move();
-          break;
-        case 'n':
-          value.push_back('\n');
-          move();
-          break;
-        case 'r':
-          value.push_back('\r');
-          move();
-          break;
-        case 't':
-          value.push_back('\t');
-          move();
-          break;
-        case 'u': {
-          move();
-          uint32 cp = 0;
-          for (int i = 0; i < 4; ++i) {
-            if (chr >= '0' && chr <= '9') {
-              cp = cp * 16 + (move() - '0');
-            } else if (chr >= 'a' && chr <= 'f') {
-              cp = cp * 16 + (move() - 'a') + 10;
-            } else if (chr >= 'A' && chr <= 'F') {
-              cp = cp * 16 + (move() - 'A') + 10;
-            } else {
-              value = "invalid hex digit";
-              return state = tError;
-            }
-          }
-          if (cp <= 0x7F) {
-            value.push_back(cp);
-          } else if (cp <= 0x7FF) {
-            value.push_back(0xC0 | ((cp >> 6) & 0x1F));
-            value.push_back(0x80 | (cp & 0x3F));
+        continue;
+      }
+      // chr is a backslash
+      move();
+      switch (chr) {
+      case '\'':
+      case '"':
+      case '\\':
+      case '/':
+        value.push_back(move());
+        break;
+      case 'b':
+        value.push_back('\b');
+        move();
+        break;
+      case 'f':
+        value.push_back('\f');
+        move();
+        break;
+      case 'n':
+        value.push_back('\n');
+        move();
+        break;
+      case 'r':
+        value.push_back('\r');
+        move();
+        break;
+      case 't':
+        value.push_back('\t');
+        move();
+        break;
+      case 'u': {
+        move();
+        uint32 cp = 0;
+        for (int i = 0; i < 4; ++i) {
+          if (chr >= '0' && chr <= '9') {
+            cp = cp * 16 + (move() - '0');
+          } else if (chr >= 'a' && chr <= 'f') {
+            cp = cp * 16 + (move() - 'a') + 10;
+          } else if (chr >= 'A' && chr <= 'F') {
+            cp = cp * 16 + (move() - 'A') + 10;
           } else {
-            value.push_back(0xE0 | ((cp >> 12) & 0x0F));
-            value.push_back(0x80 | ((cp >> 6) & 0x3F));
-            value.push_back(0x80 | (cp & 0x3F));
+            value = "invalid hex digit";
+            return state = tError;
           }
-          break;
         }
-        default:
-          value = "invalid escape sequence";
-          return state = tError;
+        if (cp <= 0x7F) {
+          value.push_back(cp);
+        } else if (cp <= 0x7FF) {
+          value.push_back(0xC0 | ((cp >> 6) & 0x1F));
+          value.push_back(0x80 | (cp & 0x3F));
+        } else {
+          value.push_back(0xE0 | ((cp >> 12) & 0x0F));
+          value.push_back(0x80 | ((cp >> 6) & 0x3F));
+          value.push_back(0x80 | (cp & 0x3F));
         }
-      } else {
-        value.push_back(move());
+        break;
+      }
+      default:
+        value = "invalid escape sequence";
+        return state = tError;
       }
     }
     move();
   } else if (chr == '-' || (chr >= '0' && chr <= '9') || (!strict && (chr == '.' || chr == '+'))) {
+    size_t start = pos;
     state = tInteger;
     if (chr == '-' || (!strict && chr == '+')) {
-      value.push_back(move());
+      move();
     }
+    size_t digits = pos;
     if (chr == '0') {
-      value.push_back(move());
+      move();
     } else if (chr >= '1' && chr <= '9') {
       while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
+        move();
       }
     } else if (strict || chr != '.') {
       value = "invalid number";
       return state = tError;
     }
+    digits = pos - digits;
     if (chr == '.') {
       state = tNumber;
-      value.push_back(move());
+      move();
       if ((chr < '0' || chr > '9') && strict) {
         value = "invalid number";
         return state = tError;
       }
       while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
+        move();
       }
     }
     if (chr == 'e' || chr == 'E') {
       state = tNumber;
-      value.push_back(move());
+      move();
       if (chr == '-' || chr == '+') {
-        value.push_back(move());
+        move();
       }
       if (chr < '0' || chr > '9') {
         value = "invalid number";
         return state = tError;
       }
       while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
+        move();
       }
     }
-    valNumber = atof(value.c_str());
-    if (state == tInteger) {
-      valInteger = int(valNumber);
-      if (double(valInteger) != valNumber) {
-        state = tNumber;
+    value.assign(reinterpret_cast<char const*>(data + start), pos - start);
+    if (state == tInteger && digits <= 9) {
+      // fits in an int, no need to go through atof
+      int result = 0;
+      for (size_t i = pos - digits; i < pos; ++i) {
+        result = result * 10 + (data[i] - '0');
+      }
+      valInteger = (data[start] == '-' ? -result : result);
+      valNumber = (data[start] == '-' ? -double(result) : double(result));
+    } else {
+      valNumber = atof(value.c_str());
+      if (state == tInteger) {
+        valInteger = int(valNumber);
+        if (double(valInteger) != valNumber) {
+          state = tNumber;
+        }
       }
     }
   } else if (chr == '{' || chr == '}' || chr == '[' || chr == ']' || chr == ':' || chr == ',' || chr == '(' || chr == ')') {
     state = tSymbol;
     value.push_back(move());
   } else if ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_') {
+    size_t start = pos;
     state = tIdentifier;
     while ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || (chr >= '0' && chr <= '9') || chr == '_') {
-      value.push_back(move());
+      move();
     }
+    value.assign(reinterpret_cast<char const*>(data + start), pos - start);
   } else if (chr == '/') {
     move();
     if (chr == '/') {
@@ -585,7 +664,19 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
   enum State{sValue, sKey, sColon, sNext, sEnd} state = sValue;
   std::vector<Value::Type> objStack;
   bool topEmpty = true;
-  Tokenizer tok(&file, mode == mJSON);
+  // parse from the current position, in place if the file is in memory
+  uint64 start = file.tell();
+  size_t size = static_cast<size_t>(file.size() - start);
+  uint8 const* data = file.borrow();
+  std::vector<uint8> copy;
+  if (data) {
+    data += start;
+  } else {
+    copy.resize(size);
+    size = file.read(copy.data(), size);
+    data = copy.data();
+  }
+  Tokenizer tok(data, size, mode == mJSON);
   if (mode == mJSCall) {
     if (func) func->clear();
     while (tok.chr != EOF && tok.chr != '(') {
@@ -593,7 +684,7 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
       tok.move();
     }
     if (tok.chr != '(') {
-      visitor->onError(tok.line, tok.col, "expected '('");
+      visitor->onError(tok.line(), tok.col(), "expected '('");
       return false;
     }
     tok.move();
@@ -601,7 +692,7 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
   tok.next();
   while (state != sEnd) {
     if (tok.state == Tokenizer::tError) {
-      visitor->onError(tok.line, tok.col, tok.value);
+      visitor->onError(tok.line(), tok.col(), tok.value);
       return false;
     }
     bool advance = true;
@@ -621,7 +712,7 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
         } else if (tok.value == "false") {
           if (!visitor->onBoolean(false)) return false;
         } else {
-          visitor->onError(tok.line, tok.col, "unexpected identifier " + tok.value);
+          visitor->onError(tok.line(), tok.col(), "unexpected identifier " + tok.value);
           return false;
         }
       } else if (tok.state == Tokenizer::tSymbol) {
@@ -642,11 +733,11 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
           advance = false;
           break;
         } else {
-          visitor->onError(tok.line, tok.col, "unexpected symbol '" + tok.value + "'");
+          visitor->onError(tok.line(), tok.col(), "unexpected symbol '" + tok.value + "'");
           return false;
         }
       } else {
-        visitor->onError(tok.line, tok.col, "value expected");
+        visitor->onError(tok.line(), tok.col(), "value expected");
         return false;
       }
       topEmpty = false;
@@ -670,7 +761,7 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
         state = sNext;
         advance = false;
       } else {
-        visitor->onError(tok.line, tok.col, "object key expected");
+        visitor->onError(tok.line(), tok.col(), "object key expected");
         return false;
       }
       break;
@@ -678,7 +769,7 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
       if (tok.state == Tokenizer::tSymbol && tok.value == ":") {
         state = sValue;
       } else {
-        visitor->onError(tok.line, tok.col, "':' expected");
+        visitor->onError(tok.line(), tok.col(), "':' expected");
         return false;
       }
       break;
@@ -692,18 +783,18 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
           }
         } else if (tok.value == "}") {
           if (objStack.back() != Value::tObject) {
-            visitor->onError(tok.line, tok.col, "mismatched '}'");
+            visitor->onError(tok.line(), tok.col(), "mismatched '}'");
             return false;
           }
           if (!visitor->onCloseMap()) return false;
         } else if (tok.value == "]") {
           if (objStack.back() != Value::tArray) {
-            visitor->onError(tok.line, tok.col, "mismatched ']'");
+            visitor->onError(tok.line(), tok.col(), "mismatched ']'");
             return false;
           }
           if (!visitor->onCloseArray()) return false;
         } else {
-          visitor->onError(tok.line, tok.col, "unexpected symbol '" + tok.value + "'");
+          visitor->onError(tok.line(), tok.col(), "unexpected symbol '" + tok.value + "'");
           return false;
         }
         if (state == sNext) {
@@ -718,15 +809,15 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
         }
       } else {
         if (objStack.back() == Value::tObject) {
-          visitor->onError(tok.line, tok.col, "'}' or ',' expected");
+          visitor->onError(tok.line(), tok.col(), "'}' or ',' expected");
         } else {
-          visitor->onError(tok.line, tok.col, "']' or ',' expected");
+          visitor->onError(tok.line(), tok.col(), "']' or ',' expected");
         }
         return false;
       }
       break;
     default:
-      visitor->onError(tok.line, tok.col, "internal error");
+      visitor->onError(tok.line(), tok.col(), "internal error");
       return false;
     }
     if (advance) {
@@ -735,23 +826,23 @@ bool parse(File& file, Visitor* visitor, int mode, std::string* func) {
   }
   if (mode == mJSCall) {
     if (tok.next() != Tokenizer::tSymbol || tok.value != ")") {
-      visitor->onError(tok.line, tok.col, "expected ')'");
+      visitor->onError(tok.line(), tok.col(), "expected ')'");
       return false;
     }
     tok.move();
     if (tok.chr == ';') tok.move();
     //while (tok.chr != EOF && isspace(tok.chr)) tok.move();
     //if (tok.chr != EOF) {
-    //  visitor->onError(tok.line, tok.col, fmtstring("unexpected symbol '%c'", (char)tok.chr));
+    //  visitor->onError(tok.line(), tok.col(), fmtstring("unexpected symbol '%c'", (char)tok.chr));
     //  return false;
     //}
   } else {
     //if (tok.next() != Tokenizer::tEnd) {
-    //  visitor->onError(tok.line, tok.col, fmtstring("unexpected symbol '%c'", (char)tok.chr));
+    //  visitor->onError(tok.line(), tok.col(), fmtstring("unexpected symbol '%c'", (char)tok.chr));
     //  return false;
     //}
   }
-  file.seek(-1, SEEK_CUR);
+  file.seek(start + std::min(tok.pos, size));
   return visitor->onEnd();
 }
 
@@ -836,6 +927,135 @@ bool Value::walk(Visitor* visitor) const {
   }
 }
 
+// number formatting for the writer: integers as "%d", numbers as "%.14g" without going through
+// printf for the common cases
+
+static size_t formatInteger(char* buf, int val) {
+  char tmp[16];
+  char* end = tmp + sizeof tmp;
+  char* pos = end;
+  uint32 abs = (val < 0 ? 0U - static_cast<uint32>(val) : static_cast<uint32>(val));
+  do {
+    *--pos = static_cast<char>('0' + abs % 10);
+    abs /= 10;
+  } while (abs);
+  if (val < 0) *--pos = '-';
+  memcpy(buf, pos, end - pos);
+  return end - pos;
+}
+
+static size_t formatDigits(char* buf, uint64 val) {
+  char tmp[24];
+  char* end = tmp + sizeof tmp;
+  char* pos = end;
+  do {
+    *--pos = static_cast<char>('0' + val % 10);
+    val /= 10;
+  } while (val);
+  memcpy(buf, pos, end - pos);
+  return end - pos;
+}
+
+static const double powers10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// "%.14g" is the value rounded to 14 significant digits. val * 10^p is computed with an error of
+// at most half an ulp (below 1/128 for results under 2^47), so the rounded digits are exact
+// unless the fraction is that close to one half; such values, exponent notation (whose format
+// differs between C runtimes) and non-finite values are left to printf
+static size_t formatNumber(char* buf, double val) {
+  char* dst = buf;
+  if (val == 0) {
+    if (std::signbit(val)) *dst++ = '-';
+    *dst++ = '0';
+    return dst - buf;
+  }
+  double abs = std::fabs(val);
+  if (abs < 1e14 && abs == std::floor(abs)) {
+    if (val < 0) *dst++ = '-';
+    return (dst - buf) + formatDigits(dst, static_cast<uint64>(abs));
+  }
+  if (abs >= 1e-4 && abs < 1e14) {
+    int exp = static_cast<int>(std::floor(std::log10(abs)));
+    double scaled = abs * powers10[13 - exp];
+    if (scaled < 1e13) {
+      --exp;
+      scaled = abs * powers10[13 - exp];
+    } else if (scaled >= 1e14) {
+      ++exp;
+      scaled = abs * powers10[13 - exp];
+    }
+    double whole = std::floor(scaled);
+    double frac = scaled - whole;
+    if (exp >= -4 && exp < 14 && scaled >= 1e13 && scaled < 1e14 && std::fabs(frac - 0.5) > 1.0 / 64) {
+      uint64 digits = static_cast<uint64>(whole) + (frac > 0.5 ? 1 : 0);
+      if (digits == 100000000000000ULL) {
+        digits /= 10;
+        ++exp;
+      }
+      if (exp < 14) {
+        char text[16];
+        formatDigits(text, digits);
+        size_t last = 14;
+        while (last > 1 && text[last - 1] == '0') {
+          --last;
+        }
+        if (val < 0) *dst++ = '-';
+        if (exp >= 0) {
+          memcpy(dst, text, exp + 1);
+          dst += exp + 1;
+          if (last > static_cast<size_t>(exp + 1)) {
+            *dst++ = '.';
+            memcpy(dst, text + exp + 1, last - exp - 1);
+            dst += last - exp - 1;
+          }
+        } else {
+          *dst++ = '0';
+          *dst++ = '.';
+          for (int i = exp + 1; i < 0; ++i) {
+            *dst++ = '0';
+          }
+          memcpy(dst, text, last);
+          dst += last;
+        }
+        return dst - buf;
+      }
+    }
+  }
+  return sprintf(buf, "%.14g", val);
+}
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+// length of the run of characters at the start of str that are written as they are
+static size_t safeRun(uint8 const* str, size_t length, bool escape) {
+  size_t pos = 0;
+#ifdef JSON_SSE2
+  __m128i const quote = _mm_set1_epi8('"');
+  __m128i const slash = _mm_set1_epi8('\\');
+  __m128i const control = _mm_set1_epi8(0x1F);
+  for (; pos + 16 <= length; pos += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(str + pos));
+    __m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, slash));
+    special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+    uint32 mask = _mm_movemask_epi8(special);
+    if (escape) mask |= _mm_movemask_epi8(chunk);
+    if (mask) {
+      unsigned long index;
+      _BitScanForward(&index, mask);
+      return pos + index;
+    }
+  }
+#endif
+  for (; pos < length; ++pos) {
+    uint8 chr = str[pos];
+    if (chr < 32 || chr == '"' || chr == '\\' || (chr > 0x7F && escape)) break;
+  }
+  return pos;
+}
+
 WriterVisitor::WriterVisitor(File& file, int mode, char const* func)
   : file_(file)
   , mode_(mode)
@@ -843,17 +1063,33 @@ WriterVisitor::WriterVisitor(File& file, int mode, char const* func)
   , empty_(true)
   , object_(false)
 {
+  buffer_.reserve(FlushSize + 4096);
   if (mode == mJSCall) {
-    file.printf("%s(", func ? func : "");
+    if (func) put(func, strlen(func));
+    put('(');
+  }
+}
+WriterVisitor::~WriterVisitor() {
+  flush();
+}
+
+void WriterVisitor::flush() {
+  if (!buffer_.empty()) {
+    file_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
   }
 }
 
 void WriterVisitor::onValue() {
+  if (buffer_.size() >= FlushSize) {
+    flush();
+  }
   if (!object_ && !empty_) {
-    file_.putc(',');
+    put(',');
   }
   if (!object_ && !curIndent_.empty()) {
-    file_.printf("\n%s", curIndent_.c_str());
+    put('\n');
+    put(curIndent_);
   }
   empty_ = false;
   object_ = false;
@@ -862,86 +1098,101 @@ void WriterVisitor::onValue() {
 void WriterVisitor::openValue(char chr) {
   onValue();
   empty_ = true;
-  file_.putc(chr);
+  put(chr);
   curIndent_.append(indent_);
 }
 void WriterVisitor::closeValue(char chr) {
   curIndent_.resize(curIndent_.size() - indent_.size());
   if (!empty_ && !indent_.empty()) {
-    if (mode_ != mJSON) file_.putc(',');
-    file_.printf("\n%s", curIndent_.c_str());
+    if (mode_ != mJSON) put(',');
+    put('\n');
+    put(curIndent_);
   }
-  file_.putc(chr);
+  put(chr);
   empty_ = false;
 }
 
 void WriterVisitor::writeString(std::string const& str) {
-  file_.putc('"');
-  for (uint32 pos = 0; pos < str.length(); ++pos) {
-    uint8 chr = static_cast<uint8>(str[pos]);
+  uint8 const* data = reinterpret_cast<uint8 const*>(str.data());
+  size_t length = str.length();
+  put('"');
+  for (size_t pos = 0; pos < length; ++pos) {
+    size_t run = safeRun(data + pos, length - pos, escape_);
+    if (run) {
+      put(str.data() + pos, run);
+      pos += run;
+      if (pos >= length) break;
+    }
+    uint8 chr = data[pos];
     switch (chr) {
     case '"':
-      file_.printf("\\\"");
+      put("\\\"", 2);
       break;
     case '\\':
-      file_.printf("\\\\");
+      put("\\\\", 2);
       break;
     case '\b':
-      file_.printf("\\b");
+      put("\\b", 2);
       break;
     case '\f':
-      file_.printf("\\f");
+      put("\\f", 2);
       break;
     case '\n':
-      file_.printf("\\n");
+      put("\\n", 2);
       break;
     case '\r':
-      file_.printf("\\r");
+      put("\\r", 2);
       break;
     case '\t':
-      file_.printf("\\t");
+      put("\\t", 2);
       break;
-    default:
-      if (chr < 32) {
-        file_.printf("\\u%04X", (int)chr);
-      } else if (chr <= 0x7F || !escape_) {
-        file_.putc(chr);
-      } else {
+    default: {
+      uint32 cp = chr;
+      if (chr >= 32) {
         uint8 hdr = chr;
         uint32 mask = 0x3F;
-        uint32 cp = chr;
-        while ((hdr & 0xC0) == 0xC0 && pos < str.length() - 1) {
-          chr = str[++pos];
+        while ((hdr & 0xC0) == 0xC0 && pos < length - 1) {
+          chr = data[++pos];
           cp = (cp << 6) | (chr & 0x3F);
           mask = (mask << 5) | 0x1F;
           hdr <<= 1;
         }
         cp &= mask;
-        file_.printf("\\u%04X", cp & 0xFFFF);
       }
+      char code[6] = {'\\', 'u',
+        hexDigits[(cp >> 12) & 15], hexDigits[(cp >> 8) & 15],
+        hexDigits[(cp >> 4) & 15], hexDigits[cp & 15]};
+      put(code, 6);
+    }
     }
   }
-  file_.putc('"');
+  put('"');
 }
 
 bool WriterVisitor::onNull() {
   onValue();
-  file_.printf("null");
+  put("null", 4);
   return true;
 }
 bool WriterVisitor::onBoolean(bool val) {
   onValue();
-  file_.printf(val ? "true" : "false");
+  if (val) {
+    put("true", 4);
+  } else {
+    put("false", 5);
+  }
   return true;
 }
 bool WriterVisitor::onInteger(int val) {
   onValue();
-  file_.printf("%d", val);
+  char buf[16];
+  put(buf, formatInteger(buf, val));
   return true;
 }
 bool WriterVisitor::onNumber(double val) {
   onValue();
-  file_.printf("%.14g", val);
+  char buf[64];
+  put(buf, formatNumber(buf, val));
   return true;
 }
 bool WriterVisitor::onString(std::string const& val) {
@@ -964,17 +1215,18 @@ bool WriterVisitor::onMapKey(std::string const& key) {
     }
   }
   if (safe) {
-    file_.printf("%s", key.c_str());
+    put(key);
   } else {
     writeString(key);
   }
-  file_.putc(':');
-  if (!indent_.empty()) file_.putc(' ');
+  put(':');
+  if (!indent_.empty()) put(' ');
   return true;
 }
 bool WriterVisitor::onEnd() {
-  if (mode_ == mJSCall) file_.printf(");");
-  if (!indent_.empty()) file_.putc('\n');
+  if (mode_ == mJSCall) put(");", 2);
+  if (!indent_.empty()) put('\n');
+  flush();
   return true;
 }
 
@@ -27,9 +27,6 @@ private:
     bool bool_;
   };
 public:
-  typedef std::map<std::string, Value> Map;
-  typedef std::vector<Value> Array;
-
   Value(Type type = tUndefined);
   ~Value() {
     clear();
@@ -38,8 +35,8 @@ public:
   Value(bool val);
   Value(int val);
   Value(unsigned int val);
-  Value(sint32 val);
-  Value(uint32 val);
+  Value(long val);
+  Value(unsigned long val);
   Value(sint64 val);
   Value(uint64 val);
   Value(double val);
@@ -228,7 +225,7 @@ public:
   virtual bool onCloseMap() { return true; }
   virtual bool onOpenArray() { return true; }
   virtual bool onCloseArray() { return true; }
-  virtual bool onIntegerEx(int val, std::string const& alt) {
+  virtual bool onIntegerEx(int val, char const* alt) {
     if (printExStrings) {
       return onString(alt);
     } else {
@@ -323,10 +320,19 @@ enum {mJSON, mJS, mJSCall};
 
 bool parse(File& file, Visitor* visitor, int mode = mJSON, std::string* func = nullptr);
 bool parse(File& file, Value& value, int mode = mJSON, std::string* func = nullptr, bool throwExceptions = false);
+inline bool parse(File&& file, Visitor* visitor, int mode = mJSON, std::string* func = nullptr) {
+  return parse(file, visitor, mode, func);
+}
+inline bool parse(File&& file, Value& value, int mode = mJSON, std::string* func = nullptr, bool throwExceptions = false) {
+  return parse(file, value, mode, func, throwExceptions);
+}
 
+// output is collected in memory and written to the file in large blocks; onEnd() and the
+// destructor flush it, so the file can be written to directly before and after a value
 class WriterVisitor : public Visitor {
 public:
   WriterVisitor(File& file, int mode = mJSON, char const* func = nullptr);
+  ~WriterVisitor();
 
   void setIndent(std::string indent) {
     indent_ = indent;
@@ -362,7 +368,10 @@ public:
   }
   bool onEnd();
 
+  void flush();
+
 protected:
+  enum { FlushSize = 65536 };
   File& file_;
   int mode_;
   bool escape_;
@@ -370,6 +379,16 @@ protected:
   bool object_;
   std::string indent_;
   std::string curIndent_;
+  std::string buffer_;
+  void put(char chr) {
+    buffer_.push_back(chr);
+  }
+  void put(char const* str, size_t length) {
+    buffer_.append(str, length);
+  }
+  void put(std::string const& str) {
+    buffer_.append(str);
+  }
   void onValue();
   void openValue(char chr);
   void closeValue(char chr);
@@ -377,5 +396,8 @@ protected:
 };
 
 bool write(File& file, Value& value, int mode = mJSON, char const* func = nullptr);
+inline bool write(File&& file, Value& value, int mode = mJSON, char const* func = nullptr) {
+  return write(file, value, mode, func);
+}
 
 }
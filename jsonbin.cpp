@@ -0,0 +1,290 @@
+#include "jsonbin.h"
+#include <string.h>
+
+namespace json {
+
+static char const binaryMagic[4] = {'J', 'S', 'N', 'B'};
+
+static uint32 zigzag(int val) {
+  return (static_cast<uint32>(val) << 1) ^ static_cast<uint32>(val >> 31);
+}
+static int unzigzag(uint32 val) {
+  return static_cast<int>((val >> 1) ^ (0U - (val & 1)));
+}
+
+BinaryWriter::BinaryWriter(File& file)
+  : file_(file)
+{
+  buffer_.append(binaryMagic, sizeof binaryMagic);
+  put(Binary::Version);
+}
+BinaryWriter::~BinaryWriter() {
+  flush();
+}
+
+void BinaryWriter::flush() {
+  if (!buffer_.empty()) {
+    file_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+  }
+}
+
+void BinaryWriter::putVarint(uint32 val) {
+  while (val >= 0x80) {
+    buffer_.push_back(static_cast<char>(val | 0x80));
+    val >>= 7;
+  }
+  buffer_.push_back(static_cast<char>(val));
+}
+void BinaryWriter::putString(std::string const& str) {
+  auto it = strings_.find(str);
+  if (it != strings_.end()) {
+    putVarint(it->second + 1);
+    return;
+  }
+  uint32 index = static_cast<uint32>(strings_.size());
+  strings_.emplace(str, index);
+  putVarint(0);
+  putVarint(static_cast<uint32>(str.size()));
+  buffer_.append(str);
+}
+
+bool BinaryWriter::onNull() {
+  put(Binary::tNull);
+  onValue();
+  return true;
+}
+bool BinaryWriter::onBoolean(bool val) {
+  put(val ? Binary::tTrue : Binary::tFalse);
+  onValue();
+  return true;
+}
+bool BinaryWriter::onInteger(int val) {
+  put(Binary::tInteger);
+  putVarint(zigzag(val));
+  onValue();
+  return true;
+}
+bool BinaryWriter::onNumber(double val) {
+  // most numbers in SNO files come from floats; NaN fails the comparison and stays a double
+  float single = static_cast<float>(val);
+  if (static_cast<double>(single) == val) {
+    put(Binary::tFloat);
+    buffer_.append(reinterpret_cast<char const*>(&single), sizeof single);
+  } else {
+    put(Binary::tNumber);
+    buffer_.append(reinterpret_cast<char const*>(&val), sizeof val);
+  }
+  onValue();
+  return true;
+}
+bool BinaryWriter::onString(std::string const& val) {
+  put(Binary::tString);
+  putString(val);
+  onValue();
+  return true;
+}
+bool BinaryWriter::onOpenMap() {
+  put(Binary::tOpenMap);
+  return true;
+}
+bool BinaryWriter::onMapKey(std::string const& key) {
+  put(Binary::tMapKey);
+  putString(key);
+  return true;
+}
+bool BinaryWriter::onCloseMap() {
+  put(Binary::tCloseMap);
+  onValue();
+  return true;
+}
+bool BinaryWriter::onOpenArray() {
+  put(Binary::tOpenArray);
+  return true;
+}
+bool BinaryWriter::onCloseArray() {
+  put(Binary::tCloseArray);
+  onValue();
+  return true;
+}
+bool BinaryWriter::onIntegerEx(int val, char const* alt) {
+  put(Binary::tIntegerEx);
+  putVarint(zigzag(val));
+  temp_.assign(alt);
+  putString(temp_);
+  onValue();
+  return true;
+}
+bool BinaryWriter::onEnd() {
+  put(Binary::tEnd);
+  flush();
+  return true;
+}
+
+class BinaryReader {
+public:
+  BinaryReader(uint8 const* data, size_t size, Visitor* visitor)
+    : data_(data)
+    , size_(size)
+    , pos_(0)
+    , visitor_(visitor)
+  {}
+
+  size_t pos() const {
+    return pos_;
+  }
+  bool run();
+
+private:
+  uint8 const* data_;
+  size_t size_;
+  size_t pos_;
+  Visitor* visitor_;
+  std::vector<std::string> strings_;
+
+  bool error(char const* reason) {
+    visitor_->onError(0, static_cast<uint32>(pos_), reason);
+    return false;
+  }
+  bool readVarint(uint32& val) {
+    val = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (pos_ >= size_) return error("unexpected end of data");
+      uint8 byte = data_[pos_++];
+      val |= static_cast<uint32>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return error("invalid varint");
+  }
+  bool readString(std::string const*& str) {
+    uint32 index;
+    if (!readVarint(index)) return false;
+    if (index) {
+      if (index > strings_.size()) return error("invalid string reference");
+      str = &strings_[index - 1];
+      return true;
+    }
+    uint32 length;
+    if (!readVarint(length)) return false;
+    if (length > size_ - pos_) return error("unexpected end of data");
+    strings_.emplace_back(reinterpret_cast<char const*>(data_ + pos_), length);
+    pos_ += length;
+    str = &strings_.back();
+    return true;
+  }
+  template<class T>
+  bool readRaw(T& val) {
+    if (sizeof(T) > size_ - pos_) return error("unexpected end of data");
+    memcpy(&val, data_ + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+};
+
+bool BinaryReader::run() {
+  if (size_ < sizeof binaryMagic + 1 || memcmp(data_, binaryMagic, sizeof binaryMagic)) {
+    return error("not a binary JSON stream");
+  }
+  pos_ = sizeof binaryMagic;
+  if (data_[pos_++] != Binary::Version) return error("unsupported version");
+  uint32 depth = 0;
+  while (true) {
+    if (pos_ >= size_) return error("unexpected end of data");
+    uint8 tag = data_[pos_++];
+    uint32 uval;
+    std::string const* str;
+    bool res;
+    switch (tag) {
+    case Binary::tEnd:
+      if (depth) return error("unexpected end of stream");
+      return visitor_->onEnd();
+    case Binary::tNull:
+      res = visitor_->onNull();
+      break;
+    case Binary::tFalse:
+    case Binary::tTrue:
+      res = visitor_->onBoolean(tag == Binary::tTrue);
+      break;
+    case Binary::tInteger:
+      if (!readVarint(uval)) return false;
+      res = visitor_->onInteger(unzigzag(uval));
+      break;
+    case Binary::tNumber: {
+      double val;
+      if (!readRaw(val)) return false;
+      res = visitor_->onNumber(val);
+      break;
+    }
+    case Binary::tFloat: {
+      float val;
+      if (!readRaw(val)) return false;
+      res = visitor_->onNumber(val);
+      break;
+    }
+    case Binary::tString:
+      if (!readString(str)) return false;
+      res = visitor_->onString(*str);
+      break;
+    case Binary::tOpenMap:
+      ++depth;
+      res = visitor_->onOpenMap();
+      break;
+    case Binary::tMapKey:
+      if (!readString(str)) return false;
+      res = visitor_->onMapKey(*str);
+      break;
+    case Binary::tOpenArray:
+      ++depth;
+      res = visitor_->onOpenArray();
+      break;
+    case Binary::tCloseMap:
+    case Binary::tCloseArray:
+      if (!depth) return error("unbalanced close");
+      --depth;
+      res = (tag == Binary::tCloseMap ? visitor_->onCloseMap() : visitor_->onCloseArray());
+      break;
+    case Binary::tIntegerEx:
+      if (!readVarint(uval) || !readString(str)) return false;
+      res = visitor_->onIntegerEx(unzigzag(uval), str->c_str());
+      break;
+    default:
+      --pos_;
+      return error("invalid tag");
+    }
+    if (!res) return false;
+  }
+}
+
+bool parseBinary(File& file, Visitor* visitor) {
+  // read from the current position, in place if the file is in memory
+  uint64 start = file.tell();
+  size_t size = static_cast<size_t>(file.size() - start);
+  uint8 const* data = file.borrow();
+  std::vector<uint8> copy;
+  if (data) {
+    data += start;
+  } else {
+    copy.resize(size);
+    size = file.read(copy.data(), size);
+    data = copy.data();
+  }
+  BinaryReader reader(data, size, visitor);
+  bool res = reader.run();
+  file.seek(start + reader.pos());
+  return res;
+}
+
+bool parseBinary(File& file, Value& value, bool throwExceptions) {
+  if (!file) return false;
+  BuilderVisitor builder(value, throwExceptions);
+  value.clear();
+  return parseBinary(file, &builder);
+}
+
+bool writeBinary(File& file, Value& value) {
+  BinaryWriter writer(file);
+  if (!value.walk(&writer)) return false;
+  return writer.onEnd();
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// compact binary form of a json::Visitor event stream
+//
+// BinaryWriter records the events it receives and parseBinary plays them back into any visitor,
+// so a binary dump can be loaded wherever the JSON text would have been parsed. Integers are
+// zigzag varints, numbers are stored as floats when that is exact, and all strings (map keys,
+// string values and the names passed to onIntegerEx) are written once and then referenced by
+// index. onIntegerEx is kept as such, the reading visitor decides whether it wants the name.
+//
+// layout: "JSNB" version, then one tag byte per event followed by its data, up to tEnd
+//   string reference: varint 0, varint length, bytes (new string, gets the next index)
+//                     varint index + 1 (string seen before)
+
+#include "json.h"
+#include <unordered_map>
+
+namespace json {
+
+namespace Binary {
+  enum { Version = 1 };
+  enum Tag {
+    tEnd,
+    tNull,
+    tFalse,
+    tTrue,
+    tInteger,     // varint
+    tNumber,      // double
+    tFloat,       // float
+    tString,      // string
+    tOpenMap,
+    tMapKey,      // string
+    tCloseMap,
+    tOpenArray,
+    tCloseArray,
+    tIntegerEx,   // varint, string
+
+    tCount
+  };
+}
+
+class BinaryWriter : public Visitor {
+public:
+  BinaryWriter(File& file);
+  ~BinaryWriter();
+
+  bool onNull();
+  bool onBoolean(bool val);
+  bool onInteger(int val);
+  bool onNumber(double val);
+  bool onString(std::string const& val);
+  bool onOpenMap();
+  bool onMapKey(std::string const& key);
+  bool onCloseMap();
+  bool onOpenArray();
+  bool onCloseArray();
+  bool onIntegerEx(int val, char const* alt);
+  bool onEnd();
+
+  void flush();
+
+protected:
+  enum { FlushSize = 65536 };
+  File& file_;
+  std::string buffer_;
+  std::unordered_map<std::string, uint32> strings_;
+  std::string temp_;
+
+  void put(uint8 tag) {
+    buffer_.push_back(static_cast<char>(tag));
+  }
+  void putVarint(uint32 val);
+  void putString(std::string const& str);
+  void onValue() {
+    if (buffer_.size() >= FlushSize) flush();
+  }
+};
+
+// returns false (and calls visitor->onError with the byte offset as the column) if the data is
+// not a binary stream or is truncated; the file is left after the end of the stream
+bool parseBinary(File& file, Visitor* visitor);
+bool parseBinary(File& file, Value& value, bool throwExceptions = false);
+inline bool parseBinary(File&& file, Visitor* visitor) {
+  return parseBinary(file, visitor);
+}
+inline bool parseBinary(File&& file, Value& value, bool throwExceptions = false) {
+  return parseBinary(file, value, throwExceptions);
+}
+
+bool writeBinary(File& file, Value& value);
+inline bool writeBinary(File&& file, Value& value) {
+  return writeBinary(file, value);
+}
+
+}
@@ -0,0 +1,432 @@
+#include "jsondiff.h"
+
+namespace json {
+
+static bool scalarEqual(Node const& lhs, Node const& rhs) {
+  switch (lhs.type()) {
+  case Value::tString: return lhs.getString() == rhs.getString();
+  case Value::tInteger: return lhs.getInteger() == rhs.getInteger();
+  case Value::tNumber: return lhs.getNumber() == rhs.getNumber();
+  case Value::tBoolean: return lhs.getBoolean() == rhs.getBoolean();
+  default: return true;
+  }
+}
+
+// documents that share a string table compare keys by address
+void compare(Node const& lhs, Node const& rhs, Value& lout, Value& rout) {
+  lout.clear();
+  rout.clear();
+  if (lhs.type() != rhs.type()) {
+    lhs.copy(lout);
+    rhs.copy(rout);
+  } else if (lhs.type() == Value::tArray) {
+    uint32 common = std::min(lhs.length(), rhs.length());
+    bool same = true;
+    lout.setType(Value::tArray);
+    rout.setType(Value::tArray);
+    for (uint32 i = 0; i < common; ++i) {
+      compare(lhs[i], rhs[i], lout[i], rout[i]);
+      if (lout[i].type() != Value::tUndefined) {
+        same = false;
+      }
+    }
+    if (same && lhs.length() == rhs.length()) {
+      lout.clear();
+      rout.clear();
+      return;
+    }
+    for (uint32 i = common; i < lhs.length(); ++i) {
+      lhs[i].copy(lout[i]);
+    }
+    for (uint32 i = common; i < rhs.length(); ++i) {
+      rhs[i].copy(rout[i]);
+    }
+  } else if (lhs.type() == Value::tObject) {
+    auto lit = lhs.begin();
+    auto rit = rhs.begin();
+    while (lit != lhs.end() || rit != rhs.end()) {
+      if (rit == rhs.end() || (lit != lhs.end() && &lit.key() != &rit.key() && lit.key() < rit.key())) {
+        lit->copy(lout[lit.key()]);
+        ++lit;
+      } else if (lit == lhs.end() || (&lit.key() != &rit.key() && lit.key() != rit.key())) {
+        rit->copy(rout[rit.key()]);
+        ++rit;
+      } else {
+        Value& lsub = lout[lit.key()];
+        Value& rsub = rout[rit.key()];
+        compare(*lit, *rit, lsub, rsub);
+        if (lsub.type() == Value::tUndefined) lout.remove(lit.key());
+        if (rsub.type() == Value::tUndefined) rout.remove(rit.key());
+        ++lit;
+        ++rit;
+      }
+    }
+    if (lout.getMap().empty()) lout.clear();
+    if (rout.getMap().empty()) rout.clear();
+  } else if (!scalarEqual(lhs, rhs)) {
+    lhs.copy(lout);
+    rhs.copy(rout);
+  }
+}
+
+// EventStream
+
+bool EventStream::onNull() {
+  add(eNull);
+  return true;
+}
+bool EventStream::onBoolean(bool val) {
+  add(eBoolean);
+  events_.back().bool_ = val;
+  return true;
+}
+bool EventStream::onInteger(int val) {
+  add(eInteger);
+  events_.back().int_ = val;
+  return true;
+}
+bool EventStream::onNumber(double val) {
+  add(eNumber);
+  events_.back().number_ = val;
+  return true;
+}
+bool EventStream::onString(std::string const& val) {
+  add(eString);
+  events_.back().string_ = strings_.intern(val);
+  return true;
+}
+bool EventStream::onOpenMap() {
+  open_.push_back(static_cast<uint32>(events_.size()));
+  add(eOpenMap);
+  return true;
+}
+bool EventStream::onMapKey(std::string const& key) {
+  add(eMapKey);
+  events_.back().string_ = strings_.intern(key);
+  return true;
+}
+bool EventStream::onCloseMap() {
+  add(eCloseMap);
+  close();
+  return true;
+}
+bool EventStream::onOpenArray() {
+  open_.push_back(static_cast<uint32>(events_.size()));
+  add(eOpenArray);
+  return true;
+}
+bool EventStream::onCloseArray() {
+  add(eCloseArray);
+  close();
+  return true;
+}
+void EventStream::close() {
+  if (open_.empty()) return;
+  events_[open_.back()].end = static_cast<uint32>(events_.size());
+  open_.pop_back();
+}
+
+size_t EventStream::skip(size_t pos) const {
+  if (pos >= events_.size()) return pos;
+  Event const& event = events_[pos];
+  if (event.type == eOpenMap || event.type == eOpenArray) {
+    return (event.end ? event.end : events_.size());
+  }
+  return pos + 1;
+}
+
+size_t EventStream::replay(size_t pos, Visitor* visitor) const {
+  size_t end = skip(pos);
+  for (; pos < end; ++pos) {
+    Event const& event = events_[pos];
+    switch (event.type) {
+    case eNull: visitor->onNull(); break;
+    case eBoolean: visitor->onBoolean(event.bool_); break;
+    case eInteger: visitor->onInteger(event.int_); break;
+    case eNumber: visitor->onNumber(event.number_); break;
+    case eString: visitor->onString(*event.string_); break;
+    case eOpenMap: visitor->onOpenMap(); break;
+    case eMapKey: visitor->onMapKey(*event.string_); break;
+    case eCloseMap: visitor->onCloseMap(); break;
+    case eOpenArray: visitor->onOpenArray(); break;
+    case eCloseArray: visitor->onCloseArray(); break;
+    }
+  }
+  return end;
+}
+
+// DiffVisitor
+
+DiffVisitor::DiffVisitor(EventStream& lhs, Value& lout, Value& rout)
+  : lhs_(lhs)
+  , pos_(0)
+  , capture_(nullptr)
+  , depth_(0)
+{
+  lout.clear();
+  rout.clear();
+  Frame root = {Value::tUndefined, nullptr, nullptr, &lout, &rout, nullptr, 0, 0, true};
+  stack_.push_back(root);
+}
+
+// type of the value that starts at the current left position, tUndefined for keys and closes
+Value::Type DiffVisitor::lhsType() const {
+  if (pos_ >= lhs_.size()) return Value::tUndefined;
+  switch (lhs_[pos_].type) {
+  case EventStream::eNull: return Value::tNull;
+  case EventStream::eBoolean: return Value::tBoolean;
+  case EventStream::eInteger: return Value::tInteger;
+  case EventStream::eNumber: return Value::tNumber;
+  case EventStream::eString: return Value::tString;
+  case EventStream::eOpenMap: return Value::tObject;
+  case EventStream::eOpenArray: return Value::tArray;
+  default: return Value::tUndefined;
+  }
+}
+
+// sets up the outputs for a value from the right side; returns false if there is no left value
+// to compare it with
+bool DiffVisitor::startSlot() {
+  Frame& frame = stack_.back();
+  if (frame.type == Value::tArray) {
+    frame.rslot = &(*frame.rout)[frame.rindex++];
+    if (lhsType() == Value::tUndefined) {
+      frame.lslot = nullptr;
+    } else {
+      frame.lslot = &(*frame.lout)[frame.lindex++];
+    }
+  }
+  return frame.lslot && frame.rslot && lhsType() != Value::tUndefined;
+}
+
+void DiffVisitor::finishSlot() {
+  Frame& frame = stack_.back();
+  if (frame.type == Value::tArray) {
+    if (frame.lslot && frame.lslot->type() != Value::tUndefined) {
+      frame.same = false;
+    }
+  } else if (frame.type == Value::tObject && frame.key) {
+    if (frame.lslot->type() == Value::tUndefined) frame.lout->remove(*frame.key);
+    if (frame.rslot->type() == Value::tUndefined) frame.rout->remove(*frame.key);
+    frame.lslot = frame.rslot = nullptr;
+    frame.key = nullptr;
+  }
+}
+
+void DiffVisitor::copyLeft(Value& dst) {
+  BuilderVisitor builder(dst);
+  pos_ = lhs_.replay(pos_, &builder);
+}
+
+void DiffVisitor::startCapture(Visitor* visitor) {
+  capture_ = visitor;
+  depth_ = 0;
+}
+
+void DiffVisitor::finishCapture() {
+  capture_ = nullptr;
+  if (builder_) {
+    builder_.reset();
+    finishSlot();
+    return;
+  }
+  // the rest of an object after a key mismatch
+  Value lres, rres;
+  compare(*lrest_, *rrest_, lres, rres);
+  rrestBuilder_.reset();
+  rrest_.reset();
+  lrest_.reset();
+  Frame& frame = stack_.back();
+  for (auto const& kv : lres.getMap()) {
+    (*frame.lout)[kv.first] = kv.second;
+  }
+  for (auto const& kv : rres.getMap()) {
+    (*frame.rout)[kv.first] = kv.second;
+  }
+  closeFrame();
+}
+
+template<class Equal, class Set>
+bool DiffVisitor::scalar(Value::Type type, Equal const& equal, Set const& set) {
+  if (stack_.back().type == Value::tObject && !stack_.back().key) return false;
+  bool left = startSlot();
+  Frame& frame = stack_.back();
+  if (left && lhsType() == type) {
+    if (equal(lhs_[pos_])) {
+      ++pos_;
+    } else {
+      copyLeft(*frame.lslot);
+      set(*frame.rslot);
+    }
+  } else {
+    if (left) copyLeft(*frame.lslot);
+    set(*frame.rslot);
+  }
+  finishSlot();
+  return true;
+}
+
+bool DiffVisitor::onNull() {
+  if (capture_) return capture_->onNull();
+  return scalar(Value::tNull, [](EventStream::Event const&) {
+    return true;
+  }, [](Value& dst) {
+    dst.setType(Value::tNull);
+  });
+}
+bool DiffVisitor::onBoolean(bool val) {
+  if (capture_) return capture_->onBoolean(val);
+  return scalar(Value::tBoolean, [val](EventStream::Event const& event) {
+    return event.bool_ == val;
+  }, [val](Value& dst) {
+    dst.setBoolean(val);
+  });
+}
+bool DiffVisitor::onInteger(int val) {
+  if (capture_) return capture_->onInteger(val);
+  return scalar(Value::tInteger, [val](EventStream::Event const& event) {
+    return event.int_ == val;
+  }, [val](Value& dst) {
+    dst.setInteger(val);
+  });
+}
+bool DiffVisitor::onNumber(double val) {
+  if (capture_) return capture_->onNumber(val);
+  return scalar(Value::tNumber, [val](EventStream::Event const& event) {
+    return event.number_ == val;
+  }, [val](Value& dst) {
+    dst.setNumber(val);
+  });
+}
+bool DiffVisitor::onString(std::string const& val) {
+  if (capture_) return capture_->onString(val);
+  return scalar(Value::tString, [&val](EventStream::Event const& event) {
+    return *event.string_ == val;
+  }, [&val](Value& dst) {
+    dst.setString(val);
+  });
+}
+
+bool DiffVisitor::open(Value::Type type) {
+  if (stack_.back().type == Value::tObject && !stack_.back().key) return false;
+  bool left = startSlot();
+  Frame& frame = stack_.back();
+  if (left && lhsType() == type) {
+    ++pos_;
+    Value* lout = frame.lslot;
+    Value* rout = frame.rslot;
+    lout->setType(type);
+    rout->setType(type);
+    Frame child = {static_cast<uint32>(type), lout, rout, nullptr, nullptr, nullptr, 0, 0, true};
+    stack_.push_back(child);
+    return true;
+  }
+  if (left) copyLeft(*frame.lslot);
+  builder_.reset(new BuilderVisitor(*frame.rslot));
+  startCapture(builder_.get());
+  ++depth_;
+  return (type == Value::tObject ? capture_->onOpenMap() : capture_->onOpenArray());
+}
+
+bool DiffVisitor::onOpenMap() {
+  if (capture_) {
+    ++depth_;
+    return capture_->onOpenMap();
+  }
+  return open(Value::tObject);
+}
+bool DiffVisitor::onOpenArray() {
+  if (capture_) {
+    ++depth_;
+    return capture_->onOpenArray();
+  }
+  return open(Value::tArray);
+}
+
+bool DiffVisitor::onMapKey(std::string const& key) {
+  if (capture_) return capture_->onMapKey(key);
+  Frame& frame = stack_.back();
+  if (frame.type != Value::tObject || frame.key) return false;
+  if (pos_ < lhs_.size() && lhs_[pos_].type == EventStream::eMapKey && *lhs_[pos_].string_ == key) {
+    frame.key = lhs_[pos_++].string_;
+    frame.lslot = &(*frame.lout)[*frame.key];
+    frame.rslot = &(*frame.rout)[*frame.key];
+    frame.lslot->clear();
+    frame.rslot->clear();
+    return true;
+  }
+
+  // keys are out of step: collect the rest of both objects and compare them as documents
+  lrest_.reset(new Document(&lhs_.strings()));
+  DocumentBuilder lbuilder(*lrest_);
+  lbuilder.onOpenMap();
+  while (pos_ < lhs_.size() && lhs_[pos_].type == EventStream::eMapKey) {
+    lbuilder.onMapKey(*lhs_[pos_].string_);
+    pos_ = lhs_.replay(pos_ + 1, &lbuilder);
+  }
+  lbuilder.onCloseMap();
+  if (pos_ < lhs_.size()) ++pos_;
+
+  rrest_.reset(new Document(&lhs_.strings()));
+  rrestBuilder_.reset(new DocumentBuilder(*rrest_));
+  startCapture(rrestBuilder_.get());
+  depth_ = 1;
+  capture_->onOpenMap();
+  return capture_->onMapKey(key);
+}
+
+bool DiffVisitor::onCloseMap() {
+  if (capture_) {
+    bool res = capture_->onCloseMap();
+    if (!--depth_) finishCapture();
+    return res;
+  }
+  Frame& frame = stack_.back();
+  if (frame.type != Value::tObject || frame.key) return false;
+  // members that are only on the left
+  while (pos_ < lhs_.size() && lhs_[pos_].type == EventStream::eMapKey) {
+    Value& dst = (*frame.lout)[*lhs_[pos_++].string_];
+    dst.clear();
+    copyLeft(dst);
+  }
+  if (pos_ < lhs_.size()) ++pos_;
+  closeFrame();
+  return true;
+}
+
+bool DiffVisitor::onCloseArray() {
+  if (capture_) {
+    bool res = capture_->onCloseArray();
+    if (!--depth_) finishCapture();
+    return res;
+  }
+  Frame& frame = stack_.back();
+  if (frame.type != Value::tArray) return false;
+  // elements that are only on the left
+  while (lhsType() != Value::tUndefined) {
+    copyLeft((*frame.lout)[frame.lindex++]);
+  }
+  if (pos_ < lhs_.size()) ++pos_;
+  if (frame.same && frame.lindex == frame.rindex) {
+    frame.lout->clear();
+    frame.rout->clear();
+  }
+  closeFrame();
+  return true;
+}
+
+void DiffVisitor::closeFrame() {
+  Frame& frame = stack_.back();
+  if (frame.type == Value::tObject) {
+    if (frame.lout->getMap().empty()) frame.lout->clear();
+    if (frame.rout->getMap().empty()) frame.rout->clear();
+  }
+  stack_.pop_back();
+  finishSlot();
+}
+
+bool DiffVisitor::onEnd() {
+  return !capture_ && stack_.size() == 1;
+}
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+// differences between two visitor event streams
+//
+// compare() works on two documents. For two versions of the same file, which are mostly equal,
+// building trees is not needed: the left side is recorded as a flat list of events (EventStream),
+// and the right side is fed to a DiffVisitor that walks the recorded events in step with it, so
+// only the parts that differ are copied into the output.
+//
+// Both produce the same result, the remaining entries of lhs and rhs:
+//   - equal scalars are removed; values of different types are kept whole
+//   - objects keep differing members and members found only on one side, and are removed if empty
+//   - arrays are compared by index; they are removed if all common elements are equal on the left
+//     and the lengths match, otherwise both are kept, with equal elements left undefined
+// Member order may differ between the streams: from the first key that does not match, the rest
+// of the object is collected on both sides and compared as documents.
+
+#include "json.h"
+#include "jsondoc.h"
+
+namespace json {
+
+void compare(Node const& lhs, Node const& rhs, Value& lout, Value& rout);
+
+class EventStream : public Visitor {
+public:
+  enum EventType {
+    eNull,
+    eBoolean,
+    eInteger,
+    eNumber,
+    eString,
+    eOpenMap,
+    eMapKey,
+    eCloseMap,
+    eOpenArray,
+    eCloseArray,
+  };
+  struct Event {
+    uint32 type;
+    uint32 end;     // eOpenMap/eOpenArray: index after the matching close
+    union {
+      bool bool_;
+      int int_;
+      double number_;
+      std::string const* string_;
+    };
+  };
+
+  bool onNull();
+  bool onBoolean(bool val);
+  bool onInteger(int val);
+  bool onNumber(double val);
+  bool onString(std::string const& val);
+  bool onOpenMap();
+  bool onMapKey(std::string const& key);
+  bool onCloseMap();
+  bool onOpenArray();
+  bool onCloseArray();
+
+  size_t size() const {
+    return events_.size();
+  }
+  Event const& operator[](size_t i) const {
+    return events_[i];
+  }
+  StringTable& strings() {
+    return strings_;
+  }
+
+  // plays back the value that starts at pos, returns the position after it
+  size_t replay(size_t pos, Visitor* visitor) const;
+  // position after the value that starts at pos
+  size_t skip(size_t pos) const;
+
+private:
+  StringTable strings_;
+  std::vector<Event> events_;
+  std::vector<uint32> open_;
+
+  void add(uint32 type) {
+    Event event;
+    event.type = type;
+    event.end = 0;
+    event.number_ = 0;
+    events_.push_back(event);
+  }
+  void close();
+};
+
+class DiffVisitor : public Visitor {
+public:
+  DiffVisitor(EventStream& lhs, Value& lout, Value& rout);
+
+  bool onNull();
+  bool onBoolean(bool val);
+  bool onInteger(int val);
+  bool onNumber(double val);
+  bool onString(std::string const& val);
+  bool onOpenMap();
+  bool onMapKey(std::string const& key);
+  bool onCloseMap();
+  bool onOpenArray();
+  bool onCloseArray();
+  bool onEnd();
+
+private:
+  // the bottom frame stands for the root value; lslot/rslot are the outputs for the current
+  // child (lslot is null for elements past the end of the left array)
+  struct Frame {
+    uint32 type;
+    Value* lout;
+    Value* rout;
+    Value* lslot;
+    Value* rslot;
+    std::string const* key;
+    uint32 lindex;
+    uint32 rindex;
+    bool same;
+  };
+
+  EventStream& lhs_;
+  size_t pos_;
+  std::vector<Frame> stack_;
+
+  // right side values that are copied whole: a subtree into rslot, or the rest of an object after
+  // a key mismatch into rrest_
+  Visitor* capture_;
+  uint32 depth_;
+  std::unique_ptr<BuilderVisitor> builder_;
+  std::unique_ptr<Document> lrest_;
+  std::unique_ptr<Document> rrest_;
+  std::unique_ptr<DocumentBuilder> rrestBuilder_;
+
+  Value::Type lhsType() const;
+  bool startSlot();
+  void finishSlot();
+  void copyLeft(Value& dst);
+  void startCapture(Visitor* visitor);
+  void finishCapture();
+  template<class Equal, class Set>
+  bool scalar(Value::Type type, Equal const& equal, Set const& set);
+  bool open(Value::Type type);
+  void closeFrame();
+};
+
+}
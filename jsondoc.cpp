@@ -0,0 +1,351 @@
+#include "jsondoc.h"
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+namespace json {
+
+static Node const undefinedNode;
+static std::string const emptyString;
+
+Arena::Arena()
+  : pos_(nullptr)
+  , left_(0)
+  , next_(MinBlock)
+  , size_(0)
+{}
+Arena::~Arena() {
+  clear();
+}
+
+void* Arena::alloc(size_t size) {
+  size = (size + 7) & ~size_t(7);
+  if (size > left_) {
+    // blocks grow with the arena, so that small documents stay small; allocations that do not
+    // fit in the next block get a block of their own and leave the current one in use
+    size_t block = std::max<size_t>(next_, size);
+    char* ptr = static_cast<char*>(malloc(block));
+    if (!ptr) throw Exception("out of memory");
+    blocks_.push_back(ptr);
+    size_ += block;
+    if (block > next_) return ptr;
+    next_ = std::min<size_t>(next_ * 2, MaxBlock);
+    pos_ = ptr;
+    left_ = block;
+  }
+  void* res = pos_;
+  pos_ += size;
+  left_ -= size;
+  return res;
+}
+
+void Arena::clear() {
+  for (char* block : blocks_) {
+    free(block);
+  }
+  blocks_.clear();
+  pos_ = nullptr;
+  left_ = 0;
+  next_ = MinBlock;
+  size_ = 0;
+}
+
+// tString
+std::string const& Node::getString() const {
+  return (type_ == Value::tString ? *string_ : emptyString);
+}
+
+// tNumber
+bool Node::isInteger() const {
+  switch (type_) {
+  case Value::tInteger: return true;
+  case Value::tNumber: return (int)number_ == number_;
+  default: return false;
+  }
+}
+int Node::getInteger() const {
+  if (!isInteger()) return 0;
+  switch (type_) {
+  case Value::tInteger: return int_;
+  case Value::tNumber: return static_cast<int>(number_);
+  default: return 0;
+  }
+}
+double Node::getNumber() const {
+  switch (type_) {
+  case Value::tInteger: return static_cast<double>(int_);
+  case Value::tNumber: return number_;
+  default: return 0;
+  }
+}
+
+// tObject
+template<class K>
+Node const* Node::find(K const& name) const {
+  if (type_ != Value::tObject) return nullptr;
+  size_t left = 0, right = size_;
+  while (left < right) {
+    size_t mid = (left + right) / 2;
+    int cmp = map_[mid].first.compare(name);
+    if (cmp == 0) return &map_[mid].second;
+    if (cmp < 0) {
+      left = mid + 1;
+    } else {
+      right = mid;
+    }
+  }
+  return nullptr;
+}
+template Node const* Node::find(std::string const& name) const;
+template Node const* Node::find(char const* const& name) const;
+
+Node const& Node::operator[](std::string const& name) const {
+  Node const* ptr = get(name);
+  return (ptr ? *ptr : undefinedNode);
+}
+Node const& Node::operator[](char const* name) const {
+  Node const* ptr = get(name);
+  return (ptr ? *ptr : undefinedNode);
+}
+
+// tArray
+Node const& Node::operator[](int i) const {
+  if (type_ != Value::tArray || i < 0 || static_cast<uint32>(i) >= size_) return undefinedNode;
+  return array_[i];
+}
+
+Node::ConstIterator Node::begin() const {
+  switch (type_) {
+  case Value::tObject:
+    return ConstIterator(map_);
+  case Value::tArray:
+    return ConstIterator(array_);
+  default:
+    return ConstIterator();
+  }
+}
+Node::ConstIterator Node::end() const {
+  switch (type_) {
+  case Value::tObject:
+    return ConstIterator(map_ + size_);
+  case Value::tArray:
+    return ConstIterator(array_ + size_);
+  default:
+    return ConstIterator();
+  }
+}
+
+bool Node::walk(Visitor* visitor) const {
+  switch (type_) {
+  case Value::tUndefined:
+  case Value::tNull:
+    return visitor->onNull();
+  case Value::tBoolean:
+    return visitor->onBoolean(bool_);
+  case Value::tString:
+    return visitor->onString(*string_);
+  case Value::tInteger:
+    return visitor->onInteger(int_);
+  case Value::tNumber:
+    return visitor->onNumber(number_);
+  case Value::tObject:
+    if (!visitor->onOpenMap()) return false;
+    for (uint32 i = 0; i < size_; ++i) {
+      if (!visitor->onMapKey(map_[i].first)) return false;
+      if (!map_[i].second.walk(visitor)) return false;
+    }
+    return visitor->onCloseMap();
+  case Value::tArray:
+    if (!visitor->onOpenArray()) return false;
+    for (uint32 i = 0; i < size_; ++i) {
+      if (!array_[i].walk(visitor)) return false;
+    }
+    return visitor->onCloseArray();
+  default:
+    return false;
+  }
+}
+
+void Node::copy(Value& dst) const {
+  switch (type_) {
+  case Value::tNull:
+    dst.setType(Value::tNull);
+    break;
+  case Value::tBoolean:
+    dst.setBoolean(bool_);
+    break;
+  case Value::tString:
+    dst.setString(*string_);
+    break;
+  case Value::tInteger:
+    dst.setInteger(int_);
+    break;
+  case Value::tNumber:
+    dst.setNumber(number_);
+    break;
+  case Value::tObject:
+    dst.setType(Value::tObject);
+    for (uint32 i = 0; i < size_; ++i) {
+      map_[i].second.copy(dst[map_[i].first]);
+    }
+    break;
+  case Value::tArray:
+    dst.setType(Value::tArray);
+    for (uint32 i = 0; i < size_; ++i) {
+      array_[i].copy(dst[static_cast<int>(i)]);
+    }
+    break;
+  default:
+    dst.clear();
+  }
+}
+Value Node::value() const {
+  Value res;
+  copy(res);
+  return res;
+}
+
+Document::Document(StringTable* strings)
+  : strings_(strings)
+{
+  if (!strings_) {
+    own_.reset(new StringTable);
+    strings_ = own_.get();
+  }
+}
+
+void Document::clear() {
+  static_cast<Node&>(*this) = Node();
+  arena_.clear();
+  if (own_) own_->clear();
+}
+
+DocumentBuilder::DocumentBuilder(Document& document, bool throwExceptions)
+  : Visitor(throwExceptions)
+  , document_(document)
+  , key_(nullptr)
+  , finished_(false)
+{}
+
+bool DocumentBuilder::setValue(Node const& value) {
+  if (stack_.empty()) {
+    if (finished_) return false;
+    static_cast<Node&>(document_) = value;
+    return true;
+  }
+  Slot slot = {nullptr, value};
+  if (stack_.back().type == Value::tObject) {
+    if (!key_) return false;
+    slot.key = key_;
+    key_ = nullptr;
+  }
+  slots_.push_back(slot);
+  return true;
+}
+
+bool DocumentBuilder::onNull() {
+  Node node;
+  node.type_ = Value::tNull;
+  return setValue(node);
+}
+bool DocumentBuilder::onBoolean(bool val) {
+  Node node;
+  node.type_ = Value::tBoolean;
+  node.bool_ = val;
+  return setValue(node);
+}
+bool DocumentBuilder::onInteger(int val) {
+  Node node;
+  node.type_ = Value::tInteger;
+  node.int_ = val;
+  return setValue(node);
+}
+bool DocumentBuilder::onNumber(double val) {
+  Node node;
+  node.type_ = Value::tNumber;
+  node.number_ = val;
+  return setValue(node);
+}
+bool DocumentBuilder::onString(std::string const& val) {
+  Node node;
+  node.type_ = Value::tString;
+  node.string_ = document_.strings_->intern(val);
+  return setValue(node);
+}
+bool DocumentBuilder::onMapKey(std::string const& key) {
+  if (stack_.empty() || stack_.back().type != Value::tObject || key_) return false;
+  key_ = document_.strings_->intern(key);
+  return true;
+}
+
+bool DocumentBuilder::open(uint32 type) {
+  if (stack_.empty() ? finished_ : (stack_.back().type == Value::tObject && !key_)) {
+    return false;
+  }
+  Frame frame = {type, key_, slots_.size()};
+  stack_.push_back(frame);
+  key_ = nullptr;
+  return true;
+}
+
+static bool slotLess(std::string const* lhs, std::string const* rhs) {
+  return lhs != rhs && *lhs < *rhs;
+}
+
+bool DocumentBuilder::close(uint32 type) {
+  if (stack_.empty() || stack_.back().type != type || key_) return false;
+  Frame frame = stack_.back();
+  stack_.pop_back();
+
+  Slot* first = slots_.data() + frame.start;
+  Slot* last = slots_.data() + slots_.size();
+  Node node;
+  node.type_ = type;
+  if (type == Value::tObject) {
+    std::stable_sort(first, last, [](Slot const& lhs, Slot const& rhs) {
+      return slotLess(lhs.key, rhs.key);
+    });
+    Node::Member* members = document_.arena_.alloc<Node::Member>(last - first);
+    uint32 count = 0;
+    for (Slot* slot = first; slot != last; ++slot) {
+      if (slot + 1 != last && slot[1].key == slot->key) continue;
+      new(members + count++) Node::Member{*slot->key, slot->value};
+    }
+    node.size_ = count;
+    node.map_ = members;
+  } else {
+    Node* items = document_.arena_.alloc<Node>(last - first);
+    uint32 count = 0;
+    for (Slot* slot = first; slot != last; ++slot) {
+      new(items + count++) Node(slot->value);
+    }
+    node.size_ = count;
+    node.array_ = items;
+  }
+  slots_.resize(frame.start);
+
+  if (stack_.empty()) {
+    static_cast<Node&>(document_) = node;
+    finished_ = true;
+    return true;
+  }
+  key_ = frame.key;
+  return setValue(node);
+}
+
+bool parse(File& file, Document& document, int mode, std::string* func, bool throwExceptions) {
+  if (!file) return false;
+  document.clear();
+  DocumentBuilder builder(document, throwExceptions);
+  return parse(file, &builder, mode, func);
+}
+
+bool write(File& file, Node const& value, int mode, char const* func) {
+  WriterVisitor writer(file, mode, func);
+  writer.setIndent(2);
+  if (!value.walk(&writer)) return false;
+  return writer.onEnd();
+}
+
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+// read-only JSON documents
+//
+// json::Value keeps every object in a std::map and every string, array and object in a separate
+// heap allocation, which is slow to build and to destroy for large trees. A Document is built once
+// (with DocumentBuilder, or json::parse) and then only read: all nodes live in a memory arena owned
+// by the document, arrays and objects are contiguous runs of nodes, object members are sorted by
+// key, and keys and string values are interned in a StringTable that may be shared between
+// documents (equal strings from documents with the same table have the same address).
+//
+// The read interface matches json::Value: type(), get*(), has/get/operator[], length/at,
+// iteration with key(), getMap() and walk(). copy() and value() turn a node into a json::Value.
+
+#include "json.h"
+#include <memory>
+#include <unordered_set>
+
+namespace json {
+
+class StringTable {
+public:
+  StringTable() {}
+  StringTable(StringTable const&) = delete;
+
+  std::string const* intern(std::string const& str) {
+    return &*strings_.insert(str).first;
+  }
+  size_t size() const {
+    return strings_.size();
+  }
+  void clear() {
+    strings_.clear();
+  }
+
+private:
+  std::unordered_set<std::string> strings_;
+};
+
+// memory is only released by clear() or the destructor
+class Arena {
+public:
+  Arena();
+  Arena(Arena const&) = delete;
+  ~Arena();
+
+  void* alloc(size_t size);
+  template<class T>
+  T* alloc(size_t count) {
+    return static_cast<T*>(alloc(sizeof(T) * count));
+  }
+
+  void clear();
+  size_t size() const {
+    return size_;
+  }
+
+private:
+  enum { MinBlock = 4096, MaxBlock = 1048576 };
+  std::vector<char*> blocks_;
+  char* pos_;
+  size_t left_;
+  size_t next_;
+  size_t size_;
+};
+
+class Node {
+public:
+  typedef Value::Type Type;
+  struct Member;
+
+  template<class T>
+  class Range {
+  public:
+    Range(T const* begin, T const* end)
+      : begin_(begin)
+      , end_(end)
+    {}
+    T const* begin() const {
+      return begin_;
+    }
+    T const* end() const {
+      return end_;
+    }
+    size_t size() const {
+      return end_ - begin_;
+    }
+    bool empty() const {
+      return begin_ == end_;
+    }
+  private:
+    T const* begin_;
+    T const* end_;
+  };
+
+  Node()
+    : type_(Value::tUndefined)
+    , size_(0)
+  {
+    number_ = 0;
+  }
+
+  Type type() const {
+    return static_cast<Type>(type_);
+  }
+
+  // tBoolean
+  bool getBoolean() const {
+    return (type_ == Value::tBoolean ? bool_ : false);
+  }
+
+  // tString
+  std::string const& getString() const;
+
+  // tNumber
+  bool isInteger() const;
+  int getInteger() const;
+  double getNumber() const;
+
+  // tObject
+  Range<Member> getMap() const;
+  bool has(std::string const& name) const {
+    return get(name) != nullptr;
+  }
+  bool has(char const* name) const {
+    return get(name) != nullptr;
+  }
+  Node const* get(std::string const& name) const {
+    return find(name);
+  }
+  Node const* get(char const* name) const {
+    return find(name);
+  }
+  Node const& operator[](std::string const& name) const;
+  Node const& operator[](char const* name) const;
+
+  bool hasProperty(char const* name, uint8 type) const {
+    Node const* prop = get(name);
+    return prop && prop->type() == type;
+  }
+
+  // tArray
+  Range<Node> getArray() const {
+    return (type_ == Value::tArray ? Range<Node>(array_, array_ + size_) : Range<Node>(nullptr, nullptr));
+  }
+  uint32 length() const {
+    return (type_ == Value::tArray ? size_ : 0);
+  }
+  Node const* at(uint32 i) const {
+    return (type_ == Value::tArray && i < size_ ? &array_[i] : nullptr);
+  }
+  Node const& operator[](int i) const;
+
+  class ConstIterator {
+    Type type_;
+    Member const* map_;
+    Node const* array_;
+    friend class Node;
+    ConstIterator(Member const* map) : type_(Value::tObject), map_(map), array_(nullptr) {}
+    ConstIterator(Node const* array) : type_(Value::tArray), map_(nullptr), array_(array) {}
+  public:
+    ConstIterator() : type_(Value::tUndefined), map_(nullptr), array_(nullptr) {}
+
+    ConstIterator& operator++();
+    bool operator==(ConstIterator const& it) const {
+      return type_ == it.type_ && map_ == it.map_ && array_ == it.array_;
+    }
+    bool operator!=(ConstIterator const& it) const {
+      return !(*this == it);
+    }
+
+    Node const& operator*() const;
+    Node const* operator->() const {
+      return &**this;
+    }
+    std::string const& key() const;
+  };
+  typedef ConstIterator Iterator;
+
+  ConstIterator begin() const;
+  ConstIterator end() const;
+
+  bool walk(Visitor* visitor) const;
+  // deep copy into a json::Value (undefined nodes clear dst)
+  void copy(Value& dst) const;
+  Value value() const;
+
+protected:
+  friend class DocumentBuilder;
+  uint32 type_;
+  uint32 size_;
+  union {
+    bool bool_;
+    int int_;
+    double number_;
+    std::string const* string_;
+    Node const* array_;
+    Member const* map_;
+  };
+
+  template<class K>
+  Node const* find(K const& name) const;
+};
+
+// members are placed in the arena in key order; first points into the document's StringTable
+struct Node::Member {
+  std::string const& first;
+  Node second;
+};
+
+inline Node::Range<Node::Member> Node::getMap() const {
+  return (type_ == Value::tObject ? Range<Member>(map_, map_ + size_) : Range<Member>(nullptr, nullptr));
+}
+inline Node::ConstIterator& Node::ConstIterator::operator++() {
+  if (type_ == Value::tObject) ++map_;
+  if (type_ == Value::tArray) ++array_;
+  return *this;
+}
+inline Node const& Node::ConstIterator::operator*() const {
+  return (type_ == Value::tObject ? map_->second : *array_);
+}
+inline std::string const& Node::ConstIterator::key() const {
+  return map_->first;
+}
+
+// a document is its own root node; pass a StringTable to share interned strings with other
+// documents, otherwise the document keeps a table of its own
+class Document : public Node {
+public:
+  explicit Document(StringTable* strings = nullptr);
+  Document(Document const&) = delete;
+
+  void clear();
+
+  StringTable& strings() {
+    return *strings_;
+  }
+  // bytes reserved for nodes (the string table is not included)
+  size_t memory() const {
+    return arena_.size();
+  }
+
+private:
+  friend class DocumentBuilder;
+  Arena arena_;
+  std::unique_ptr<StringTable> own_;
+  StringTable* strings_;
+};
+
+// builds a Document from visitor events; children are collected on a stack and copied into the
+// arena as one block when their array or object is closed, objects are sorted by key and the last
+// of duplicate keys is kept (as json::Value::insert would)
+class DocumentBuilder : public Visitor {
+public:
+  DocumentBuilder(Document& document, bool throwExceptions = false);
+
+  bool onNull();
+  bool onBoolean(bool val);
+  bool onInteger(int val);
+  bool onNumber(double val);
+  bool onString(std::string const& val);
+  bool onOpenMap() {
+    return open(Value::tObject);
+  }
+  bool onMapKey(std::string const& key);
+  bool onCloseMap() {
+    return close(Value::tObject);
+  }
+  bool onOpenArray() {
+    return open(Value::tArray);
+  }
+  bool onCloseArray() {
+    return close(Value::tArray);
+  }
+
+protected:
+  struct Slot {
+    std::string const* key;
+    Node value;
+  };
+  struct Frame {
+    uint32 type;
+    std::string const* key;
+    size_t start;
+  };
+  Document& document_;
+  std::string const* key_;
+  std::vector<Slot> slots_;
+  std::vector<Frame> stack_;
+  bool finished_;
+
+  bool setValue(Node const& value);
+  bool open(uint32 type);
+  bool close(uint32 type);
+};
+
+bool parse(File& file, Document& document, int mode = mJSON, std::string* func = nullptr, bool throwExceptions = false);
+inline bool parse(File&& file, Document& document, int mode = mJSON, std::string* func = nullptr, bool throwExceptions = false) {
+  return parse(file, document, mode, func, throwExceptions);
+}
+
+bool write(File& file, Node const& value, int mode = mJSON, char const* func = nullptr);
+inline bool write(File&& file, Node const& value, int mode = mJSON, char const* func = nullptr) {
+  return write(file, value, mode, func);
+}
+
+}
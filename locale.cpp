@@ -6,7 +6,9 @@
 #include "affixes.h"
 #include "translations.h"
 #include "itemlib.h"
+#include "gamebalance.h"
 #include "types/Recipe.h"
+#include "jsondoc.h"
 
 template<class Func>
 bool testString(std::string const& str, Func const& func) {
@@ -249,18 +251,23 @@ void GenerateItems(json::Value& value, json::Value& data) {
   std::map<std::string, std::string> powerFix;
   powerFix.emplace("Unique_Amulet_109_x1_210", "ItemPassive_x1_Amulet_norm_unique_25_DemonHunter");
 
+  // recipe affixes come from 1xx_AffixList only, same-named rows in other files are ignored
+  auto& table = GameBalanceTables::affixes();
+  uint32 affixFile = GameBalanceTables::file("1xx_AffixList");
   std::map<uint32, GameBalance::Type::AffixTableEntry*> affixes;
-  SnoFile<GameBalance> affixFile("1xx_AffixList");
-  for (auto& afx : affixFile->x078_AffixTable) {
-    affixes.emplace(HashNameLower(afx.x000_Text), &afx);
+  for (uint32 row = 0; row < table.size(); ++row) {
+    if (table.file(row) == affixFile) {
+      affixes.emplace(table.id(row), &table[row]);
+    }
   }
   for (auto& rcp : SnoLoader::All<Recipe>()) {
     std::string item = rcp->x0C_ItemSpecifierData.x00_ItemsGameBalanceId.name();
     if (item.empty()) continue;
     uint32 power = 0;
     for (auto& id : rcp->x0C_ItemSpecifierData.x08_GameBalanceIds) {
-      if (affixes.count(id)) {
-        for (auto& attr : affixes[id]->x260_AttributeSpecifiers) {
+      auto it = affixes.find(id);
+      if (it != affixes.end()) {
+        for (auto& attr : it->second->x260_AttributeSpecifiers) {
           if (attr.x00_Type == powId) {
             power = attr.x04_Param;
             break;
@@ -343,21 +350,17 @@ void GenerateItems(json::Value& value, json::Value& data) {
 
 void GenerateItemSets(json::Value& value, json::Value& data) {
   uint32 powId = fixAttrId(1270, true);
-  SnoFile<GameBalance> sets("SetItemBonuses");
+  auto& sets = GameBalanceTables::setBonuses();
+  uint32 setFile = GameBalanceTables::file("SetItemBonuses");
   std::map<std::string, uint32> setMap;
   std::map<uint32, std::string> setNames;
-  std::map<uint32, std::vector<GameBalance::Type::SetItemBonusTableEntry*>> entries;
-  auto namesEn = Strings::list("ItemSets", SnoLoader::default);
+  auto namesEn = Strings::list("ItemSets", SnoLoader::primary);
   auto names = Strings::list("ItemSets");
-  for (auto& bonus : sets->x168_SetItemBonusTable) {
-    if (bonus.x108_SetItemBonusesGameBalanceId == -1) {
-      if (namesEn.has(bonus.x000_Text)) {
-        uint32 id = HashNameLower(bonus.x000_Text);
-        setMap[namesEn[bonus.x000_Text]] = id;
-        setNames[id] = bonus.x000_Text;
-      }
-    } else if (bonus.x10C) {
-      entries[bonus.x108_SetItemBonusesGameBalanceId].push_back(&bonus);
+  for (uint32 row = 0; row < sets.size(); ++row) {
+    auto& bonus = sets[row];
+    if (sets.file(row) == setFile && bonus.x108_SetItemBonusesGameBalanceId == -1 && namesEn.has(bonus.x000_Text)) {
+      setMap[namesEn[bonus.x000_Text]] = sets.id(row);
+      setNames[sets.id(row)] = bonus.x000_Text;
     }
   }
 
@@ -373,7 +376,9 @@ void GenerateItemSets(json::Value& value, json::Value& data) {
     data["setMap"][kv.first] = setNames[id];
     if (!kv.second.has("bonuses")) continue;
     std::map<int, std::vector<std::string>> powers;
-    for (auto* bonus : entries[id]) {
+    for (uint32 row : GameBalanceTables::setBonuses(id)) {
+      auto* bonus = &sets[row];
+      if (sets.file(row) != setFile || !bonus->x10C) continue;
       std::vector<AttributeSpecifier> specs;
       for (auto& attr : bonus->x110_AttributeSpecifiers) {
         if (attr.x00_Type == powId) specs.emplace_back(attr);
@@ -485,12 +490,12 @@ void GenerateSimBuffs(json::Value& value, json::Value& data) {
 
   auto powers = Strings::list("Powers");
   auto attrs = Strings::list("AttributeDescriptions");
-  auto powersEn = Strings::list("Powers", SnoLoader::default);
-  auto attrsEn = Strings::list("AttributeDescriptions", SnoLoader::default);
+  auto powersEn = Strings::list("Powers", SnoLoader::primary);
+  auto attrsEn = Strings::list("AttributeDescriptions", SnoLoader::primary);
   auto sets = Strings::list("ItemSets");
-  auto setsEn = Strings::list("ItemSets", SnoLoader::default);
+  auto setsEn = Strings::list("ItemSets", SnoLoader::primary);
   auto items = Strings::list("Items");
-  auto itemsEn = Strings::list("Items", SnoLoader::default);
+  auto itemsEn = Strings::list("Items", SnoLoader::primary);
 
   for (auto& kv : data["simMapping"]["buffs"].getMap()) {
     std::string type = kv.second["category"].getString();
@@ -635,9 +640,9 @@ void FormatLocale(std::string const& dest, int flags) {
     }
   }
 
-  json::Value src;
+  json::Document src;
   json::parse(File("locale_base/datasource.js"), src, json::mJS);
-  auto powersEn = Strings::list("Powers", SnoLoader::default);
+  auto powersEn = Strings::list("Powers", SnoLoader::primary);
   for (auto& kv1 : src.getMap()) {
     for (auto& kv2 : kv1.second.getMap()) {
       for (auto& kv3 : kv2.second.getMap()) {
@@ -664,7 +669,7 @@ void FormatLocale(std::string const& dest, int flags) {
   }
 }
 
-void CompareJson(json::Value& lhs, json::Value& rhs, json::Value& output) {
+void CompareJson(json::Node const& lhs, json::Node const& rhs, json::Value& output) {
   std::string lstr, rstr;
   if (rhs.type() != lhs.type()) return;
   switch (lhs.type()) {
@@ -687,26 +692,26 @@ void CompareJson(json::Value& lhs, json::Value& rhs, json::Value& output) {
     break;
   case json::Value::tObject:
     for (auto it = lhs.begin(); it != lhs.end(); ++it) {
-      if (rhs.has(it.key())) {
-        CompareJson(*it, rhs[it.key()], output);
+      if (json::Node const* sub = rhs.get(it.key())) {
+        CompareJson(*it, *sub, output);
       }
     }
     break;
   }
 }
-void CompareJsonRight(json::Value& lhs, json::Value& rhs, json::Value& output) {
+void CompareJsonRight(json::Node const& lhs, json::Node const& rhs, json::Value& output) {
   for (auto& kv : rhs.getMap()) {
     if (kv.second.type() == json::Value::tObject) {
       for (auto& skv : kv.second.getMap()) {
-        output[kv.first][skv.first] = skv.second;
+        skv.second.copy(output[kv.first][skv.first]);
       }
     } else {
-      output["Global"][kv.first] = kv.second;
+      kv.second.copy(output["Global"][kv.first]);
     }
   }
 }
 
-typedef void(*CompareFunc)(json::Value& lhs, json::Value& rhs, json::Value& output);
+typedef void(*CompareFunc)(json::Node const& lhs, json::Node const& rhs, json::Value& output);
 static struct {
   std::string name;
   CompareFunc func;
@@ -731,7 +736,8 @@ static struct {
 void CompareLocale() {
   json::Value output;
   for (auto& pair : compareList) {
-    json::Value lhs, rhs;
+    json::StringTable strings;
+    json::Document lhs(&strings), rhs(&strings);
     File flhs("locale" / pair.name);
     File frhs("locale_diff" / pair.name);
     if (!frhs) continue;
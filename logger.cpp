@@ -4,6 +4,7 @@
 #include "common.h"
 #include <algorithm>
 #include <list>
+#include <mutex>
 
 Logger Logger::instance;
 
@@ -52,6 +53,9 @@ static Logger::Task _root;
 Logger::Task* Logger::root = &_root;
 Logger::Task* Logger::top = nullptr;
 
+// progress may be reported from worker threads
+static std::recursive_mutex logMutex;
+
 void Logger::Task::move(int y) {
   erase();
   pos.Y = y;
@@ -249,19 +253,23 @@ Logger::Task::~Task() {
 }
 
 void* Logger::begin(size_t count, char const* name, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
   Task* task = (task_ ? (Task*)task_ : top);
   if (!task) task = root;
   return top = task->insert(count, std::string(name ? name : ""));
 }
 void Logger::item(char const* name, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
   Task* task = (task_ ? (Task*)task_ : top);
   task->item(name);
 }
 void Logger::progress(size_t count, bool add, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
   Task* task = (task_ ? (Task*)task_ : top);
   task->progress(count, add);
 }
 void Logger::end(bool pop, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
   Task* task = (task_ ? (Task*)task_ : top);
   if (top == task) top = task->parent;
   if (pop) {
@@ -275,6 +283,7 @@ void Logger::log(char const* fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
   std::string text = varfmtstring(fmt, ap);
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
   root->insert(Task::cLog, text);
   va_end(ap);
   if (!instance.logfile) {
@@ -103,7 +103,7 @@ void archon();
 
 template<class T>
 void SnoMerge(std::map<uint32, std::string>& dst) {
-  auto& src = SnoManager::get<T>().get();
+  auto& src = SnoManager::get<T>();
   for (auto& kv : src) {
     dst[kv.first] = kv.second;
   }
@@ -169,7 +169,7 @@ void write_tex(std::string const& name, ImageFormat::Type format = ImageFormat::
   SnoFile<Textures> tex(name);
   tex->load(0).write("Tex/" + name + ".png", format);
 }
-void item_flavor(SnoLoader* loader = SnoLoader::default);
+void item_flavor(SnoLoader* loader = SnoLoader::primary);
 void translate_extra();
 
 std::string ActorApp(uint32 aid) {
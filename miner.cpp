@@ -3,11 +3,13 @@
 #include "strings.h"
 #include "regexp.h"
 #include "affixes.h"
+#include "gamebalance.h"
 #include "types/StringList.h"
 #include "types/SkillKit.h"
 #include "types/Actor.h"
 #include "types/Recipe.h"
 #include "powertag.h"
+#include "jsondiff.h"
 #include <algorithm>
 #include <locale>
 #include <cctype>
@@ -143,12 +145,7 @@ void parseItem(GameBalance::Type::Item const& item, json::Value& to, bool html)
   }
 
   dst["name"] = stl.items[id];
-  uint32 type = item.x10C_ItemTypesGameBalanceId;
-  while (true) {
-    uint32 parent = GameAffixes::itemTypeParent(type);
-    if (!parent || parent == -1) break;
-    type = parent;
-  }
+  uint32 type = GameBalanceTables::typeRoot(item.x10C_ItemTypesGameBalanceId);
   uint32 setbonus = item.x170_SetItemBonusesGameBalanceId;
   char const* setname = SnoManager::gameBalance()[setbonus];
   if (setname) {
@@ -530,7 +527,7 @@ void diff(File& file, json::Value const& lhs, json::Value const& rhs, std::vecto
     }
     file.printf(">\n");
     if (links) {
-      file.printf("   <i><a href=\"/powers/%d/%s\">%s</a></i>\n", SnoLoader::default->build(), key.c_str(), key.c_str());
+      file.printf("   <i><a href=\"/powers/%d/%s\">%s</a></i>\n", SnoLoader::primary->build(), key.c_str(), key.c_str());
     } else {
       file.printf("   <i>%s</i>\n", key.c_str());
     }
@@ -569,9 +566,9 @@ void diff(File& file, json::Value const& lhs, json::Value const& rhs, std::vecto
           for (auto& lr : list) {
             if (sub == "powers") {
               if (lr.second) {
-                file.printf("    <a href=\"/powers/%d/%s\">", SnoLoader::default->build(), firstKey(*lr.second).c_str());
+                file.printf("    <a href=\"/powers/%d/%s\">", SnoLoader::primary->build(), firstKey(*lr.second).c_str());
               } else {
-                file.printf("    <a href=\"/powers/%d/%s\">", SnoLoader::default->build(), firstKey(*lr.first).c_str());
+                file.printf("    <a href=\"/powers/%d/%s\">", SnoLoader::primary->build(), firstKey(*lr.first).c_str());
               }
             } else {
               file.printf("    ");
@@ -640,7 +637,7 @@ void makehtml(File& file, json::Value const& val, std::vector<std::string> const
     }
     file.printf(">\n");
     if (links) {
-      file.printf("   <i><a href=\"/powers/%d/%s\">%s</a></i>\n", SnoLoader::default->build(), key.c_str(), key.c_str());
+      file.printf("   <i><a href=\"/powers/%d/%s\">%s</a></i>\n", SnoLoader::primary->build(), key.c_str(), key.c_str());
     } else {
       file.printf("   <i>%s</i>\n", key.c_str());
     }
@@ -665,7 +662,7 @@ void makehtml(File& file, json::Value const& val, std::vector<std::string> const
         file.printf("   <span class=\"label\">%s</span>: <p class=\"indent\">\n", sub.c_str());
         for (auto& lri : lv) {
           if (sub == "powers") {
-            file.printf("    <a href=\"/powers/%d/%s\">", SnoLoader::default->build(), firstKey(lri).c_str());
+            file.printf("    <a href=\"/powers/%d/%s\">", SnoLoader::primary->build(), firstKey(lri).c_str());
           } else {
             file.printf("    ");
           }
@@ -718,55 +715,102 @@ json::Value dumpPower(json::Value const& pow) {
 
 namespace MinerPrivate {
 
-  void dumpfile(SnoLoader& loader, std::string const& name, ParseFunc func, std::string const& type) {
-    Logger::item(name.c_str());
+  void dumpfile(File& src, std::string const& name, ParseFunc func, std::string const& type) {
     File out("diff" / type / name + ".txt", "w");
     json::WriterVisitor writer(out);
     writer.setIndent(2);
-    func(loader, name, &writer);
+    func(src, &writer);
     writer.onEnd();
   }
-  void readfile(SnoLoader& loader, std::string const& name, ParseFunc func, json::Value& value) {
-    json::BuilderVisitor builder(value);
-    func(loader, name, &builder);
-    builder.onEnd();
+
+  static bool sameContents(File& lhs, File& rhs) {
+    if (lhs.size() != rhs.size()) return false;
+    uint8 const* ldata = lhs.borrow();
+    uint8 const* rdata = rhs.borrow();
+    if (ldata && rdata) {
+      return !memcmp(ldata, rdata, static_cast<size_t>(lhs.size()));
+    }
+    std::vector<uint8> lbuf(65536), rbuf(65536);
+    lhs.seek(0);
+    rhs.seek(0);
+    size_t count;
+    bool same = true;
+    while (same && (count = lhs.read(lbuf.data(), lbuf.size())) != 0) {
+      same = (rhs.read(rbuf.data(), count) == count && !memcmp(lbuf.data(), rbuf.data(), count));
+    }
+    lhs.seek(0);
+    rhs.seek(0);
+    return same;
   }
 
-  void fulldiff(SnoLoader& lhs, SnoLoader& rhs,
+  void fulldiff(SnoLoader& lhs, SnoLoader& rhs, LoadFunc load, KeyFunc key,
     ParseFunc func, ListFunc list, std::string const& type)
   {
-    std::set<istring> names;
+    enum Status { Unchanged, Changed, Added, Removed };
+    struct Entry {
+      istring name;
+      SnoLoader* loader;
+      Status status;
+    };
+    std::vector<Entry> entries;
     auto lhs_list = list(lhs);
     auto rhs_list = list(rhs);
-    for (auto& x : lhs_list) names.insert(x);
-    for (auto& x : rhs_list) names.insert(x);
-    Logger::begin(names.size(), ("Comparing " + type).c_str());
     auto li = lhs_list.begin(), ri = rhs_list.begin();
     while (li != lhs_list.end() || ri != rhs_list.end()) {
-      if (li == lhs_list.end()) {
-        dumpfile(rhs, *ri++, func, type);
-      } else if (ri == rhs_list.end()) {
-        dumpfile(lhs, *li++, func, type);
+      Entry entry;
+      if (ri == rhs_list.end() || (li != lhs_list.end() && *li < *ri)) {
+        entry = Entry{*li++, &lhs, Removed};
+      } else if (li == lhs_list.end() || *ri < *li) {
+        entry = Entry{*ri++, &rhs, Added};
       } else {
-        if (*li == *ri) {
-          auto name = *li++;
-          ri++;
-          Logger::item(name.c_str());
-          json::Value lval, rval;
-          readfile(lhs, name, func, lval);
-          readfile(rhs, name, func, rval);
-          jsonCompare(lval, rval, false);
-          if (lval.type() != json::Value::tUndefined) {
-            json::write(File("diff" / type / name + "_lhs.txt", "w"), lval);
-            json::write(File("diff" / type / name + "_rhs.txt", "w"), rval);
-          }
-        } else if (*li < *ri) {
-          dumpfile(lhs, *li++, func, type);
-        } else {
-          dumpfile(rhs, *ri++, func, type);
-        }
+        entry = Entry{*li++, nullptr, Unchanged};
+        ri++;
       }
+      entries.push_back(entry);
     }
-    Logger::end();
+
+    // every entry writes its own files, so the order in which they finish does not matter
+    void* task = Logger::begin(entries.size(), ("Comparing " + type).c_str());
+    ThreadPool::instance().parallel_for(entries.size(), [&](size_t i) {
+      Entry& entry = entries[i];
+      std::string name = entry.name;
+      Logger::item(name.c_str(), task);
+      if (entry.loader) {
+        File src = load(*entry.loader, name);
+        dumpfile(src, name, func, type);
+        return;
+      }
+      // equal content keys mean equal files; otherwise compare the bytes before parsing
+      uint8 lkey[16], rkey[16];
+      if (key(lhs, name, lkey) && key(rhs, name, rkey) && !memcmp(lkey, rkey, sizeof lkey)) {
+        return;
+      }
+      File lsrc = load(lhs, name);
+      File rsrc = load(rhs, name);
+      if (sameContents(lsrc, rsrc)) return;
+      // the old version is recorded and the new one compared with it as it is parsed, only
+      // the differences are built as json::Value (same result as jsonCompare without noArrays)
+      json::EventStream lstream;
+      func(lsrc, &lstream);
+      lstream.onEnd();
+      json::Value lval, rval;
+      json::DiffVisitor differ(lstream, lval, rval);
+      func(rsrc, &differ);
+      differ.onEnd();
+      if (lval.type() != json::Value::tUndefined) {
+        entry.status = Changed;
+        json::write(File("diff" / type / name + "_lhs.txt", "w"), lval);
+        json::write(File("diff" / type / name + "_rhs.txt", "w"), rval);
+      }
+    });
+    Logger::end(false, task);
+
+    size_t counts[4] = {0, 0, 0, 0};
+    for (auto& entry : entries) {
+      ++counts[entry.status];
+    }
+    Logger::log("%s: %d changed, %d added, %d removed, %d unchanged", type.c_str(),
+      (int) counts[Changed], (int) counts[Added], (int) counts[Removed], (int) counts[Unchanged]);
   }
 }
+
@@ -5,18 +5,21 @@
 //
 // parseItem, parseSetBonus, parsePower - parse into json
 //
-// jsonCompare - compare two json values, only leave different entries
+// jsonCompare - compare two json values, only leave different entries (or copy them out of two
+//   read-only documents)
 //
 // diff, makehtml - generate diff/dump json as html, json values must have a certain structure:
 //   id: {name1: value1, name2: value2, ...}, where values are plain numbers/strings, or arrays of numbers/strings
 //   see uses in garbage.cpp for details
 //
-// fulldiff<T> - find *all* differences between two game versions (in files of type T)
+// fulldiff<T> - find *all* differences between two game versions (in files of type T); files with
+//   equal contents are skipped without parsing, the rest are compared on the thread pool
 
 #pragma once
 #include "types/GameBalance.h"
 #include "types/Power.h"
 #include "json.h"
+#include "jsondoc.h"
 #include <set>
 
 void parseItem(GameBalance::Type::Item const& item, json::Value& to, bool html);
@@ -24,17 +27,27 @@ void parseSetBonus(GameBalance::Type::SetItemBonusTableEntry const& bonus, json:
 void parsePower(Power::Type const& power, json::Value& to, bool html);
 
 void jsonCompare(json::Value& lhs, json::Value& rhs, bool noArrays = true);
+void jsonCompare(json::Node const& lhs, json::Node const& rhs, json::Value& lout, json::Value& rout);
 
 std::vector<std::string> mergeKeys(json::Value const& lhs, json::Value const& rhs, std::set<std::string> const& excl = {});
 void diff(File& file, json::Value const& lhs, json::Value const& rhs, std::vector<std::string> const& order = {}, bool links = false);
 void makehtml(File& file, json::Value const& val, std::vector<std::string> const& order = {}, bool links = false);
 
 namespace MinerPrivate {
-  typedef void(*ParseFunc)(SnoLoader&, std::string const&, json::Visitor*);
+  typedef File(*LoadFunc)(SnoLoader&, std::string const&);
+  typedef bool(*KeyFunc)(SnoLoader&, std::string const&, uint8*);
+  typedef void(*ParseFunc)(File&, json::Visitor*);
   typedef std::vector<istring>(*ListFunc)(SnoLoader&);
   template<class T>
-  void parse(SnoLoader& loader, std::string const& name, json::Visitor* visitor) {
-    File src = loader.load<T>(name);
+  File load(SnoLoader& loader, std::string const& name) {
+    return loader.load<T>(name);
+  }
+  template<class T>
+  bool contentkey(SnoLoader& loader, std::string const& name, uint8* key) {
+    return loader.contentkey<T>(name, key);
+  }
+  template<class T>
+  void parse(File& src, json::Visitor* visitor) {
     T::parse(src, visitor);
   }
   template<class T>
@@ -47,11 +60,12 @@ namespace MinerPrivate {
     res.resize(std::unique(res.begin(), res.end()) - res.begin());
     return res;
   }
-  void fulldiff(SnoLoader& lhs, SnoLoader& rhs,
+  void fulldiff(SnoLoader& lhs, SnoLoader& rhs, LoadFunc load, KeyFunc key,
     ParseFunc func, ListFunc list, std::string const& type);
 }
 
 template<class T>
 void fulldiff(SnoLoader& lhs, SnoLoader& rhs) {
-  MinerPrivate::fulldiff(lhs, rhs, MinerPrivate::parse<T>, MinerPrivate::list<T>, T::type());
+  MinerPrivate::fulldiff(lhs, rhs, MinerPrivate::load<T>, MinerPrivate::contentkey<T>,
+    MinerPrivate::parse<T>, MinerPrivate::list<T>, T::type());
 }
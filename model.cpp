@@ -643,7 +643,7 @@ public:
     viewer->setPoint(PT_BOTTOMRIGHT, 0, 0);
 
     listActors();
-    for (auto& ani : SnoManager::get<Anim>().get()) {
+    for (auto& ani : SnoManager::get<Anim>()) {
       anims->insertEx(ani.first, ani.second);
     }
     anims->sortEx();
@@ -653,7 +653,7 @@ public:
     int m = mode->getCurSel();
     actors->clear();
     if (m == 2) {
-      for (auto& acr : SnoManager::get<Appearance>().get()) {
+      for (auto& acr : SnoManager::get<Appearance>()) {
         actors->insert(acr.first, acr.second);
       }
     } else if (m == 1) {
@@ -665,7 +665,7 @@ public:
         if (!name.empty()) actors->insert(id, name);
       }
     } else {
-      for (auto& acr : SnoManager::get<Actor>().get()) {
+      for (auto& acr : SnoManager::get<Actor>()) {
         actors->insert(acr.first, acr.second);
       }
     }
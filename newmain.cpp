@@ -4,6 +4,7 @@
 #include <conio.h>
 #include <set>
 #include "snomap.h"
+#include "benchmark.h"
 #include "strings.h"
 #include "stringmgr.h"
 #include "parser.h"
@@ -170,7 +171,7 @@ void write_icon(Archive& dsticons, GameBalance::Type::Item const& item) {
 static json::Value versions;
 
 void OpExtract() {
-  uint32 build = SnoLoader::default->build();
+  uint32 build = SnoLoader::primary->build();
   std::string suffix = fmtstring(".%d.js", build);
   json::Value js_sets;
   json::Value js_items;
@@ -195,7 +196,7 @@ void OpExtract() {
 }
 
 void OpCompare() {
-  uint32 build = SnoLoader::default->build();
+  uint32 build = SnoLoader::primary->build();
   if (!File::exists(path::work() / fmtstring("items.%d.js", build))) {
     Logger::log("Please extract game data first");
     return;
@@ -252,7 +253,7 @@ void OpExtractIcons() {
 
 void OpDumpPowers() {
   json::Value value = PowerTags::dump();
-  File out(path::work() / fmtstring("jspowers.%d.js", SnoLoader::default->build()), "wb");
+  File out(path::work() / fmtstring("jspowers.%d.js", SnoLoader::primary->build()), "wb");
   out.printf("var Powers=");
   json::WriterVisitor visitor(out, json::mJS);
   value.walk(&visitor);
@@ -271,6 +272,7 @@ struct {
   { "Extract icons", OpExtractIcons },
   { "Model viewer", ViewModels },
   { "Dump powers", OpDumpPowers },
+  { "Benchmarks", Benchmark::menu },
   { "Exit", nullptr },
 };
 
@@ -310,7 +312,7 @@ int do_main() {
       } while (choice < '1' || choice > '9');
       pos += (choice - '1');
       if (pos >= builds.size()) throw Exception("invalid build number");
-      SnoLoader::default = new SnoCdnLoader(builds[pos], "choose");
+      SnoLoader::primary = new SnoCdnLoader(builds[pos], "choose");
       break;
     } else if (game_choice == game_options.size() - 1) {
       return 0;
@@ -343,13 +345,13 @@ int do_main() {
       if (GetFileAttributes((dir / ".build.info").c_str()) != INVALID_FILE_ATTRIBUTES) {
         dir = dir / "Data";
       }
-      SnoLoader::default = new SnoCascLoader(dir, "choose");
+      SnoLoader::primary = new SnoCascLoader(dir, "choose");
       break;
     }
   }
-  Logger::log("Loaded build %d", SnoLoader::default->build());
+  Logger::log("Loaded build %d", SnoLoader::primary->build());
   json::parse(File(path::work() / "versions.js"), versions);
-  versions[fmtstring("%d", SnoLoader::default->build())] = SnoLoader::default->version();
+  versions[fmtstring("%d", SnoLoader::primary->build())] = SnoLoader::primary->version();
   json::write(File(path::work() / "versions.js", "wb"), versions);
 
   while (true) {
@@ -1,9 +1,15 @@
 #include "ngdp.h"
+#ifdef _WIN32
 #include "http.h"
+#endif
 #include "path.h"
 #include "checksum.h"
 #include "logger.h"
+#include "threadpool.h"
 #include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
 
 namespace NGDP {
 
@@ -23,9 +29,19 @@ namespace NGDP {
     file.seek(0);
   }
 
+#ifdef _WIN32
+  static File httpGet(std::string const& url) {
+    return HttpRequest::get(url);
+  }
+#else
+  static File httpGet(std::string const& url) {
+    return File();
+  }
+#endif
+
   std::map<std::string, CdnData> GetCdns(std::string const& app) {
     std::map<std::string, CdnData> result;
-    File f = HttpRequest::get(HOST + "/" + app + "/cdns");
+    File f = httpGet(HOST + "/" + app + "/cdns");
     if (!f) return result;
     bool first = true;
     for (std::string const& line : f) {
@@ -39,7 +55,7 @@ namespace NGDP {
   }
   std::map<std::string, VersionData> GetVersions(std::string const& app) {
     std::map<std::string, VersionData> result;
-    File f = HttpRequest::get(HOST + "/" + app + "/versions");
+    File f = httpGet(HOST + "/" + app + "/versions");
     if (!f) return result;
     bool first = true;
     for (std::string const& line : f) {
@@ -54,6 +70,13 @@ namespace NGDP {
     return result;
   }
 
+  NGDP::NGDP(std::string const& base, VersionData const& version)
+    : base_(base)
+    , version_(version)
+  {
+    if (!base_.empty() && base_.back() != '/') base_.push_back('/');
+  }
+
   NGDP::NGDP(std::string const& app, std::string const& region) {
     auto cdns = GetCdns(app);
     auto versions = GetVersions(app);
@@ -72,9 +95,9 @@ namespace NGDP {
   File NGDP::load(std::string const& hash, std::string const& type, bool index, char const* preload) const {
     std::string path = path::work() / CACHE / type / hash;
     if (index) path += ".index";
-    File file(path);
+    File file = File::mapfile(path);
     if (file) return file;
-    file = HttpRequest::get(geturl(hash, type, index));
+    file = get(geturl(hash, type, index));
     if (!file) return file;
     if (preload) {
       ::NGDP::preload(preload, file);
@@ -84,55 +107,237 @@ namespace NGDP {
     return file;
   }
 
-  File DecodeBLTE(File& blte, uint32 eusize) {
-    if (blte.read32(true) != 'BLTE') return File();
+  File NGDP::get(std::string const& url) const {
+    return httpGet(url);
+  }
+
+#ifdef _WIN32
+  File NGDP::get(std::string const& url, uint32 first, uint32 last, uint32& start, uint32& total) const {
+    HttpRequest request(url);
+    request.addHeader(fmtstring("Range: bytes=%u-%u", first, last));
+    request.send();
+    uint32 status = request.status();
+    if (status != 200 && status != 206) return File();
+    auto headers = request.headers();
+    File response = request.response();
+    if (!response) return File();
+    uint32 end;
+    if (headers.count("Content-Range")) {
+      if (sscanf(headers["Content-Range"].c_str(), "bytes %u-%u/%u", &start, &end, &total) != 3) {
+        return File();
+      }
+    } else {
+      // server ignored the range and sent the whole archive
+      start = 0;
+      total = response.size();
+      end = total - 1;
+    }
+    if (end < start || response.size() < end - start + 1) return File();
+    return response.subfile(0, end - start + 1);
+  }
+#else
+  File NGDP::get(std::string const& url, uint32 first, uint32 last, uint32& start, uint32& total) const {
+    return File();
+  }
+#endif
+
+  struct BlteChunk {
+    uint64 offset;  // position of the mode byte in the encoded file
+    uint32 csize;   // including the mode byte
+    uint32 usize;
+    uint64 uoffset; // position in the decoded file
+    Hash hash;
+    bool verify;
+  };
+
+  // read the chunk table; headerless files are treated as a single unverified chunk
+  static bool ReadBLTE(File& blte, std::vector<BlteChunk>& chunks, uint64& total, uint32 eusize) {
+    if (blte.read32(true) != 'BLTE') return false;
     uint32 headerSize = blte.read32(true);
+    total = 0;
     if (headerSize) {
-      std::vector<uint32> csize;
-      std::vector<uint32> usize;
       uint16 flags = blte.read16(true);
-      uint16 chunks = blte.read16(true);
-      for (uint16 i = 0; i < chunks; ++i) {
-        csize.push_back(blte.read32(true));
-        usize.push_back(blte.read32(true));
-        blte.seek(16, SEEK_CUR);
-      }
-      MemoryFile dst;
-      std::vector<uint8> tmp;
-      for (uint16 i = 0; i < chunks; ++i) {
-        uint8 type = blte.read8();
-        if (type == 'N') {
-          if (csize[i] - 1 != usize[i]) return File();
-          blte.read(dst.reserve(usize[i]), usize[i]);
-        } else if (type == 'Z') {
-          tmp.resize(csize[i] - 1);
-          blte.read(&tmp[0], tmp.size());
-          if (gzinflate(&tmp[0], tmp.size(), dst.reserve(usize[i]), &usize[i])) return File();
-        } else {
-          // unsupported compression
-          return File();
-        }
+      uint16 count = blte.read16(true);
+      uint64 offset = headerSize;
+      chunks.resize(count);
+      for (auto& chunk : chunks) {
+        chunk.offset = offset;
+        chunk.csize = blte.read32(true);
+        chunk.usize = blte.read32(true);
+        chunk.uoffset = total;
+        chunk.verify = true;
+        if (blte.read(chunk.hash, sizeof(Hash)) != sizeof(Hash) || !chunk.csize) return false;
+        offset += chunk.csize;
+        total += chunk.usize;
       }
-      dst.seek(0);
-      return dst;
+      return offset <= blte.size();
     } else {
+      chunks.resize(1);
+      BlteChunk& chunk = chunks[0];
+      chunk.offset = blte.tell();
+      chunk.csize = blte.size() - chunk.offset;
+      chunk.uoffset = 0;
+      chunk.verify = false;
+      if (!chunk.csize) return false;
       uint8 type = blte.read8();
-      uint64 offset = blte.tell();
-      uint64 size = blte.size() - offset;
       if (type == 'N') {
-        return blte.subfile(offset, size);
+        chunk.usize = chunk.csize - 1;
       } else if (type == 'Z' && eusize) {
-        std::vector<uint8> tmp(size);
-        blte.read(&tmp[0], size);
-        MemoryFile dst;
-        if (gzinflate(&tmp[0], size, dst.reserve(eusize), &eusize)) return File();
-        dst.seek(0);
-        return dst;
+        chunk.usize = eusize;
       } else {
         // unsupported compression
-        return File();
+        return false;
+      }
+      total = chunk.usize;
+      return true;
+    }
+  }
+
+  // src points at the mode byte, dst has room for chunk.usize bytes
+  static bool DecodeChunk(uint8 const* src, BlteChunk const& chunk, uint8* dst) {
+    if (chunk.verify) {
+      Hash hash;
+      MD5::checksum(src, chunk.csize, hash);
+      if (memcmp(hash, chunk.hash, sizeof(Hash))) return false;
+    }
+    if (src[0] == 'N') {
+      if (chunk.csize - 1 != chunk.usize) return false;
+      memcpy(dst, src + 1, chunk.usize);
+      return true;
+    } else if (src[0] == 'Z') {
+      uint32 usize = chunk.usize;
+      return !gzinflate(src + 1, chunk.csize - 1, dst, &usize) && usize == chunk.usize;
+    } else {
+      // unsupported compression
+      return false;
+    }
+  }
+
+  File DecodeBLTE(File& blte, uint32 eusize) {
+    std::vector<BlteChunk> chunks;
+    uint64 total;
+    if (!ReadBLTE(blte, chunks, total, eusize)) return File();
+    if (!chunks[0].verify) {
+      // headerless file, uncompressed data can be used as is
+      blte.seek(chunks[0].offset);
+      if (blte.read8() == 'N') return blte.subfile(chunks[0].offset + 1, chunks[0].usize);
+    }
+
+    // the encoded data is needed in memory anyway, read it once instead of once per chunk
+    std::vector<uint8> copy;
+    uint8 const* src = blte.borrow();
+    if (!src) {
+      copy.resize(blte.size());
+      blte.seek(0);
+      if (blte.read(copy.data(), copy.size()) != copy.size()) return File();
+      src = copy.data();
+    }
+
+    MemoryFile dst(std::max<size_t>(total, 1));
+    uint8* out = dst.reserve(total);
+    std::atomic<bool> failed(false);
+    auto decode = [&](size_t i) {
+      if (!failed && !DecodeChunk(src + chunks[i].offset, chunks[i], out + chunks[i].uoffset)) {
+        failed = true;
+      }
+    };
+    if (chunks.size() > 1 && total >= ParallelBLTE) {
+      ThreadPool::instance().parallel_for(chunks.size(), decode);
+    } else {
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        decode(i);
       }
     }
+    if (failed) return File();
+    dst.seek(0);
+    return dst;
+  }
+
+  class BlteStreamBuffer : public FileBuffer {
+  public:
+    BlteStreamBuffer(File& blte, std::vector<BlteChunk>& chunks, uint64 size)
+      : blte_(blte)
+      , size_(size)
+      , pos_(0)
+      , current_(-1)
+    {
+      chunks_.swap(chunks);
+    }
+
+    uint64 tell() const {
+      return pos_;
+    }
+    void seek(int64 pos, int mode) {
+      switch (mode) {
+      case SEEK_CUR:
+        pos += pos_;
+        break;
+      case SEEK_END:
+        pos += size_;
+        break;
+      }
+      if (pos < 0) pos = 0;
+      if (pos > size_) pos = size_;
+      pos_ = pos;
+    }
+    uint64 size() {
+      return size_;
+    }
+
+    size_t read(void* ptr, size_t size) {
+      uint8* dst = (uint8*) ptr;
+      size_t done = 0;
+      while (done < size && pos_ < size_) {
+        if (!load()) break;
+        BlteChunk const& chunk = chunks_[current_];
+        size_t offset = pos_ - chunk.uoffset;
+        size_t count = std::min<size_t>(size - done, chunk.usize - offset);
+        memcpy(dst + done, data_.data() + offset, count);
+        done += count;
+        pos_ += count;
+      }
+      return done;
+    }
+    size_t write(void const* ptr, size_t size) {
+      return 0;
+    }
+
+  private:
+    File blte_;
+    std::vector<BlteChunk> chunks_;
+    uint64 size_;
+    uint64 pos_;
+    size_t current_;
+    std::vector<uint8> data_;
+    std::vector<uint8> encoded_;
+
+    // decode the chunk containing pos_
+    bool load() {
+      if (current_ < chunks_.size() && pos_ >= chunks_[current_].uoffset &&
+          pos_ < chunks_[current_].uoffset + chunks_[current_].usize) {
+        return true;
+      }
+      auto it = std::upper_bound(chunks_.begin(), chunks_.end(), pos_, [](uint64 pos, BlteChunk const& chunk) {
+        return pos < chunk.uoffset;
+      });
+      if (it == chunks_.begin()) return false;
+      BlteChunk const& chunk = *--it;
+      current_ = -1;
+      encoded_.resize(chunk.csize);
+      data_.resize(chunk.usize);
+      blte_.seek(chunk.offset);
+      if (blte_.read(encoded_.data(), chunk.csize) != chunk.csize) return false;
+      if (!DecodeChunk(encoded_.data(), chunk, data_.data())) return false;
+      current_ = it - chunks_.begin();
+      return true;
+    }
+  };
+
+  File StreamBLTE(File& blte, uint32 eusize) {
+    std::vector<BlteChunk> chunks;
+    uint64 total;
+    if (!ReadBLTE(blte, chunks, total, eusize)) return File();
+    return File(new BlteStreamBuffer(blte, chunks, total));
   }
 
   std::map<std::string, std::string> ParseConfig(File& file) {
@@ -209,225 +414,703 @@ namespace NGDP {
       while (*ptr) ++ptr;
     }
 
+    // pages are independent: verify and index them in parallel, then merge the lists in file order
+    std::vector<uint8> pageHeaders(header.entriesA * 32);
     file.seek(posHeaderA, SEEK_SET);
-    encodingTable_.resize(header.entriesA);
-    for (uint32 i = 0; i < header.entriesA; ++i) {
-      file.read(encodingTable_[i].hash, sizeof(Hash));
-      Hash blockHash, realHash;
-      file.read(blockHash, sizeof blockHash);
-      MD5::checksum(entriesA, 4096, realHash);
-      if (memcmp(realHash, blockHash, sizeof(Hash))) {
+    file.read(pageHeaders.data(), pageHeaders.size());
+    std::vector<std::vector<std::pair<uint64, uint32>>> pages(header.entriesA);
+    ThreadPool::instance().parallel_for(header.entriesA, [&](size_t i) {
+      uint8* page = entriesA + i * 4096;
+      Hash realHash;
+      MD5::checksum(page, 4096, realHash);
+      if (memcmp(realHash, &pageHeaders[i * 32 + 16], sizeof(Hash))) {
         throw Exception("encoding file checksum mismatch");
       }
-      for (uint8* ptr = entriesA; ptr + sizeof(EncodingEntry) <= entriesA + 4096;) {
+      for (uint8* ptr = page; ptr + sizeof(EncodingEntry) <= page + 4096;) {
         EncodingEntry* entry = reinterpret_cast<EncodingEntry*>(ptr);
         if (!entry->keyCount) break;
-        encodingTable_[i].entries.push_back(entry);
+        pages[i].emplace_back(KeyIndex::prefix(entry->hash), ptr - &data_[0]);
         flip(entry->usize);
         ptr += sizeof(EncodingEntry) + (entry->keyCount - 1) * sizeof(Hash);
       }
-      entriesA += 4096;
-    }
+    });
+    encodingIndex_.build(pages);
 
     Hash nilHash;
     memset(nilHash, 0, sizeof(Hash));
 
+    pageHeaders.resize(header.entriesB * 32);
     file.seek(posHeaderB, SEEK_SET);
-    layoutTable_.resize(header.entriesB);
-    for (uint32 i = 0; i < header.entriesB; ++i) {
-      file.read(layoutTable_[i].key, sizeof(Hash));
-      Hash blockHash, realHash;
-      file.read(blockHash, sizeof blockHash);
-      MD5::checksum(entriesB, 4096, realHash);
-      if (memcmp(realHash, blockHash, sizeof(Hash))) {
+    file.read(pageHeaders.data(), pageHeaders.size());
+    pages.assign(header.entriesB, std::vector<std::pair<uint64, uint32>>());
+    ThreadPool::instance().parallel_for(header.entriesB, [&](size_t i) {
+      uint8* page = entriesB + i * 4096;
+      Hash realHash;
+      MD5::checksum(page, 4096, realHash);
+      if (memcmp(realHash, &pageHeaders[i * 32 + 16], sizeof(Hash))) {
         throw Exception("encoding file checksum mismatch");
       }
-      for (uint8* ptr = entriesB; ptr + sizeof(LayoutEntry) <= entriesB + 4096;) {
+      for (uint8* ptr = page; ptr + sizeof(LayoutEntry) <= page + 4096;) {
         LayoutEntry* entry = reinterpret_cast<LayoutEntry*>(ptr);
         if (!memcmp(entry->key, nilHash, sizeof(Hash))) {
           break;
         }
-        layoutTable_[i].entries.push_back(entry);
+        pages[i].emplace_back(KeyIndex::prefix(entry->key), ptr - &data_[0]);
         flip(entry->stringIndex);
         flip(entry->csize);
         ptr += sizeof(LayoutEntry);
       }
-      entriesB += 4096;
+    });
+    layoutIndex_.build(pages);
+  }
+
+  void Encoding::KeyIndex::build(std::vector<std::vector<std::pair<uint64, uint32>>>& pages) {
+    std::vector<std::pair<uint64, uint32>> entries;
+    for (auto& page : pages) {
+      entries.insert(entries.end(), page.begin(), page.end());
+      std::vector<std::pair<uint64, uint32>>().swap(page);
+    }
+    // pages are sorted in the file; only sort if that ever stops being true
+    if (!std::is_sorted(entries.begin(), entries.end())) {
+      std::sort(entries.begin(), entries.end());
     }
+    prefixes_.resize(entries.size());
+    offsets_.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      prefixes_[i] = entries[i].first;
+      offsets_[i] = entries[i].second;
+    }
+    jump_.resize((1 << JumpBits) + 1);
+    size_t pos = 0;
+    for (uint32 i = 0; i < (1 << JumpBits); ++i) {
+      while (pos < prefixes_.size() && (prefixes_[pos] >> (64 - JumpBits)) < i) ++pos;
+      jump_[i] = pos;
+    }
+    jump_[1 << JumpBits] = prefixes_.size();
   }
 
-  template<class Vec, class Comp>
-  typename Vec::const_iterator find_hash(Vec const& vec, Comp less) {
-    if (vec.empty() || less(vec[0])) return vec.end();
-    size_t left = 0, right = vec.size();
-    while (right - left > 1) {
-      size_t mid = (left + right) / 2;
-      if (less(vec[mid])) {
-        right = mid;
-      } else {
-        left = mid;
-      }
+  uint32 Encoding::KeyIndex::find(const Hash key, uint8 const* base, uint32 keyOffset, uint32 from) const {
+    uint64 prefix = KeyIndex::prefix(key);
+    uint32 bucket = uint32(prefix >> (64 - JumpBits));
+    uint32 right = jump_[bucket + 1];
+    uint32 left = std::min(std::max(jump_[bucket], from), right);
+    uint32 pos = std::lower_bound(prefixes_.begin() + left, prefixes_.begin() + right, prefix) - prefixes_.begin();
+    for (uint32 i = pos; i < right && prefixes_[i] == prefix; ++i) {
+      if (!memcmp(base + offsets_[i] + keyOffset, key, sizeof(Hash))) return i;
     }
-    return vec.begin() + left;
+    return NotFound;
   }
 
   Encoding::EncodingEntry const* Encoding::getEncoding(const Hash hash) const {
-    auto it = find_hash(encodingTable_, [&hash](EncodingHeader const& rhs) {
-      return memcmp(hash, rhs.hash, sizeof(Hash)) < 0;
-    });
-    if (it == encodingTable_.end()) return nullptr;
-    auto sub = find_hash(it->entries, [&hash](EncodingEntry const* rhs) {
-      return memcmp(hash, rhs->hash, sizeof(Hash)) < 0;
-    });
-    if (sub == it->entries.end()) return nullptr;
-    if (memcmp((*sub)->hash, hash, sizeof(Hash))) return nullptr;
-    return *sub;
+    uint32 pos = encodingIndex_.find(hash, &data_[0], offsetof(EncodingEntry, hash));
+    if (pos == KeyIndex::NotFound) return nullptr;
+    return reinterpret_cast<EncodingEntry const*>(&data_[encodingIndex_.offset(pos)]);
   }
   Encoding::LayoutEntry const* Encoding::getLayout(const Hash key) const {
-    auto it = find_hash(layoutTable_, [&key](LayoutHeader const& rhs) {
-      return memcmp(key, rhs.key, sizeof(Hash)) < 0;
-    });
-    if (it == layoutTable_.end()) return nullptr;
-    auto sub = find_hash(it->entries, [&key](LayoutEntry const* rhs) {
-      return memcmp(key, rhs->key, sizeof(Hash)) < 0;
+    uint32 pos = layoutIndex_.find(key, &data_[0], offsetof(LayoutEntry, key));
+    if (pos == KeyIndex::NotFound) return nullptr;
+    return reinterpret_cast<LayoutEntry const*>(&data_[layoutIndex_.offset(pos)]);
+  }
+
+  void Encoding::getEncodings(Hash_container const* hashes, size_t count, EncodingEntry const** result) const {
+    // resolve in key order, so that each search starts where the previous match was
+    std::vector<uint32> order(count);
+    for (size_t i = 0; i < count; ++i) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [hashes](uint32 lhs, uint32 rhs) {
+      return memcmp(hashes[lhs]._, hashes[rhs]._, sizeof(Hash)) < 0;
     });
-    if (sub == it->entries.end()) return nullptr;
-    if (memcmp((*sub)->key, key, sizeof(Hash))) return nullptr;
-    return *sub;
+    uint32 from = 0;
+    for (uint32 i : order) {
+      uint32 pos = encodingIndex_.find(hashes[i]._, &data_[0], offsetof(EncodingEntry, hash), from);
+      if (pos == KeyIndex::NotFound) {
+        result[i] = nullptr;
+      } else {
+        result[i] = reinterpret_cast<EncodingEntry const*>(&data_[encodingIndex_.offset(pos)]);
+        from = pos;
+      }
+    }
   }
 
+  struct ArchiveIndexHeader {
+    enum { Magic = 'AIDX', Version = 1 };
+    uint32 magic;
+    uint32 version;
+    uint32 archives;
+    uint32 count;
+  };
+
   ArchiveIndex::ArchiveIndex(NGDP const& ngdp, uint32 blockSize)
     : ngdp_(ngdp)
     , blockSize_(blockSize)
+    , entries_(nullptr)
+    , jump_(nullptr)
   {
-    Hash nilHash;
-    memset(nilHash, 0, sizeof(Hash));
-
     File cdnFile = ngdp.load(ngdp.version().cdn);
     if (!cdnFile) return;
     std::vector<std::string> archives = split(ParseConfig(cdnFile)["archives"]);
 
     archives_.resize(archives.size());
-    Logger::begin(archives.size(), "Loading indices");
     for (size_t i = 0; i < archives.size(); ++i) {
       archives_[i].name = archives[i];
+      File mask(path::work() / CACHE / "data" / archives[i] + ".mask");
+      if (mask) {
+        archives_[i].mask.resize(mask.size());
+        mask.read(&archives_[i].mask[0], archives_[i].mask.size());
+      }
+    }
+
+    std::string cachePath = path::work() / CACHE / "data" / ngdp.version().cdn + ".idx";
+    if (loadCache(cachePath)) return;
+
+    Hash nilHash;
+    memset(nilHash, 0, sizeof(Hash));
 
-      Logger::item(nullptr);
+    std::vector<std::vector<IndexEntry>> lists(archives.size());
+    std::vector<uint8> missing(archives.size(), 0);
+    void* task = Logger::begin(archives.size(), "Loading indices");
+    ThreadPool::instance().parallel_for(archives.size(), [&](size_t i) {
+      Logger::item(nullptr, task);
       File index = ngdp.load(archives[i], "data", true);
-      if (!index) continue;
+      if (!index) {
+        missing[i] = 1;
+        return;
+      }
       size_t size = index.size();
+      std::vector<uint8> copy;
+      uint8 const* data = index.borrow();
+      if (!data) {
+        copy.resize(size);
+        size = index.read(copy.data(), size);
+        data = copy.data();
+      }
+      auto& list = lists[i];
       for (size_t block = 0; block + 4096 <= size; block += 4096) {
-        Hash hash;
-        index.seek(block, SEEK_SET);
-        for (size_t pos = 0; pos + 24 <= 4096; pos += 24) {
-          index.read(hash, sizeof(Hash));
-          if (!memcmp(hash, nilHash, sizeof(Hash))) {
+        uint8 const* ptr = data + block;
+        for (size_t pos = 0; pos + 24 <= 4096; pos += 24, ptr += 24) {
+          if (!memcmp(ptr, nilHash, sizeof(Hash))) {
             block = size;
             break;
           }
-          auto& dst = index_[Hash_container::from(hash)];
+          list.emplace_back();
+          IndexEntry& dst = list.back();
+          memcpy(dst.key, ptr, sizeof(Hash));
           dst.index = i;
-          dst.size = index.read32(true);
-          dst.offset = index.read32(true);
+          dst.size = _byteswap_ulong(*reinterpret_cast<uint32 const*>(ptr + 16));
+          dst.offset = _byteswap_ulong(*reinterpret_cast<uint32 const*>(ptr + 20));
         }
       }
+    });
+    Logger::end(false, task);
 
-      File mask(path::work() / CACHE / "data" / archives[i] + ".mask");
-      if (mask) {
-        archives_[i].mask.resize(mask.size());
-        mask.read(&archives_[i].mask[0], archives_[i].mask.size());
-      }
+    build(lists);
+    // an incomplete index is not cached, so the missing archives are retried on the next run
+    if (std::find(missing.begin(), missing.end(), 1) == missing.end()) {
+      saveCache(cachePath);
     }
-    Logger::end();
   }
 
-  File ArchiveIndex::load(Hash const& hash) {
-    auto it = index_.find(Hash_container::from(hash));
-    if (it == index_.end()) return ngdp_.load(hash, "data");
-    std::string archivePath = path::work() / CACHE / "data" / archives_[it->second.index].name;
-
-    uint32 offset = it->second.offset;
-    uint32 size = it->second.size;
-    uint32 blockStart = offset / blockSize_;
-    uint32 blockEnd = (offset + size + blockSize_ - 1) / blockSize_;
-    auto& mask = archives_[it->second.index].mask;
-    uint32 getStart = blockEnd;
-    uint32 getEnd = blockStart;
+  void ArchiveIndex::build(std::vector<std::vector<IndexEntry>>& lists) {
+    size_t total = 0;
+    for (auto const& list : lists) {
+      total += list.size();
+    }
+    table_.clear();
+    table_.reserve(total);
+    for (auto& list : lists) {
+      table_.insert(table_.end(), list.begin(), list.end());
+      std::vector<IndexEntry>().swap(list);
+    }
+    // keys found in several archives resolve to the last one, as they did when later indices
+    // overwrote earlier ones
+    std::sort(table_.begin(), table_.end(), [](IndexEntry const& lhs, IndexEntry const& rhs) {
+      int cmp = memcmp(lhs.key, rhs.key, sizeof(Hash));
+      return cmp ? cmp < 0 : lhs.index < rhs.index;
+    });
+    size_t count = 0;
+    for (size_t i = 0; i < table_.size(); ++i) {
+      if (i + 1 < table_.size() && !memcmp(table_[i].key, table_[i + 1].key, sizeof(Hash))) continue;
+      table_[count++] = table_[i];
+    }
+    table_.resize(count);
+
+    jumpTable_.resize(JumpSize + 1);
+    size_t pos = 0;
+    for (uint32 i = 0; i < JumpSize; ++i) {
+      while (pos < count && ((table_[pos].key[0] << 8) | table_[pos].key[1]) < i) ++pos;
+      jumpTable_[i] = pos;
+    }
+    jumpTable_[JumpSize] = count;
+
+    entries_ = table_.data();
+    jump_ = jumpTable_.data();
+  }
+
+  bool ArchiveIndex::loadCache(std::string const& path) {
+    File file = File::mapfile(path);
+    if (!file) return false;
+    uint8 const* data = file.borrow();
+    if (!data || file.size() < sizeof(ArchiveIndexHeader)) return false;
+    ArchiveIndexHeader const* header = reinterpret_cast<ArchiveIndexHeader const*>(data);
+    if (header->magic != ArchiveIndexHeader::Magic || header->version != ArchiveIndexHeader::Version ||
+        header->archives != archives_.size()) {
+      return false;
+    }
+    uint64 size = sizeof(ArchiveIndexHeader) + (JumpSize + 1) * sizeof(uint32) + uint64(header->count) * sizeof(IndexEntry);
+    if (file.size() < size) return false;
+    jump_ = reinterpret_cast<uint32 const*>(data + sizeof(ArchiveIndexHeader));
+    entries_ = reinterpret_cast<IndexEntry const*>(jump_ + JumpSize + 1);
+    bool valid = (jump_[JumpSize] == header->count);
+    for (uint32 i = 0; valid && i < JumpSize; ++i) {
+      valid = (jump_[i] <= jump_[i + 1]);
+    }
+    for (uint32 i = 0; valid && i < header->count; ++i) {
+      valid = (entries_[i].index < archives_.size());
+    }
+    if (!valid) {
+      jump_ = nullptr;
+      entries_ = nullptr;
+      return false;
+    }
+    source_ = file;
+    return true;
+  }
+
+  void ArchiveIndex::saveCache(std::string const& path) {
+    File file(path, "wb");
+    if (!file) return;
+    ArchiveIndexHeader header;
+    header.magic = ArchiveIndexHeader::Magic;
+    header.version = ArchiveIndexHeader::Version;
+    header.archives = archives_.size();
+    header.count = table_.size();
+    file.write(header);
+    file.write(jumpTable_.data(), jumpTable_.size() * sizeof(uint32));
+    file.write(table_.data(), table_.size() * sizeof(IndexEntry));
+  }
+
+  ArchiveIndex::IndexEntry const* ArchiveIndex::find(Hash const& hash) const {
+    if (!jump_) return nullptr;
+    uint32 bucket = (hash[0] << 8) | hash[1];
+    IndexEntry const* first = entries_ + jump_[bucket];
+    IndexEntry const* last = entries_ + jump_[bucket + 1];
+    IndexEntry const* it = std::lower_bound(first, last, hash, [](IndexEntry const& lhs, uint8 const* rhs) {
+      return memcmp(lhs.key, rhs, sizeof(Hash)) < 0;
+    });
+    if (it == last || memcmp(it->key, hash, sizeof(Hash))) return nullptr;
+    return it;
+  }
+
+  ArchiveIndex::Range ArchiveIndex::missing(IndexEntry const& entry) const {
+    Range range;
+    range.archive = entry.index;
+    uint32 blockStart = entry.offset / blockSize_;
+    uint32 blockEnd = (entry.offset + entry.size + blockSize_ - 1) / blockSize_;
+    auto& mask = archives_[entry.index].mask;
+    range.start = blockEnd;
+    range.end = blockStart;
     for (uint32 i = blockStart; i < blockEnd; ++i) {
       if (i / 8 >= mask.size() || !(mask[i / 8] & (1 << (i & 7)))) {
-        getStart = std::min(getStart, i);
-        getEnd = std::max(getEnd, i + 1);
-      }
-    }
-    if (getStart < getEnd) {
-      std::string url = ngdp_.geturl(archives_[it->second.index].name, "data");
-      HttpRequest request(url);
-      request.addHeader(fmtstring("Range: bytes=%u-%u", getStart * blockSize_, getEnd * blockSize_ - 1));
-      request.send();
-      uint32 status = request.status();
-      if (status != 200 && status != 206) return File();
-      auto headers = request.headers();
-      File result = request.response();
-      File archive = File(archivePath, "rb+");
-      if (!archive) archive = File(archivePath, "wb+");
-      if (headers.count("Content-Range")) {
-        uint32 start, end, total;
-        if (sscanf(headers["Content-Range"].c_str(), "bytes %u-%u/%u", &start, &end, &total) != 3) {
-          return File();
-        }
-        if (archive.size() < total) {
-          archive.seek(total - 1, SEEK_SET);
-          archive.putc(0);
-        }
-        archive.seek(start, SEEK_SET);
-        archive.copy(result, end - start + 1);
-        start = (start + blockSize_ - 1) / blockSize_;
-        if (end >= total - 1) {
-          end = (end + blockSize_) / blockSize_;
-        } else {
-          end = (end + 1) / blockSize_;
-        }
-        total = (total + blockSize_ - 1) / blockSize_;
-        mask.resize((total + 7) / 8, 0);
-        for (uint32 i = start; i < end; ++i) {
-          mask[i / 8] |= (1 << (i & 7));
-        }
-        File(path::work() / CACHE / "data" / archives_[it->second.index].name + ".mask", "wb").write(&mask[0], mask.size());
-      } else {
-        archive.copy(result);
+        range.start = std::min(range.start, i);
+        range.end = std::max(range.end, i + 1);
+      }
+    }
+    return range;
+  }
+
+  bool ArchiveIndex::fetch(Range const& range, MemoryFile& body, uint32& start) {
+    uint32 total;
+    File response = ngdp_.get(ngdp_.geturl(archives_[range.archive].name, "data"),
+      range.start * blockSize_, range.end * blockSize_ - 1, start, total);
+    if (!response) return false;
+    body.copy(response);
+    if (!body.csize() || start + body.csize() > total) return false;
+    uint32 end = start + body.csize() - 1;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string archivePath = path::work() / CACHE / "data" / archives_[range.archive].name;
+    File archive = File(archivePath, "rb+");
+    if (!archive) archive = File(archivePath, "wb+");
+    if (!archive) return false;
+    if (archive.size() < total) {
+      archive.seek(total - 1, SEEK_SET);
+      archive.putc(0);
+    }
+    archive.seek(start, SEEK_SET);
+    archive.write(body.data(), end - start + 1);
+
+    // mark blocks that are now complete
+    uint32 first = (start + blockSize_ - 1) / blockSize_;
+    uint32 last;
+    if (end >= total - 1) {
+      last = (end + blockSize_) / blockSize_;
+    } else {
+      last = (end + 1) / blockSize_;
+    }
+    auto& mask = archives_[range.archive].mask;
+    mask.resize(std::max<size_t>(mask.size(), ((total + blockSize_ - 1) / blockSize_ + 7) / 8), 0);
+    for (uint32 i = first; i < last; ++i) {
+      mask[i / 8] |= (1 << (i & 7));
+    }
+    return true;
+  }
+
+  void ArchiveIndex::saveMask(uint32 archive) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& mask = archives_[archive].mask;
+    if (mask.empty()) return;
+    File(path::work() / CACHE / "data" / archives_[archive].name + ".mask", "wb").write(&mask[0], mask.size());
+  }
+
+  File ArchiveIndex::load(Hash const& hash) {
+    IndexEntry const* found = find(hash);
+    if (!found) return ngdp_.load(hash, "data");
+    IndexEntry const& entry = *found;
+
+    Range range;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      range = missing(entry);
+    }
+    if (range.start < range.end) {
+      MemoryFile body;
+      uint32 start;
+      if (!fetch(range, body, start)) return File();
+      saveMask(entry.index);
+      if (entry.offset >= start && entry.offset + entry.size <= start + body.csize()) {
+        // the response holds the whole file, no need to read it back from disk
+        MemoryFile result(std::max<size_t>(entry.size, 1));
+        memcpy(result.reserve(entry.size), body.data() + (entry.offset - start), entry.size);
+        result.seek(0);
+        return result;
       }
     }
 
-    File data(archivePath);
+    File data(path::work() / CACHE / "data" / archives_[entry.index].name);
     if (!data) return File();
-    MemoryFile result;
-    data.seek(offset, SEEK_SET);
-    data.read(result.reserve(size), size);
+    MemoryFile result(std::max<size_t>(entry.size, 1));
+    data.seek(entry.offset, SEEK_SET);
+    data.read(result.reserve(entry.size), entry.size);
     result.seek(0);
     return result;
   }
 
+  void ArchiveIndex::prefetch(std::vector<Hash_container> const& keys, size_t connections) {
+    std::vector<Range> ranges;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto const& key : keys) {
+        IndexEntry const* entry = find(key._);
+        if (!entry) continue;
+        Range range = missing(*entry);
+        if (range.start < range.end) ranges.push_back(range);
+      }
+    }
+    if (ranges.empty()) return;
+
+    // merge overlapping and adjacent spans, but keep requests small enough to spread over connections
+    std::sort(ranges.begin(), ranges.end(), [](Range const& lhs, Range const& rhs) {
+      return lhs.archive != rhs.archive ? lhs.archive < rhs.archive : lhs.start < rhs.start;
+    });
+    // a span that overlaps a full range starts where that range ends, so no block is requested twice
+    size_t count = 0;
+    for (Range range : ranges) {
+      if (count && ranges[count - 1].archive == range.archive) {
+        Range& last = ranges[count - 1];
+        if (range.end <= last.end) continue;
+        if (range.start <= last.end && range.end - last.start <= MaxPrefetchBlocks) {
+          last.end = range.end;
+          continue;
+        }
+        range.start = std::max(range.start, last.end);
+      }
+      ranges[count++] = range;
+    }
+    ranges.resize(count);
+
+    // downloads wait on the network, so they get their own threads instead of the shared pool
+    void* task = Logger::begin(ranges.size(), "Fetching archives");
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+      MemoryFile body;
+      uint32 start;
+      for (size_t i; (i = next++) < ranges.size();) {
+        Logger::item(archives_[ranges[i].archive].name.c_str(), task);
+        body.resize(0);
+        body.seek(0);
+        fetch(ranges[i], body, start);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(connections, ranges.size()); ++i) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    Logger::end(false, task);
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      if (!i || ranges[i].archive != ranges[i - 1].archive) {
+        saveMask(ranges[i].archive);
+      }
+    }
+  }
+
+#pragma pack(push, 1)
+  struct DecodedHeader {
+    uint32 magic;
+    Hash key;
+    uint32 size;
+  };
+  struct DecodedLogEntry {
+    Hash key;
+    uint32 size;
+  };
+#pragma pack(pop)
+  static const uint32 DecodedMagic = 'DEC1';
+  // temporary names: random per process, counted within it
+  static const uint32 DecodedSession = std::random_device()();
+  static std::atomic<uint32> DecodedCounter(0);
+
+  // read-only view of a cached buffer; buffer() stays null so nobody parses shared data in place
+  class SharedBuffer : public FileBuffer {
+  public:
+    typedef std::shared_ptr<const std::vector<uint8>> Data;
+    SharedBuffer(Data const& data)
+      : data_(data)
+      , pos_(0)
+    {}
+
+    uint64 tell() const {
+      return pos_;
+    }
+    void seek(int64 pos, int mode) {
+      switch (mode) {
+      case SEEK_CUR:
+        pos += pos_;
+        break;
+      case SEEK_END:
+        pos += data_->size();
+        break;
+      }
+      if (pos < 0) pos = 0;
+      if (pos > (int64) data_->size()) pos = data_->size();
+      pos_ = pos;
+    }
+    uint64 size() {
+      return data_->size();
+    }
+    size_t read(void* ptr, size_t size) {
+      size = std::min(size, data_->size() - pos_);
+      if (size) memcpy(ptr, data_->data() + pos_, size);
+      pos_ += size;
+      return size;
+    }
+    size_t write(void const* ptr, size_t size) {
+      return 0;
+    }
+
+  private:
+    Data data_;
+    size_t pos_;
+  };
+
+  static std::string DecodedPath(const Hash hash) {
+    std::string name = to_string(hash);
+    return path::work() / CACHE / "decoded" / name.substr(0, 2) / name;
+  }
+  static std::string DecodedLog() {
+    return path::work() / CACHE / "decoded" / "files.log";
+  }
+
+  DecodedCache::DecodedCache(size_t memoryMB, size_t diskMB)
+    : limit_(memoryMB << 20)
+    , size_(0)
+    , diskLimit_(uint64(diskMB) << 20)
+    , diskSize_(0)
+  {
+    File log(DecodedLog());
+    DecodedLogEntry entry;
+    while (log && log.read(&entry, sizeof entry) == sizeof entry) {
+      auto const& hash = Hash_container::from(entry.key);
+      if (diskFiles_.count(hash)) continue;
+      diskOrder_.push_back(hash);
+      diskFiles_[hash] = entry.size;
+      diskSize_ += entry.size;
+    }
+  }
+
+  void DecodedCache::remember(const Hash hash, Buffer const& data) {
+    // files that would push out a large part of the cache are only kept on disk
+    if (data->size() > limit_ / 8) return;
+    auto it = index_.find(Hash_container::from(hash));
+    if (it != index_.end()) {
+      size_ -= it->second->data->size();
+      lru_.erase(it->second);
+      index_.erase(it);
+    }
+    lru_.emplace_front();
+    lru_.front().hash = Hash_container::from(hash);
+    lru_.front().data = data;
+    size_ += data->size();
+    index_[lru_.front().hash] = lru_.begin();
+    while (size_ > limit_) {
+      size_ -= lru_.back().data->size();
+      index_.erase(lru_.back().hash);
+      lru_.pop_back();
+    }
+  }
+
+  void DecodedCache::forget(const Hash hash) {
+    std::lock_guard<std::mutex> lock(diskMutex_);
+    auto it = diskFiles_.find(Hash_container::from(hash));
+    if (it == diskFiles_.end()) return;
+    diskSize_ -= it->second;
+    diskFiles_.erase(it);
+  }
+
+  // drops the oldest files until the disk tier is an eighth below its limit, so that the log is
+  // only rewritten once in a while; the caller removes the files outside the lock
+  void DecodedCache::trim(std::vector<Hash_container>& removed) {
+    if (diskSize_ <= diskLimit_) return;
+    while (diskSize_ > diskLimit_ - diskLimit_ / 8 && !diskOrder_.empty()) {
+      auto it = diskFiles_.find(diskOrder_.front());
+      if (it != diskFiles_.end()) {
+        diskSize_ -= it->second;
+        diskFiles_.erase(it);
+        removed.push_back(diskOrder_.front());
+      }
+      diskOrder_.pop_front();
+    }
+    std::string temp = DecodedLog() + ".tmp";
+    {
+      File log(temp, "wb");
+      if (!log) return;
+      for (auto const& hash : diskOrder_) {
+        auto it = diskFiles_.find(hash);
+        if (it == diskFiles_.end()) continue;
+        DecodedLogEntry entry;
+        memcpy(entry.key, hash._, sizeof(Hash));
+        entry.size = it->second;
+        log.write(entry);
+      }
+    }
+    if (!File::rename(temp, DecodedLog())) {
+      File::remove(temp);
+    }
+  }
+
+  File DecodedCache::get(const Hash hash) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(Hash_container::from(hash));
+      if (it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return File(new SharedBuffer(it->second->data));
+      }
+    }
+
+    std::string path = DecodedPath(hash);
+    File file = File::mapfile(path);
+    if (!file) return file;
+    DecodedHeader header;
+    if (file.read(&header, sizeof header) != sizeof header || header.magic != DecodedMagic ||
+        memcmp(header.key, hash, sizeof(Hash)) || header.size != file.size() - sizeof header) {
+      // truncated, foreign or written by an older version
+      file.release();
+      File::remove(path);
+      forget(hash);
+      return File();
+    }
+    if (header.size > limit_ / 8) {
+      return file.subfile(sizeof header, header.size);
+    }
+    auto data = std::make_shared<std::vector<uint8>>(header.size);
+    if (header.size && file.read(data->data(), header.size) != header.size) return File();
+    Buffer buffer(data);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      remember(hash, buffer);
+    }
+    return File(new SharedBuffer(buffer));
+  }
+
+  bool DecodedCache::contains(const Hash hash) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (index_.count(Hash_container::from(hash))) return true;
+    }
+    return File::exists(DecodedPath(hash));
+  }
+
+  void DecodedCache::put(const Hash hash, File& file) {
+    auto data = std::make_shared<std::vector<uint8>>(file.size());
+    file.seek(0);
+    if (data->size() && file.read(data->data(), data->size()) != data->size()) return;
+    file.seek(0);
+    Buffer buffer(data);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      remember(hash, buffer);
+    }
+    {
+      // another thread decoded the same file
+      std::lock_guard<std::mutex> lock(diskMutex_);
+      if (diskFiles_.count(Hash_container::from(hash))) return;
+    }
+
+    // write under a name no other writer uses, so that an interrupted run never leaves a truncated
+    // file behind and two writers of the same file never write into each other
+    std::string path = DecodedPath(hash);
+    std::string temp = path + fmtstring(".%08x%u.tmp", DecodedSession, DecodedCounter++);
+    DecodedHeader header;
+    header.magic = DecodedMagic;
+    memcpy(header.key, hash, sizeof(Hash));
+    header.size = data->size();
+    {
+      File out(temp, "wb");
+      if (!out) return;
+      out.write(header);
+      if (data->size()) out.write(data->data(), data->size());
+    }
+    if (!File::rename(temp, path)) {
+      File::remove(temp);
+      return;
+    }
+
+    std::vector<Hash_container> removed;
+    {
+      std::lock_guard<std::mutex> lock(diskMutex_);
+      auto const& key = Hash_container::from(hash);
+      if (!diskFiles_.count(key)) {
+        diskOrder_.push_back(key);
+        diskFiles_[key] = header.size;
+        diskSize_ += header.size;
+        DecodedLogEntry entry;
+        memcpy(entry.key, hash, sizeof(Hash));
+        entry.size = header.size;
+        File(DecodedLog(), "ab").write(entry);
+      }
+      trim(removed);
+    }
+    for (auto const& key : removed) {
+      File::remove(DecodedPath(key._));
+    }
+  }
+
   CascStorage::CascStorage(std::string const& root)
     : root_(root)
   {
-    CreateDirectory((root / "config").c_str(), nullptr);
-    CreateDirectory((root / "data").c_str(), nullptr);
-    CreateDirectory((root / "indices").c_str(), nullptr);
-    CreateDirectory((root / "patch").c_str(), nullptr);
-
-    std::vector<std::string> names;
-    WIN32_FIND_DATA fdata;
-    HANDLE hFind = FindFirstFile((root / "data" / "*").c_str(), &fdata);
-    if (hFind == INVALID_HANDLE_VALUE) return;
-    do {
-      if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-        names.push_back(fdata.cFileName);
-      }
-    } while (FindNextFile(hFind, &fdata));
-    FindClose(hFind);
-
-    for (std::string const& name : names) {
-      DeleteFile((root / "data" / name).c_str());
+    File::mkdir(root / "config");
+    File::mkdir(root / "data");
+    File::mkdir(root / "indices");
+    File::mkdir(root / "patch");
+
+    for (std::string const& name : File::listdir(root / "data")) {
+      File::remove(root / "data" / name);
     }
   }
 
@@ -3,6 +3,9 @@
 #include "json.h"
 #include "file.h"
 #include <unordered_map>
+#include <list>
+#include <memory>
+#include <mutex>
 
 namespace NGDP {
 
@@ -48,6 +51,10 @@ namespace NGDP {
   class NGDP {
   public:
     NGDP(std::string const& app = PROGRAM, std::string const& region = "us");
+    // use a fixed CDN root (e.g. a local mirror, "http://localhost:8080/tpr/d3/") instead of
+    // asking the patch server
+    NGDP(std::string const& base, VersionData const& version);
+    virtual ~NGDP() {}
 
     VersionData const& version() const {
       return version_;
@@ -59,12 +66,28 @@ namespace NGDP {
       return load(to_string(hash), type, index, preload);
     }
 
+    // every request to the CDN goes through these; they use HTTP on Windows and fail elsewhere
+    // (there is no HTTP client in the portable build), and tests override them to serve files
+    // from memory
+    // get(url) - the whole file
+    // get(url, first, last, start, total) - bytes [first, last] of a file; start is the offset of
+    //   the returned data and total the size of the whole file (a server may ignore the range)
+    virtual File get(std::string const& url) const;
+    virtual File get(std::string const& url, uint32 first, uint32 last, uint32& start, uint32& total) const;
+
   private:
     std::string base_;
     VersionData version_;
   };
 
+  // BLTE-encoded files; usize is only needed for compressed files without a chunk table
+  // DecodeBLTE decodes into memory, inflating large multi-chunk files on the thread pool.
+  // StreamBLTE decodes one chunk at a time as the returned file is read.
+  // Both check chunk MD5s and return an empty File on any error.
   File DecodeBLTE(File& blte, uint32 usize = 0);
+  File StreamBLTE(File& blte, uint32 usize = 0);
+  // minimum decoded size for which DecodeBLTE goes parallel
+  const uint32 ParallelBLTE = (1 << 20);
   std::map<std::string, std::string> ParseConfig(File& file);
 
   class Encoding {
@@ -88,6 +111,8 @@ namespace NGDP {
 
     EncodingEntry const* getEncoding(const Hash hash) const;
     LayoutEntry const* getLayout(const Hash key) const;
+    // result[i] = getEncoding(hashes[i]), resolved in sorted order
+    void getEncodings(Hash_container const* hashes, size_t count, EncodingEntry const** result) const;
 
     char const* const& layout(uint32 index) const {
       return layouts_[index];
@@ -97,17 +122,31 @@ namespace NGDP {
     }
 
   private:
-    std::vector<uint8> data_;
-    struct EncodingHeader {
-      Hash hash;
-      std::vector<EncodingEntry*> entries;
-    };
-    struct LayoutHeader {
-      Hash key;
-      std::vector<LayoutEntry*> entries;
+    // sorted first 8 bytes of every key (read big-endian, so that integer order is key order),
+    // with a jump table on the top bits; full keys are only compared on prefix matches
+    class KeyIndex {
+    public:
+      enum { JumpBits = 16 };
+      static const uint32 NotFound = 0xFFFFFFFF;
+      static uint64 prefix(const Hash key) {
+        return _byteswap_uint64(*reinterpret_cast<uint64 const*>(key));
+      }
+      // takes (prefix, entry offset) lists of all pages, in file order
+      void build(std::vector<std::vector<std::pair<uint64, uint32>>>& pages);
+      // position of the entry whose key (at keyOffset in the entry) matches, searching from position from
+      uint32 find(const Hash key, uint8 const* base, uint32 keyOffset, uint32 from = 0) const;
+      uint32 offset(uint32 pos) const {
+        return offsets_[pos];
+      }
+    private:
+      std::vector<uint64> prefixes_;
+      std::vector<uint32> offsets_;
+      std::vector<uint32> jump_;
     };
-    std::vector<EncodingHeader> encodingTable_;
-    std::vector<LayoutHeader> layoutTable_;
+
+    std::vector<uint8> data_;
+    KeyIndex encodingIndex_;
+    KeyIndex layoutIndex_;
     std::vector<char*> layouts_;
     char* layout_;
   };
@@ -135,13 +174,30 @@ namespace NGDP {
     ArchiveIndex(NGDP const& ngdp, uint32 blockSize = (1U<<20));
 
     File load(Hash const& hash);
+    // download the missing blocks of all listed files: spans are merged per archive and fetched
+    // over several connections at once, masks are written once at the end
+    void prefetch(std::vector<Hash_container> const& keys, size_t connections = 4);
 
   private:
+#pragma pack(push, 1)
     struct IndexEntry {
+      Hash key;
       uint16 index;
       uint32 size;
       uint32 offset;
     };
+#pragma pack(pop)
+    // block span [start, end) of an archive
+    struct Range {
+      uint32 archive;
+      uint32 start;
+      uint32 end;
+    };
+    enum { MaxPrefetchBlocks = 16 };
+    Range missing(IndexEntry const& entry) const;
+    bool fetch(Range const& range, MemoryFile& body, uint32& start);
+    void saveMask(uint32 archive);
+    std::mutex mutex_; // guards masks and writes to local archive copies
     struct ArchiveInfo {
       std::string name;
       std::vector<uint8> mask;
@@ -149,7 +205,59 @@ namespace NGDP {
     NGDP const& ngdp_;
     uint32 blockSize_;
     std::vector<ArchiveInfo> archives_;
-    std::unordered_map<Hash_container, IndexEntry, Hash_container::hash, Hash_container::equal> index_;
+
+    // all archive indices merged into one array sorted by key, with a jump table on the first two
+    // key bytes; cached in cdncache/data/<cdn config>.idx and mapped on later runs
+    enum { JumpSize = 65536 };
+    File source_;
+    std::vector<IndexEntry> table_;
+    std::vector<uint32> jumpTable_;
+    IndexEntry const* entries_;
+    uint32 const* jump_;
+
+    IndexEntry const* find(Hash const& hash) const;
+    void build(std::vector<std::vector<IndexEntry>>& lists);
+    bool loadCache(std::string const& path);
+    void saveCache(std::string const& path);
+  };
+
+  // decoded files by content hash: an in-memory LRU of recently used files (memoryMB total) in
+  // front of cdncache/decoded on disk (diskMB total, oldest files removed first)
+  // files in memory are shared read-only buffers, so get() does not copy them and borrow() returns
+  // nullptr (the parser copies what it modifies); large files come from disk as copy-on-write
+  // mappings that can be parsed in place
+  // disk files start with their key and size, and files that do not match are removed on read
+  class DecodedCache {
+  public:
+    DecodedCache(size_t memoryMB = 256, size_t diskMB = 4096);
+
+    File get(const Hash hash);
+    void put(const Hash hash, File& file);
+    bool contains(const Hash hash);
+
+  private:
+    typedef std::shared_ptr<const std::vector<uint8>> Buffer;
+    struct Entry {
+      Hash_container hash;
+      Buffer data;
+    };
+    typedef std::list<Entry> EntryList;
+    EntryList lru_;
+    std::unordered_map<Hash_container, EntryList::iterator, Hash_container::hash, Hash_container::equal> index_;
+    size_t limit_;
+    size_t size_;
+    std::mutex mutex_; // guards the memory tier only, files are read and written outside of it
+
+    // files on disk in the order they were written, kept in cdncache/decoded/files.log
+    std::list<Hash_container> diskOrder_;
+    std::unordered_map<Hash_container, uint32, Hash_container::hash, Hash_container::equal> diskFiles_;
+    uint64 diskLimit_;
+    uint64 diskSize_;
+    std::mutex diskMutex_; // guards the disk bookkeeping and the log
+
+    void remember(const Hash hash, Buffer const& data);
+    void forget(const Hash hash);
+    void trim(std::vector<Hash_container>& removed);
   };
 
   class DataStorage {
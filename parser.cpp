@@ -17,7 +17,7 @@ uint32 HashNameLower(std::string const& str) {
   return hash;
 }
 
-__declspec(thread) SnoParser* SnoParser::context = nullptr;
+THREAD_LOCAL SnoParser* SnoParser::context = nullptr;
 
 SnoSysLoader::SnoSysLoader(std::string dir)
   : dir_(dir)
@@ -28,24 +28,21 @@ SnoSysLoader::SnoSysLoader(std::string dir)
 }
 
 std::vector<std::string> SnoSysLoader::listdir(SnoInfo const& type) {
-  WIN32_FIND_DATA data;
-  HANDLE hFind = FindFirstFile((dir_ / type.type / "*" + type.ext).c_str(), &data);
-  std::vector<std::string> list;
-  if (hFind == INVALID_HANDLE_VALUE) return list;
-  do {
-    if (!strcmp(data.cFileName, ".") || !strcmp(data.cFileName, "..")) continue;
-    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
-    list.push_back(path::title(data.cFileName));
-  } while (FindNextFile(hFind, &data));
-  FindClose(hFind);
+  std::vector<std::string> list = File::listdir(dir_ / type.type, type.ext);
+  for (auto& name : list) {
+    name = path::title(name);
+  }
   return list;
 }
 File SnoSysLoader::loadfile(SnoInfo const& type, char const* name) {
-  return File(dir_ / type.type / name + type.ext, "rb");
+  return File::mapfile(dir_ / type.type / name + type.ext);
 }
 
-//SnoSysLoader SnoSysLoader::default("");
-SnoLoader* SnoLoader::default = nullptr;// &SnoSysLoader::default;
+//SnoSysLoader SnoSysLoader::primary("");
+SnoLoader* SnoLoader::primary = nullptr;// &SnoSysLoader::primary;
+
+// CascLib is only built for Windows; other systems read extracted files through SnoSysLoader
+#ifdef _WIN32
 
 #pragma warning(disable: 4005)
 #ifdef _WIN64
@@ -134,13 +131,24 @@ File SnoCascLoader::cascFile(HANDLE hFile) {
   return File(new CascFileBuffer(hFile));
 }
 
+// files are read into memory right away, so that they can be parsed outside of the loader lock
+static File cascMemFile(HANDLE hFile) {
+  DWORD size = CascGetFileSize(hFile, NULL);
+  MemoryFile mem(std::max<size_t>(size, 1));
+  if (size && !CascReadFile(hFile, mem.reserve(size), size, &size)) size = 0;
+  mem.resize(size);
+  mem.seek(0);
+  CascCloseFile(hFile);
+  return mem;
+}
+
 File SnoCascLoader::loadfile(SnoInfo const& type, char const* name) {
   HANDLE pFile;
   if (!lang_.empty() && CascOpenFile(handle_, fmtstring("%s\\%s\\%s%s", lang_.c_str(), type.type, name, type.ext).c_str(), 0, 0, &pFile)) {
-    return File(new CascFileBuffer(pFile));
+    return cascMemFile(pFile);
   }
   if (CascOpenFile(handle_, fmtstring("Base\\%s\\%s%s", type.type, name, type.ext).c_str(), 0, 0, &pFile)) {
-    return File(new CascFileBuffer(pFile));
+    return cascMemFile(pFile);
   }
   return File();
 }
@@ -182,7 +190,7 @@ SnoCascLoader::SnoCascLoader(std::string dir, std::string lang)
     CascReadFile(hFile, toc.data(), toc.size(), &size);
     CascCloseFile(hFile);
 
-    SnoManager::loadTOC(toc.data());
+    SnoManager::loadTOC(std::move(toc));
   }
 
   while (dir.size() && GetFileAttributes((dir / ".build.info").c_str()) == INVALID_FILE_ATTRIBUTES) {
@@ -214,3 +222,5 @@ SnoCascLoader::SnoCascLoader(std::string dir, std::string lang)
 SnoCascLoader::~SnoCascLoader() {
   CascCloseStorage(handle_);
 }
+
+#endif
@@ -7,8 +7,10 @@
 
 #include "file.h"
 #include "json.h"
+#include "jsonbin.h"
 #include "path.h"
 #include "logger.h"
+#include "threadpool.h"
 
 uint32 HashName(std::string const& str);
 uint32 HashNameLower(std::string const& str);
@@ -16,89 +18,36 @@ uint32 HashNameLower(std::string const& str);
 class SnoParser {
 protected:
   std::string name_;
-  std::vector<uint8> data_;
+  File source_;
+  std::vector<uint8> copy_;
+  uint8* data_;
+  uint32 size_;
+  SnoParser()
+    : data_(nullptr)
+    , size_(0)
+  {}
 public:
   std::string const& name() const {
     return name_;
   }
   uint32 size() const {
-    return data_.size();
+    return size_;
   }
   bool contains(uint32 offset, uint32 size) const {
-    return size && offset <= 0xFFFFFFFF - size && offset + size <= data_.size();
+    return size && offset <= 0xFFFFFFFF - size && offset + size <= size_;
   }
   uint8* data(uint32 offset) {
-    return &data_[offset];
+    return data_ + offset;
   }
   uint8 const* data(uint32 offset) const {
-    return &data_[offset];
+    return data_ + offset;
   }
 
-  static __declspec(thread) SnoParser* context;
+  static THREAD_LOCAL SnoParser* context;
 };
 
 template<class T>
-void DumpFile(File* from, File* to) {
-  json::WriterVisitor writer(to);
-  writer.setIndent(2);
-  ParseFile(from, &writer);
-  writer.onEnd();
-}
-
-class SnoLoader;
-
-template<class T>
-class SnoFile : public SnoParser {
-  typename T::Type* object_;
-public:
-  SnoFile(File& file, std::string const& name = "")
-    : object_(nullptr)
-  {
-    name_ = name;
-    if (!file) return;
-    data_.resize(file.size() - 16);
-    file.seek(16);
-    if (file.read(&data_[0], data_.size())) {
-      SnoParser::context = this;
-      object_ = new(&data_[0]) T::Type;
-      SnoParser::context = nullptr;
-    }
-  }
-  SnoFile(std::string const& name, SnoLoader* loader = SnoLoader::default)
-    : SnoFile(loader->load<T>(name), name)
-  {}
-  SnoFile(char const* name, SnoLoader* loader = SnoLoader::default)
-    : SnoFile(loader->load<T>(name), name ? name : "")
-  {}
-
-  operator bool() const {
-    return object_ != nullptr;
-  }
-  operator typename T::Type*() {
-    return object_;
-  }
-  operator typename T::Type const*() const {
-    return object_;
-  }
-
-  typename T::Type* operator->() {
-    return object_;
-  }
-  typename T::Type const* operator->() const {
-    return object_;
-  }
-
-  void dump(File& to) {
-    json::WriterVisitor writer(to);
-    writer.setIndent(2);
-    if (object_) {
-      object_->serialize(&writer);
-    } else {
-      writer.onNull();
-    }
-    writer.onEnd();
-  }
-};
+class SnoFile;
 
 struct SnoInfo {
   char const* type;
@@ -110,24 +59,76 @@ class SnoLoader {
 protected:
   virtual std::vector<std::string> listdir(SnoInfo const& type) = 0;
   virtual File loadfile(SnoInfo const& type, char const* name) = 0;
+  // loaders that can serve listdir/loadfile from several threads at once override this;
+  // otherwise calls are serialized, and loadfile must return a self-contained file
+  virtual bool threadsafe() const {
+    return false;
+  }
+  // called before all files of a type are loaded, so that remote loaders can fetch them in bulk
+  virtual void prefetchdir(SnoInfo const& type) {}
+  // content key (MD5 of the decoded file) for loaders that know it without loading the file;
+  // may be called from several threads at once
+  virtual bool filekey(SnoInfo const& type, char const* name, uint8* key) {
+    return false;
+  }
+private:
+  std::mutex mutex_;
+  std::vector<std::string> openlist(SnoInfo const& type) {
+    if (threadsafe()) return listdir(type);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return listdir(type);
+  }
+  File openfile(SnoInfo const& type, char const* name) {
+    if (threadsafe()) return loadfile(type, name);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return loadfile(type, name);
+  }
+  void openall(SnoInfo const& type) {
+    if (threadsafe()) return prefetchdir(type);
+    std::lock_guard<std::mutex> lock(mutex_);
+    prefetchdir(type);
+  }
+  // func(name) for every file of type T, on the thread pool
+  template<class T, class Func>
+  void dumpAll(Func const& func) {
+    std::vector<std::string> names = list<T>();
+    prefetch<T>();
+    void* task = Logger::begin(names.size(), fmtstring("Dumping %s", T::type()).c_str());
+    ThreadPool::instance().parallel_for(names.size(), [&](size_t i) {
+      Logger::item(names[i].c_str(), task);
+      func(names[i]);
+    });
+    Logger::end(false, task);
+  }
 public:
+  virtual ~SnoLoader() {}
+
   virtual uint32 hash() const = 0;
   virtual uint32 build() const { return 0; }
   virtual std::string version() const { return "unknown"; }
 
   template<class T>
   std::vector<std::string> list() {
-    return listdir(T::info());
+    return openlist(T::info());
+  }
+  template<class T>
+  void prefetch() {
+    openall(T::info());
+  }
+  // fills key (16 bytes) and returns true if the loader knows the content key of the file
+  template<class T>
+  bool contentkey(std::string const& name, uint8* key) {
+    return filekey(T::info(), name.c_str(), key);
   }
 
   template<class T>
   File load(std::string const& name) {
-    return loadfile(T::info(), name.c_str());
+    return openfile(T::info(), name.c_str());
   }
 
   template<class T>
   File load(char const* name) {
-    return name ? loadfile(T::info(), name) : File();
+    return name ? openfile(T::info(), name) : File();
   }
 
   template<class T>
@@ -193,6 +194,7 @@ public:
       : loader_(loader)
       , list_(loader->list<T>())
     {
+      loader->prefetch<T>();
       Logger::begin(list_.size(), fmtstring("Parsing %s", T::type()).c_str());
     }
     SnoLoader* loader_;
@@ -269,6 +271,7 @@ public:
       : loader_(loader)
       , list_(loader->list<T>())
     {
+      loader->prefetch<T>();
       Logger::begin(list_.size(), fmtstring("Parsing %s", T::type()).c_str());
     }
     SnoLoader* loader_;
@@ -279,6 +282,42 @@ public:
     return SnoAllJson<T>(this);
   }
 
+  // parallel versions of all<T>() and json<T>(): every file is loaded and parsed on the thread
+  // pool, and func is called from the worker threads (it must do its own locking)
+  // func(SnoFile<T>& file)
+  template<class T, class Func>
+  void parallel_all(Func const& func, ThreadPool& pool = ThreadPool::instance()) {
+    std::vector<std::string> names = list<T>();
+    prefetch<T>();
+    void* task = Logger::begin(names.size(), fmtstring("Parsing %s", T::type()).c_str());
+    pool.parallel_for(names.size(), [&](size_t i) {
+      Logger::item(names[i].c_str(), task);
+      File src = load<T>(names[i]);
+      SnoFile<T> file(src, names[i]);
+      if (file) func(file);
+    });
+    Logger::end(false, task);
+  }
+  // func(std::string const& name, json::Value const& value)
+  template<class T, class Func>
+  void parallel_json(Func const& func, ThreadPool& pool = ThreadPool::instance()) {
+    std::vector<std::string> names = list<T>();
+    prefetch<T>();
+    void* task = Logger::begin(names.size(), fmtstring("Parsing %s", T::type()).c_str());
+    pool.parallel_for(names.size(), [&](size_t i) {
+      Logger::item(names[i].c_str(), task);
+      json::Value value;
+      File src = load<T>(names[i]);
+      if (src) {
+        json::BuilderVisitor builder(value);
+        T::parse(src, &builder);
+        builder.onEnd();
+      }
+      func(names[i], value);
+    });
+    Logger::end(false, task);
+  }
+
   template<class T>
   void dump(std::string const& name) {
     File src = load<T>(name);
@@ -290,43 +329,134 @@ public:
     T::parse(src, &writer);
     writer.onEnd();
   }
+  // same as dump, in the compact format of json::BinaryWriter (read back with json::parseBinary)
+  template<class T>
+  void dumpBinary(std::string const& name) {
+    File src = load<T>(name);
+    if (!src) return;
+    File dst(path::work() / fmtstring("%s.%s", T::type(), version().c_str()) / name + ".bin", "wb");
+    if (!dst) return;
+    json::BinaryWriter writer(dst);
+    T::parse(src, &writer);
+    writer.onEnd();
+  }
   template<class T>
   void dump() {
-    for (auto& name : Logger::Loop(list<T>(), fmtstring("Dumping %s", T::type()).c_str())) {
+    dumpAll<T>([this](std::string const& name) {
       dump<T>(name);
-    }
+    });
+  }
+  template<class T>
+  void dumpBinary() {
+    dumpAll<T>([this](std::string const& name) {
+      dumpBinary<T>(name);
+    });
   }
 
   template<class T>
   static std::vector<std::string> List() {
-    return default->list<T>();
+    return primary->list<T>();
   }
   template<class T>
   static File Load(std::string const& name) {
-    return default->load<T>(name);
+    return primary->load<T>(name);
   }
   template<class T>
   static File Load(char const* name) {
-    return default->load<T>(name);
+    return primary->load<T>(name);
   }
   template<class T>
   static SnoAll<T> All() {
-    return default->all<T>();
+    return primary->all<T>();
   }
   template<class T>
   static SnoAll<T> Json() {
-    return default->json<T>();
+    return primary->json<T>();
   }
   template<class T>
   static void Dump(std::string const& name) {
-    default->dump<T>(name);
+    primary->dump<T>(name);
   }
   template<class T>
   static void Dump() {
-    default->dump<T>();
+    primary->dump<T>();
+  }
+  template<class T>
+  static void DumpBinary(std::string const& name) {
+    primary->dumpBinary<T>(name);
+  }
+  template<class T>
+  static void DumpBinary() {
+    primary->dumpBinary<T>();
+  }
+
+  static SnoLoader* primary;
+};
+
+template<class T>
+class SnoFile : public SnoParser {
+  typename T::Type* object_;
+public:
+  SnoFile(File& file, std::string const& name = "")
+    : object_(nullptr)
+  {
+    name_ = name;
+    if (!file) return;
+    uint64 size = file.size();
+    if (size <= 16) return;
+    size_ = size - 16;
+    if (uint8* memory = file.borrow()) {
+      // decoded or mapped buffer that nobody else uses: parse it in place
+      source_ = file;
+      data_ = memory + 16;
+    } else {
+      copy_.resize(size_);
+      file.seek(16);
+      if (file.read(&copy_[0], size_) != size_) return;
+      data_ = &copy_[0];
+    }
+    SnoParser* prev = SnoParser::context;
+    SnoParser::context = this;
+    object_ = new(data_) typename T::Type;
+    SnoParser::context = prev;
+  }
+  SnoFile(File&& file, std::string const& name = "")
+    : SnoFile(file, name)
+  {}
+  SnoFile(std::string const& name, SnoLoader* loader = SnoLoader::primary)
+    : SnoFile(loader->template load<T>(name), name)
+  {}
+  SnoFile(char const* name, SnoLoader* loader = SnoLoader::primary)
+    : SnoFile(loader->template load<T>(name), name ? name : "")
+  {}
+
+  operator bool() const {
+    return object_ != nullptr;
+  }
+  operator typename T::Type*() {
+    return object_;
+  }
+  operator typename T::Type const*() const {
+    return object_;
+  }
+
+  typename T::Type* operator->() {
+    return object_;
+  }
+  typename T::Type const* operator->() const {
+    return object_;
   }
 
-  static SnoLoader* default;
+  void dump(File& to) {
+    json::WriterVisitor writer(to);
+    writer.setIndent(2);
+    if (object_) {
+      object_->serialize(&writer);
+    } else {
+      writer.onNull();
+    }
+    writer.onEnd();
+  }
 };
 
 class SnoSysLoader : public SnoLoader {
@@ -334,12 +464,15 @@ protected:
   std::string dir_;
   std::vector<std::string> listdir(SnoInfo const& type);
   File loadfile(SnoInfo const& type, char const* name);
+  bool threadsafe() const {
+    return true;
+  }
 public:
   SnoSysLoader(std::string dir = "");
   uint32 hash() const {
     return HashNameLower(dir_);
   }
-  static SnoSysLoader default;
+  static SnoSysLoader primary;
 };
 
 class SnoCascLoader : public SnoLoader {
@@ -364,7 +497,9 @@ public:
   SnoCascLoader(std::string dir, std::string lang = "");
   ~SnoCascLoader();
 
+#ifdef _WIN32
   static File cascFile(HANDLE hFile);
+#endif
 };
 
 class SnoCdnLoader : public SnoLoader {
@@ -375,6 +510,8 @@ protected:
   CdnImpl* handle_;
   std::vector<std::string> listdir(SnoInfo const& type);
   File loadfile(SnoInfo const& type, char const* name);
+  void prefetchdir(SnoInfo const& type);
+  bool filekey(SnoInfo const& type, char const* name, uint8* key);
 public:
   uint32 hash() const {
     return hash_;
@@ -1,6 +1,9 @@
 #include "path.h"
 #include "common.h"
-#include <windows.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 using namespace std;
 
 string path::name(string const& path) {
@@ -49,6 +52,35 @@ string path::ext(string const& path) {
 }
 
 namespace path {
+#ifdef _WIN32
+  static bool isdir(string const& path) {
+    uint32 attr = GetFileAttributes(path.c_str());
+    return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
+  }
+  static void chdir(string const& path) {
+    SetCurrentDirectory(path.c_str());
+  }
+  static string module() {
+    char buffer[512];
+    GetModuleFileName(GetModuleHandle(NULL), buffer, sizeof buffer);
+    return buffer;
+  }
+#else
+  static bool isdir(string const& path) {
+    struct stat info;
+    return !stat(path.c_str(), &info) && S_ISDIR(info.st_mode);
+  }
+  static void chdir(string const& path) {
+    if (::chdir(path.c_str())) {}
+  }
+  static string module() {
+    char buffer[512];
+    ssize_t length = readlink("/proc/self/exe", buffer, sizeof buffer - 1);
+    buffer[length > 0 ? length : 0] = 0;
+    return buffer;
+  }
+#endif
+
   struct Paths {
     string root, work, casc;
     static Paths& get();
@@ -63,29 +95,25 @@ namespace path {
     static Paths instance;
     if (initialized) return instance;
     for (auto const& root : roots) {
-      uint32 attr = GetFileAttributes(root.c_str());
-      if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY)) {
+      if (isdir(root)) {
         instance.root = root;
         instance.work = root / "Work";
-        SetCurrentDirectory(instance.work.c_str());
+        chdir(instance.work);
         initialized = true;
         break;
       }
     }
     if (roots.empty()) {
-      char buffer[512];
-      GetModuleFileName(GetModuleHandle(NULL), buffer, sizeof buffer);
-      std::string root = path(buffer);
+      std::string root = path(module());
       instance.root = root;
       instance.work = root / "Work";
-      SetCurrentDirectory(instance.work.c_str());
+      chdir(instance.work);
       initialized = true;
     }
     if (!initialized) throw Exception("work dir not found");
     initialized = false;
     for (auto const& casc : cascs) {
-      uint32 attr = GetFileAttributes(casc.c_str());
-      if (attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY)) {
+      if (isdir(casc)) {
         instance.casc = casc;
         initialized = true;
         break;
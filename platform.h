@@ -0,0 +1,77 @@
+// platform.h
+//
+// the few compiler and OS specifics used outside of the Windows-only modules
+// (loaders, viewer, server); included through common.h
+//
+// THREAD_LOCAL - thread local storage for POD statics
+// _byteswap_ushort/_byteswap_ulong/_byteswap_uint64, _stricmp/_strnicmp, _vscprintf, _ftelli64/_fseeki64,
+// InterlockedIncrement/InterlockedDecrement, _BitScanForward - MSVC and Win32 names, provided on
+// other systems
+
+#pragma once
+
+#include "types.h"
+
+#ifdef _WIN32
+
+#define NOMINMAX
+#include <windows.h>
+#include <intrin.h>
+
+#define THREAD_LOCAL __declspec(thread)
+
+#else
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#define THREAD_LOCAL __thread
+
+inline uint16 _byteswap_ushort(uint16 x) {
+  return __builtin_bswap16(x);
+}
+inline uint32 _byteswap_ulong(uint32 x) {
+  return __builtin_bswap32(x);
+}
+inline uint64 _byteswap_uint64(uint64 x) {
+  return __builtin_bswap64(x);
+}
+
+inline uint32 InterlockedIncrement(uint32 volatile* value) {
+  return __sync_add_and_fetch(value, 1);
+}
+inline uint32 InterlockedDecrement(uint32 volatile* value) {
+  return __sync_sub_and_fetch(value, 1);
+}
+
+inline unsigned char _BitScanForward(unsigned long* index, unsigned long mask) {
+  if (!mask) return 0;
+  *index = __builtin_ctzl(mask);
+  return 1;
+}
+
+inline int _stricmp(char const* lhs, char const* rhs) {
+  return strcasecmp(lhs, rhs);
+}
+inline int _strnicmp(char const* lhs, char const* rhs, size_t count) {
+  return strncasecmp(lhs, rhs, count);
+}
+
+inline int64 _ftelli64(FILE* file) {
+  return ftello(file);
+}
+inline int _fseeki64(FILE* file, int64 pos, int mode) {
+  return fseeko(file, pos, mode);
+}
+
+inline int _vscprintf(char const* fmt, va_list list) {
+  va_list copy;
+  va_copy(copy, list);
+  int length = vsnprintf(nullptr, 0, fmt, copy);
+  va_end(copy);
+  return length;
+}
+
+#endif
@@ -2,10 +2,44 @@
 #include "types/Power.h"
 #include "types/GameBalance.h"
 #include "description.h"
+#include "snomap.h"
 #include <iostream>
-#include <set>
+#include <algorithm>
 
-PowerTags::PowerTags(SnoLoader* loader) {
+// sno_<version>/powertags.bin: "PTG1", then one record per power or table set, in the order
+// they were read: uint32 kind, uint32 size, payload
+//   kind 1: uint32 power id, string name, uint32 count, then count formulas: uint32 formula id,
+//           0 and int32 value, or 1 and uint32 length, opcodes, string text; string comment
+//   kind 2: uint32 count, then count tables: string name, double[76]
+// strings are uint32 length followed by the bytes
+// the opcodes are the raw ones from the Power file, so formulas are still compiled on every run;
+// records are checked against their size when decoded, and one that does not fit is dropped and
+// replaced by parsing the file again
+static char const cacheMagic[4] = {'P', 'T', 'G', '1'};
+enum { cachePower = 1, cacheTables = 2 };
+
+static void writeString(File& file, std::string const& str) {
+  file.write32(str.size());
+  file.write(str.data(), str.size());
+}
+static uint64 left(File& file) {
+  return file.size() - file.tell();
+}
+// false if the string does not fit in the rest of the record
+static bool readString(File& file, std::string& str) {
+  if (left(file) < 4) return false;
+  uint32 size = file.read32();
+  if (size > left(file)) return false;
+  str.resize(size);
+  if (size) file.read(&str[0], size);
+  return true;
+}
+
+PowerTags::PowerTags(SnoLoader* loader)
+  : loader_(loader)
+  , tablesLoaded_(false)
+  , cachedTables_(0)
+{
   json::Value tags;
   json::parse(File("tags.txt"), tags);
   for (auto& kv : tags.getMap()) {
@@ -15,77 +49,348 @@ PowerTags::PowerTags(SnoLoader* loader) {
     reverse_[id] = name;
     rawnames_[id] = kv.second["tag"].getString();
   }
-  for (auto& gmb : loader->all<GameBalance>()) {
-    for (auto& pow : gmb->x198_PowerFormulaTable) {
-      auto& tbl = tables_[pow.x000_Text];
-      for (int i = 0; i < 76; ++i) {
-        tbl.entries[i] = (&pow.x400)[i];
+  cachePath_ = path::work() / fmtstring("sno_%s", loader->version().c_str()) / "powertags.bin";
+  readCache();
+}
+
+PowerTags& PowerTags::instance(SnoLoader* loader) {
+  static PowerTags inst_(loader);
+  return inst_;
+}
+
+void PowerTags::readCache() {
+  File file(cachePath_, "rb");
+  if (!file) return;
+  cache_.resize(file.size());
+  if (cache_.empty() || file.read(&cache_[0], cache_.size()) != cache_.size()) {
+    cache_.clear();
+    return;
+  }
+  if (cache_.size() < sizeof cacheMagic || memcmp(&cache_[0], cacheMagic, sizeof cacheMagic)) {
+    cache_.clear();
+    return;
+  }
+  // an interrupted run may have left a partial record at the end; it is dropped, and the file
+  // rewritten before anything is appended
+  size_t pos = sizeof cacheMagic;
+  while (cache_.size() - pos >= 8) {
+    uint32 kind = *reinterpret_cast<uint32 const*>(&cache_[pos]);
+    uint32 size = *reinterpret_cast<uint32 const*>(&cache_[pos + 4]);
+    if (cache_.size() - pos - 8 < size) break;
+    if (kind == cachePower && size >= 8) {
+      File record = File::memfile(&cache_[pos + 12], size - 4);
+      std::string name;
+      if (readString(record, name)) cachedPowers_[name] = pos + 8;
+    } else if (kind == cacheTables) {
+      cachedTables_ = pos + 8;
+    }
+    pos += 8 + size;
+  }
+  cache_.resize(pos);
+}
+
+void PowerTags::writeCache(uint32 kind, MemoryFile& data) {
+  if (!cacheOut_) {
+    File file(cachePath_, "rb");
+    if (!cache_.empty() && file && file.size() == cache_.size()) {
+      file = File();
+      cacheOut_ = File(cachePath_, "ab");
+    } else {
+      file = File();
+      cacheOut_ = File(cachePath_, "wb");
+      if (cache_.empty()) {
+        cacheOut_.write(cacheMagic, sizeof cacheMagic);
+      } else {
+        cacheOut_.write(&cache_[0], cache_.size());
       }
     }
   }
+  cacheOut_.write32(kind);
+  cacheOut_.write32(data.csize());
+  cacheOut_.write(data.data(), data.csize());
+}
+
+// false if a count or length runs past the end of the record
+bool PowerTags::decodePower(size_t offset, std::string& name, uint32& id, Formulas& formulas) {
+  uint32 size = *reinterpret_cast<uint32 const*>(&cache_[offset - 4]);
+  File record = File::memfile(&cache_[offset], size);
+  if (left(record) < 4) return false;
+  id = record.read32();
+  if (!readString(record, name) || left(record) < 4) return false;
+  uint32 count = record.read32();
+  // a formula takes at least 16 bytes: id, kind, value or length, comment length
+  if (count > left(record) / 16) return false;
+  while (count--) {
+    uint32 fid = record.read32();
+    uint32 kind = record.read32();
+    if (kind > 1 || left(record) < 4) return false;
+    if (kind == 0) {
+      formulas.emplace(fid, static_cast<int>(record.read32()));
+    } else {
+      uint32 length = record.read32();
+      if (length > left(record) / sizeof(uint32)) return false;
+      std::vector<uint32> code(length);
+      if (!code.empty()) record.read(&code[0], code.size() * sizeof(uint32));
+      std::string text;
+      if (!readString(record, text)) return false;
+      formulas.emplace(
+        std::piecewise_construct,
+        std::forward_as_tuple(fid),
+        std::forward_as_tuple(code.data(), code.data() + code.size(), text.c_str())
+      );
+    }
+    if (!readString(record, formulas.find(fid)->second.comment) || (count && left(record) < 16)) return false;
+  }
+  return true;
+}
+
+void PowerTags::readPower(SnoFile<Power>& pow, uint32& powerId, Formulas& formulas) {
   static uint32 mapOffsets[] = {
     0x008, 0x018, 0x028, 0x050, 0x058, 0x060, 0x068, 0x090, 0x098, 0x0A0, 0x0A8
   };
-  for (auto& pow : loader->all<Power>()) {
-    PowerTag& power = powers_[pow.name()];
-    raw_[pow->x000_Header.id] = &power;
-    power.name_ = pow.name();
-    uint8* base = reinterpret_cast<uint8*>(&pow->x050_PowerDef);
-    using PowerTags = Power::Type::PowerTags;
-    for (uint32 offset : mapOffsets) {
-      uint32 const* data = reinterpret_cast<PowerTags*>(base + offset)->data();
-      uint32 count = *data++;
-      while (count--) {
-        uint32 type = *data++;
-        uint32 id = *data++;
-        if (type != 4) {
-          power.formulas_.emplace(id, (int)*data++);
-        } else {
-          data += 5;
-          uint32 len_name = *data++;
-          data += 1;
-          uint32 len_data = *data++;
-          char const* text = (char*)data;
-          data += (len_name + 3) / 4;
-          len_data = (len_data + 3) / 4;
-          power.formulas_.emplace(
-            std::piecewise_construct,
-            std::forward_as_tuple(id),
-            std::forward_as_tuple(data, data + len_data, text)
-          );
-          data += len_data;
-        }
+  powerId = pow->x000_Header.id;
+  uint8* base = reinterpret_cast<uint8*>(&pow->x050_PowerDef);
+  using PowerTags = Power::Type::PowerTags;
+  for (uint32 offset : mapOffsets) {
+    uint32 const* data = reinterpret_cast<PowerTags*>(base + offset)->data();
+    uint32 count = *data++;
+    while (count--) {
+      uint32 type = *data++;
+      uint32 id = *data++;
+      if (type != 4) {
+        formulas.emplace(id, (int)*data++);
+      } else {
+        data += 5;
+        uint32 len_name = *data++;
+        data += 1;
+        uint32 len_data = *data++;
+        char const* text = (char*)data;
+        data += (len_name + 3) / 4;
+        len_data = (len_data + 3) / 4;
+        formulas.emplace(
+          std::piecewise_construct,
+          std::forward_as_tuple(id),
+          std::forward_as_tuple(data, data + len_data, text)
+        );
+        data += len_data;
+      }
+    }
+  }
+  for (size_t sf = 0; sf < pow->x438_ScriptFormulaDetails.size(); ++sf) {
+    auto it = formulas.find(PowerTag::sfid(sf));
+    if (it != formulas.end()) {
+      it->second.comment = pow->x438_ScriptFormulaDetails[sf].x000_Text;
+    }
+  }
+}
+
+// called with the lock held
+PowerTag* PowerTags::insert(istring const& name, uint32 id, Formulas& formulas) {
+  auto it = powers_.find(name);
+  if (it != powers_.end()) return &it->second;
+  PowerTag& power = powers_[name];
+  power.name_ = name;
+  power.formulas_.swap(formulas);
+  raw_[id] = &power;
+  return &power;
+}
+
+PowerTag* PowerTags::find(istring const& name) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = powers_.find(name);
+    if (it != powers_.end()) return &it->second;
+    if (missing_.count(name)) return nullptr;
+    auto cached = cachedPowers_.find(name);
+    if (cached != cachedPowers_.end()) {
+      std::string fileName;
+      uint32 id;
+      Formulas formulas;
+      if (decodePower(cached->second, fileName, id, formulas)) {
+        return insert(fileName, id, formulas);
       }
+      // damaged record: parse the power again, which appends a new record that later runs use
+      cachedPowers_.erase(cached);
+    }
+  }
+  // parse without the lock, so that other threads can use the powers that are already loaded;
+  // the map gives the name with the case of the file
+  SnoMap const& map = SnoManager::get<Power>();
+  uint32 mapId = map.find(name.c_str());
+  SnoFile<Power> pow(mapId == -1 ? nullptr : map[mapId], loader_);
+  uint32 id = 0;
+  Formulas formulas;
+  if (pow) readPower(pow, id, formulas);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!pow) {
+    missing_.insert(name);
+    return nullptr;
+  }
+  auto it = powers_.find(name);
+  if (it != powers_.end()) return &it->second;
+  MemoryFile record;
+  record.write32(id);
+  writeString(record, pow.name());
+  record.write32(formulas.size());
+  for (auto& kv : formulas) {
+    record.write32(kv.first);
+    if (kv.second.state == PowerTag::sDone) {
+      record.write32(0);
+      record.write32(kv.second.value);
+    } else {
+      record.write32(1);
+      record.write32(kv.second.formula.size());
+      record.write(kv.second.formula.data(), kv.second.formula.size() * sizeof(uint32));
+      writeString(record, kv.second.text);
+    }
+    writeString(record, kv.second.comment);
+  }
+  writeCache(cachePower, record);
+  return insert(pow.name(), id, formulas);
+}
+
+PowerTag* PowerTags::find(uint32 id) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = raw_.find(id);
+    if (it != raw_.end()) return it->second;
+  }
+  char const* name = Power::name(id);
+  PowerTag* tag = (name ? find(istring(name)) : nullptr);
+  if (!tag) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    raw_.emplace(id, nullptr);
+  }
+  return tag;
+}
+
+void PowerTags::loadTables() {
+  if (cachedTables_) {
+    uint32 size = *reinterpret_cast<uint32 const*>(&cache_[cachedTables_ - 4]);
+    File record = File::memfile(&cache_[cachedTables_], size);
+    bool valid = (size >= 4);
+    uint32 count = (valid ? record.read32() : 0);
+    // a table takes at least its name length and the entries
+    valid = valid && count <= left(record) / (4 + sizeof(PowerTable));
+    std::string name;
+    while (valid && count--) {
+      valid = readString(record, name) && left(record) >= sizeof(PowerTable);
+      if (valid) record.read(tables_[name].entries, sizeof(PowerTable));
     }
-    for (size_t sf = 0; sf < pow->x438_ScriptFormulaDetails.size(); ++sf) {
-      auto it = power.formulas_.find(PowerTag::sfid(sf));
-      if (it != power.formulas_.end()) {
-        it->second.comment = pow->x438_ScriptFormulaDetails[sf].x000_Text;
+    if (valid) return;
+    // damaged record: build the tables again and append a new record
+    tables_.clear();
+  }
+  for (auto& gmb : loader_->all<GameBalance>()) {
+    for (auto& pow : gmb->x198_PowerFormulaTable) {
+      auto& tbl = tables_[pow.x000_Text];
+      for (int i = 0; i < 76; ++i) {
+        tbl.entries[i] = (&pow.x400)[i];
       }
     }
   }
+  MemoryFile record;
+  record.write32(tables_.size());
+  for (auto& kv : tables_) {
+    writeString(record, kv.first);
+    record.write(kv.second.entries, sizeof kv.second.entries);
+  }
+  writeCache(cacheTables, record);
 }
 
-PowerTags& PowerTags::instance(SnoLoader* loader) {
-  static PowerTags inst_(loader);
-  return inst_;
+double const* PowerTags::table(istring const& name) {
+  auto& inst = instance();
+  std::lock_guard<std::mutex> lock(inst.mutex_);
+  if (!inst.tablesLoaded_) {
+    inst.loadTables();
+    inst.tablesLoaded_ = true;
+  }
+  auto it = inst.tables_.find(name);
+  if (it == inst.tables_.end()) return nullptr;
+  return it->second.entries;
 }
 
-AttributeValue PowerTag::_get(uint32 id, ScriptFormula& sf, AttributeMap const& attr) {
+std::string const& PowerTags::lookup(std::map<uint32, std::string> const& map, uint32 id) {
+  static std::string const empty;
+  auto it = map.find(id);
+  return (it == map.end() ? empty : it->second);
+}
+
+// formulas being evaluated on this thread, innermost first
+struct EvalFrame {
+  PowerTag const* tag;
+  uint32 id;
+  EvalFrame* next;
+};
+static THREAD_LOCAL EvalFrame* evaluating = nullptr;
+
+class PowerTag::EvalGuard {
+public:
+  EvalGuard(PowerTag const* tag, uint32 id) {
+    for (EvalFrame* frame = evaluating; frame; frame = frame->next) {
+      if (frame->tag == tag && frame->id == id) {
+        throw Exception("recursive formula in PowerTag.%s.\"%s\"", tag->name().c_str(),
+          PowerTags::instance().lookup(PowerTags::instance().reverse_, id).c_str());
+      }
+    }
+    frame_.tag = tag;
+    frame_.id = id;
+    frame_.next = evaluating;
+    evaluating = &frame_;
+  }
+  ~EvalGuard() {
+    evaluating = frame_.next;
+  }
+private:
+  EvalFrame frame_;
+};
+
+Formula const& PowerTag::code(ScriptFormula& sf) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (sf.code.empty()) {
+    sf.code = Formula(sf.formula.data(), sf.formula.data() + sf.formula.size());
+  }
+  return sf.code;
+}
+
+AttributeValue PowerTag::_get(uint32 id, ScriptFormula& sf, AttributeVector const& attr) {
   if (sf.state == sDone) return sf.value;
-  if (sf.state == sCurrent) {
-    throw Exception("recursive formula in PowerTag.%s.\"%s\"", name_.c_str(), PowerTags::instance().reverse_[id].c_str());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : sf.memo) {
+      if (entry.first == attr) return entry.second;
+    }
+  }
+  EvalGuard guard(this, id);
+  AttributeValue value = code(sf).eval(attr, this);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (sf.memo.size() < MemoSize) {
+    sf.memo.emplace_back(attr, value);
+  } else {
+    sf.memo[sf.memoNext] = std::make_pair(attr, value);
+    sf.memoNext = (sf.memoNext + 1) % MemoSize;
   }
-  sf.state = sCurrent;
-  AttributeValue value = ExecFormula(sf.formula, attr, this);
-  sf.state = sNone;
   return value;
 }
+AttributeColumn PowerTag::_getBatch(uint32 id, AttributeColumns const& attr) {
+  auto it = formulas_.find(id);
+  if (it == formulas_.end()) return AttributeColumn(attr.size());
+  ScriptFormula& sf = it->second;
+  if (sf.state == sDone) {
+    AttributeColumn res(attr.size());
+    std::fill(res.min.begin(), res.min.end(), sf.value);
+    std::fill(res.max.begin(), res.max.end(), sf.value);
+    return res;
+  }
+  EvalGuard guard(this, id);
+  return code(sf).eval(attr, this);
+}
 Dictionary PowerTag::formulas() {
   auto& tags = PowerTags::instance().reverse_;
   Dictionary values;
   for (auto& kv : formulas_) {
-    values.emplace(tags[kv.first], kv.second.state == sDone ? fmtstring("%d", kv.second.value) : kv.second.text);
+    values.emplace(PowerTags::lookup(tags, kv.first), kv.second.state == sDone ? fmtstring("%d", kv.second.value) : kv.second.text);
   }
   return values;
 }
@@ -95,11 +400,16 @@ AttributeValue PowerTag::operator[](istring const& formula) {
   auto it = tags.find(formula);
   return (it == tags.end() ? 0 : get(it->second));
 }
-AttributeValue PowerTag::get(istring const& formula, AttributeMap const& attr) {
+AttributeValue PowerTag::get(istring const& formula, AttributeVector const& attr) {
   auto& tags = PowerTags::instance().tags_;
   auto it = tags.find(formula);
   return (it == tags.end() ? 0 : _get(it->second, attr));
 }
+AttributeColumn PowerTag::getBatch(istring const& formula, AttributeColumns const& attr) {
+  auto& tags = PowerTags::instance().tags_;
+  auto it = tags.find(formula);
+  return (it == tags.end() ? AttributeColumn(attr.size()) : _getBatch(it->second, attr));
+}
 uint32 PowerTag::getint(istring const& formula) {
   auto& tags = PowerTags::instance().tags_;
   auto it = tags.find(formula);
@@ -121,7 +431,7 @@ json::Value PowerTag::dump() const {
   auto& rawnames = PowerTags::instance().rawnames_;
   json::Value dst;
   for (auto& kv : formulas_) {
-    auto& cur = dst[rawnames[kv.first]];
+    auto& cur = dst[PowerTags::lookup(rawnames, kv.first)];
     if (kv.second.state == sDone) {
       cur = (uint32) kv.second.value;
     } else {
@@ -141,9 +451,22 @@ json::Value PowerTag::dump() const {
 }
 
 json::Value PowerTags::dump() {
-  auto& tags = instance().raw_;
+  auto& inst = instance();
+  std::vector<uint32> ids;
+  for (auto& entry : SnoManager::get<Power>()) {
+    ids.push_back(entry.first);
+  }
+  void* task = Logger::begin(ids.size(), "Loading powers");
+  ThreadPool::instance().parallel_for(ids.size(), [&](size_t i) {
+    Logger::item(SnoManager::get<Power>()[ids[i]], task);
+    inst.find(ids[i]);
+  });
+  Logger::end(false, task);
+
+  std::lock_guard<std::mutex> lock(inst.mutex_);
   json::Value dst;
-  for (auto& kv : tags) {
+  for (auto& kv : inst.raw_) {
+    if (!kv.second) continue;
     auto& cur = dst[kv.second->name()];
     cur["id"] = kv.first;
     cur["tags"] = kv.second->dump();
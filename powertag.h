@@ -14,21 +14,38 @@
 //   get formula by name, or Script Formula #
 // AttributeValue PowerTag::getraw(uint32 id, AttributeMap const& attr = {})
 //   get formula by raw id
+// (all of these also take an AttributeVector, to avoid looking up the attributes again)
+// AttributeColumn PowerTag::getBatch(istring const& formula, AttributeColumns const& attr)
+// AttributeColumn PowerTag::getBatch(int id, AttributeColumns const& attr)
+//   evaluate a formula for every row of attr at once
 // uint32 getint(istring const& formula)
 //   get constant value (no formulas)
+//
+// Powers are read on first access, by name or by id (through the Power SnoMap), and the formulas
+// of every power read are appended to a cache file for the build, so later runs do not parse
+// Power files at all. Lookups and evaluation may be done from several threads at once.
 
 #include "common.h"
 #include "parser.h"
 #include "description.h"
+#include <mutex>
+#include <set>
+
+struct Power;
 
 class PowerTag {
-  enum FormulaState { sNone, sCurrent, sDone };
+  enum FormulaState { sNone, sDone };
+  enum { MemoSize = 8 };
   struct ScriptFormula {
     FormulaState state;
     int value;
     std::vector<uint32> formula;
     std::string text;
     std::string comment;
+    // compiled on first use; results are remembered for the last few attribute vectors
+    Formula code;
+    std::vector<std::pair<AttributeVector, AttributeValue>> memo;
+    uint32 memoNext = 0;
     ScriptFormula(int value)
       : state(sDone)
       , value(value)
@@ -42,30 +59,54 @@ class PowerTag {
   friend class PowerTags;
   std::string name_;
   std::map<uint32, ScriptFormula> formulas_;
+  // guards compilation and the memo of the formulas; held only while they are accessed, not
+  // during evaluation, which may refer to other powers
+  std::mutex mutex_;
+  Formula const& code(ScriptFormula& sf);
+  // recursion check for the formulas being evaluated on the current thread
+  class EvalGuard;
   static uint32 sfid(int id) {
     return 0x41100 + (id % 10) * 0x10 + (id / 10) * 0x100;
   }
-  AttributeValue _get(uint32 id, ScriptFormula& sf, AttributeMap const& attr);
-  AttributeValue _get(uint32 id, AttributeMap const& attr) {
+  AttributeValue _get(uint32 id, ScriptFormula& sf, AttributeVector const& attr);
+  AttributeValue _get(uint32 id, AttributeVector const& attr) {
     auto it = formulas_.find(id);
     if (it == formulas_.end()) return 0;
     return _get(id, it->second, attr);
   }
+  AttributeColumn _getBatch(uint32 id, AttributeColumns const& attr);
 public:
   AttributeValue operator[](istring const& formula);
   AttributeValue operator[](int id) {
     if (id < 0 || id > 63) return 0;
     return get(sfid(id), {});
   }
-  AttributeValue get(istring const& formula, AttributeMap const& attr = {});
+  AttributeValue get(istring const& formula, AttributeVector const& attr);
+  AttributeValue get(istring const& formula, AttributeMap const& attr = {}) {
+    return get(formula, AttributeVector(attr));
+  }
   uint32 getint(istring const& formula);
-  AttributeValue get(int id, AttributeMap const& attr = {}) {
+  AttributeValue get(int id, AttributeVector const& attr) {
     if (id < 0 || id > 63) return 0;
     return _get(sfid(id), attr);
   }
-  AttributeValue getraw(uint32 id, AttributeMap const& attr = {}) {
+  AttributeValue get(int id, AttributeMap const& attr = {}) {
+    return get(id, AttributeVector(attr));
+  }
+  AttributeValue getraw(uint32 id, AttributeVector const& attr) {
     return _get(id, attr);
   }
+  AttributeValue getraw(uint32 id, AttributeMap const& attr = {}) {
+    return _get(id, AttributeVector(attr));
+  }
+  AttributeColumn getBatch(istring const& formula, AttributeColumns const& attr);
+  AttributeColumn getBatch(int id, AttributeColumns const& attr) {
+    if (id < 0 || id > 63) return AttributeColumn(attr.size());
+    return _getBatch(sfid(id), attr);
+  }
+  AttributeColumn getrawBatch(uint32 id, AttributeColumns const& attr) {
+    return _getBatch(id, attr);
+  }
   std::string comment(istring const& formula);
   std::string comment(int id) {
     if (id < 0 || id > 63) return 0;
@@ -82,13 +123,11 @@ public:
 };
 
 class PowerTags {
-  PowerTags(SnoLoader* loader = SnoLoader::default);
+  PowerTags(SnoLoader* loader = SnoLoader::primary);
 public:
-  static PowerTags& instance(SnoLoader* loader = SnoLoader::default);
+  static PowerTags& instance(SnoLoader* loader = SnoLoader::primary);
   static PowerTag* get(istring const& name) {
-    auto& pow = instance().powers_;
-    auto it = pow.find(name);
-    return (it == pow.end() ? nullptr : &it->second);
+    return instance().find(name);
   }
   static AttributeValue get(istring const& name, int id, AttributeMap const& attr = {}) {
     return instance()[name].get(id, attr);
@@ -96,33 +135,41 @@ public:
   static AttributeValue get(istring const& name, istring const& formula, AttributeMap const& attr = {}) {
     return instance()[name].get(formula, attr);
   }
+  static AttributeValue get(istring const& name, istring const& formula, AttributeVector const& attr) {
+    return instance()[name].get(formula, attr);
+  }
   static PowerTag* getraw(uint32 power_id) {
-    auto& raw = instance().raw_;
-    auto it = raw.find(power_id);
-    return (it == raw.end() ? nullptr : it->second);
+    return instance().find(power_id);
   }
   static AttributeValue getraw(uint32 power_id, uint32 formula_id, AttributeMap const& attr = {}) {
-    auto& raw = instance().raw_;
-    auto it = raw.find(power_id);
-    return (it == raw.end() ? 0 : it->second->getraw(formula_id, attr));
+    PowerTag* tag = getraw(power_id);
+    return (tag ? tag->getraw(formula_id, attr) : 0);
+  }
+  static AttributeValue getraw(uint32 power_id, uint32 formula_id, AttributeVector const& attr) {
+    PowerTag* tag = getraw(power_id);
+    return (tag ? tag->getraw(formula_id, attr) : 0);
   }
-  static double const* table(istring const& name) {
-    auto& inst = instance();
-    auto it = inst.tables_.find(name);
-    if (it == inst.tables_.end()) return nullptr;
-    return it->second.entries;
+  static AttributeColumn getrawBatch(uint32 power_id, uint32 formula_id, AttributeColumns const& attr) {
+    PowerTag* tag = getraw(power_id);
+    return (tag ? tag->getrawBatch(formula_id, attr) : AttributeColumn(attr.size()));
   }
+  static double const* table(istring const& name);
 
   PowerTag& operator[](istring const& name) {
-    auto it = powers_.find(name);
-    return (it == powers_.end() ? nil_ : it->second);
+    PowerTag* tag = find(name);
+    return (tag ? *tag : nil_);
   }
 
+  // reads every power
   static json::Value dump();
 
 private:
   friend class PowerTag;
+  typedef std::map<uint32, PowerTag::ScriptFormula> Formulas;
+  std::mutex mutex_;
+  SnoLoader* loader_;
   Map<PowerTag> powers_;
+  std::set<istring> missing_;
   std::map<uint32, PowerTag*> raw_;
   Map<uint32> tags_;
   std::map<uint32, std::string> reverse_;
@@ -132,4 +179,22 @@ private:
     double entries[76];
   };
   Map<PowerTable> tables_;
+  bool tablesLoaded_;
+
+  // cache file contents up to the last complete record, and where the records are
+  std::string cachePath_;
+  std::vector<uint8> cache_;
+  Map<size_t> cachedPowers_;
+  size_t cachedTables_;
+  File cacheOut_;
+
+  PowerTag* find(istring const& name);
+  PowerTag* find(uint32 id);
+  PowerTag* insert(istring const& name, uint32 id, Formulas& formulas);
+  void loadTables();
+  static void readPower(SnoFile<Power>& pow, uint32& id, Formulas& formulas);
+  void readCache();
+  bool decodePower(size_t offset, std::string& name, uint32& id, Formulas& formulas);
+  void writeCache(uint32 kind, MemoryFile& data);
+  static std::string const& lookup(std::map<uint32, std::string> const& map, uint32 id);
 };
@@ -0,0 +1,444 @@
+#include "resample.h"
+#include "cpu.h"
+#include "threadpool.h"
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLE_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 kernels are compiled for that target alone and only picked when the CPU reports support
+#if defined(RESAMPLE_SSE2) && defined(_MSC_VER) && _MSC_VER >= 1800
+#define RESAMPLE_AVX2
+#define RESAMPLE_TARGET_AVX2
+#include <immintrin.h>
+#elif defined(RESAMPLE_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESAMPLE_AVX2
+#define RESAMPLE_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace Resample {
+
+enum {
+  Bits = 14,                  // fractional bits of the weights
+  Half = 1 << (Bits - 1),
+  ChunkWork = 1 << 18,        // multiply-adds per thread pool task
+  CacheSize = 16,             // weight tables kept for reuse
+};
+
+// weights of one pass: every output pixel reads taps consecutive source pixels from left[i]; the
+// window is moved back near the far edge so that it stays inside the source, with zero weights
+// filling the difference
+struct Coeffs {
+  uint32 taps;
+  std::vector<uint32> left;
+  std::vector<int16> weights;   // taps per output pixel
+};
+
+static void coeffs(Coeffs& dst, uint32 from, uint32 to, double radius, ImageFilter::Function filter) {
+  double scale = static_cast<double>(to) / from;
+  double support = (scale < 1 ? radius / scale : radius);
+  double step = std::min(scale, 1.0);
+  std::vector<std::pair<int, int>> ranges(to);
+  dst.taps = 1;
+  for (uint32 i = 0; i < to; ++i) {
+    double center = (i + 0.5) / scale;
+    int left = std::max(0, static_cast<int>(floor(center - support)));
+    int right = std::min<int>(from, static_cast<int>(ceil(center + support)) + 1);
+    ranges[i] = std::make_pair(left, right);
+    dst.taps = std::max<uint32>(dst.taps, right - left);
+  }
+  dst.left.resize(to);
+  dst.weights.assign(size_t(to) * dst.taps, 0);
+  std::vector<double> factors;
+  for (uint32 i = 0; i < to; ++i) {
+    double center = (i + 0.5) / scale;
+    int left = ranges[i].first, right = ranges[i].second;
+    factors.clear();
+    double sum = 0;
+    for (int j = left; j < right; ++j) {
+      factors.push_back(filter(std::abs((center - j - 0.5) * step)));
+      sum += factors.back();
+    }
+    uint32 pos = std::min<uint32>(left, from - dst.taps);
+    dst.left[i] = pos;
+    if (sum == 0) continue;
+    // rounding errors go to the largest weight, so that flat areas keep their color
+    int16* weights = &dst.weights[size_t(i) * dst.taps + (left - pos)];
+    int total = 0;
+    size_t largest = 0;
+    for (size_t j = 0; j < factors.size(); ++j) {
+      weights[j] = static_cast<int16>(floor(factors[j] / sum * (1 << Bits) + 0.5));
+      total += weights[j];
+      if (std::abs(weights[j]) > std::abs(weights[largest])) largest = j;
+    }
+    weights[largest] += (1 << Bits) - total;
+  }
+}
+
+// thumbnails are made from many images of the same size, so the last few weight tables are kept
+struct CachedCoeffs {
+  uint32 from;
+  uint32 to;
+  double radius;
+  ImageFilter::Function filter;
+  std::shared_ptr<Coeffs const> coeffs;
+};
+static std::mutex cacheMutex;
+static std::vector<CachedCoeffs> cache;   // most recently used last
+
+static std::shared_ptr<Coeffs const> getCoeffs(uint32 from, uint32 to, double radius, ImageFilter::Function filter) {
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (size_t i = cache.size(); i--;) {
+      CachedCoeffs& entry = cache[i];
+      if (entry.from == from && entry.to == to && entry.radius == radius && entry.filter == filter) {
+        std::rotate(cache.begin() + i, cache.begin() + i + 1, cache.end());
+        return cache.back().coeffs;
+      }
+    }
+  }
+  std::shared_ptr<Coeffs> result = std::make_shared<Coeffs>();
+  coeffs(*result, from, to, radius, filter);
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  if (cache.size() >= CacheSize) {
+    cache.erase(cache.begin());
+  }
+  CachedCoeffs entry = {from, to, radius, filter, result};
+  cache.push_back(entry);
+  return result;
+}
+
+static inline uint32 clamp8(int value) {
+  return static_cast<uint32>(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// x * alpha / 255, rounded
+static inline uint32 mul255(uint32 x, uint32 alpha) {
+  uint32 t = x * alpha + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32 premultiply(uint32 color) {
+  uint32 alpha = color >> 24;
+  if (alpha == 255) return color;
+  if (alpha == 0) return 0;
+  return mul255(color & 0xFF, alpha) | (mul255((color >> 8) & 0xFF, alpha) << 8) |
+    (mul255((color >> 16) & 0xFF, alpha) << 16) | (alpha << 24);
+}
+
+// 255 / alpha in 16.16 fixed point
+static struct Reciprocals {
+  uint32 value[256];
+  Reciprocals() {
+    value[0] = 0;
+    for (uint32 alpha = 1; alpha < 256; ++alpha) {
+      value[alpha] = ((255 << 16) + alpha / 2) / alpha;
+    }
+  }
+} const reciprocals;
+
+static inline uint32 unpremultiply(uint32 color) {
+  uint32 alpha = color >> 24;
+  if (alpha == 255) return color;
+  uint32 scale = reciprocals.value[alpha];
+  uint32 b = std::min<uint32>(((color & 0xFF) * scale + 0x8000) >> 16, 255);
+  uint32 g = std::min<uint32>((((color >> 8) & 0xFF) * scale + 0x8000) >> 16, 255);
+  uint32 r = std::min<uint32>((((color >> 16) & 0xFF) * scale + 0x8000) >> 16, 255);
+  return b | (g << 8) | (r << 16) | (alpha << 24);
+}
+
+// horizontal pass: count output pixels of one row
+typedef void(*RowFunc)(uint32 const* src, uint32* dst, uint32 count, Coeffs const& coeffs);
+// vertical pass: one output row from taps source rows starting at src, all of them width pixels
+typedef void(*ColumnFunc)(uint32 const* src, uint32* dst, uint32 width, uint32 taps, int16 const* weights);
+
+static void rowScalar(uint32 const* src, uint32* dst, uint32 count, Coeffs const& coeffs) {
+  for (uint32 x = 0; x < count; ++x) {
+    uint32 const* pixels = src + coeffs.left[x];
+    int16 const* weights = &coeffs.weights[size_t(x) * coeffs.taps];
+    int b = Half, g = Half, r = Half, a = Half;
+    for (uint32 k = 0; k < coeffs.taps; ++k) {
+      uint32 color = pixels[k];
+      int weight = weights[k];
+      b += weight * static_cast<int>(color & 0xFF);
+      g += weight * static_cast<int>((color >> 8) & 0xFF);
+      r += weight * static_cast<int>((color >> 16) & 0xFF);
+      a += weight * static_cast<int>(color >> 24);
+    }
+    dst[x] = clamp8(b >> Bits) | (clamp8(g >> Bits) << 8) | (clamp8(r >> Bits) << 16) | (clamp8(a >> Bits) << 24);
+  }
+}
+
+static void columnScalar(uint32 const* src, uint32* dst, uint32 width, uint32 taps, int16 const* weights, uint32 first) {
+  for (uint32 x = first; x < width; ++x) {
+    int b = Half, g = Half, r = Half, a = Half;
+    for (uint32 k = 0; k < taps; ++k) {
+      uint32 color = src[size_t(k) * width + x];
+      int weight = weights[k];
+      b += weight * static_cast<int>(color & 0xFF);
+      g += weight * static_cast<int>((color >> 8) & 0xFF);
+      r += weight * static_cast<int>((color >> 16) & 0xFF);
+      a += weight * static_cast<int>(color >> 24);
+    }
+    dst[x] = clamp8(b >> Bits) | (clamp8(g >> Bits) << 8) | (clamp8(r >> Bits) << 16) | (clamp8(a >> Bits) << 24);
+  }
+}
+static void columnScalar(uint32 const* src, uint32* dst, uint32 width, uint32 taps, int16 const* weights) {
+  columnScalar(src, dst, width, taps, weights, 0);
+}
+
+#ifdef RESAMPLE_SSE2
+// two weights as the (first, second) int16 pair that _mm_madd_epi16 expects
+static inline int weightPair(int16 const* weights) {
+  return static_cast<uint16>(weights[0]) | (static_cast<uint32>(static_cast<uint16>(weights[1])) << 16);
+}
+
+// taps [first, taps) of one output pixel, added to the (b, g, r, a) sums
+static inline __m128i rowTailSSE2(uint32 const* pixels, int16 const* weights, uint32 first, uint32 taps, __m128i sum) {
+  __m128i zero = _mm_setzero_si128();
+  uint32 k = first;
+  for (; k + 2 <= taps; k += 2) {
+    // b0 b1 g0 g1 r0 r1 a0 a1
+    __m128i pair = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixels[k]), _mm_cvtsi32_si128(pixels[k + 1]));
+    pair = _mm_unpacklo_epi8(pair, zero);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(pair, _mm_set1_epi32(weightPair(weights + k))));
+  }
+  if (k < taps) {
+    __m128i single = _mm_unpacklo_epi8(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixels[k]), zero), zero);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(single, _mm_set1_epi32(static_cast<uint16>(weights[k]))));
+  }
+  return sum;
+}
+
+static inline uint32 packSSE2(__m128i sum) {
+  sum = _mm_srai_epi32(sum, Bits);
+  sum = _mm_packs_epi32(sum, sum);
+  return static_cast<uint32>(_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum)));
+}
+
+static void rowSSE2(uint32 const* src, uint32* dst, uint32 count, Coeffs const& coeffs) {
+  for (uint32 x = 0; x < count; ++x) {
+    __m128i sum = rowTailSSE2(src + coeffs.left[x], &coeffs.weights[size_t(x) * coeffs.taps], 0, coeffs.taps, _mm_set1_epi32(Half));
+    dst[x] = packSSE2(sum);
+  }
+}
+
+// four pixels: source rows are interleaved byte by byte in pairs, so that one _mm_madd_epi16 adds
+// two taps of four channels
+static inline void column4SSE2(uint32 const* src, uint32* dst, uint32 width, uint32 taps, int16 const* weights) {
+  __m128i zero = _mm_setzero_si128();
+  __m128i s0 = _mm_set1_epi32(Half), s1 = s0, s2 = s0, s3 = s0;
+  for (uint32 k = 0; k < taps; k += 2) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + size_t(k) * width));
+    __m128i b = zero, weight;
+    if (k + 1 < taps) {
+      b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + size_t(k + 1) * width));
+      weight = _mm_set1_epi32(weightPair(weights + k));
+    } else {
+      weight = _mm_set1_epi32(static_cast<uint16>(weights[k]));
+    }
+    __m128i lo = _mm_unpacklo_epi8(a, b), hi = _mm_unpackhi_epi8(a, b);
+    s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), weight));
+    s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), weight));
+    s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), weight));
+    s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), weight));
+  }
+  __m128i lo = _mm_packs_epi32(_mm_srai_epi32(s0, Bits), _mm_srai_epi32(s1, Bits));
+  __m128i hi = _mm_packs_epi32(_mm_srai_epi32(s2, Bits), _mm_srai_epi32(s3, Bits));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(lo, hi));
+}
+
+static void columnSSE2(uint32 const* src, uint32* dst, uint32 width, uint32 taps, int16 const* weights) {
+  uint32 x = 0;
+  for (; x + 4 <= width; x += 4) {
+    column4SSE2(src + x, dst + x, width, taps, weights);
+  }
+  columnScalar(src, dst, width, taps, weights, x);
+}
+#endif
+
+#ifdef RESAMPLE_AVX2
+// four taps at a time: the pixels are shuffled into (b0 b1 g0 g1 r0 r1 a0 a1) and
+// (b2 b3 g2 g3 r2 r3 a2 a3) and widened into the two 128-bit lanes
+RESAMPLE_TARGET_AVX2 static void rowAVX2(uint32 const* src, uint32* dst, uint32 count, Coeffs const& coeffs) {
+  __m128i const order = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15);
+  __m256i const spread = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+  uint32 taps = coeffs.taps;
+  for (uint32 x = 0; x < count; ++x) {
+    uint32 const* pixels = src + coeffs.left[x];
+    int16 const* weights = &coeffs.weights[size_t(x) * taps];
+    __m256i sum = _mm256_setzero_si256();
+    uint32 k = 0;
+    for (; k + 4 <= taps; k += 4) {
+      __m128i quad = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(pixels + k)), order);
+      __m256i weight = _mm256_permutevar8x32_epi32(
+        _mm256_castsi128_si256(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(weights + k))), spread);
+      sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_cvtepu8_epi16(quad), weight));
+    }
+    __m128i total = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    total = rowTailSSE2(pixels, weights, k, taps, _mm_add_epi32(total, _mm_set1_epi32(Half)));
+    dst[x] = packSSE2(total);
+  }
+}
+
+// eight pixels; the byte interleaving and packing work within 128-bit lanes, which keeps the
+// pixels in order
+RESAMPLE_TARGET_AVX2 static void columnAVX2(uint32 const* src, uint32* dst, uint32 width, uint32 taps, int16 const* weights) {
+  __m256i zero = _mm256_setzero_si256();
+  uint32 x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i s0 = _mm256_set1_epi32(Half), s1 = s0, s2 = s0, s3 = s0;
+    for (uint32 k = 0; k < taps; k += 2) {
+      __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + size_t(k) * width + x));
+      __m256i b = zero, weight;
+      if (k + 1 < taps) {
+        b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + size_t(k + 1) * width + x));
+        weight = _mm256_set1_epi32(weightPair(weights + k));
+      } else {
+        weight = _mm256_set1_epi32(static_cast<uint16>(weights[k]));
+      }
+      __m256i lo = _mm256_unpacklo_epi8(a, b), hi = _mm256_unpackhi_epi8(a, b);
+      s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_unpacklo_epi8(lo, zero), weight));
+      s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_unpackhi_epi8(lo, zero), weight));
+      s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_unpacklo_epi8(hi, zero), weight));
+      s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_unpackhi_epi8(hi, zero), weight));
+    }
+    __m256i lo = _mm256_packs_epi32(_mm256_srai_epi32(s0, Bits), _mm256_srai_epi32(s1, Bits));
+    __m256i hi = _mm256_packs_epi32(_mm256_srai_epi32(s2, Bits), _mm256_srai_epi32(s3, Bits));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_packus_epi16(lo, hi));
+  }
+  for (; x + 4 <= width; x += 4) {
+    column4SSE2(src + x, dst + x, width, taps, weights);
+  }
+  columnScalar(src, dst, width, taps, weights, x);
+}
+
+#endif
+
+static struct {
+  RowFunc row;
+  ColumnFunc column;
+} const kernels[NumKernels] = {
+  {rowScalar, columnScalar},
+#ifdef RESAMPLE_SSE2
+  {rowSSE2, columnSSE2},
+#else
+  {nullptr, nullptr},
+#endif
+#ifdef RESAMPLE_AVX2
+  {rowAVX2, columnAVX2},
+#else
+  {nullptr, nullptr},
+#endif
+};
+
+bool supported(Kernel kernel) {
+  switch (kernel) {
+  case Scalar:
+    return true;
+#ifdef RESAMPLE_SSE2
+  case SSE2:
+    return true;
+#endif
+#ifdef RESAMPLE_AVX2
+  case AVX2:
+    return CPU::hasAVX2();
+#endif
+  default:
+    return false;
+  }
+}
+
+static Kernel best() {
+  for (int kernel = NumKernels - 1; kernel > Scalar; --kernel) {
+    if (supported(static_cast<Kernel>(kernel))) return static_cast<Kernel>(kernel);
+  }
+  return Scalar;
+}
+// detected once at startup; setKernel() overrides it for benchmarks, and may be called while the
+// thread pool resamples
+static Kernel const detected = best();
+static std::atomic<int> selected(-1);
+
+Kernel kernel() {
+  int kernel = selected.load(std::memory_order_relaxed);
+  return (kernel < 0 ? detected : static_cast<Kernel>(kernel));
+}
+void setKernel(Kernel kernel) {
+  if (supported(kernel)) selected.store(kernel, std::memory_order_relaxed);
+}
+
+// func(first, last) over ranges of rows, on the thread pool when there is enough work
+template<class Func>
+static void forRows(uint32 count, uint64 rowWork, Func const& func) {
+  uint32 chunk = static_cast<uint32>(std::max<uint64>(1, ChunkWork / std::max<uint64>(rowWork, 1)));
+  uint32 chunks = (count + chunk - 1) / chunk;
+  if (chunks <= 1) {
+    func(0, count);
+    return;
+  }
+  ThreadPool::instance().parallel_for(chunks, [&](size_t i) {
+    uint32 first = static_cast<uint32>(i) * chunk;
+    func(first, std::min(count, first + chunk));
+  });
+}
+
+}
+
+namespace ImagePrivate {
+
+Image imResize(Image const& image, uint32 width, uint32 height, double radius, ImageFilter::Function filter) {
+  using namespace Resample;
+  uint32 srcWidth = image.width(), srcHeight = image.height();
+  if (srcWidth == width && srcHeight == height) return image;
+  if (!srcWidth || !srcHeight) return Image(width, height);
+  auto const& kernel = kernels[Resample::kernel()];
+
+  std::vector<uint32> cur(size_t(srcWidth) * srcHeight);
+  uint32 const* bits = image.bits();
+  for (size_t i = 0; i < cur.size(); ++i) {
+    cur[i] = premultiply(bits[i]);
+  }
+
+  if (srcWidth != width) {
+    std::shared_ptr<Coeffs const> coeffs = getCoeffs(srcWidth, width, radius, filter);
+    Coeffs const& horz = *coeffs;
+    std::vector<uint32> next(size_t(width) * srcHeight);
+    forRows(srcHeight, uint64(width) * horz.taps, [&](uint32 first, uint32 last) {
+      for (uint32 y = first; y < last; ++y) {
+        kernel.row(&cur[size_t(y) * srcWidth], &next[size_t(y) * width], width, horz);
+      }
+    });
+    cur.swap(next);
+  }
+  if (srcHeight != height) {
+    std::shared_ptr<Coeffs const> coeffs = getCoeffs(srcHeight, height, radius, filter);
+    Coeffs const& vert = *coeffs;
+    std::vector<uint32> next(size_t(width) * height);
+    forRows(height, uint64(width) * vert.taps, [&](uint32 first, uint32 last) {
+      for (uint32 y = first; y < last; ++y) {
+        kernel.column(&cur[size_t(vert.left[y]) * width], &next[size_t(y) * width], width,
+          vert.taps, &vert.weights[size_t(y) * vert.taps]);
+      }
+    });
+    cur.swap(next);
+  }
+
+  Image result(width, height);
+  uint32* dst = result.mutable_bits();
+  for (size_t i = 0; i < cur.size(); ++i) {
+    dst[i] = unpremultiply(cur[i]);
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,33 @@
+// resample.h
+//
+// the resampler behind ImageBase::resize (ImagePrivate::imResize)
+//
+// Images are resized in two separable passes, horizontal then vertical. Filter weights are
+// computed once per axis and stored as 16-bit fixed point numbers (14 fractional bits) that add
+// up to one for every output pixel, so each pass is integer multiply-adds over 8-bit channels.
+// Color is filtered premultiplied by alpha, which keeps the color of fully transparent pixels
+// from bleeding into the edges of the visible ones. The vertical pass combines whole source rows
+// instead of walking columns, and large images are split into row ranges on the thread pool.
+//
+// The inner loops (kernels) are plain C++, SSE2 or AVX2, picked on first use by what the CPU
+// supports; all of them produce the same pixels.
+//
+// bool Resample::supported(Kernel kernel), Kernel Resample::kernel(), void Resample::setKernel(Kernel kernel)
+//   kernel selection, for comparing them in benchmarks
+
+#pragma once
+#include "image.h"
+
+namespace Resample {
+  enum Kernel {
+    Scalar,
+    SSE2,
+    AVX2,
+
+    NumKernels
+  };
+
+  bool supported(Kernel kernel);
+  Kernel kernel();
+  void setKernel(Kernel kernel);
+}
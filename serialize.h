@@ -9,8 +9,10 @@ template<class T> inline void _serialize(T& x, json::Visitor* visitor) { x.seria
 template<> inline void _serialize(unsigned int& x, json::Visitor* visitor) { visitor->onInteger(x); }
 template<> inline void _serialize(int& x, json::Visitor* visitor) { visitor->onInteger(x); }
 template<> inline void _serialize(char& x, json::Visitor* visitor) { visitor->onInteger(x); }
+#ifdef _MSC_VER
 template<> inline void _serialize(uint32& x, json::Visitor* visitor) { visitor->onInteger(x); }
 template<> inline void _serialize(sint32& x, json::Visitor* visitor) { visitor->onInteger(x); }
+#endif
 template<> inline void _serialize(uint16& x, json::Visitor* visitor) { visitor->onInteger(x); }
 template<> inline void _serialize(sint16& x, json::Visitor* visitor) { visitor->onInteger(x); }
 template<> inline void _serialize(uint8& x, json::Visitor* visitor) { visitor->onInteger(x); }
@@ -40,8 +42,8 @@ public:
     visitor->onCloseMap();
   };
 protected:
-  template<class T>
-  void _write(char const* name, T& x, json::Visitor* visitor) {
+  template<class U>
+  void _write(char const* name, U& x, json::Visitor* visitor) {
     visitor->onMapKey(name);
     _serialize(x, visitor);
   }
@@ -56,16 +58,22 @@ struct sno_size_helper {
   typedef char yes[1];
   typedef yes no[2];
   template<size_t(*F)(uint32)> struct helper;
-  template<typename C> static yes& test(helper<C::snosize>*) {}
-  template<typename> static no& test(...) {}
-  template<bool B> static size_t getter() { return sizeof(T); }
-  template<> static size_t getter<true>() { return T::snosize(SnoLoader::default->build()); }
+  template<typename C> static yes& test(helper<&C::snosize>*);
+  template<typename> static no& test(...);
+  template<bool B, class D = void> struct select {
+    static size_t get() { return sizeof(T); }
+  };
+  template<class D> struct select<true, D> {
+    static size_t get() { return T::snosize(SnoLoader::primary->build()); }
+  };
+  static size_t get() {
+    return select<sizeof(test<T>(0)) == sizeof(yes)>::get();
+  }
 };
 
 template<class T>
 size_t SnoSize() {
-  typedef sno_size_helper<T> helper;
-  static size_t value = helper::getter<sizeof(helper::test<T>(0)) == sizeof(helper::yes)>();
+  static size_t value = sno_size_helper<T>::get();
   return value;
 };
 
@@ -79,7 +87,11 @@ size_t SnoSize() {
 #define do_write5(x,y,z,w,t) do{do_write(x);do_write(y);do_write(z);do_write(w);do_write(t);}while(0)
 #define do_write6(x,y,z,w,t,u) do{do_write(x);do_write(y);do_write(z);do_write(w);do_write(t);do_write(u);}while(0)
 #define _get_write(_1,_2,_3,_4,_5,_6,name,...) name
+#ifdef _MSC_VER
 #define dumpval(...) expand(_get_write(__VA_ARGS__,do_write6,do_write5,do_write4,do_write3,do_write2,do_write))expand((__VA_ARGS__))
+#else
+#define dumpval(...) _get_write(__VA_ARGS__,do_write6,do_write5,do_write4,do_write3,do_write2,do_write)(__VA_ARGS__)
+#endif
 
 struct SerializeData : public Serializable<SerializeData> {
   uint32 offset;
@@ -160,7 +172,12 @@ using ArrayData = ArrayDataImpl<T, sizeof(T*)>;
 
 template<class T>
 class Array : public ArrayData<T> {
+protected:
+  using ArrayData<T>::pdata;
 public:
+  using ArrayData<T>::data;
+  using ArrayData<T>::size;
+
   Array(SerializeData const& sd)
     : ArrayData<T>(sd)
   {
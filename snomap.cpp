@@ -1,93 +1,264 @@
 #include "snomap.h"
 #include "file.h"
 #include "types/GameBalance.h"
-#include <Windows.h>
+#include <algorithm>
+
+#pragma pack(push, 1)
+struct SnoMapHeader {
+  enum { Magic = 'SMAP', Version = 1 };
+  uint32 magic;
+  uint32 version;
+  uint32 count;
+  uint32 hashSize;
+  uint32 poolSize;
+};
+#pragma pack(pop)
+
+static uint32 hashLower(char const* str) {
+  uint32 hash = 0;
+  while (uint8 c = *str++) {
+    hash = hash * 33 + std::tolower(c);
+  }
+  return hash;
+}
+
+SnoMap::SnoMap()
+  : count_(0)
+  , hashSize_(0)
+  , ids_(nullptr)
+  , names_(nullptr)
+  , buckets_(nullptr)
+  , pool_(nullptr)
+{}
+
+char const* SnoMap::operator[](uint32 id) const {
+  uint32 const* it = std::lower_bound(ids_, ids_ + count_, id);
+  if (it == ids_ + count_ || *it != id) return nullptr;
+  return pool_ + names_[it - ids_];
+}
+uint32 SnoMap::find(char const* name) const {
+  if (!hashSize_) return -1;
+  uint32 mask = hashSize_ - 1;
+  for (uint32 pos = hashLower(name) & mask; buckets_[pos]; pos = (pos + 1) & mask) {
+    uint32 index = buckets_[pos] - 1;
+    if (!_stricmp(pool_ + names_[index], name)) {
+      return ids_[index];
+    }
+  }
+  return -1;
+}
+
+void SnoMap::build() {
+  if (pending_.empty()) return;
+  std::vector<std::pair<uint32, std::string>> entries;
+  entries.reserve(count_ + pending_.size());
+  for (uint32 i = 0; i < count_; ++i) {
+    entries.emplace_back(ids_[i], pool_ + names_[i]);
+  }
+  for (auto& entry : pending_) {
+    entries.push_back(std::move(entry));
+  }
+  std::vector<std::pair<uint32, std::string>>().swap(pending_);
+
+  // later entries replace earlier ones with the same id
+  std::stable_sort(entries.begin(), entries.end(), [](std::pair<uint32, std::string> const& lhs, std::pair<uint32, std::string> const& rhs) {
+    return lhs.first < rhs.first;
+  });
+  size_t count = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (i + 1 < entries.size() && entries[i + 1].first == entries[i].first) continue;
+    if (count != i) entries[count] = std::move(entries[i]);
+    ++count;
+  }
+  entries.resize(count);
+
+  std::vector<char> strings;
+  tables_.resize(count * 2);
+  for (uint32 i = 0; i < count; ++i) {
+    tables_[i] = entries[i].first;
+    tables_[count + i] = strings.size();
+    strings.insert(strings.end(), entries[i].second.begin(), entries[i].second.end());
+    strings.push_back(0);
+  }
+  strings_.swap(strings);
+  index(count, strings_.data());
+}
+
+void SnoMap::index(uint32 count, char const* pool) {
+  hashSize_ = 16;
+  while (hashSize_ < count * 2) {
+    hashSize_ *= 2;
+  }
+  tables_.resize(count * 2 + hashSize_);
+  uint32* buckets = &tables_[count * 2];
+  std::fill(buckets, buckets + hashSize_, 0);
+  uint32 mask = hashSize_ - 1;
+  for (uint32 i = 0; i < count; ++i) {
+    uint32 pos = hashLower(pool + tables_[count + i]) & mask;
+    while (buckets[pos]) {
+      pos = (pos + 1) & mask;
+    }
+    buckets[pos] = i + 1;
+  }
+
+  count_ = count;
+  ids_ = tables_.data();
+  names_ = ids_ + count_;
+  buckets_ = buckets;
+  pool_ = pool;
+  source_.release();
+}
+
+bool SnoMap::attach(uint8 const* data, size_t size) {
+  if (size < sizeof(SnoMapHeader)) return false;
+  SnoMapHeader const* header = reinterpret_cast<SnoMapHeader const*>(data);
+  if (header->magic != SnoMapHeader::Magic || header->version != SnoMapHeader::Version) return false;
+  if (header->hashSize & (header->hashSize - 1)) return false;
+  // lookups stop at the first empty bucket, so a full table is not valid; maps of types without
+  // files are saved with no table at all
+  if (header->count && header->hashSize <= header->count) return false;
+  uint64 tables = (uint64(header->count) * 2 + header->hashSize) * sizeof(uint32);
+  if (sizeof(SnoMapHeader) + tables + header->poolSize > size) return false;
+  char const* pool = reinterpret_cast<char const*>(data + sizeof(SnoMapHeader) + tables);
+  if (header->poolSize && pool[header->poolSize - 1]) return false;
+
+  count_ = header->count;
+  hashSize_ = header->hashSize;
+  ids_ = reinterpret_cast<uint32 const*>(data + sizeof(SnoMapHeader));
+  names_ = ids_ + count_;
+  buckets_ = names_ + count_;
+  pool_ = pool;
+  for (uint32 i = 0; i < count_; ++i) {
+    if (names_[i] >= header->poolSize) return false;
+  }
+  for (uint32 i = 0; i < hashSize_; ++i) {
+    if (buckets_[i] > count_) return false;
+  }
+  return true;
+}
+
+static std::string cachePath(std::string const& type) {
+  return path::work() / fmtstring("sno_%s", SnoLoader::primary->version().c_str()) / type + ".idx";
+}
 
 void SnoMap::parse(File& file, std::string const& name) {
   if (!file) return;
   if (file.read32() == 0xDEADBEEF) {
     file.seek(16);
-    map_[file.read32()] = name;
+    add(file.read32(), name);
   }
 }
 void SnoMap::save(std::string const& type) {
-  File file(path::work() / fmtstring("sno_%s", SnoLoader::default->version().c_str()) / type + ".txt", "wt");
-  for (const auto& kv : map_) {
-    file.printf("%d %s\n", kv.first, kv.second.c_str());
+  File file(cachePath(type), "wb");
+  if (!file) return;
+  SnoMapHeader header;
+  header.magic = SnoMapHeader::Magic;
+  header.version = SnoMapHeader::Version;
+  header.count = count_;
+  header.hashSize = hashSize_;
+  header.poolSize = strings_.size();
+  if (pool_ != strings_.data()) {
+    // names live in another buffer; the cache file needs its own pool
+    std::vector<char> strings;
+    std::vector<uint32> names(count_);
+    for (uint32 i = 0; i < count_; ++i) {
+      char const* name = pool_ + names_[i];
+      names[i] = strings.size();
+      strings.insert(strings.end(), name, name + strlen(name) + 1);
+    }
+    header.poolSize = strings.size();
+    file.write(header);
+    file.write(ids_, count_ * sizeof(uint32));
+    file.write(names.data(), count_ * sizeof(uint32));
+    file.write(buckets_, hashSize_ * sizeof(uint32));
+    file.write(strings.data(), strings.size());
+    return;
   }
+  file.write(header);
+  file.write(ids_, count_ * sizeof(uint32));
+  file.write(names_, count_ * sizeof(uint32));
+  file.write(buckets_, hashSize_ * sizeof(uint32));
+  file.write(pool_, header.poolSize);
 }
 bool SnoMap::load(std::string const& type) {
-  File file(path::work() / fmtstring("sno_%s", SnoLoader::default->version().c_str()) / type + ".txt", "rt");
+  File file = File::mapfile(cachePath(type));
   if (!file) return false;
-  int id;
-  char fname[512];
-  for (auto& line : file) {
-    size_t space = line.find(' ');
-    if (space != std::string::npos) {
-      map_[atoi(line.c_str())] = line.substr(space + 1);
-    }
+  uint8 const* data = file.borrow();
+  if (!data || !attach(data, file.size())) {
+    count_ = hashSize_ = 0;
+    return false;
   }
+  source_ = file;
   return true;
 }
 
 template<class T>
-static void insert(std::map<uint32, std::string>& dst, T const& src) {
+void SnoManager::insert(SnoMap& dst, T const& src) {
   for (auto& entry : src) {
     std::string name((char*)&entry);
-    dst[HashNameLower(name)] = name;
+    dst.add(HashNameLower(name), name);
   }
 }
 
 const SnoMap& SnoManager::gameBalance() {
+  SnoMap const* ready = instance_.gameBalance_;
+  if (ready) return *ready;
+  std::lock_guard<std::mutex> lock(instance_.mutex_);
+  ready = instance_.gameBalance_;
+  if (ready) return *ready;
   auto it = instance_.map_.find(0xDEADBEEF);
   if (it == instance_.map_.end()) {
     SnoMap& map = instance_.map_[0xDEADBEEF];
-    if (map.load("GameBalanceId")) return map;
+    if (map.load("GameBalanceId")) {
+      instance_.gameBalance_ = &map;
+      return map;
+    }
     for (auto& gmb : SnoLoader::All<GameBalance>()) {
-      insert(map.map_, gmb->x018_ItemTypes);
-      insert(map.map_, gmb->x028_Items);
-      insert(map.map_, gmb->x078_AffixTable);
-      insert(map.map_, gmb->x088_Heros);
-      insert(map.map_, gmb->x098_MovementStyles);
-      insert(map.map_, gmb->x0A8_Labels);
-      insert(map.map_, gmb->x0C8_RareItemNamesTable);
-      insert(map.map_, gmb->x0D8_MonsterAffixesTable);
-      insert(map.map_, gmb->x0E8_RareMonsterNamesTable);
-      insert(map.map_, gmb->x0F8_SocketedEffectsTable);
-      insert(map.map_, gmb->x108_ItemDropTable);
-      insert(map.map_, gmb->x128_QualityClassTable);
-      insert(map.map_, gmb->x158_Hirelings);
-      insert(map.map_, gmb->x168_SetItemBonusTable);
-      insert(map.map_, gmb->x178_EliteModifiers);
-      insert(map.map_, gmb->x198_PowerFormulaTable);
-      insert(map.map_, gmb->x1A8_RecipesTable);
-      insert(map.map_, gmb->x1B8_ScriptedAchievementEventsTable);
-      insert(map.map_, gmb->x1C8_LootRunQuestTierTable);
-      insert(map.map_, gmb->x1D8_ParagonBonusesTable);
-      insert(map.map_, gmb->x1E8_LegacyItemConversionTable);
-      insert(map.map_, gmb->x218_TransmuteRecipesTable);
+      insert(map, gmb->x018_ItemTypes);
+      insert(map, gmb->x028_Items);
+      insert(map, gmb->x078_AffixTable);
+      insert(map, gmb->x088_Heros);
+      insert(map, gmb->x098_MovementStyles);
+      insert(map, gmb->x0A8_Labels);
+      insert(map, gmb->x0C8_RareItemNamesTable);
+      insert(map, gmb->x0D8_MonsterAffixesTable);
+      insert(map, gmb->x0E8_RareMonsterNamesTable);
+      insert(map, gmb->x0F8_SocketedEffectsTable);
+      insert(map, gmb->x108_ItemDropTable);
+      insert(map, gmb->x128_QualityClassTable);
+      insert(map, gmb->x158_Hirelings);
+      insert(map, gmb->x168_SetItemBonusTable);
+      insert(map, gmb->x178_EliteModifiers);
+      insert(map, gmb->x198_PowerFormulaTable);
+      insert(map, gmb->x1A8_RecipesTable);
+      insert(map, gmb->x1B8_ScriptedAchievementEventsTable);
+      insert(map, gmb->x1C8_LootRunQuestTierTable);
+      insert(map, gmb->x1D8_ParagonBonusesTable);
+      insert(map, gmb->x1E8_LegacyItemConversionTable);
+      insert(map, gmb->x218_TransmuteRecipesTable);
     }
+    map.build();
     map.save("GameBalanceId");
+    instance_.gameBalance_ = &map;
     return map;
   } else {
+    instance_.gameBalance_ = &it->second;
     return it->second;
   }
 }
 
 void SnoManager::clear() {
-  std::string root = path::work() / fmtstring("sno_%s", SnoLoader::default->version().c_str());
-  WIN32_FIND_DATA fdata;
-  HANDLE hFind = FindFirstFile((root / "*").c_str(), &fdata);
-  if (hFind == INVALID_HANDLE_VALUE) return;
-  std::vector<std::string> list;
-  do {
-    if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-      list.push_back(fdata.cFileName);
-    }
-  } while (FindNextFile(hFind, &fdata));
-  FindClose(hFind);
-  for (std::string const& name : list) {
-    DeleteFile((root / name).c_str());
+  std::string root = path::work() / fmtstring("sno_%s", SnoLoader::primary->version().c_str());
+  for (std::string const& name : File::listdir(root)) {
+    File::remove(root / name);
+  }
+}
+
+SnoManager::SnoManager()
+  : gameBalance_(nullptr)
+{
+  for (auto& ready : ready_) {
+    ready = nullptr;
   }
 }
 
@@ -106,17 +277,51 @@ struct TocEntry {
   uint32 name;
 };
 
-void SnoManager::loadTOC(uint8 const* toc) {
-  TocHeader const* header = (TocHeader const*) toc;
+void SnoManager::loadTOC(std::vector<uint8>&& blob) {
+  instance_.tocs_.push_back(std::move(blob));
+  uint8 const* toc = instance_.tocs_.back().data();
+  TocHeader const* header = (TocHeader const*)toc;
   toc += sizeof(TocHeader);
   for (size_t i = 0; i < TocHeader::MAX_ASSETS; ++i) {
-    if (!header->entryCounts[i]) continue;
+    uint32 count = header->entryCounts[i];
+    if (!count) continue;
 
     TocEntry const* entries = (TocEntry const*)(toc + header->entryOffsets[i]);
-    char const* names = (char const*)(entries + header->entryCounts[i]);
+    char const* names = (char const*)(entries + count);
 
-    for (size_t j = 0; j < header->entryCounts[i]; ++j) {
-      instance_.map_[entries[j].asset].map_[entries[j].index] = names + entries[j].name;
+    SnoMap& map = instance_.map_[i];
+    bool direct = (!map.count_ && map.pending_.empty());
+    for (size_t j = 0; j < count && direct; ++j) {
+      direct = (entries[j].asset == i);
+    }
+    if (!direct) {
+      // merging with names from another TOC, or a mixed group: copy the strings
+      for (size_t j = 0; j < count; ++j) {
+        instance_.map_[entries[j].asset].add(entries[j].index, names + entries[j].name);
+      }
+      continue;
     }
+
+    std::vector<std::pair<uint32, uint32>> order(count);
+    for (size_t j = 0; j < count; ++j) {
+      order[j] = std::make_pair(entries[j].index, entries[j].name);
+    }
+    std::stable_sort(order.begin(), order.end(), [](std::pair<uint32, uint32> const& lhs, std::pair<uint32, uint32> const& rhs) {
+      return lhs.first < rhs.first;
+    });
+    size_t unique = 0;
+    for (size_t j = 0; j < count; ++j) {
+      if (j + 1 < count && order[j + 1].first == order[j].first) continue;
+      order[unique++] = order[j];
+    }
+    map.tables_.resize(unique * 2);
+    for (size_t j = 0; j < unique; ++j) {
+      map.tables_[j] = order[j].first;
+      map.tables_[unique + j] = order[j].second;
+    }
+    map.index(unique, names);
+  }
+  for (auto& kv : instance_.map_) {
+    kv.second.build();
   }
 }
@@ -4,22 +4,103 @@
 #include "parser.h"
 #include "logger.h"
 #include <map>
+#include <vector>
+#include <list>
 #include <string>
+#include <mutex>
+#include <atomic>
 
 class File;
 
+// id <-> name table for one sno group
+//
+// entries are stored flat: a sorted id array, name offsets into a string pool, and an
+// open-addressing hash of lowercase names for the reverse direction. The cache file written by
+// save() has the same layout, so load() maps it and answers lookups without parsing anything.
 class SnoMap {
 public:
-  char const* operator[](uint32 id) const {
-    auto it = map_.find(id);
-    return (it == map_.end() ? nullptr : it->second.c_str());
+  SnoMap();
+  SnoMap(SnoMap const&) = delete;
+
+  char const* operator[](uint32 id) const;
+  // id of the file with the given name (case insensitive), or -1
+  uint32 find(char const* name) const;
+  uint32 find(std::string const& name) const {
+    return find(name.c_str());
   }
-  std::map<uint32, std::string> const& get() const {
-    return map_;
+
+  size_t size() const {
+    return count_;
   }
+
+  class Iterator {
+  public:
+    Iterator& operator++() {
+      ++index_;
+      fetch();
+      return *this;
+    }
+    bool operator!=(Iterator const& rhs) const {
+      return index_ != rhs.index_;
+    }
+    bool operator==(Iterator const& rhs) const {
+      return index_ == rhs.index_;
+    }
+    std::pair<uint32, char const*> const& operator*() const {
+      return value_;
+    }
+    std::pair<uint32, char const*> const* operator->() const {
+      return &value_;
+    }
+  private:
+    friend class SnoMap;
+    Iterator(SnoMap const* map, uint32 index)
+      : map_(map)
+      , index_(index)
+    {
+      fetch();
+    }
+    void fetch() {
+      if (index_ < map_->count_) {
+        value_.first = map_->ids_[index_];
+        value_.second = map_->pool_ + map_->names_[index_];
+      }
+    }
+    SnoMap const* map_;
+    uint32 index_;
+    std::pair<uint32, char const*> value_;
+  };
+  Iterator begin() const {
+    return Iterator(this, 0);
+  }
+  Iterator end() const {
+    return Iterator(this, count_);
+  }
+
 private:
   friend class SnoManager;
-  std::map<uint32, std::string> map_;
+  uint32 count_;
+  uint32 hashSize_;
+  uint32 const* ids_;
+  uint32 const* names_;
+  uint32 const* buckets_; // index + 1, or 0 for empty slots
+  char const* pool_;
+
+  File source_;                 // mapped cache file
+  std::vector<uint32> tables_;  // ids, names and buckets of a map built in memory
+  std::vector<char> strings_;
+  std::vector<std::pair<uint32, std::string>> pending_;
+
+  void add(uint32 id, std::string const& name) {
+    pending_.emplace_back(id, name);
+  }
+  // merge entries added since the last call into the tables
+  void build();
+  // use tables_ (count ids in ascending order, followed by their name offsets) with names stored
+  // at pool, which must outlive the map
+  void index(uint32 count, char const* pool);
+  bool attach(uint8 const* data, size_t size);
+
   void save(std::string const& type);
   bool load(std::string const& type);
   void parse(File& file, std::string const& name);
@@ -27,28 +108,51 @@ private:
 
 class SnoManager {
 public:
-  static void loadTOC(uint8 const* toc);
+  // maps of the groups listed in the TOC point into the blob, which is kept alive
+  static void loadTOC(std::vector<uint8>&& toc);
 
+  // maps are built on first use and never modified afterwards, so lookups from parser threads
+  // only need the lock until the map has been published
   template<class T>
   static const SnoMap& get() {
-    auto it = instance_.map_.find(T::index);
+    static_assert(T::index < MaxGroups, "invalid sno group");
+    SnoMap const* ready = instance_.ready_[T::index];
+    if (ready) return *ready;
+    std::lock_guard<std::mutex> lock(instance_.mutex_);
+    ready = instance_.ready_[T::index];
+    if (ready) return *ready;
+    uint32 const index = T::index;
+    auto it = instance_.map_.find(index);
     if (it == instance_.map_.end()) {
-      SnoMap& map = instance_.map_[T::index];
+      SnoMap& map = instance_.map_[index];
       if (!map.load(T::type())) {
-        for (auto& name : Logger::Loop(SnoLoader::default->list<T>(),
+        SnoLoader::primary->prefetch<T>();
+        for (auto& name : Logger::Loop(SnoLoader::primary->list<T>(),
             fmtstring("Mapping %s", T::type()).c_str())) {
-          map.parse(SnoLoader::default->load<T>(name), name);
+          File file = SnoLoader::primary->load<T>(name);
+          map.parse(file, name);
         }
+        map.build();
         map.save(T::type());
       }
+      instance_.ready_[T::index] = &map;
       return map;
     } else {
+      instance_.ready_[T::index] = &it->second;
       return it->second;
     }
   }
   static const SnoMap& gameBalance();
   static void clear();
 private:
+  enum { MaxGroups = 128 };
+  SnoManager();
+  template<class T>
+  static void insert(SnoMap& dst, T const& src);
   static SnoManager instance_;
   std::map<uint32, SnoMap> map_;
+  std::list<std::vector<uint8>> tocs_;
+  std::mutex mutex_;
+  std::atomic<SnoMap const*> ready_[MaxGroups];
+  std::atomic<SnoMap const*> gameBalance_;
 };
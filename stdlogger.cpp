@@ -0,0 +1,136 @@
+// plain stdout logger for systems without the Windows console; tasks are reported when they
+// begin and end instead of being redrawn in place, so output can be piped to a file
+#include "logger.h"
+#include "common.h"
+#include <stdarg.h>
+#include <iostream>
+#include <list>
+#include <mutex>
+
+Logger Logger::instance;
+
+struct Logger::Task {
+  Task* parent;
+  std::string name;
+  size_t count;
+  size_t index;
+  int depth;
+  std::list<Task> sub;
+
+  Task()
+    : parent(nullptr)
+    , count(0)
+    , index(0)
+    , depth(-1)
+  {}
+  Task(Task* parent, size_t count, std::string const& name)
+    : parent(parent)
+    , name(name)
+    , count(count)
+    , index(0)
+    , depth(parent->depth + 1)
+  {}
+
+  void print(char const* state) const {
+    if (name.empty()) return;
+    if (count) {
+      printf("%*s%s %s (%u/%u)\n", depth * 2, "", name.c_str(), state, (uint32) index, (uint32) count);
+    } else {
+      printf("%*s%s %s\n", depth * 2, "", name.c_str(), state);
+    }
+    fflush(stdout);
+  }
+  void remove(Task* task) {
+    for (auto it = sub.begin(); it != sub.end(); ++it) {
+      if (&*it == task) {
+        sub.erase(it);
+        return;
+      }
+    }
+  }
+};
+
+static Logger::Task _root;
+Logger::Task* Logger::root = &_root;
+Logger::Task* Logger::top = nullptr;
+
+// progress may be reported from worker threads
+static std::recursive_mutex logMutex;
+
+void* Logger::begin(size_t count, char const* name, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
+  Task* task = (task_ ? (Task*)task_ : top);
+  if (!task) task = root;
+  task->sub.emplace_back(task, count, name ? name : "");
+  top = &task->sub.back();
+  top->print("...");
+  return top;
+}
+void Logger::item(char const* name, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
+  Task* task = (task_ ? (Task*)task_ : top);
+  if (task) ++task->index;
+}
+void Logger::progress(size_t count, bool add, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
+  Task* task = (task_ ? (Task*)task_ : top);
+  if (task) task->index = (add ? task->index + count : count);
+}
+void Logger::end(bool pop, void* task_) {
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
+  Task* task = (task_ ? (Task*)task_ : top);
+  if (!task || !task->parent) return;
+  if (top == task) top = (task->parent == root ? nullptr : task->parent);
+  if (!pop) task->print("done");
+  task->parent->remove(task);
+}
+
+void Logger::log(char const* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  std::string text = varfmtstring(fmt, ap);
+  va_end(ap);
+  std::lock_guard<std::recursive_mutex> lock(logMutex);
+  printf("%s\n", text.c_str());
+  fflush(stdout);
+  if (!instance.logfile) {
+    instance.logfile = new File("log.txt", "at");
+    instance.logfile->printf("============\n");
+  }
+  instance.logfile->printf("%s\n", text.c_str());
+}
+
+static int readOption() {
+  std::string line;
+  if (!std::getline(std::cin, line)) throw Exception("unexpected end of input");
+  return line.empty() ? -1 : line[0];
+}
+
+int Logger::menu(char const* title, std::vector<std::string> const& options) {
+  printf("%s\n", title);
+  for (size_t i = 0; i < options.size(); ++i) {
+    printf("  %u. %s\n", (uint32) i + 1, options[i].c_str());
+  }
+  while (true) {
+    printf("? ");
+    fflush(stdout);
+    std::string line;
+    if (!std::getline(std::cin, line)) throw Exception("unexpected end of input");
+    int input = atoi(line.c_str());
+    if (input >= 1 && input <= (int) options.size()) return input - 1;
+  }
+}
+
+int Logger::menu(char const* title, std::map<char, std::string> const& options) {
+  printf("%s\n", title);
+  for (auto const& kv : options) {
+    printf("  %c. %s\n", kv.first, kv.second.c_str());
+  }
+  int chr;
+  do {
+    printf("? ");
+    fflush(stdout);
+    chr = ::toupper(readOption());
+  } while (options.find(chr) == options.end());
+  return chr;
+}
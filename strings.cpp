@@ -12,7 +12,7 @@ std::string const& DictionaryRef::getfmt(char const* fmt, ...) const {
 
 Dictionary* Strings::get(istring const& dict, SnoLoader* theloader) {
   if (!theloader) theloader = loader;
-  if (!theloader) theloader = SnoLoader::default;
+  if (!theloader) theloader = SnoLoader::primary;
   Key key(dict, theloader);
   auto it = strings_.find(key);
   if (it != strings_.end()) return &it->second;
@@ -34,7 +34,7 @@ std::string const& Strings::get(istring const& dict, istring const& name) {
   return (it == res->end() ? DictionaryRef::nil_ : it->second);
 }
 bool Strings::has(istring const& dict, istring const& name) {
-  Dictionary* res = instance().get(dict, SnoLoader::default);
+  Dictionary* res = instance().get(dict, SnoLoader::primary);
   return res != nullptr && res->find(name) != res->end();
 }
 
@@ -0,0 +1,803 @@
+#include "tests.h"
+#include "ngdp.h"
+#include "path.h"
+#include "logger.h"
+#include "jsondiff.h"
+#include "dxt.h"
+#include <algorithm>
+#include <random>
+
+// CDN stand-in that serves files from memory and records every request
+class MirrorCdn : public NGDP::NGDP {
+public:
+  struct Request {
+    std::string url;
+    uint32 first;
+    uint32 last;
+  };
+
+  MirrorCdn(::NGDP::VersionData const& version)
+    : NGDP("mirror", version)
+  {}
+
+  std::map<std::string, std::string> files;
+
+  File get(std::string const& url) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++counts_[url];
+    auto it = files.find(url);
+    if (it == files.end()) return File();
+    return File::memfile(it->second.data(), it->second.size(), true);
+  }
+  File get(std::string const& url, uint32 first, uint32 last, uint32& start, uint32& total) const override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++counts_[url];
+    ranges_.push_back(Request{url, first, last});
+    auto it = files.find(url);
+    if (it == files.end() || first > last || first >= it->second.size()) return File();
+    start = first;
+    total = it->second.size();
+    last = std::min<uint32>(last, total - 1);
+    return File::memfile(it->second.data() + first, last - first + 1, true);
+  }
+
+  size_t count(std::string const& url) const {
+    auto it = counts_.find(url);
+    return (it == counts_.end() ? 0 : it->second);
+  }
+  size_t total() const {
+    size_t sum = 0;
+    for (auto const& kv : counts_) sum += kv.second;
+    return sum;
+  }
+  std::vector<Request> const& ranges() const {
+    return ranges_;
+  }
+  void reset() {
+    counts_.clear();
+    ranges_.clear();
+  }
+
+private:
+  mutable std::mutex mutex_;
+  mutable std::map<std::string, size_t> counts_;
+  mutable std::vector<Request> ranges_;
+};
+
+static std::string readAll(std::string const& path) {
+  File file(path);
+  if (!file) return std::string();
+  std::string data(file.size(), 0);
+  if (data.size()) file.read(&data[0], data.size());
+  return data;
+}
+
+// random archives with overlapping keys behind a MirrorCdn: ArchiveIndex must download every
+// index once, prefetch must not request any byte twice, and loading every key after a parallel
+// or single connection prefetch must match loading them one by one, which in turn must match a
+// plain map filled in archive order (keys in several archives resolve to the last one)
+static bool prefetch() {
+  using namespace NGDP;
+  enum { BlockSize = 4096, Archives = 6, EntriesPerBlock = 4096 / 24 };
+  std::mt19937 rng(7);
+  auto randomHash = [&](Hash hash) {
+    for (size_t i = 0; i < sizeof(Hash); ++i) hash[i] = rng() & 0xFF;
+  };
+
+  Hash hash;
+  randomHash(hash);
+  VersionData version;
+  version.cdn = to_string(hash);
+  version.id = 0;
+  MirrorCdn cdn(version);
+
+  std::vector<std::string> archives;
+  std::vector<Hash_container> keys;
+  std::map<std::string, std::string> expected;
+  for (size_t i = 0; i < Archives; ++i) {
+    randomHash(hash);
+    archives.push_back(to_string(hash));
+    std::string data(std::uniform_int_distribution<uint32>(40000, 160000)(rng), 0);
+    for (char& chr : data) chr = rng() & 0xFF;
+
+    std::vector<uint8> index;
+    uint32 offset = 0, count = 0;
+    // keys are only repeated across archives; an archive index never lists a key twice
+    size_t shared = keys.size();
+    while (true) {
+      uint32 size = std::uniform_int_distribution<uint32>(1, 3 * BlockSize)(rng);
+      if (offset + size > data.size()) break;
+      Hash_container key;
+      if (shared && rng() % 8 == 0) {
+        key = keys[rng() % shared];
+      } else {
+        randomHash(key._);
+        keys.push_back(key);
+      }
+      // 4096 byte blocks of 24 byte entries, zero padded
+      if (count % EntriesPerBlock == 0) index.resize(index.size() + 4096, 0);
+      uint8* entry = &index[count / EntriesPerBlock * 4096 + count % EntriesPerBlock * 24];
+      ++count;
+      memcpy(entry, key._, sizeof(Hash));
+      *reinterpret_cast<uint32*>(entry + 16) = _byteswap_ulong(size);
+      *reinterpret_cast<uint32*>(entry + 20) = _byteswap_ulong(offset);
+      expected[to_string(key._)] = data.substr(offset, size);
+      offset += size + rng() % 64;
+    }
+    cdn.files[cdn.geturl(archives.back(), "data", true)] = std::string(index.begin(), index.end());
+    cdn.files[cdn.geturl(archives.back(), "data")] = data;
+  }
+  cdn.files[cdn.geturl(version.cdn, "config")] = "# CDN Configuration\narchives = " + join(archives) + "\n";
+  std::shuffle(keys.begin(), keys.end(), rng);
+
+  std::string cache = path::work() / "cdncache";
+  std::vector<std::string> local;
+  local.push_back(cache / "config" / version.cdn);
+  local.push_back(cache / "data" / version.cdn + ".idx");
+  for (auto const& name : archives) {
+    local.push_back(cache / "data" / name + ".index");
+    local.push_back(cache / "data" / name);
+    local.push_back(cache / "data" / name + ".mask");
+  }
+  auto cleanup = [&]() {
+    for (auto const& path : local) File::remove(path);
+  };
+
+  // connections = 0 loads every key on its own
+  auto check = [&](size_t connections, std::string& state) {
+    char const* mode = (connections ? (connections > 1 ? "parallel prefetch" : "serial prefetch") : "serial load");
+    cleanup();
+    cdn.reset();
+    {
+      ArchiveIndex index(cdn, BlockSize);
+      for (auto const& name : archives) {
+        size_t count = cdn.count(cdn.geturl(name, "data", true));
+        if (count != 1) {
+          Logger::log("prefetch: %s: index %s downloaded %u times", mode, name.c_str(), (uint32) count);
+          return false;
+        }
+      }
+      if (connections) {
+        cdn.reset();
+        index.prefetch(keys, connections);
+        auto ranges = cdn.ranges();
+        std::sort(ranges.begin(), ranges.end(), [](MirrorCdn::Request const& lhs, MirrorCdn::Request const& rhs) {
+          return lhs.url != rhs.url ? lhs.url < rhs.url : lhs.first < rhs.first;
+        });
+        for (size_t i = 1; i < ranges.size(); ++i) {
+          if (ranges[i].url == ranges[i - 1].url && ranges[i].first <= ranges[i - 1].last) {
+            Logger::log("prefetch: %s: %s requested twice", mode, ranges[i].url.c_str());
+            return false;
+          }
+        }
+        cdn.reset();
+      }
+      for (auto const& key : keys) {
+        File file = index.load(key._);
+        std::string data(file ? file.size() : 0, 0);
+        if (data.size()) file.read(&data[0], data.size());
+        if (!file || data != expected[to_string(key._)]) {
+          Logger::log("prefetch: %s: wrong data for %s", mode, to_string(key._).c_str());
+          return false;
+        }
+      }
+      if (connections && cdn.total()) {
+        Logger::log("prefetch: %s: %u requests after prefetch", mode, (uint32) cdn.total());
+        return false;
+      }
+    }
+    state.clear();
+    for (auto const& path : local) {
+      state += readAll(path);
+    }
+    return true;
+  };
+
+  std::string serial, parallel, single;
+  bool ok = check(0, serial) && check(4, parallel) && check(1, single);
+  if (ok && (parallel != serial || single != serial)) {
+    Logger::log("prefetch: local cache differs from the serial load");
+    ok = false;
+  }
+  if (ok) {
+    // a second index over the same cache reads the merged table back without any requests
+    cdn.reset();
+    ArchiveIndex index(cdn, BlockSize);
+    if (cdn.total()) {
+      Logger::log("prefetch: cached index made %u requests", (uint32) cdn.total());
+      ok = false;
+    }
+  }
+  cleanup();
+  return ok;
+}
+
+// DecodedCache with a 1 MB memory and disk tier: files read back from memory and from disk
+// unchanged, memory hits share one read-only buffer, damaged files are dropped, and the disk tier
+// removes the oldest files once it is full
+static bool decoded() {
+  using namespace NGDP;
+  enum { Files = 24, FileSize = 100000, LargeSize = 200000 };
+  std::mt19937 rng(11);
+  std::string dir = path::work() / "cdncache" / "decoded";
+  std::vector<Hash_container> keys(Files + 1);
+  std::vector<std::string> contents(Files + 1);
+  for (size_t i = 0; i <= Files; ++i) {
+    for (uint8& byte : keys[i]._) byte = rng() & 0xFF;
+    contents[i].resize(i < Files ? FileSize : LargeSize);
+    for (char& chr : contents[i]) chr = rng() & 0xFF;
+  }
+  auto cleanup = [&]() {
+    for (auto const& key : keys) {
+      std::string name = to_string(key._);
+      File::remove(dir / name.substr(0, 2) / name);
+    }
+    File::remove(dir / "files.log");
+  };
+  auto matches = [&](File& file, size_t i) {
+    if (!file || file.size() != contents[i].size()) return false;
+    std::string data(contents[i].size(), 0);
+    file.seek(0);
+    return file.read(&data[0], data.size()) == data.size() && data == contents[i];
+  };
+
+  cleanup();
+  bool ok = true;
+  {
+    DecodedCache cache(1, 1);
+    for (size_t i = 0; i <= Files; ++i) {
+      File file = File::memfile(contents[i].data(), contents[i].size(), true);
+      cache.put(keys[i]._, file);
+    }
+    File first = cache.get(keys[Files - 1]._);
+    File second = cache.get(keys[Files - 1]._);
+    if (!matches(first, Files - 1) || !matches(second, Files - 1) || first.borrow()) {
+      Logger::log("decoded: memory hit does not match");
+      ok = false;
+    }
+  }
+  if (ok) {
+    // the disk tier holds the newest files that fit in 1 MB, the oldest are gone
+    DecodedCache cache(1, 1);
+    size_t kept = 0;
+    for (size_t i = 0; i <= Files; ++i) {
+      File file = cache.get(keys[i]._);
+      if (!file) continue;
+      if (!matches(file, i)) {
+        Logger::log("decoded: disk file %u does not match", (uint32) i);
+        ok = false;
+      }
+      ++kept;
+    }
+    if (cache.get(keys[0]._) || !cache.contains(keys[Files]._) || kept * FileSize > (1 << 20)) {
+      Logger::log("decoded: disk tier kept %u files", (uint32) kept);
+      ok = false;
+    }
+  }
+  if (ok) {
+    // a truncated file is removed instead of returned
+    std::string name = to_string(keys[Files]._);
+    std::string path = dir / name.substr(0, 2) / name;
+    std::string data = readAll(path);
+    File(path, "wb").write(data.data(), data.size() / 2);
+    DecodedCache cache(1, 1);
+    if (cache.get(keys[Files]._) || File::exists(path)) {
+      Logger::log("decoded: truncated file was not dropped");
+      ok = false;
+    }
+  }
+  cleanup();
+  return ok;
+}
+
+// jsonCompare(lhs, rhs, false) from miner.cpp as it was before jsondiff.cpp, on json::Value trees
+static void cleanup(json::Value& value) {
+  json::Value tmp(json::Value::tObject);
+  for (auto& it : value.getMap()) {
+    if (it.second.type() != json::Value::tUndefined) {
+      tmp[it.first] = it.second;
+    }
+  }
+  if (tmp.getMap().empty()) {
+    value.clear();
+  } else {
+    value = tmp;
+  }
+}
+static bool jsonEqual(json::Value& lhs, json::Value& rhs) {
+  switch (lhs.type()) {
+  case json::Value::tString: return lhs.getString() == rhs.getString();
+  case json::Value::tInteger: return lhs.getInteger() == rhs.getInteger();
+  case json::Value::tNumber: return lhs.getNumber() == rhs.getNumber();
+  case json::Value::tBoolean: return lhs.getBoolean() == rhs.getBoolean();
+  default: return true;
+  }
+}
+static void jsonCompare(json::Value& lhs, json::Value& rhs) {
+  if (lhs.type() != rhs.type()) return;
+  if (lhs.type() == json::Value::tArray) {
+    bool same = true;
+    for (size_t i = 0; i < lhs.length() && i < rhs.length(); ++i) {
+      jsonCompare(lhs[i], rhs[i]);
+      if (lhs[i].type() != json::Value::tUndefined) {
+        same = false;
+      }
+    }
+    if (same && lhs.length() == rhs.length()) {
+      lhs.clear();
+      rhs.clear();
+    }
+    return;
+  }
+  if (lhs.type() == json::Value::tObject) {
+    auto lit = lhs.begin();
+    auto rit = rhs.begin();
+    while (lit != lhs.end() && rit != rhs.end()) {
+      if (lit.key() == rit.key()) {
+        jsonCompare(*lit, *rit);
+        ++lit;
+        ++rit;
+      } else if (lit.key() < rit.key()) {
+        ++lit;
+      } else {
+        ++rit;
+      }
+    }
+    cleanup(lhs);
+    cleanup(rhs);
+  } else if (jsonEqual(lhs, rhs)) {
+    lhs.clear();
+    rhs.clear();
+  }
+}
+
+// small value and key ranges, so that random trees often share members and scalars
+static json::Value randomValue(std::mt19937& rng, int depth) {
+  static char const* const strings[] = {"", "a", "b", "ab"};
+  switch (rng() % (depth > 0 ? 8 : 5)) {
+  case 0: return json::Value(json::Value::tNull);
+  case 1: return json::Value(rng() % 2 != 0);
+  case 2: return json::Value(int(rng() % 3));
+  case 3: return json::Value((rng() % 3) * 0.5);
+  case 4: return json::Value(strings[rng() % 4]);
+  case 5:
+  case 6: {
+    json::Value value(json::Value::tObject);
+    for (size_t i = rng() % 6; i > 0; --i) {
+      value[std::string(1, 'a' + rng() % 8)] = randomValue(rng, depth - 1);
+    }
+    return value;
+  }
+  default: {
+    json::Value value(json::Value::tArray);
+    for (size_t i = rng() % 5; i > 0; --i) {
+      value.append(randomValue(rng, depth - 1));
+    }
+    return value;
+  }
+  }
+}
+// a copy with some members changed, retyped, added or removed and some arrays resized
+static json::Value mutate(json::Value const& value, std::mt19937& rng, int depth) {
+  switch (rng() % 8) {
+  case 0: return randomValue(rng, depth);
+  case 1: case 2: return value;
+  }
+  if (value.type() == json::Value::tObject) {
+    json::Value result(json::Value::tObject);
+    for (auto const& kv : value.getMap()) {
+      if (rng() % 8) result[kv.first] = mutate(kv.second, rng, depth - 1);
+    }
+    if (rng() % 4 == 0) result[std::string(1, 'a' + rng() % 8)] = randomValue(rng, depth - 1);
+    return result;
+  } else if (value.type() == json::Value::tArray) {
+    json::Value result(json::Value::tArray);
+    for (auto const& sub : value.getArray()) {
+      result.append(mutate(sub, rng, depth - 1));
+    }
+    if (rng() % 4 == 0) {
+      result.append(randomValue(rng, depth - 1));
+    } else if (rng() % 3 == 0 && result.length()) {
+      result.remove(result.length() - 1);
+    }
+    return result;
+  }
+  return value;
+}
+// plays a value to a visitor with object members in random order
+static void emit(json::Value const& value, json::Visitor* visitor, std::mt19937& rng) {
+  switch (value.type()) {
+  case json::Value::tNull: visitor->onNull(); break;
+  case json::Value::tBoolean: visitor->onBoolean(value.getBoolean()); break;
+  case json::Value::tInteger: visitor->onInteger(value.getInteger()); break;
+  case json::Value::tNumber: visitor->onNumber(value.getNumber()); break;
+  case json::Value::tString: visitor->onString(value.getString()); break;
+  case json::Value::tObject: {
+    std::vector<json::Value::Map::const_iterator> members;
+    for (auto it = value.getMap().begin(); it != value.getMap().end(); ++it) {
+      members.push_back(it);
+    }
+    std::shuffle(members.begin(), members.end(), rng);
+    visitor->onOpenMap();
+    for (auto const& it : members) {
+      visitor->onMapKey(it->first);
+      emit(it->second, visitor, rng);
+    }
+    visitor->onCloseMap();
+    break;
+  }
+  case json::Value::tArray:
+    visitor->onOpenArray();
+    for (auto const& sub : value.getArray()) {
+      emit(sub, visitor, rng);
+    }
+    visitor->onCloseArray();
+    break;
+  }
+}
+static std::string toString(json::Value& value) {
+  MemoryFile file;
+  json::write(file, value);
+  return std::string(reinterpret_cast<char const*>(file.data()), file.csize());
+}
+
+// random pairs of trees, with members in a different order on each side: json::compare on two
+// documents and DiffVisitor on an EventStream must both leave what jsonCompare leaves
+static bool jsondiff() {
+  enum { Pairs = 20000, Depth = 4 };
+  std::mt19937 rng(3);
+  for (size_t i = 0; i < Pairs; ++i) {
+    json::Value lhs(json::Value::tObject);
+    for (size_t j = rng() % 6 + 1; j > 0; --j) {
+      lhs[std::string(1, 'a' + rng() % 8)] = randomValue(rng, Depth);
+    }
+    json::Value rhs = mutate(lhs, rng, Depth);
+
+    json::Value lref = lhs, rref = rhs;
+    jsonCompare(lref, rref);
+
+    json::StringTable strings;
+    json::Document ldoc(&strings), rdoc(&strings);
+    json::DocumentBuilder lbuilder(ldoc), rbuilder(rdoc);
+    emit(lhs, &lbuilder, rng);
+    lbuilder.onEnd();
+    emit(rhs, &rbuilder, rng);
+    rbuilder.onEnd();
+    json::Value ldoc_out, rdoc_out;
+    json::compare(ldoc, rdoc, ldoc_out, rdoc_out);
+
+    json::EventStream stream;
+    emit(lhs, &stream, rng);
+    stream.onEnd();
+    json::Value lstream_out, rstream_out;
+    json::DiffVisitor differ(stream, lstream_out, rstream_out);
+    emit(rhs, &differ, rng);
+    differ.onEnd();
+
+    std::string expected = toString(lref) + toString(rref);
+    char const* failed = nullptr;
+    if (toString(ldoc_out) + toString(rdoc_out) != expected) {
+      failed = "json::compare";
+    } else if (toString(lstream_out) + toString(rstream_out) != expected) {
+      failed = "DiffVisitor";
+    }
+    if (failed) {
+      Logger::log("jsondiff: %s differs from jsonCompare on\n%s\n%s", failed, toString(lhs).c_str(), toString(rhs).c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// the DXT decoders of Textures as they were before dxt.cpp: one pixel at a time, planar blocks
+typedef FormatXRGB<0, 5, 6, 5> FormatDXT;
+static Image oldPlanarDXT1(uint32 width, uint32 height, uint8 const* data) {
+  Image image(width, height);
+  Image::color_t* bits = image.mutable_bits();
+  uint16 const* colors = (uint16*) data;
+  uint32 const* lookups = (uint32*) (data + width * height / 4);
+  for (uint32 y = 0; y < height; y += 4) {
+    for (uint32 x = 0; x < width; x += 4) {
+      uint16 p = *colors++;
+      uint16 q = *colors++;
+      uint32 lookup = *lookups++;
+      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
+        Image::Format::from<FormatDXT>(q)};
+      if (p > q) {
+        c[2] = Image::Format::mix(c[0], 2, c[1], 1);
+        c[3] = Image::Format::mix(c[0], 1, c[1], 2);
+      } else {
+        c[2] = Image::Format::mix(c[0], 1, c[1], 1);
+        c[3] = 0;
+      }
+      for (uint32 cy = y; cy < y + 4; ++cy) {
+        Image::color_t* dst = bits + cy * width + x;
+        for (uint32 cx = x; cx < x + 4; ++cx) {
+          *dst++ = c[lookup & 3];
+          lookup >>= 2;
+        }
+      }
+    }
+  }
+  return image;
+}
+
+static Image oldPlanarDXT3(uint32 width, uint32 height, uint8 const* data) {
+  Image image(width, height);
+  Image::color_t* bits = image.mutable_bits();
+  uint64 const* alphas = (uint64*) data;
+  uint16 const* colors = (uint16*) (data + width * height / 2);
+  uint32 const* lookups = (uint32*) (data + width * height * 3 / 4);
+  for (uint32 y = 0; y < height; y += 4) {
+    for (uint32 x = 0; x < width; x += 4) {
+      uint64 alpha = *alphas++;
+      uint16 p = *colors++;
+      uint16 q = *colors++;
+      uint32 lookup = *lookups++;
+      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
+        Image::Format::from<FormatDXT>(q)};
+      c[2] = Image::Format::mix(c[0], 2, c[1], 1);
+      c[3] = Image::Format::mix(c[0], 1, c[1], 2);
+      for (uint32 cy = y; cy < y + 4; ++cy) {
+        Image::color_t* dst = bits + cy * width + x;
+        for (uint32 cx = x; cx < x + 4; ++cx) {
+          int a = (alpha & 15) * 255 / 15;
+          *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a);
+          lookup >>= 2;
+          alpha >>= 4;
+        }
+      }
+    }
+  }
+  return image;
+}
+
+static Image oldPlanarDXT5(uint32 width, uint32 height, uint8 const* data) {
+  Image image(width, height);
+  Image::color_t* bits = image.mutable_bits();
+  uint8 const* alphas = data;
+  uint8 const* alphamaps = data + width * height / 8;
+  uint16 const* colors = (uint16*) (data + width * height / 2);
+  uint32 const* lookups = (uint32*) (data + width * height * 3 / 4);
+  for (uint32 y = 0; y < height; y += 4) {
+    for (uint32 x = 0; x < width; x += 4) {
+      uint32 a0 = *alphas++;
+      uint32 a1 = *alphas++;
+      uint64 amap = 0;
+      for (int i = 0; i < 48; i += 8) {
+        amap |= (static_cast<uint64>(*alphamaps++) << i);
+      }
+      uint16 p = *colors++;
+      uint16 q = *colors++;
+      uint32 lookup = *lookups++;
+      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
+        Image::Format::from<FormatDXT>(q)};
+      c[2] = Image::Format::mix(c[0], 2, c[1], 1);
+      c[3] = Image::Format::mix(c[0], 1, c[1], 2);
+      uint32 a[8] = {a0, a1};
+      if (a0 > a1) {
+        a[2] = (a0 * 6 + a1 * 1) / 7;
+        a[3] = (a0 * 5 + a1 * 2) / 7;
+        a[4] = (a0 * 4 + a1 * 3) / 7;
+        a[5] = (a0 * 3 + a1 * 4) / 7;
+        a[6] = (a0 * 2 + a1 * 5) / 7;
+        a[7] = (a0 * 1 + a1 * 6) / 7;
+      } else {
+        a[2] = (a0 * 4 + a1 * 1) / 5;
+        a[3] = (a0 * 3 + a1 * 2) / 5;
+        a[4] = (a0 * 2 + a1 * 3) / 5;
+        a[5] = (a0 * 1 + a1 * 4) / 5;
+        a[6] = 0;
+        a[7] = 255;
+      }
+      for (uint32 cy = y; cy < y + 4; ++cy) {
+        Image::color_t* dst = bits + cy * width + x;
+        for (uint32 cx = x; cx < x + 4; ++cx) {
+          *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a[amap & 7]);
+          lookup >>= 2;
+          amap >>= 3;
+        }
+      }
+    }
+  }
+  return image;
+}
+
+// the DXT decoders of BLP2 as they were before dxt.cpp: whole blocks one after another; DXT3
+// did not advance src past each block, which is fixed here
+static Image oldInterleavedDXT1(uint32 width, uint32 height, uint8 const* src) {
+  Image image(width, height);
+  Image::color_t* bits = image.mutable_bits();
+  for (uint32 y = 0; y < height; y += 4) {
+    for (uint32 x = 0; x < width; x += 4) {
+      uint16 p = *(uint16*)src;
+      uint16 q = *(uint16*)(src + 2);
+      uint32 lookup = *(uint32*)(src + 4);
+      src += 8;
+      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
+        Image::Format::from<FormatDXT>(q)};
+      if (p > q) {
+        c[2] = Image::Format::mix(c[0], 2, c[1], 1);
+        c[3] = Image::Format::mix(c[0], 1, c[1], 2);
+      } else {
+        c[2] = Image::Format::mix(c[0], 1, c[1], 1);
+        c[3] = 0;
+      }
+      for (uint32 cy = y; cy < y + 4; ++cy) {
+        Image::color_t* dst = bits + cy * width + x;
+        for (uint32 cx = x; cx < x + 4; ++cx) {
+          *dst++ = c[lookup & 3];
+          lookup >>= 2;
+        }
+      }
+    }
+  }
+  return image;
+}
+
+static Image oldInterleavedDXT3(uint32 width, uint32 height, uint8 const* src) {
+  Image image(width, height);
+  Image::color_t* bits = image.mutable_bits();
+  for (uint32 y = 0; y < height; y += 4) {
+    for (uint32 x = 0; x < width; x += 4) {
+      uint64 alpha = *(uint64*)src;
+      uint16 p = *(uint16*)(src + 8);
+      uint16 q = *(uint16*)(src + 10);
+      uint32 lookup = *(uint32*)(src + 12);
+      src += 16;
+      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
+        Image::Format::from<FormatDXT>(q)};
+      c[2] = Image::Format::mix(c[0], 2, c[1], 1);
+      c[3] = Image::Format::mix(c[0], 1, c[1], 2);
+      for (uint32 cy = y; cy < y + 4; ++cy) {
+        Image::color_t* dst = bits + cy * width + x;
+        for (uint32 cx = x; cx < x + 4; ++cx) {
+          int a = (alpha & 15) * 255 / 15;
+          *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a);
+          lookup >>= 2;
+          alpha >>= 4;
+        }
+      }
+    }
+  }
+  return image;
+}
+
+static Image oldInterleavedDXT5(uint32 width, uint32 height, uint8 const* src) {
+  Image image(width, height);
+  Image::color_t* bits = image.mutable_bits();
+  for (uint32 y = 0; y < height; y += 4) {
+    for (uint32 x = 0; x < width; x += 4) {
+      uint32 a0 = *src++;
+      uint32 a1 = *src++;
+      uint64 amap = 0;
+      for (int i = 0; i < 48; i += 8) {
+        amap |= (static_cast<uint64>(*src++) << i);
+      }
+      uint16 p = *(uint16*)src;
+      uint16 q = *(uint16*)(src + 2);
+      uint32 lookup = *(uint32*)(src + 4);
+      src += 8;
+      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
+        Image::Format::from<FormatDXT>(q)};
+      c[2] = Image::Format::mix(c[0], 2, c[1], 1);
+      c[3] = Image::Format::mix(c[0], 1, c[1], 2);
+      uint32 a[8] = {a0, a1};
+      if (a0 > a1) {
+        a[2] = (a0 * 6 + a1 * 1) / 7;
+        a[3] = (a0 * 5 + a1 * 2) / 7;
+        a[4] = (a0 * 4 + a1 * 3) / 7;
+        a[5] = (a0 * 3 + a1 * 4) / 7;
+        a[6] = (a0 * 2 + a1 * 5) / 7;
+        a[7] = (a0 * 1 + a1 * 6) / 7;
+      } else {
+        a[2] = (a0 * 4 + a1 * 1) / 5;
+        a[3] = (a0 * 3 + a1 * 2) / 5;
+        a[4] = (a0 * 2 + a1 * 3) / 5;
+        a[5] = (a0 * 1 + a1 * 4) / 5;
+        a[6] = 0;
+        a[7] = 255;
+      }
+      for (uint32 cy = y; cy < y + 4; ++cy) {
+        Image::color_t* dst = bits + cy * width + x;
+        for (uint32 cx = x; cx < x + 4; ++cx) {
+          *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a[amap & 7]);
+          lookup >>= 2;
+          amap >>= 3;
+        }
+      }
+    }
+  }
+  return image;
+}
+
+Image Tests::oldDXT(DXT::Format format, uint32 width, uint32 height, uint8 const* data, bool interleaved) {
+  static Image (*const planar[])(uint32, uint32, uint8 const*) = {oldPlanarDXT1, oldPlanarDXT3, oldPlanarDXT5};
+  static Image (*const blocks[])(uint32, uint32, uint8 const*) = {oldInterleavedDXT1, oldInterleavedDXT3, oldInterleavedDXT5};
+  return (interleaved ? blocks : planar)[format](width, height, data);
+}
+
+// random blocks in both layouts, at sizes that are and are not a multiple of 4, decoded whole
+// and as a sub-rectangle by every kernel the CPU supports; all must match the old decoder on the
+// padded image bit for bit
+static bool dxt() {
+  static char const* formats[] = {"DXT1", "DXT3", "DXT5"};
+  static char const* kernels[] = {"scalar", "SSE2", "AVX2"};
+  static uint32 const sizes[][2] = {
+    {4, 4}, {1, 1}, {2, 7}, {5, 3}, {13, 9}, {16, 16}, {33, 17}, {64, 8}, {71, 30}, {130, 66},
+  };
+  std::mt19937 rng(5);
+  DXT::Kernel saved = DXT::kernel();
+  bool ok = true;
+  for (int format = DXT::DXT1; format <= DXT::DXT5 && ok; ++format) {
+    DXT::Format fmt = static_cast<DXT::Format>(format);
+    for (int interleaved = 0; interleaved < 2 && ok; ++interleaved) {
+      for (auto const& size : sizes) {
+        uint32 width = size[0], height = size[1];
+        uint32 padWidth = (width + 3) & ~3, padHeight = (height + 3) & ~3;
+        std::vector<uint8> data(DXT::size(fmt, width, height));
+        for (auto& byte : data) {
+          byte = static_cast<uint8>(rng());
+        }
+        DXT::Blocks blocks = (interleaved ? DXT::interleaved(fmt, data.data()) : DXT::planar(fmt, data.data(), width, height));
+        Image reference = Tests::oldDXT(fmt, padWidth, padHeight, data.data(), interleaved != 0);
+        uint32 left = rng() % width, top = rng() % height;
+        uint32 right = left + 1 + rng() % (width - left), bottom = top + 1 + rng() % (height - top);
+        for (int kernel = DXT::Scalar; kernel < DXT::NumKernels && ok; ++kernel) {
+          if (!DXT::supported(static_cast<DXT::Kernel>(kernel))) continue;
+          DXT::setKernel(static_cast<DXT::Kernel>(kernel));
+          Image image(width, height);
+          DXT::decode(fmt, blocks, image);
+          Image part(right - left, bottom - top);
+          DXT::decode(fmt, blocks, width, height, left, top, right, bottom, part.mutable_bits(), part.width());
+          for (uint32 y = 0; y < height && ok; ++y) {
+            Image::color_t const* expected = reference.bits() + y * padWidth;
+            ok = !memcmp(image.bits() + y * width, expected, width * sizeof(Image::color_t));
+            if (ok && y >= top && y < bottom) {
+              ok = !memcmp(part.bits() + (y - top) * part.width(), expected + left, part.width() * sizeof(Image::color_t));
+            }
+          }
+          if (!ok) {
+            Logger::log("dxt: %s %s %s %ux%u differs from the old decoder", formats[format],
+              interleaved ? "interleaved" : "planar", kernels[kernel], width, height);
+          }
+        }
+      }
+    }
+  }
+  DXT::setKernel(saved);
+  return ok;
+}
+
+struct TestInfo {
+  char const* name;
+  bool(*func)();
+};
+static TestInfo const tests[] = {
+  {"prefetch", prefetch},
+  {"decoded", decoded},
+  {"jsondiff", jsondiff},
+  {"dxt", dxt},
+};
+
+std::vector<std::string> Tests::names() {
+  std::vector<std::string> list;
+  for (auto const& test : tests) {
+    list.push_back(test.name);
+  }
+  return list;
+}
+
+bool Tests::run(char const* name) {
+  bool all = !_stricmp(name, "all");
+  bool found = false, ok = true;
+  for (auto const& test : tests) {
+    if (!all && _stricmp(name, test.name)) continue;
+    found = true;
+    bool passed = test.func();
+    Logger::log("%-16s %s", test.name, passed ? "ok" : "FAILED");
+    ok = ok && passed;
+  }
+  if (!found) Logger::log("Unknown test: %s", name);
+  return found && ok;
+}
@@ -0,0 +1,22 @@
+// tests.h
+//
+// self checks that need no game data, run by "snocli test" and ctest; each logs what differs
+//
+// bool Tests::run(char const* name) - run one check, or every check with "all"; false if a check
+//   failed or the name is unknown
+// std::vector<std::string> Tests::names() - names of all checks
+// Image Tests::oldDXT(DXT::Format format, uint32 width, uint32 height, uint8 const* data, bool interleaved)
+//   the DXT decoders as they were before dxt.cpp, the reference for the kernels (and timed by the
+//   benchmark); width and height must be a multiple of 4
+
+#pragma once
+
+#include "common.h"
+#include "dxt.h"
+
+namespace Tests {
+  bool run(char const* name);
+  std::vector<std::string> names();
+
+  Image oldDXT(DXT::Format format, uint32 width, uint32 height, uint8 const* data, bool interleaved);
+}
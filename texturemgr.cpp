@@ -1,75 +1,319 @@
 #include "textures.h"
 #include "snomap.h"
+#include "threadpool.h"
+#include <algorithm>
 
 GameTextures& GameTextures::instance() {
   static GameTextures inst;
   return inst;
 }
 
-GameTextures::GameTextures() {
-  File src(path::work() / fmtstring("sno_%s/TextureMap.dat", SnoLoader::default->version().c_str()));
-  if (!src) {
-    auto const& files = SnoManager::get<Textures>().get();
-    size_t count = 0;
-    for (auto const& kv : files) {
-      if (kv.second.substr(0, 2) == "2D") {
-        ++count;
-      }
+// sno_<version>/TextureDir.dat: header, then
+//   Texture[textures] - 2D textures in ascending id order, each with its content key (from the
+//                       loader, or the MD5 of the file; none if it did not load) and a range of
+//                       frames
+//   Frame[frames]     - frame name hash and texture id, in texture order
+//   uint32[hashSize]  - open-addressing hash on the frame hash, frame index + 1 or 0
+// The hash is built in texture order and a frame name that appears in several textures maps to
+// the last one. TextureDir.last in the work folder names the version the file was last built
+// for; the next build reuses the frames of textures whose content key did not change.
+#pragma pack(push, 1)
+struct TextureDirHeader {
+  enum { Magic = 'TDIR', Version = 2 };
+  uint32 magic;
+  uint32 version;
+  uint32 textures;
+  uint32 frames;
+  uint32 hashSize;
+};
+struct TextureDir::Texture {
+  enum { HasKey = 1 };
+  uint32 id;
+  uint32 flags;
+  uint32 frame;
+  uint32 count;
+  uint8 key[16];
+};
+struct TextureDir::Frame {
+  uint32 hash;
+  uint32 texture;
+};
+#pragma pack(pop)
+
+static std::string dirPath(std::string const& version) {
+  return path::work() / fmtstring("sno_%s", version.c_str()) / "TextureDir.dat";
+}
+static std::string lastPath() {
+  return path::work() / "TextureDir.last";
+}
+
+TextureDir::TextureDir()
+  : textures_(nullptr)
+  , frames_(nullptr)
+  , buckets_(nullptr)
+  , count_(0)
+  , hashSize_(0)
+{}
+
+bool TextureDir::load(std::string const& version) {
+  File file = File::mapfile(dirPath(version));
+  uint8 const* data = file.borrow();
+  if (!data || !attach(data, file.size())) return false;
+  source_ = file;
+  return true;
+}
+
+bool TextureDir::attach(uint8 const* data, size_t size) {
+  if (size < sizeof(TextureDirHeader)) return false;
+  TextureDirHeader const* header = reinterpret_cast<TextureDirHeader const*>(data);
+  if (header->magic != TextureDirHeader::Magic || header->version != TextureDirHeader::Version) return false;
+  if (!header->hashSize || (header->hashSize & (header->hashSize - 1))) return false;
+  if (header->hashSize < header->frames) return false;
+  uint64 total = sizeof(TextureDirHeader) + uint64(header->textures) * sizeof(Texture) +
+    uint64(header->frames) * sizeof(Frame) + uint64(header->hashSize) * sizeof(uint32);
+  if (total > size) return false;
+  Texture const* textures = reinterpret_cast<Texture const*>(data + sizeof(TextureDirHeader));
+  Frame const* frames = reinterpret_cast<Frame const*>(textures + header->textures);
+  uint32 const* buckets = reinterpret_cast<uint32 const*>(frames + header->frames);
+  for (uint32 i = 0; i < header->textures; ++i) {
+    if (textures[i].frame > header->frames || header->frames - textures[i].frame < textures[i].count) return false;
+  }
+  for (uint32 i = 0; i < header->hashSize; ++i) {
+    if (buckets[i] > header->frames) return false;
+  }
+  textures_ = textures;
+  frames_ = frames;
+  buckets_ = buckets;
+  count_ = header->textures;
+  hashSize_ = header->hashSize;
+  return true;
+}
+
+TextureDir::Texture const* TextureDir::texture(uint32 id) const {
+  Texture const* it = std::lower_bound(textures_, textures_ + count_, id, [](Texture const& tex, uint32 id) {
+    return tex.id < id;
+  });
+  return (it != textures_ + count_ && it->id == id ? it : nullptr);
+}
+
+uint32 TextureDir::operator[](uint32 frame) const {
+  if (!hashSize_) return -1;
+  uint32 mask = hashSize_ - 1;
+  for (uint32 pos = frame & mask; buckets_[pos]; pos = (pos + 1) & mask) {
+    Frame const& entry = frames_[buckets_[pos] - 1];
+    if (entry.hash == frame) return entry.texture;
+  }
+  return -1;
+}
+
+void TextureDir::build(std::string const& version) {
+  // frames of the build the directory was last made for, reused for unchanged textures
+  TextureDir prev;
+  std::string last;
+  File src(lastPath());
+  if (src && src.getline(last) && !last.empty() && last != version) {
+    prev.load(last);
+  }
+
+  struct Scan {
+    uint32 id;
+    char const* name;
+    uint32 flags;
+    uint8 key[16];
+    std::vector<uint32> frames;
+  };
+  std::vector<Scan> scans;
+  for (auto const& kv : SnoManager::get<Textures>()) {
+    if (!strncmp(kv.second, "2D", 2)) {
+      scans.emplace_back();
+      scans.back().id = kv.first;
+      scans.back().name = kv.second;
     }
-    Logger::begin(count, "Parsing textures");
-    for (auto const& kv : files) {
-      if (kv.second.substr(0, 2) == "2D") {
-        Logger::item(kv.second.c_str());
-        SnoFile<Textures> tex(kv.second);
-        for (auto& frame : tex->frames) {
-          if (frame.name[0]) {
-            dir_[HashName(frame.name)] = kv.first;
-          }
-        }
+  }
+
+  // only the header and frame table of each texture are read, pixel data is not decoded
+  void* task = Logger::begin(scans.size(), "Parsing textures");
+  ThreadPool::instance().parallel_for(scans.size(), [&](size_t i) {
+    Scan& scan = scans[i];
+    Logger::item(scan.name, task);
+    scan.flags = 0;
+    memset(scan.key, 0, sizeof scan.key);
+    // a content key is the MD5 of the file, so it is computed when the loader does not know it
+    uint8 key[16];
+    File file;
+    if (!SnoLoader::primary->contentkey<Textures>(scan.name, key)) {
+      file = SnoLoader::primary->load<Textures>(scan.name);
+      if (!file) return;
+      file.md5(key);
+    }
+    Texture const* old = prev.texture(scan.id);
+    if (old && (old->flags & Texture::HasKey) && !memcmp(old->key, key, sizeof key)) {
+      for (uint32 j = 0; j < old->count; ++j) {
+        scan.frames.push_back(prev.frames_[old->frame + j].hash);
       }
+      scan.flags = Texture::HasKey;
+      memcpy(scan.key, key, sizeof key);
+      return;
     }
-    Logger::end();
-    File dst(path::work() / fmtstring("sno_%s/TextureMap.dat", SnoLoader::default->version().c_str()), "wb");
-    dst.write32(dir_.size());
-    for (auto& d : dir_) {
-      dst.write32(d.first);
-      dst.write32(d.second);
+    if (!file) file = SnoLoader::primary->load<Textures>(scan.name);
+    SnoFile<Textures> tex(file, scan.name);
+    // textures that fail to load keep no key, so the next build tries them again
+    if (!tex) return;
+    scan.flags = Texture::HasKey;
+    memcpy(scan.key, key, sizeof key);
+    for (auto& frame : tex->frames) {
+      if (frame.name[0]) {
+        scan.frames.push_back(HashName(frame.name));
+      }
     }
-  } else {
-    uint32 dir = src.read32();
-    while (dir--) {
-      uint32 id = src.read32();
-      dir_[id] = src.read32();
+  });
+  Logger::end(false, task);
+
+  size_t frameCount = 0;
+  for (auto& scan : scans) {
+    frameCount += scan.frames.size();
+  }
+  TextureDirHeader header;
+  header.magic = TextureDirHeader::Magic;
+  header.version = TextureDirHeader::Version;
+  header.textures = scans.size();
+  header.frames = frameCount;
+  header.hashSize = 16;
+  while (header.hashSize < frameCount * 2) {
+    header.hashSize *= 2;
+  }
+  data_.assign(sizeof(TextureDirHeader) + header.textures * sizeof(Texture) +
+    header.frames * sizeof(Frame) + header.hashSize * sizeof(uint32), 0);
+  memcpy(data_.data(), &header, sizeof header);
+  Texture* textures = reinterpret_cast<Texture*>(data_.data() + sizeof(TextureDirHeader));
+  Frame* frames = reinterpret_cast<Frame*>(textures + header.textures);
+  uint32* buckets = reinterpret_cast<uint32*>(frames + header.frames);
+  uint32 mask = header.hashSize - 1;
+  uint32 frame = 0;
+  for (uint32 i = 0; i < header.textures; ++i) {
+    Scan& scan = scans[i];
+    textures[i].id = scan.id;
+    textures[i].flags = scan.flags;
+    textures[i].frame = frame;
+    textures[i].count = scan.frames.size();
+    memcpy(textures[i].key, scan.key, sizeof scan.key);
+    for (uint32 hash : scan.frames) {
+      frames[frame].hash = hash;
+      frames[frame].texture = scan.id;
+      uint32 pos = hash & mask;
+      while (buckets[pos] && frames[buckets[pos] - 1].hash != hash) {
+        pos = (pos + 1) & mask;
+      }
+      buckets[pos] = ++frame;
     }
   }
+  attach(data_.data(), data_.size());
+  source_ = File();
+
+  File dst(dirPath(version), "wb");
+  if (dst) {
+    dst.write(data_.data(), data_.size());
+    File(lastPath(), "wt").printf("%s\n", version.c_str());
+  }
 }
 
-Image GameTextures::get(uint32 id) {
+GameTextures::GameTextures()
+  : size_(0)
+  , budget_(DefaultBudget)
+{
+  std::string version = SnoLoader::primary->version();
+  if (!dir_.load(version)) {
+    dir_.build(version);
+  }
+}
+
+GameTextures::Texture* GameTextures::open(uint32 id, char const* name) {
+  auto it = index_.find(id);
+  if (it != index_.end()) {
+    textures_.splice(textures_.begin(), textures_, it->second);
+    return &textures_.front();
+  }
+  if (!name) return nullptr;
+  std::unique_ptr<SnoFile<Textures>> file(new SnoFile<Textures>(name));
+  if (!*file) return nullptr;
+  textures_.emplace_front();
+  Texture& tex = textures_.front();
+  tex.id = id;
+  tex.size = 0;
+  for (auto& data : (*file)->data) {
+    tex.size += data.size();
+  }
+  for (auto& frame : (*file)->frames) {
+    tex.frames[HashName(frame.name)] = frame;
+  }
+  tex.file = std::move(file);
+  index_[id] = textures_.begin();
+  size_ += tex.size;
+  return &tex;
+}
+
+void GameTextures::trim() {
+  // the texture in front was just used
+  while (size_ > budget_ && textures_.size() > 1) {
+    Texture& tex = textures_.back();
+    size_ -= tex.size;
+    index_.erase(tex.id);
+    textures_.pop_back();
+  }
+}
+
+void GameTextures::setBudget(size_t bytes) {
   GameTextures& inst = instance();
-  auto it = inst.dir_.find(id);
-  if (it == inst.dir_.end()) {
-    auto fit = inst.textures_.find(id);
-    if (fit == inst.textures_.end()) {
-      auto const& files = SnoManager::get<Textures>().get();
-      auto fid = files.find(id);
-      if (fid == files.end()) return Image();
-      auto& tex = inst.textures_[id];
-      SnoFile<Textures> texture(fid->second);
-      if (texture) tex.image = texture->load();
-      return tex.image;
-    }
-    return fit->second.image;
-  }
-  auto fit = inst.textures_.find(it->second);
-  if (fit == inst.textures_.end()) {
-    auto& tex = inst.textures_[it->second];
-    SnoFile<Textures> texture(Textures::name(it->second));
-    tex.image = texture->load();
-    for (auto& frame : texture->frames) {
-      tex.frames[HashName(frame.name)] = frame;
+  inst.budget_ = bytes;
+  inst.trim();
+}
+
+static int framePos(uint32 size, float pos) {
+  return std::max(static_cast<int>(size * pos + 0.5f), 0);
+}
+
+Image GameTextures::get(uint32 id, uint32 width, uint32 height) {
+  GameTextures& inst = instance();
+  uint32 texId = inst.dir_[id];
+  if (texId == -1) {
+    Texture* tex = inst.open(id, SnoManager::get<Textures>()[id]);
+    if (!tex) return Image();
+    if (!tex->image) {
+      tex->image = (*tex->file)->load();
+      if (tex->image) {
+        tex->size += tex->image.size();
+        inst.size_ += tex->image.size();
+      }
     }
-    fit = inst.textures_.find(it->second);
+    Image image = tex->image;
+    inst.trim();
+    return image;
+  }
+
+  Texture* tex = inst.open(texId, Textures::name(texId));
+  if (!tex) return Image();
+  auto fit = tex->frames.find(id);
+  if (fit == tex->frames.end()) return Image();
+  auto const& frame = fit->second;
+  if (tex->image) {
+    Image image = tex->image.subimagef(frame.x0, frame.y0, frame.x1, frame.y1);
+    inst.trim();
+    return image;
+  }
+
+  // smallest mip level that still has the requested size
+  Textures::Type const* texture = *tex->file;
+  int mip = 0;
+  while (width && height && mip + 1 < texture->mipLevels && mip + 1 < Textures::Type::MaxMipLevels && texture->data[mip + 1].size()) {
+    uint32 mipWidth = texture->width >> (mip + 1), mipHeight = texture->height >> (mip + 1);
+    int frameWidth = framePos(mipWidth, frame.x1) - framePos(mipWidth, frame.x0);
+    int frameHeight = framePos(mipHeight, frame.y1) - framePos(mipHeight, frame.y0);
+    if (frameWidth < static_cast<int>(width) || frameHeight < static_cast<int>(height)) break;
+    ++mip;
   }
-  auto& frame = fit->second.frames[id];
-  return fit->second.image.subimagef(frame.x0, frame.y0, frame.x1, frame.y1);
+  uint32 mipWidth = texture->width >> mip, mipHeight = texture->height >> mip;
+  Image image = texture->load(mip, framePos(mipWidth, frame.x0), framePos(mipHeight, frame.y0),
+    framePos(mipWidth, frame.x1), framePos(mipHeight, frame.y1));
+  inst.trim();
+  return image;
 }
@@ -1,23 +1,65 @@
 // textures.h
 //
-// Image GameTextures::get(uint32 id)
+// Image GameTextures::get(uint32 id, uint32 width = 0, uint32 height = 0)
 //   get texture by file id, or by subimage id
-//   takes a very long time to build the cache on the first run
+//   frame ids are looked up in the texture directory (sno_<version>/TextureDir.dat, mapped into
+//   memory); the first run for a build reads the frame tables of all 2D textures on the thread
+//   pool, reusing the frames of textures whose content key (from the loader, or the MD5 of the
+//   file) did not change since the previous build
+//   subimages are decoded from the blocks that cover them only; with a target size, the smallest
+//   mip level that is at least width x height is used instead of the full size image
+// void GameTextures::setBudget(size_t bytes)
+//   memory for textures kept between calls (compressed data and decoded whole textures), the
+//   least recently used ones are dropped first
 
 #pragma once
 #include "types/Textures.h"
 #include "common.h"
+#include <list>
+#include <memory>
+
+// frame id -> texture id
+class TextureDir {
+public:
+  TextureDir();
+  bool load(std::string const& version);
+  void build(std::string const& version);
+  // texture id or -1
+  uint32 operator[](uint32 frame) const;
+private:
+  struct Texture;
+  struct Frame;
+  File source_;                 // mapped directory file
+  std::vector<uint8> data_;     // or a directory built in memory
+  Texture const* textures_;
+  Frame const* frames_;
+  uint32 const* buckets_;
+  uint32 count_;
+  uint32 hashSize_;
+  bool attach(uint8 const* data, size_t size);
+  Texture const* texture(uint32 id) const;
+};
 
 class GameTextures {
 public:
-  static Image get(uint32 id);
+  static Image get(uint32 id, uint32 width = 0, uint32 height = 0);
+  static void setBudget(size_t bytes);
 private:
   GameTextures();
   struct Texture {
+    uint32 id;
+    std::unique_ptr<SnoFile<Textures>> file;
     Image image;
     std::map<uint32, Textures::Type::TexFrame> frames;
+    size_t size;
   };
-  std::map<uint32, Texture> textures_;
-  std::map<uint32, uint32> dir_;
+  enum { DefaultBudget = 256 * 1024 * 1024 };
+  std::list<Texture> textures_;   // most recently used first
+  std::map<uint32, std::list<Texture>::iterator> index_;
+  TextureDir dir_;
+  size_t size_;
+  size_t budget_;
+  Texture* open(uint32 id, char const* name);
+  void trim();
   static GameTextures& instance();
 };
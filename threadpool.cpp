@@ -0,0 +1,109 @@
+#include "threadpool.h"
+
+static THREAD_LOCAL ThreadPool* currentPool = nullptr;
+static THREAD_LOCAL size_t currentWorker = 0;
+
+ThreadPool::ThreadPool(size_t threads)
+  : queued_(0)
+  , next_(0)
+  , stop_(false)
+{
+  if (!threads) {
+    threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    queues_.push_back(new Queue);
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back(&ThreadPool::run, this, i);
+  }
+}
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread : workers_) {
+    thread.join();
+  }
+  for (Queue* queue : queues_) {
+    delete queue;
+  }
+}
+
+void ThreadPool::push(Task const& task) {
+  size_t target;
+  if (currentPool == this) {
+    target = currentWorker;
+  } else {
+    target = (next_++) % queues_.size();
+  }
+  {
+    std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+    queues_[target]->tasks.push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++queued_;
+  }
+  wake_.notify_one();
+}
+
+bool ThreadPool::pop(size_t self, Task& task) {
+  if (!queued_) return false;
+  {
+    Queue* own = queues_[self];
+    std::lock_guard<std::mutex> lock(own->mutex);
+    if (!own->tasks.empty()) {
+      task = std::move(own->tasks.back());
+      own->tasks.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    Queue* victim = queues_[(self + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim->mutex);
+    if (!victim->tasks.empty()) {
+      task = std::move(victim->tasks.front());
+      victim->tasks.pop_front();
+      --queued_;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::help() {
+  Task task;
+  if (!pop(currentPool == this ? currentWorker : 0, task)) return false;
+  task();
+  return true;
+}
+
+void ThreadPool::run(size_t index) {
+  currentPool = this;
+  currentWorker = index;
+  Task task;
+  while (true) {
+    if (pop(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stop_) break;
+    if (!queued_) wake_.wait(lock);
+  }
+}
+
+static ThreadPool* sharedPool = nullptr;
+static std::once_flag sharedPoolFlag;
+
+ThreadPool& ThreadPool::instance() {
+  std::call_once(sharedPoolFlag, []() {
+    sharedPool = new ThreadPool;
+  });
+  return *sharedPool;
+}
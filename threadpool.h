@@ -0,0 +1,128 @@
+#pragma once
+
+// threadpool.h
+//
+// work-stealing thread pool
+//
+// every worker owns a task deque; it pops its own tasks from the back and steals from the front
+// of other workers' deques when it runs dry. Threads that block on a batch (parallel_for) keep
+// executing queued tasks, so nested parallel loops do not deadlock.
+//
+// void ThreadPool::push(Task const& task) - queue a task
+// void ThreadPool::parallel_for(size_t count, Func const& func)
+//   call func(i) for every i in [0, count) and wait for completion; at most size() + 1 calls are
+//   in flight at any time, and the first exception thrown by func is rethrown in the caller
+
+#include "common.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include <algorithm>
+
+class ThreadPool {
+public:
+  typedef std::function<void()> Task;
+
+  ThreadPool(size_t threads = 0);
+  ~ThreadPool();
+
+  size_t size() const {
+    return workers_.size();
+  }
+
+  void push(Task const& task);
+  // run one queued task on the calling thread; returns false if there was nothing to run
+  bool help();
+
+  template<class Func>
+  void parallel_for(size_t count, Func const& func) {
+    if (!count) return;
+    Batch batch(count);
+    size_t helpers = std::min(size(), count - 1);
+    for (size_t i = 0; i < helpers; ++i) {
+      batch.start();
+      push([&batch, &func]() {
+        batch.run(func);
+        batch.finish();
+      });
+    }
+    batch.run(func);
+    while (!batch.done()) {
+      if (!help()) batch.sleep();
+    }
+    batch.rethrow();
+  }
+
+  static ThreadPool& instance();
+
+private:
+  class Batch {
+  public:
+    Batch(size_t count)
+      : count_(count)
+      , next_(0)
+      , running_(0)
+    {}
+
+    template<class Func>
+    void run(Func const& func) {
+      size_t index;
+      while ((index = next_++) < count_) {
+        try {
+          func(index);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (!error_) error_ = std::current_exception();
+          next_ = count_;
+        }
+      }
+    }
+    void start() {
+      ++running_;
+    }
+    void finish() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!--running_) done_.notify_all();
+    }
+    bool done() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return running_ == 0;
+    }
+    void sleep() {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (running_) done_.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    void rethrow() {
+      if (error_) std::rethrow_exception(error_);
+    }
+
+  private:
+    size_t count_;
+    std::atomic<size_t> next_;
+    std::atomic<size_t> running_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::exception_ptr error_;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+  std::vector<Queue*> queues_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_;
+  std::atomic<size_t> next_;
+  bool stop_;
+
+  bool pop(size_t self, Task& task);
+  void run(size_t index);
+};
@@ -141,7 +141,7 @@ void SkillTips::generate(std::string const& cls, uint32 kitId, bool elems, json:
   }
   int index = 0;
   auto dictSkillsUI = Strings::list("SkillsUI");
-  auto dictSkillsUIEn = Strings::list("SkillsUI", SnoLoader::default);
+  auto dictSkillsUIEn = Strings::list("SkillsUI", SnoLoader::primary);
   for (auto& kv : catIds) {
     std::string tag = fmtstring("Cat_%s%d", catId, ++index);
     kv.second = dictSkillsUI[tag];
@@ -153,7 +153,7 @@ void SkillTips::generate(std::string const& cls, uint32 kitId, bool elems, json:
   };
 
   auto dictPowers = Strings::list("Powers");
-  auto dictPowersEn = Strings::list("Powers", SnoLoader::default);
+  auto dictPowersEn = Strings::list("Powers", SnoLoader::primary);
   auto dictAttributes = Strings::list("AttributeDescriptions");
 
   AttributeMap attr = GameAffixes::defaultMap();
@@ -376,17 +376,18 @@ void simBase(std::string const& name) {
     if (!tag->getint("IsPrimary")) {
       out.printf("    secondary: true,\n");
     }
-    std::vector<double> gen(6);
+    // row 0 is the skill without runes, rows 1-5 have one rune each
+    AttributeColumns rattr(6, attr);
+    for (int i = 0; i < 5; ++i) {
+      rattr.set(fmtstring("Rune_%c", 'A' + i), i + 1, 1);
+    }
+    std::vector<double> gen = tag->getBatch("Resource Gained On First Hit", rattr).max;
     std::vector<double> proc(6);
     std::vector<int> elem(6);
-    gen[0] = tag->get("Resource Gained On First Hit", attr).max;
     proc[0] = tag->get("NoRune Proc Scalar", attr).max;
     elem[0] = tag->getint("NoRune Damage Type");
     for (int i = 0; i < 5; ++i) {
-      AttributeMap rattr = attr;
-      rattr[fmtstring("Rune_%c", 'A' + i)] = 1;
-      gen[i + 1] = tag->get("Resource Gained On First Hit", rattr).max;
-      proc[i + 1] = tag->get(fmtstring("Rune%c Proc Scalar", 'A' + i), rattr).max;
+      proc[i + 1] = tag->get(fmtstring("Rune%c Proc Scalar", 'A' + i), rattr.row(i + 1)).max;
       elem[i + 1] = tag->getint(fmtstring("Rune%c Damage Type", 'A' + i));
     }
 
@@ -1,14 +1,25 @@
 #pragma once
 
+#ifndef _MSC_VER
+// long is 64 bits wide on LP64 systems
+#define __int64 long long
+#endif
+
 typedef unsigned char uint8;
 typedef signed char sint8;
 typedef char int8;
 typedef unsigned short uint16;
 typedef signed short sint16;
 typedef short int16;
+#ifdef _MSC_VER
 typedef unsigned long uint32;
 typedef signed long sint32;
 typedef long int32;
+#else
+typedef unsigned int uint32;
+typedef signed int sint32;
+typedef int int32;
+#endif
 typedef unsigned __int64 uint64;
 typedef signed __int64 sint64;
 typedef __int64 int64;
@@ -19,9 +30,9 @@ typedef char* int8_ptr;
 typedef unsigned short* uint16_ptr;
 typedef signed short* sint16_ptr;
 typedef short* int16_ptr;
-typedef unsigned long* uint32_ptr;
-typedef signed long* sint32_ptr;
-typedef long* int32_ptr;
+typedef uint32* uint32_ptr;
+typedef sint32* sint32_ptr;
+typedef int32* int32_ptr;
 typedef unsigned __int64* uint64_ptr;
 typedef signed __int64* sint64_ptr;
 typedef __int64* int64_ptr;
@@ -32,9 +43,9 @@ typedef char const* int8_const_ptr;
 typedef unsigned short const* uint16_const_ptr;
 typedef signed short const* sint16_const_ptr;
 typedef short const* int16_const_ptr;
-typedef unsigned long const* uint32_const_ptr;
-typedef signed long const* sint32_const_ptr;
-typedef long const* int32_const_ptr;
+typedef uint32 const* uint32_const_ptr;
+typedef sint32 const* sint32_const_ptr;
+typedef int32 const* int32_const_ptr;
 typedef unsigned __int64 const* uint64_const_ptr;
 typedef signed __int64 const* sint64_const_ptr;
 typedef __int64 const* int64_const_ptr;
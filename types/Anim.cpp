@@ -18,7 +18,7 @@ map<uint32, vector<float>> const& BaseFPA() {
   static map<uint32, vector<float>> baseFpa_;
   static bool baseParsed_ = false;
   if (baseParsed_) return baseFpa_;
-  for (auto& name : Logger::Loop(SnoLoader::default->list<Anim>(), "Parsing FPA")) {
+  for (auto& name : Logger::Loop(SnoLoader::primary->list<Anim>(), "Parsing FPA")) {
     baseFpa_.insert(GetFPA(name.c_str()));
   }
   baseParsed_ = true;
@@ -1,23 +1,24 @@
 #include "Power.h"
+#include <mutex>
 
 void Power::Type::PowerTags::serialize(json::Visitor* visitor) {
   static std::map<int, std::string> powerTags;
-  static bool loaded = false;
-  if (!loaded) {
+  static std::once_flag loaded;
+  std::call_once(loaded, []() {
     json::Value tags;
     json::parse(File("tags.txt"), tags);
     for (auto& kv : tags.getMap()) {
       powerTags[atoi(kv.first.c_str())] = kv.second["tag"].getString();
     }
-    loaded = true;
-  }
+  });
   uint32 const* ptr = data();
   uint32 count = *ptr++;
   visitor->onOpenMap();
   while (count--) {
     uint32 type = *ptr++;
     uint32 id = *ptr++;
-    visitor->onMapKey(powerTags[id]);
+    auto tag = powerTags.find(id);
+    visitor->onMapKey(tag == powerTags.end() ? "" : tag->second);
     if (type != 4) {
       visitor->onInteger(*ptr++);
     } else {
@@ -7,7 +7,7 @@ using namespace std;
 void dumpKits(std::map<std::string, std::string>& strings) {
   File output(path::work() / "kits.js", "wt");
   output.printf("var Passives = {};\nvar Skills = {};\n");
-  for (auto& kit : SnoLoader::default->all<SkillKit>()) {
+  for (auto& kit : SnoLoader::primary->all<SkillKit>()) {
     std::string title = kit.name();
     std::transform(title.begin(), title.end(), title.begin(), ::tolower);
     output.printf("Passives[\"%s\"] = {\n", title.c_str());
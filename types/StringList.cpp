@@ -1,8 +1,7 @@
-#include "stringlist.h"
+#include "StringList.h"
 #include "path.h"
 #include <map>
 #include <vector>
-#include <windows.h>
 using namespace std;
 
 Dictionary readStrings(char const* name, SnoLoader* loader) {
@@ -31,4 +31,4 @@ declstruct(StringList::Type) {
 
 #pragma pack(pop)
 
-Dictionary readStrings(char const* name, SnoLoader* loader = SnoLoader::default);
+Dictionary readStrings(char const* name, SnoLoader* loader = SnoLoader::primary);
@@ -1,136 +1,33 @@
 #include "Textures.h"
+#include "dxt.h"
 
-typedef FormatXRGB<0, 5, 6, 5> FormatDXT;
-Image LoadDXT1(uint32 width, uint32 height, uint8 const* data, size_t size) {
-  if (size != width * height / 2) return Image();
-  Image image(width, height);
-  Image::color_t* bits = image.mutable_bits();
-  uint16 const* colors = (uint16*) data;
-  uint32 const* lookups = (uint32*) (data + width * height / 4);
-  for (uint32 y = 0; y < height; y += 4) {
-    for (uint32 x = 0; x < width; x += 4) {
-      uint16 p = *colors++;
-      uint16 q = *colors++;
-      uint32 lookup = *lookups++;
-      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
-        Image::Format::from<FormatDXT>(q)};
-      if (p > q) {
-        c[2] = Image::Format::mix(c[0], 2, c[1], 1);
-        c[3] = Image::Format::mix(c[0], 1, c[1], 2);
-      } else {
-        c[2] = Image::Format::mix(c[0], 1, c[1], 1);
-        c[3] = 0;
-      }
-      for (uint32 cy = y; cy < y + 4; ++cy) {
-        Image::color_t* dst = bits + cy * width + x;
-        for (uint32 cx = x; cx < x + 4; ++cx) {
-          *dst++ = c[lookup & 3];
-          lookup >>= 2;
-        }
-      }
-    }
-  }
-  return image;
-}
-
-Image LoadDXT3(uint32 width, uint32 height, uint8 const* data, size_t size) {
-  if (size != width * height) return Image();
-  Image image(width, height);
-  Image::color_t* bits = image.mutable_bits();
-  uint64 const* alphas = (uint64*) data;
-  uint16 const* colors = (uint16*) (data + width * height / 2);
-  uint32 const* lookups = (uint32*) (data + width * height * 3 / 4);
-  for (uint32 y = 0; y < height; y += 4) {
-    for (uint32 x = 0; x < width; x += 4) {
-      uint64 alpha = *alphas++;
-      uint16 p = *colors++;
-      uint16 q = *colors++;
-      uint32 lookup = *lookups++;
-      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
-        Image::Format::from<FormatDXT>(q)};
-      c[2] = Image::Format::mix(c[0], 2, c[1], 1);
-      c[3] = Image::Format::mix(c[0], 1, c[1], 2);
-      for (uint32 cy = y; cy < y + 4; ++cy) {
-        Image::color_t* dst = bits + cy * width + x;
-        for (uint32 cx = x; cx < x + 4; ++cx) {
-          int a = (alpha & 15) * 255 / 15;
-          *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a);
-          lookup >>= 2;
-          alpha >>= 4;
-        }
-      }
-    }
-  }
-  return image;
-}
-
-Image LoadDXT5(uint32 width, uint32 height, uint8 const* data, size_t size) {
-  if (size != width * height) return Image();
-  Image image(width, height);
-  Image::color_t* bits = image.mutable_bits();
-  uint8 const* alphas = data;
-  uint8 const* alphamaps = data + width * height / 8;
-  uint16 const* colors = (uint16*) (data + width * height / 2);
-  uint32 const* lookups = (uint32*) (data + width * height * 3 / 4);
-  for (uint32 y = 0; y < height; y += 4) {
-    for (uint32 x = 0; x < width; x += 4) {
-      uint32 a0 = *alphas++;
-      uint32 a1 = *alphas++;
-      uint64 amap = 0;
-      for (int i = 0; i < 48; i += 8) {
-        amap |= (static_cast<uint64>(*alphamaps++) << i);
-      }
-      uint16 p = *colors++;
-      uint16 q = *colors++;
-      uint32 lookup = *lookups++;
-      Image::color_t c[4] = {Image::Format::from<FormatDXT>(p),
-        Image::Format::from<FormatDXT>(q)};
-      c[2] = Image::Format::mix(c[0], 2, c[1], 1);
-      c[3] = Image::Format::mix(c[0], 1, c[1], 2);
-      uint32 a[8] = {a0, a1};
-      if (a0 > a1) {
-        a[2] = (a0 * 6 + a1 * 1) / 7;
-        a[3] = (a0 * 5 + a1 * 2) / 7;
-        a[4] = (a0 * 4 + a1 * 3) / 7;
-        a[5] = (a0 * 3 + a1 * 4) / 7;
-        a[6] = (a0 * 2 + a1 * 5) / 7;
-        a[7] = (a0 * 1 + a1 * 6) / 7;
-      } else {
-        a[2] = (a0 * 4 + a1 * 1) / 5;
-        a[3] = (a0 * 3 + a1 * 2) / 5;
-        a[4] = (a0 * 2 + a1 * 3) / 5;
-        a[5] = (a0 * 1 + a1 * 4) / 5;
-        a[6] = 0;
-        a[7] = 255;
-      }
-      for (uint32 cy = y; cy < y + 4; ++cy) {
-        Image::color_t* dst = bits + cy * width + x;
-        for (uint32 cx = x; cx < x + 4; ++cx) {
-          *dst++ = (c[lookup & 3] & ~Image::Format::alpha::mask) | Image::Format::alpha::to(a[amap & 7]);
-          lookup >>= 2;
-          amap >>= 3;
-        }
-      }
-    }
-  }
+// blocks are stored in planes: DXT5 alpha endpoints, DXT5 alpha indices or DXT3 alpha, colors, indices
+template<DXT::Format F>
+Image LoadDXT(uint32 width, uint32 height, uint8 const* data, size_t size, uint32 left, uint32 top, uint32 right, uint32 bottom) {
+  // whole blocks, rounded up at the right and bottom edges
+  if (size != DXT::size(F, width, height)) return Image();
+  Image image(right - left, bottom - top);
+  DXT::decode(F, DXT::planar(F, data, width, height), width, height, left, top, right, bottom, image.mutable_bits(), image.width());
   return image;
 }
 
 template<typename PF>
-Image LoadRaw(uint32 width, uint32 height, uint8 const* data, size_t size) {
-  if (size != width * height * sizeof(PF::color_t)) return Image();
-  Image image(width, height);
+Image LoadRaw(uint32 width, uint32 height, uint8 const* data, size_t size, uint32 left, uint32 top, uint32 right, uint32 bottom) {
+  if (size != width * height * sizeof(typename PF::color_t)) return Image();
+  Image image(right - left, bottom - top);
   Image::color_t* dst = image.mutable_bits();
-  PF::color_t const* src = (PF::color_t*) data;
-  for (uint32 i = 0; i < width * height; ++i) {
-    *dst++ = Image::Format::from<PF>(*src++);
+  for (uint32 y = top; y < bottom; ++y) {
+    typename PF::color_t const* src = (typename PF::color_t*) data + y * width + left;
+    for (uint32 x = left; x < right; ++x) {
+      *dst++ = Image::Format::template from<PF>(*src++);
+    }
   }
   return image;
 }
 
 const struct Loader {
   uint32 id;
-  Image(*load)(uint32 width, uint32 height, uint8 const* data, size_t size);
+  Image(*load)(uint32 width, uint32 height, uint8 const* data, size_t size, uint32 left, uint32 top, uint32 right, uint32 bottom);
 } loaders[] = {
     {0, LoadRaw<FormatARGB<8, 8, 8, 8>>},
     {2, LoadRaw<FormatXRGB<8, 8, 8, 8>>},
@@ -138,15 +35,19 @@ const struct Loader {
     {4, LoadRaw<FormatARGB<1, 5, 5, 5>>},
     {5, LoadRaw<FormatXRGB<1, 5, 5, 5>>},
     {6, LoadRaw<FormatXRGB<0, 5, 6, 5>>},
-    {9, LoadDXT1},
-    {10, LoadDXT1},
-    {11, LoadDXT3},
-    {12, LoadDXT5},
+    {9, LoadDXT<DXT::DXT1>},
+    {10, LoadDXT<DXT::DXT1>},
+    {11, LoadDXT<DXT::DXT3>},
+    {12, LoadDXT<DXT::DXT5>},
     {21, LoadRaw<FormatABGR<8, 8, 8, 8>>},
     {23, LoadRaw<FormatARGB<8, 0, 0, 0>>},
 };
 
 Image Textures::Type::load(int mip) const {
+  return load(mip, 0, 0, width >> mip, height >> mip);
+}
+
+Image Textures::Type::load(int mip, uint32 left, uint32 top, uint32 right, uint32 bottom) const {
   Loader const* loader = nullptr;
   for (auto& ldr : loaders) {
     if (ldr.id == pixelFormat) {
@@ -154,10 +55,15 @@ Image Textures::Type::load(int mip) const {
       break;
     }
   }
-  if (!loader) {
+  if (!loader || mip < 0 || mip >= MaxMipLevels) {
     return Image();
   }
   uint32 mipWidth = width >> mip;
   uint32 mipHeight = height >> mip;
-  return loader->load(mipWidth, mipHeight, (uint8*) data[mip].data(), data[mip].size());
+  right = std::min(right, mipWidth);
+  bottom = std::min(bottom, mipHeight);
+  if (left >= right || top >= bottom) {
+    return Image();
+  }
+  return loader->load(mipWidth, mipHeight, (uint8*) data[mip].data(), data[mip].size(), left, top, right, bottom);
 }
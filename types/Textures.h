@@ -15,12 +15,15 @@ declstruct(Textures::Type) {
     }
   };
 
+  // size of data[]; mipLevels may claim more
+  enum { MaxMipLevels = 60 };
+
   SnoHeader header;
   int flags, pixelFormat;
   int width, height;
   int mipLevels;
   int x020, x024;
-  Binary data[60];
+  Binary data[MaxMipLevels];
   int numFrames;
   SerializeData x20C_data;
   uint32 x214_;
@@ -43,6 +46,9 @@ declstruct(Textures::Type) {
   }
 
   Image load(int mip = 0) const;
+  // pixels [left, right) x [top, bottom) of a mip level; compressed formats only decode the blocks
+  // covering the rectangle
+  Image load(int mip, uint32 left, uint32 top, uint32 right, uint32 bottom) const;
 };
 
 #pragma pack(pop)